@@ -3,13 +3,29 @@
 #include <assert.h>
 #include <sys/param.h>
 
+size_t Buffer_SizeClass(size_t n) {
+  if (n <= 16) {
+    return n <= 8 ? 8 : 16;
+  }
+  if (n <= 64) {
+    return (n + 15) & ~(size_t)15;
+  }
+  // between two powers of two p < n <= 2p there are four classes, p/4 apart
+  size_t p = 64;
+  while (p * 2 < n) {
+    p *= 2;
+  }
+  size_t step = p / 4;
+  return (n + step - 1) & ~(step - 1);
+}
+
 size_t Buffer_Write(BufferWriter *bw, void *data, size_t len) {
 
   Buffer *buf = bw->buf;
   if (buf->offset + len > buf->cap) {
-    do {
-      buf->cap += MIN(1 + buf->cap / 5, 1024 * 1024);
-    } while (buf->offset + len > buf->cap);
+    // grow by at least a quarter, which is at least the next size class
+    size_t cap = buf->cap + MIN(buf->cap / 4, 1024 * 1024);
+    buf->cap = Buffer_SizeClass(MAX(cap, buf->offset + len));
 
     buf->data = rm_realloc(buf->data, buf->cap);
     bw->pos = buf->data + buf->offset;
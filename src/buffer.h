@@ -41,6 +41,11 @@ typedef struct {
 
 } BufferWriter;
 
+/* Round a buffer capacity up to the size class the allocator would serve it from - 8 and 16 bytes,
+ * multiples of 16 up to 64, and four classes between every two powers of two above that. Growing
+ * buffers to size classes means no allocated byte goes unused, and fewer reallocations */
+size_t Buffer_SizeClass(size_t n);
+
 size_t Buffer_Write(BufferWriter *b, void *data, size_t len);
 size_t Buffer_Truncate(Buffer *b, size_t newlen);
 
@@ -8,15 +8,21 @@
 
 #define RS_CREATE_CMD RS_CMD_PREFIX ".CREATE"
 #define RS_ADD_CMD RS_CMD_PREFIX ".ADD"
+#define RS_UPDATE_CMD RS_CMD_PREFIX ".UPDATE"
 #define RS_SETPAYLOAD_CMD RS_CMD_PREFIX ".SETPAYLOAD"
 #define RS_ADDHASH_CMD RS_CMD_PREFIX ".ADDHASH"
 #define RS_INFO_CMD RS_CMD_PREFIX ".INFO"
 #define RS_SEARCH_CMD RS_CMD_PREFIX ".SEARCH"
+#define RS_CURSOR_CMD RS_CMD_PREFIX ".CURSOR"
 #define RS_EXPLAIN_CMD RS_CMD_PREFIX ".EXPLAIN"
+#define RS_PROFILE_CMD RS_CMD_PREFIX ".PROFILE"
 #define RS_DEL_CMD RS_CMD_PREFIX ".DEL"
 #define RS_DROP_CMD RS_CMD_PREFIX ".DROP"
 #define RS_DTADD_CMD RS_CMD_PREFIX ".DTADD"
+#define RS_RESTORE_CMD RS_CMD_PREFIX ".RESTORE"
 #define RS_REPAIR_CMD RS_CMD_PREFIX ".REPAIR"
+#define RS_COMPACT_CMD RS_CMD_PREFIX ".COMPACT"
+#define RS_OPTIMIZE_CMD RS_CMD_PREFIX ".OPTIMIZE"
 
 #define RS_SUGADD_CMD RS_CMD_PREFIX ".SUGADD"
 #define RS_SUGGET_CMD RS_CMD_PREFIX ".SUGGET"
@@ -23,8 +23,9 @@ inline void ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx) {
   long long durationNS = (long long)1000000000 * (now.tv_sec - ctx->lastTime.tv_sec) +
                          (now.tv_nsec - ctx->lastTime.tv_nsec);
 
-  // Timeout - release the thread safe context lock and let other threads run as well
-  if (durationNS > CONCURRENT_TIMEOUT_NS) {
+  // Timeout - release the thread safe context lock and let other threads run as well. Queries
+  // executed outside of redis, like in the unit tests, have no lock to release
+  if (durationNS > CONCURRENT_TIMEOUT_NS && ctx->ctx) {
     RedisModule_ThreadSafeContextUnlock(ctx->ctx);
 
     // Right after releasing, we try to acquire the lock again.
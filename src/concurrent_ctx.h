@@ -66,4 +66,16 @@ void ConcurrentSearchCtx_Init(RedisModuleCtx *rctx, ConcurrentSearchCtx *ctx);
     }                                                    \
   }
 
+/** Tick n cycles at once, checking the timer if a check was due in any of them */
+#define CONCURRENT_CTX_TICK_N(x, n)                                                         \
+  {                                                                                         \
+    if (x) {                                                                                \
+      long long __prev = x->ticker;                                                         \
+      x->ticker += (n);                                                                     \
+      if (__prev / CONCURRENT_TICK_CHECK != x->ticker / CONCURRENT_TICK_CHECK) {            \
+        ConcurrentSearch_CheckTimer(x);                                                     \
+      }                                                                                     \
+    }                                                                                       \
+  }
+
 #endif
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "cursor.h"
+#include "rmalloc.h"
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+
+/* The live cursors. There are few of them at any time, so a flat array is all we need */
+static struct {
+  Cursor **cursors;
+  size_t len;
+  size_t cap;
+  size_t numResults;
+  uint64_t lastId;
+} __cursors = {0};
+
+static long long cursors_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Cursor ids are replied as integers, so they are kept positive. Starting from a random id makes
+ * them hard to guess across restarts */
+static uint64_t cursors_newId() {
+  if (__cursors.lastId == 0) {
+    srand(time(NULL));
+    __cursors.lastId = ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+  }
+  __cursors.lastId = (__cursors.lastId + 1) & 0x7fffffffffffffffULL;
+  if (__cursors.lastId == 0) __cursors.lastId = 1;
+  return __cursors.lastId;
+}
+
+static void cursor_Free(Cursor *c) {
+  __cursors.numResults -= c->numResults;
+  RSSearchRequest_Free(c->req);
+  free(c->docIds);
+  free(c->scores);
+  free(c);
+}
+
+/* Remove the cursor at index i of the table, replacing it with the last one */
+static void cursors_removeAt(size_t i) {
+  cursor_Free(__cursors.cursors[i]);
+  __cursors.cursors[i] = __cursors.cursors[--__cursors.len];
+}
+
+size_t Cursors_GC() {
+  long long now = cursors_now();
+  size_t n = 0;
+  for (size_t i = 0; i < __cursors.len;) {
+    Cursor *c = __cursors.cursors[i];
+    if (now - c->lastAccess >= c->maxIdle) {
+      cursors_removeAt(i);
+      n++;
+    } else {
+      i++;
+    }
+  }
+  return n;
+}
+
+size_t Cursors_PurgeIndex(IndexSpec *sp) {
+  size_t n = 0;
+  for (size_t i = 0; i < __cursors.len;) {
+    if (__cursors.cursors[i]->spec == sp) {
+      cursors_removeAt(i);
+      n++;
+    } else {
+      i++;
+    }
+  }
+  return n;
+}
+
+size_t Cursors_Budget() {
+  Cursors_GC();
+  return RS_CURSOR_MAX_RESULTS - __cursors.numResults;
+}
+
+Cursor *Cursors_Create(RSSearchRequest *req, QueryResult *r, size_t pos, long long maxIdle) {
+  Cursor *c = malloc(sizeof(*c));
+  *c = (Cursor){
+      .id = cursors_newId(),
+      .spec = req->sctx->spec,
+      .req = req,
+      .numResults = r->numResults,
+      .docIds = malloc(MAX(1, r->numResults) * sizeof(t_docId)),
+      .scores = malloc(MAX(1, r->numResults) * sizeof(double)),
+      .pos = pos,
+      .totalResults = r->totalResults,
+      .maxIdle = maxIdle,
+      .lastAccess = cursors_now(),
+  };
+  for (size_t i = 0; i < r->numResults; i++) {
+    c->docIds[i] = r->results[i].docId;
+    c->scores[i] = r->results[i].score;
+  }
+
+  // the request's search context belongs to the command that created the cursor
+  req->sctx = NULL;
+  req->bc = NULL;
+
+  if (__cursors.len == __cursors.cap) {
+    __cursors.cap = __cursors.cap ? __cursors.cap * 2 : 16;
+    __cursors.cursors = realloc(__cursors.cursors, __cursors.cap * sizeof(Cursor *));
+  }
+  __cursors.cursors[__cursors.len++] = c;
+  __cursors.numResults += c->numResults;
+  return c;
+}
+
+static ssize_t cursors_indexOf(uint64_t id) {
+  for (size_t i = 0; i < __cursors.len; i++) {
+    if (__cursors.cursors[i]->id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+Cursor *Cursors_Find(uint64_t id) {
+  Cursors_GC();
+  ssize_t i = cursors_indexOf(id);
+  if (i < 0) {
+    return NULL;
+  }
+  Cursor *c = __cursors.cursors[i];
+  c->lastAccess = cursors_now();
+  return c;
+}
+
+int Cursors_Delete(uint64_t id) {
+  ssize_t i = cursors_indexOf(id);
+  if (i < 0) {
+    return 0;
+  }
+  cursors_removeAt(i);
+  return 1;
+}
+
+size_t Cursors_Count() {
+  return __cursors.len;
+}
+
+size_t Cursors_NumResults() {
+  return __cursors.numResults;
+}
+
+int Cursor_SerializePage(Cursor *c, RedisSearchCtx *sctx, size_t count) {
+  QueryResult page = {.totalResults = c->totalResults, .numResults = 0};
+  page.results = calloc(MAX(1, MIN(count, c->numResults - c->pos)), sizeof(ResultEntry));
+
+  // documents deleted since the snapshot was taken are skipped, and don't count towards the page
+  DocTable *dt = sctx->spec->docs;
+  while (c->pos < c->numResults && page.numResults < count) {
+    size_t i = c->pos++;
+    RSDocumentMetadata *dmd = DocTable_Get(dt, c->docIds[i]);
+    if (!dmd || dmd->flags & Document_Deleted) {
+      continue;
+    }
+    page.results[page.numResults++] = (ResultEntry){
+        .id = dmd->key,
+        .docId = c->docIds[i],
+        .score = c->scores[i],
+        .payload = dmd->payload,
+        .sortKey = c->req->sortBy ? RSSortingVector_Get(dmd->sortVector, c->req->sortBy) : NULL,
+    };
+  }
+
+  QueryResult_Serialize(&page, sctx, c->req, NULL);
+  free(page.results);
+  return c->pos == c->numResults;
+}
+
+void Cursor_Reply(Cursor *c, RedisSearchCtx *sctx, size_t count) {
+  RedisModule_ReplyWithArray(sctx->redisCtx, 2);
+  if (Cursor_SerializePage(c, sctx, count)) {
+    Cursors_Delete(c->id);
+    RedisModule_ReplyWithLongLong(sctx->redisCtx, 0);
+  } else {
+    RedisModule_ReplyWithLongLong(sctx->redisCtx, (long long)c->id);
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef __RS_CURSOR_H__
+#define __RS_CURSOR_H__
+
+#include <stdint.h>
+#include "redisearch.h"
+#include "search_request.h"
+#include "query.h"
+#include "spec.h"
+
+/* Cursors keep the full, ranked result list of a query server side, so that a client can page
+ * through it with FT.CURSOR READ at the cost of a single page per call, instead of re-running the
+ * query and skipping OFFSET results every time.
+ *
+ * A cursor holds a snapshot of the document ids and scores of all the matching documents, taken
+ * when the query ran. Documents are looked up again when a page is read, so documents deleted in
+ * the meantime are skipped.
+ *
+ * The cursor table is protected by the GIL, like the rest of the module's keyspace data */
+
+/* The default time a cursor can be idle before it is expired, in milliseconds */
+#define RS_CURSOR_DEFAULT_MAXIDLE 300000
+
+/* The maximal number of results held by all the cursors together. A query that would push the
+ * total above this fails instead of creating its cursor */
+#define RS_CURSOR_MAX_RESULTS 10000000
+
+typedef struct {
+  uint64_t id;
+  /* The index the cursor was created on, so a cursor is never read against an index that was
+   * dropped and re-created with the same name. The cursors of an index are purged when it's freed,
+   * so this never points at a freed spec that a new one could reuse the address of */
+  IndexSpec *spec;
+  /* The original request, used for serializing the pages. The cursor owns it */
+  RSSearchRequest *req;
+
+  /* The snapshot of the ranked results */
+  t_docId *docIds;
+  double *scores;
+  size_t numResults;
+  /* The position of the next result to read */
+  size_t pos;
+  size_t totalResults;
+
+  /* Expiry, in milliseconds */
+  long long maxIdle;
+  long long lastAccess;
+} Cursor;
+
+/* The number of results a new cursor can still hold without going over the memory budget. Expired
+ * cursors are released first */
+size_t Cursors_Budget();
+
+/* Create a cursor from the results of a query executed in collect-all mode, starting at position
+ * pos. The cursor takes ownership of the request, which must not be used by the caller anymore */
+Cursor *Cursors_Create(RSSearchRequest *req, QueryResult *r, size_t pos, long long maxIdle);
+
+/* Find a live cursor by its id and mark it as accessed. Returns NULL if it does not exist or has
+ * expired */
+Cursor *Cursors_Find(uint64_t id);
+
+/* Delete a cursor and release its snapshot. Returns 1 if the cursor existed */
+int Cursors_Delete(uint64_t id);
+
+/* Release all the cursors whose idle time has passed. Returns the number of cursors released */
+size_t Cursors_GC();
+
+/* Release all the cursors of an index that is being freed, or whose docIds are being renumbered.
+ * Returns the number of cursors released */
+size_t Cursors_PurgeIndex(IndexSpec *sp);
+
+/* The number of live cursors and the number of results they hold */
+size_t Cursors_Count();
+size_t Cursors_NumResults();
+
+/* Reply with the next count results of the cursor and advance it, as the reply of FT.SEARCH would.
+ * Deleted documents are skipped. Returns 1 if the cursor has been exhausted */
+int Cursor_SerializePage(Cursor *c, RedisSearchCtx *sctx, size_t count);
+
+/* Reply with the next page of a cursor followed by its id, which is 0 if the cursor was exhausted
+ * and deleted */
+void Cursor_Reply(Cursor *c, RedisSearchCtx *sctx, size_t count);
+
+#endif
@@ -6,16 +6,44 @@
 #include "util/fnv.h"
 #include "dep/triemap/triemap.h"
 #include "sortable.h"
+#include "varint.h"
 #include "rmalloc.h"
+#include "lazy_free.h"
+
+/* Make sure the table has pages allocated for all ids up to (not including) cap */
+static void DocTable_grow(DocTable *t, size_t cap) {
+  size_t numPages = (cap + DOCTABLE_PAGE_SIZE - 1) >> DOCTABLE_PAGE_BITS;
+  if (numPages <= t->numPages) {
+    return;
+  }
+  t->pages = rm_realloc(t->pages, numPages * sizeof(RSDocumentMetadata *));
+  for (size_t i = t->numPages; i < numPages; i++) {
+    t->pages[i] = rm_calloc(DOCTABLE_PAGE_SIZE, sizeof(RSDocumentMetadata));
+  }
+  t->numPages = numPages;
+  t->cap = numPages * DOCTABLE_PAGE_SIZE;
+}
 
 /* Creates a new DocTable with a given capacity */
 DocTable NewDocTable(size_t cap) {
-  return (DocTable){.size = 1,
-                    .cap = cap,
-                    .maxDocId = 0,
-                    .memsize = 0,
-                    .docs = rm_calloc(cap, sizeof(RSDocumentMetadata)),
-                    .dim = NewDocIdMap()};
+  DocTable t = {.size = 1,
+                .cap = 0,
+                .maxDocId = 0,
+                .memsize = 0,
+                .pages = NULL,
+                .numPages = 0,
+                .arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE),
+                .dim = NewDocIdMap()};
+  DocTable_grow(&t, cap);
+  return t;
+}
+
+/* Copy a payload into the table's arena */
+static RSPayload *DocTable_newPayload(DocTable *t, const char *data, size_t len) {
+  RSPayload *dpl = arena_alloc(t->arena, sizeof(RSPayload));
+  dpl->data = arena_strndup(t->arena, data, len);
+  dpl->len = len;
+  return dpl;
 }
 
 /* Get the metadata for a doc Id from the DocTable.
@@ -24,7 +52,7 @@ inline RSDocumentMetadata *DocTable_Get(DocTable *t, t_docId docId) {
   if (docId == 0 || docId > t->maxDocId) {
     return NULL;
   }
-  return &t->docs[docId];
+  return DocTable_Entry(t, docId);
 }
 
 /** Get the docId of a key if it exists in the table, or 0 if it doesnt */
@@ -41,23 +69,16 @@ int DocTable_SetPayload(DocTable *t, t_docId docId, const char *data, size_t len
     return 0;
   }
 
-  /* If we already have metadata - clean up the old data */
+  /* If we already have a payload - forget the old one. Its arena space is only reclaimed when the
+   * table is freed */
   if (dmd->payload) {
-    /* Free the old payload */
-    if (dmd->payload->data) {
-      rm_free(dmd->payload->data);
-    }
-    t->memsize -= dmd->payload->len;
-  } else {
-    dmd->payload = rm_malloc(sizeof(RSPayload));
+    t->memsize -= dmd->payload->len + sizeof(RSPayload);
   }
   /* Copy it... */
-  dmd->payload->data = rm_calloc(1, len + 1);
-  dmd->payload->len = len;
-  memcpy(dmd->payload->data, data, len);
+  dmd->payload = DocTable_newPayload(t, data, len);
 
   dmd->flags |= Document_HasPayload;
-  t->memsize += len;
+  t->memsize += len + sizeof(RSPayload);
   return 1;
 }
 
@@ -73,12 +94,16 @@ int DocTable_SetSortingVector(DocTable *t, t_docId docId, RSSortingVector *v) {
   if (!v) {
     if (dmd->sortVector) {
       SortingVector_Free(dmd->sortVector);
+      dmd->sortVector = NULL;
     }
     dmd->flags &= ~Document_HasSortVector;
     return 1;
   }
 
-  /* Set th new vector and the flags accordingly */
+  /* Set th new vector and the flags accordingly, releasing the old one */
+  if (dmd->sortVector && dmd->sortVector != v) {
+    SortingVector_Free(dmd->sortVector);
+  }
   dmd->sortVector = v;
   dmd->flags |= Document_HasSortVector;
 
@@ -98,29 +123,27 @@ t_docId DocTable_Put(DocTable *t, const char *key, double score, u_char flags, c
     return 0;
   }
   t_docId docId = ++t->maxDocId;
-  // if needed - grow the table
+  // if needed - add a page to the table
   if (t->maxDocId + 1 >= t->cap) {
-
-    t->cap += 1 + (t->cap ? MIN(t->cap / 2, 1024 * 1024) : 1);
-    t->docs = rm_realloc(t->docs, t->cap * sizeof(RSDocumentMetadata));
+    DocTable_grow(t, t->maxDocId + 1);
   }
 
   /* Copy the payload since it's probably an input string not retained */
   RSPayload *dpl = NULL;
   if (payload && payloadSize) {
-
-    dpl = rm_malloc(sizeof(RSPayload));
-    dpl->data = rm_calloc(1, payloadSize + 1);
-    memcpy(dpl->data, payload, payloadSize);
-    dpl->len = payloadSize;
+    dpl = DocTable_newPayload(t, payload, payloadSize);
     flags |= Document_HasPayload;
     t->memsize += payloadSize + sizeof(RSPayload);
   }
 
-  t->docs[docId] = (RSDocumentMetadata){
-      .key = rm_strdup(key), .score = score, .flags = flags, .payload = dpl, .maxFreq = 1};
+  size_t keyLen = strlen(key);
+  *DocTable_Entry(t, docId) = (RSDocumentMetadata){.key = arena_strndup(t->arena, key, keyLen),
+                                                   .score = score,
+                                                   .flags = flags,
+                                                   .payload = dpl,
+                                                   .maxFreq = 1};
   ++t->size;
-  t->memsize += sizeof(RSDocumentMetadata) + strlen(key);
+  t->memsize += sizeof(RSDocumentMetadata) + keyLen;
   DocIdMap_Put(&t->dim, key, docId);
   return docId;
 }
@@ -129,7 +152,7 @@ RSPayload *DocTable_GetPayload(DocTable *t, t_docId docId) {
   if (docId == 0 || docId > t->maxDocId) {
     return NULL;
   }
-  return t->docs[docId].payload;
+  return DocTable_Entry(t, docId)->payload;
 }
 
 /* Get the "real" external key for an incremental id. Returns NULL if docId is not in the table. */
@@ -137,7 +160,7 @@ inline const char *DocTable_GetKey(DocTable *t, t_docId docId) {
   if (docId == 0 || docId > t->maxDocId) {
     return NULL;
   }
-  return t->docs[docId].key;
+  return DocTable_Entry(t, docId)->key;
 }
 
 /* Get the score for a document from the table. Returns 0 if docId is not in the table. */
@@ -145,31 +168,27 @@ inline float DocTable_GetScore(DocTable *t, t_docId docId) {
   if (docId == 0 || docId > t->maxDocId) {
     return 0;
   }
-  return t->docs[docId].score;
+  return DocTable_Entry(t, docId)->score;
 }
 
+/* Free the parts of the metadata not allocated from the table's arena */
 void dmd_free(RSDocumentMetadata *md) {
-  if (md->payload) {
-    rm_free(md->payload->data);
-    rm_free(md->payload);
-    md->flags &= ~Document_HasPayload;
-    md->payload = NULL;
-  }
   if (md->sortVector) {
     SortingVector_Free(md->sortVector);
     md->sortVector = NULL;
     md->flags &= ~Document_HasSortVector;
   }
-  rm_free(md->key);
 }
 void DocTable_Free(DocTable *t) {
   // we start at docId 1, not 0
-  for (int i = 1; i < t->size; i++) {
-    dmd_free(&t->docs[i]);
+  for (t_docId i = 1; i < t->size; i++) {
+    dmd_free(DocTable_Entry(t, i));
   }
-  if (t->docs) {
-    rm_free(t->docs);
+  for (size_t i = 0; i < t->numPages; i++) {
+    rm_free(t->pages[i]);
   }
+  rm_free(t->pages);
+  arena_destroy(t->arena);
   DocIdMap_Free(&t->dim);
 }
 
@@ -177,10 +196,9 @@ int DocTable_Delete(DocTable *t, const char *key) {
   t_docId docId = DocIdMap_Get(&t->dim, key);
   if (docId && docId <= t->maxDocId) {
 
-    RSDocumentMetadata *md = &t->docs[docId];
+    RSDocumentMetadata *md = DocTable_Entry(t, docId);
     if (md->payload) {
-      rm_free(md->payload->data);
-      rm_free(md->payload);
+      t->memsize -= md->payload->len + sizeof(RSPayload);
       md->payload = NULL;
     }
 
@@ -190,22 +208,81 @@ int DocTable_Delete(DocTable *t, const char *key) {
   return 0;
 }
 
+t_docId *DocTable_Compact(DocTable *t) {
+  t_docId maxDocId = t->maxDocId;
+  size_t numDeleted = 0;
+  for (t_docId i = 1; i <= maxDocId; i++) {
+    if (DocTable_Entry(t, i)->flags & Document_Deleted) {
+      numDeleted++;
+    }
+  }
+  if (numDeleted == 0) {
+    return NULL;
+  }
+
+  t_docId *idMap = rm_calloc(maxDocId + 1, sizeof(t_docId));
+  arena_t *oldArena = t->arena;
+  t->arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE);
+  t->memsize = 0;
+
+  // live entries only ever move down, so we can move them in place
+  t_docId n = 0;
+  for (t_docId i = 1; i <= maxDocId; i++) {
+    RSDocumentMetadata *md = DocTable_Entry(t, i);
+    if (md->flags & Document_Deleted) {
+      dmd_free(md);
+      continue;
+    }
+    idMap[i] = ++n;
+    RSDocumentMetadata *nmd = DocTable_Entry(t, n);
+    *nmd = *md;
+
+    size_t keyLen = strlen(md->key);
+    nmd->key = arena_strndup(t->arena, md->key, keyLen);
+    if (md->payload) {
+      nmd->payload = DocTable_newPayload(t, md->payload->data, md->payload->len);
+      t->memsize += md->payload->len + sizeof(RSPayload);
+    }
+    t->memsize += sizeof(RSDocumentMetadata) + keyLen;
+    DocIdMap_Put(&t->dim, nmd->key, n);
+  }
+
+  // clear the vacated tail of the table and release the pages it no longer needs
+  for (t_docId i = n + 1; i <= maxDocId; i++) {
+    *DocTable_Entry(t, i) = (RSDocumentMetadata){};
+  }
+  size_t numPages = ((size_t)n + 1 + DOCTABLE_PAGE_SIZE - 1) >> DOCTABLE_PAGE_BITS;
+  for (size_t i = numPages; i < t->numPages; i++) {
+    rm_free(t->pages[i]);
+  }
+  t->pages = rm_realloc(t->pages, numPages * sizeof(RSDocumentMetadata *));
+  t->numPages = numPages;
+  t->cap = numPages * DOCTABLE_PAGE_SIZE;
+
+  arena_destroy(oldArena);
+  t->maxDocId = n;
+  t->size = n + 1;
+  return idMap;
+}
+
 void DocTable_RdbSave(DocTable *t, RedisModuleIO *rdb) {
 
   RedisModule_SaveUnsigned(rdb, t->size);
   RedisModule_SaveUnsigned(rdb, t->maxDocId);
-  for (int i = 1; i < t->size; i++) {
-    RedisModule_SaveStringBuffer(rdb, t->docs[i].key, strlen(t->docs[i].key) + 1);
-    RedisModule_SaveUnsigned(rdb, t->docs[i].flags);
-    RedisModule_SaveUnsigned(rdb, t->docs[i].maxFreq);
-    RedisModule_SaveFloat(rdb, t->docs[i].score);
-    if (t->docs[i].flags & Document_HasPayload && t->docs[i].payload) {
+  for (t_docId i = 1; i < t->size; i++) {
+    RSDocumentMetadata *md = DocTable_Entry(t, i);
+    RedisModule_SaveStringBuffer(rdb, md->key, strlen(md->key) + 1);
+    RedisModule_SaveUnsigned(rdb, md->flags);
+    RedisModule_SaveUnsigned(rdb, md->maxFreq);
+    RedisModule_SaveUnsigned(rdb, md->len);
+    RedisModule_SaveFloat(rdb, md->score);
+    if (md->flags & Document_HasPayload && md->payload) {
       // save an extra space for the null terminator to make the payload null terminated on load
-      RedisModule_SaveStringBuffer(rdb, t->docs[i].payload->data, t->docs[i].payload->len + 1);
+      RedisModule_SaveStringBuffer(rdb, md->payload->data, md->payload->len + 1);
     }
 
-    if (t->docs[i].flags & Document_HasSortVector) {
-      SortingVector_RdbSave(rdb, t->docs[i].sortVector);
+    if (md->flags & Document_HasSortVector) {
+      SortingVector_RdbSave(rdb, md->sortVector);
     }
   }
 }
@@ -213,57 +290,205 @@ void DocTable_RdbLoad(DocTable *t, RedisModuleIO *rdb, int encver) {
   size_t sz = RedisModule_LoadUnsigned(rdb);
   t->maxDocId = RedisModule_LoadUnsigned(rdb);
 
-  if (sz > t->cap) {
-    t->cap = sz;
-    t->docs = rm_realloc(t->docs, t->cap * sizeof(RSDocumentMetadata));
-  }
+  DocTable_grow(t, MAX(sz, t->maxDocId + 1));
   t->size = sz;
-  for (size_t i = 1; i < sz; i++) {
+  for (t_docId i = 1; i < sz; i++) {
+    RSDocumentMetadata *md = DocTable_Entry(t, i);
     size_t len;
-    t->docs[i].key = RedisModule_LoadStringBuffer(rdb, &len);
+    // copy the loaded strings into the arena, so the table owns all its keys and payloads
+    char *tmp = RedisModule_LoadStringBuffer(rdb, &len);
+    md->key = arena_strndup(t->arena, tmp, len ? len - 1 : 0);
+    RedisModule_Free(tmp);
 
-    t->docs[i].flags = RedisModule_LoadUnsigned(rdb);
-    t->docs[i].maxFreq = 0;
+    md->flags = RedisModule_LoadUnsigned(rdb);
+    md->maxFreq = 0;
     if (encver > 1) {
-      t->docs[i].maxFreq = RedisModule_LoadUnsigned(rdb);
+      md->maxFreq = RedisModule_LoadUnsigned(rdb);
+    }
+    md->len = 0;
+    if (encver >= 7) {
+      md->len = RedisModule_LoadUnsigned(rdb);
     }
-    t->docs[i].score = RedisModule_LoadFloat(rdb);
-    t->docs[i].payload = NULL;
+    md->score = RedisModule_LoadFloat(rdb);
+    md->payload = NULL;
     // read payload if set
-    if (t->docs[i].flags & Document_HasPayload) {
-      t->docs[i].payload = RedisModule_Alloc(sizeof(RSPayload));
-      t->docs[i].payload->data = RedisModule_LoadStringBuffer(rdb, &t->docs[i].payload->len);
-      t->docs[i].payload->len--;
-      t->memsize += t->docs[i].payload->len + sizeof(RSPayload);
+    if (md->flags & Document_HasPayload) {
+      size_t plen;
+      tmp = RedisModule_LoadStringBuffer(rdb, &plen);
+      md->payload = DocTable_newPayload(t, tmp, plen ? plen - 1 : 0);
+      RedisModule_Free(tmp);
+      t->memsize += md->payload->len + sizeof(RSPayload);
     }
-    if (t->docs[i].flags & Document_HasSortVector) {
-      t->docs[i].sortVector = SortingVector_RdbLoad(rdb, encver);
+    if (md->flags & Document_HasSortVector) {
+      md->sortVector = SortingVector_RdbLoad(rdb, encver);
     }
 
     // We always save deleted docs to rdb, but we don't want to load them back to the id map
-    if (!(t->docs[i].flags & Document_Deleted)) {
-      DocIdMap_Put(&t->dim, t->docs[i].key, i);
+    if (!(md->flags & Document_Deleted)) {
+      DocIdMap_Put(&t->dim, md->key, i);
     }
     t->memsize += sizeof(RSDocumentMetadata) + len;
   }
 }
 
-void DocTable_AOFRewrite(DocTable *t, RedisModuleString *key, RedisModuleIO *aof) {
-  RedisModuleCtx *ctx = RedisModule_GetContextFromIO(aof);
-  for (int i = 1; i < t->size; i++) {
+size_t DocTable_Dump(DocTable *t, t_docId from, t_docId to, Buffer *buf) {
+  size_t start = buf->offset;
+  BufferWriter bw = NewBufferWriter(buf);
+  WriteVarint(from, &bw);
+  for (t_docId i = from; i <= to && i <= t->maxDocId; i++) {
+    RSDocumentMetadata *md = DocTable_Entry(t, i);
+    // deleted documents keep the flag but not the payload
+    u_char flags = md->flags;
+    if (!md->payload) flags &= ~Document_HasPayload;
+    if (!md->sortVector) flags &= ~Document_HasSortVector;
+
+    WriteVarint(flags, &bw);
+    WriteVarint(md->maxFreq, &bw);
+    WriteVarint(md->len, &bw);
+    Buffer_Write(&bw, &md->score, sizeof(float));
+    uint32_t keyLen = strlen(md->key);
+    WriteVarint(keyLen, &bw);
+    Buffer_Write(&bw, md->key, keyLen);
+    if (flags & Document_HasPayload) {
+      WriteVarint(md->payload->len, &bw);
+      Buffer_Write(&bw, md->payload->data, md->payload->len);
+    }
+    if (flags & Document_HasSortVector) {
+      SortingVector_Dump(md->sortVector, &bw);
+    }
+  }
+  return buf->offset - start;
+}
+
+int DocTable_Restore(DocTable *t, const char *data, size_t len) {
+  Buffer b = {.data = (char *)data, .cap = len, .offset = len};
+  BufferReader br = NewBufferReader(&b);
+  // the documents must be restored in order, and keep their ids
+  if (len == 0 || ReadVarint(&br) != t->maxDocId + 1) {
+    return -1;
+  }
+
+  int n = 0;
+  while (br.pos < len) {
+    RSDocumentMetadata md = {.payload = NULL, .sortVector = NULL};
+    md.flags = ReadVarint(&br);
+    md.maxFreq = ReadVarint(&br);
+    md.len = ReadVarint(&br);
+    if (!Buffer_Read(&br, &md.score, sizeof(float))) return -1;
+    uint32_t keyLen = ReadVarint(&br);
+    if (br.pos + keyLen > len) return -1;
+    md.key = arena_strndup(t->arena, data + br.pos, keyLen);
+    br.pos += keyLen;
+
+    if (md.flags & Document_HasPayload) {
+      uint32_t plen = ReadVarint(&br);
+      if (br.pos + plen > len) return -1;
+      md.payload = DocTable_newPayload(t, data + br.pos, plen);
+      br.pos += plen;
+      t->memsize += plen + sizeof(RSPayload);
+    }
+    if (md.flags & Document_HasSortVector) {
+      if (!(md.sortVector = SortingVector_Restore(&br))) return -1;
+    }
+
+    t_docId docId = ++t->maxDocId;
+    DocTable_grow(t, t->maxDocId + 1);
+    *DocTable_Entry(t, docId) = md;
+    ++t->size;
+    t->memsize += sizeof(RSDocumentMetadata) + keyLen;
+    if (!(md.flags & Document_Deleted)) {
+      DocIdMap_Put(&t->dim, md.key, docId);
+    }
+    n++;
+  }
+  return n;
+}
+
+void DocTable_AOFRewrite(DocTable *t, RedisModuleString *key, const char *section,
+                         RedisModuleIO *aof) {
+  Buffer buf;
+  Buffer_Init(&buf, 0);
+  for (t_docId i = 1; i <= t->maxDocId; i += DOCTABLE_AOF_CHUNK) {
+    buf.offset = 0;
+    DocTable_Dump(t, i, i + DOCTABLE_AOF_CHUNK - 1, &buf);
+    RedisModule_EmitAOF(aof, "FT.RESTORE", "scb", key, section, buf.data, buf.offset);
+  }
+  Buffer_Free(&buf);
+}
+
+RedisModuleType *DocTableType = NULL;
+
+DocTable *DocTable_OpenShared(RedisModuleCtx *ctx, const char *name, int create) {
+  RedisModuleString *s = RedisModule_CreateStringPrintf(ctx, DOCTABLE_KEY_FMT, name);
+  RedisModuleKey *k =
+      RedisModule_OpenKey(ctx, s, REDISMODULE_READ | (create ? REDISMODULE_WRITE : 0));
+  RedisModule_FreeString(ctx, s);
+  if (k == NULL) {
+    return NULL;
+  }
 
-    RedisModuleString *ss = RedisModule_CreateStringPrintf(ctx, "%f", t->docs[i].score);
-    // dump payload if possible
-    if (t->docs[i].flags & Document_HasPayload && t->docs[i].payload) {
-      RedisModule_EmitAOF(aof, "FT.DTADD", "sclsb", key, t->docs[i].key,
-                          (long long)t->docs[i].flags, ss, t->docs[i].payload->data,
-                          t->docs[i].payload->len);
-    } else {
-      RedisModule_EmitAOF(aof, "FT.DTADD", "scls", key, t->docs[i].key, (long long)t->docs[i].flags,
-                          ss);
+  DocTable *t = NULL;
+  int type = RedisModule_KeyType(k);
+  if (type == REDISMODULE_KEYTYPE_EMPTY) {
+    if (create) {
+      t = rm_malloc(sizeof(DocTable));
+      *t = NewDocTable(1000);
+      RedisModule_ModuleTypeSetValue(k, DocTableType, t);
     }
-    RedisModule_FreeString(ctx, ss);
+  } else if (RedisModule_ModuleTypeGetType(k) == DocTableType) {
+    t = RedisModule_ModuleTypeGetValue(k);
+  }
+  RedisModule_CloseKey(k);
+  return t;
+}
+
+static void *DocTableType_RdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver != 0) {
+    return NULL;
   }
+  DocTable *t = rm_malloc(sizeof(DocTable));
+  *t = NewDocTable(1000);
+  DocTable_RdbLoad(t, rdb, DOCTABLE_SHARED_FORMAT);
+  return t;
+}
+
+static void DocTableType_RdbSave(RedisModuleIO *rdb, void *value) {
+  DocTable_RdbSave(value, rdb);
+}
+
+static void DocTableType_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+  DocTable_AOFRewrite(value, key, "DOCTABLE", aof);
+}
+
+static void DocTableType_FreeInternals(void *value) {
+  DocTable_Free(value);
+  rm_free(value);
+}
+
+/* A shared table can be big, so it's freed in the background like an index spec */
+static void DocTableType_Free(void *value) {
+  DocTable *t = value;
+  LazyFree(DocTableType_FreeInternals, t, t->size);
+}
+
+static size_t DocTableType_MemUsage(const void *value) {
+  const DocTable *t = value;
+  return sizeof(DocTable) + t->memsize + TrieMap_MemUsage(t->dim.tm);
+}
+
+int DocTable_RegisterType(RedisModuleCtx *ctx) {
+  RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
+                               .rdb_load = DocTableType_RdbLoad,
+                               .rdb_save = DocTableType_RdbSave,
+                               .aof_rewrite = DocTableType_AofRewrite,
+                               .free = DocTableType_Free,
+                               .mem_usage = DocTableType_MemUsage};
+
+  DocTableType = RedisModule_CreateDataType(ctx, "ft_doctbl", 0, &tm);
+  if (DocTableType == NULL) {
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
 }
 
 DocIdMap NewDocIdMap() {
@@ -276,29 +501,27 @@ t_docId DocIdMap_Get(DocIdMap *m, const char *key) {
 
   void *val = TrieMap_Find(m->tm, (char *)key, strlen(key));
   if (val && val != TRIEMAP_NOTFOUND) {
-    return *((t_docId *)val);
+    return (t_docId)(uintptr_t)val;
   }
   return 0;
 }
 
 void *_docIdMap_replace(void *oldval, void *newval) {
-  if (oldval) {
-    rm_free(oldval);
-  }
   return newval;
 }
 
-void DocIdMap_Put(DocIdMap *m, const char *key, t_docId docId) {
+/* The map values are docIds and not pointers, so there is nothing to free */
+static void _docIdMap_free(void *val) {
+}
 
-  t_docId *pd = rm_malloc(sizeof(t_docId));
-  *pd = docId;
-  TrieMap_Add(m->tm, (char *)key, strlen(key), pd, _docIdMap_replace);
+void DocIdMap_Put(DocIdMap *m, const char *key, t_docId docId) {
+  TrieMap_Add(m->tm, (char *)key, strlen(key), (void *)(uintptr_t)docId, _docIdMap_replace);
 }
 
 void DocIdMap_Free(DocIdMap *m) {
-  TrieMap_Free(m->tm, RedisModule_Free);
+  TrieMap_Free(m->tm, _docIdMap_free);
 }
 
 int DocIdMap_Delete(DocIdMap *m, const char *key) {
-  return TrieMap_Delete(m->tm, (char *)key, strlen(key), RedisModule_Free);
-}
\ No newline at end of file
+  return TrieMap_Delete(m->tm, (char *)key, strlen(key), _docIdMap_free);
+}
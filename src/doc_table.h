@@ -6,8 +6,10 @@
 #include "dep/triemap/triemap.h"
 #include "redisearch.h"
 #include "sortable.h"
+#include "buffer.h"
+#include "util/arena.h"
 
-/* Map between external id an incremental id */
+/* Map between external id an incremental id. The docId is stored directly as the trie value */
 typedef struct { TrieMap *tm; } DocIdMap;
 
 DocIdMap NewDocIdMap();
@@ -28,17 +30,32 @@ void DocIdMap_Free(DocIdMap *m);
  *
  * NOTE: Currently there is no deduplication on the table so we do not prevent dual insertion of
  * the
- * same key. This may result in document duplication in results  */
+ * same key. This may result in document duplication in results
+ *
+ * The metadata entries are stored in fixed size pages, so growing the table never moves or copies
+ * existing entries, and pointers returned by DocTable_Get remain valid as the table grows. Document
+ * keys and payloads are allocated from an arena owned by the table instead of one malloc each */
 typedef struct {
   size_t size;
   t_docId maxDocId;
   size_t cap;
   size_t memsize;
-  RSDocumentMetadata *docs;
+  RSDocumentMetadata **pages;
+  size_t numPages;
+  arena_t *arena;
   DocIdMap dim;
 
 } DocTable;
 
+/* The number of metadata entries in each page of the table. Must be a power of two */
+#define DOCTABLE_PAGE_BITS 10
+#define DOCTABLE_PAGE_SIZE (1 << DOCTABLE_PAGE_BITS)
+#define DOCTABLE_PAGE_MASK (DOCTABLE_PAGE_SIZE - 1)
+
+/* Get the metadata entry for a docId without range checking */
+#define DocTable_Entry(t, docId) \
+  (&(t)->pages[(docId) >> DOCTABLE_PAGE_BITS][(docId)&DOCTABLE_PAGE_MASK])
+
 /* Creates a new DocTable with a given capacity */
 DocTable NewDocTable(size_t cap);
 
@@ -80,13 +97,54 @@ void DocTable_Free(DocTable *t);
 
 int DocTable_Delete(DocTable *t, const char *key);
 
+/* Compact the table by dropping deleted documents and renumbering the live ones, in their original
+ * order, to dense docIds starting at 1. The key arena is rebuilt and unused pages are released.
+ *
+ * Returns a map of size maxDocId + 1 (as it was before the compaction) from old docIds to new ones,
+ * where deleted documents map to 0. The map is monotonic, so it can be applied to delta encoded
+ * posting lists in place. The caller must apply it to all the index's structures and free it.
+ * Returns NULL if the table has no deleted documents */
+t_docId *DocTable_Compact(DocTable *t);
+
 /* Save the table to RDB. Called from the owning index */
 void DocTable_RdbSave(DocTable *t, RedisModuleIO *rdb);
 
 /* Load the table from RDB */
 void DocTable_RdbLoad(DocTable *t, RedisModuleIO *rdb, int encver);
 
-/* Emit special FT.DTADD commands to recreate the table */
-void DocTable_AOFRewrite(DocTable *t, RedisModuleString *k, RedisModuleIO *aof);
+/* Serialize the metadata of docIds from to to (inclusive), appending it to buf. Returns the number
+ * of bytes written */
+size_t DocTable_Dump(DocTable *t, t_docId from, t_docId to, Buffer *buf);
+
+/* Append the documents serialized by DocTable_Dump to the table. The first of them must get the
+ * same docId it had when it was dumped. Returns the number of documents restored, or -1 if the data
+ * is malformed */
+int DocTable_Restore(DocTable *t, const char *data, size_t len);
+
+/* The number of documents in each FT.RESTORE command emitted on AOF rewrite */
+#define DOCTABLE_AOF_CHUNK 1000
+
+/* Emit FT.RESTORE {k} {section} commands that recreate the table, DOCTABLE_AOF_CHUNK documents at a
+ * time */
+void DocTable_AOFRewrite(DocTable *t, RedisModuleString *k, const char *section,
+                         RedisModuleIO *aof);
+
+/* A document table can also be shared by several indexes, created with FT.CREATE ... DOCTABLE
+ * {name}. A shared table lives in a key of its own, so it outlives any of its indexes and is saved
+ * once, and the indexes hold nothing but its name. They get their docIds from the same sequence, so
+ * a document added to several of them has one docId and one copy of its key and metadata */
+extern RedisModuleType *DocTableType;
+
+#define DOCTABLE_KEY_PREFIX "dt:"
+#define DOCTABLE_KEY_FMT DOCTABLE_KEY_PREFIX "%s"
+
+/* The index spec version whose table format the shared tables are saved in */
+#define DOCTABLE_SHARED_FORMAT 13
+
+/* Open the shared document table called name, creating it if create is set. Returns NULL if it
+ * doesn't exist and is not created, or if its key holds something else */
+DocTable *DocTable_OpenShared(RedisModuleCtx *ctx, const char *name, int create);
+
+int DocTable_RegisterType(RedisModuleCtx *ctx);
 
 #endif
\ No newline at end of file
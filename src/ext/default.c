@@ -2,7 +2,7 @@
 #include <stdio.h>
 #include <sys/param.h>
 #include "../redisearch.h"
-#include "../dep/snowball/include/libstemmer.h"
+#include "../stemmer.h"
 #include "default.h"
 
 double _tfidfRecursive(RSIndexResult *r) {
@@ -38,6 +38,101 @@ double TFIDFScorer(RSScoringFunctionCtx *ctx, RSIndexResult *h, RSDocumentMetada
   return tfidf;
 }
 
+/* BM25 term frequency saturation and document length normalization parameters */
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+/* Sum the BM25 scores of the terms in the result. lenNorm is the document length normalization
+ * factor, which is the same for all the terms of the document */
+static double _bm25Recursive(RSIndexResult *r, double lenNorm) {
+  if (r->type == RSResultType_Term) {
+    double f = (double)r->freq;
+    return (r->term.term ? r->term.term->bm25_idf : 0) * f * (BM25_K1 + 1) /
+           (f + BM25_K1 * lenNorm);
+  }
+
+  double ret = 0;
+  if (r->type & (RSResultType_Intersection | RSResultType_Union)) {
+    for (int i = 0; i < r->agg.numChildren; i++) {
+      ret += _bm25Recursive(r->agg.children[i], lenNorm);
+    }
+  }
+  return ret;
+}
+
+/* Calculate sum(BM25)*document score for each result. Documents indexed before their length was
+ * recorded are treated as having the average length */
+double BM25Scorer(RSScoringFunctionCtx *ctx, RSIndexResult *h, RSDocumentMetadata *dmd,
+                  double minScore) {
+  if (dmd->score == 0) return 0;
+
+  double avgDocLen = ctx->indexStats.avgDocLen;
+  double lenNorm = 1;
+  if (dmd->len && avgDocLen > 0) {
+    lenNorm = 1 - BM25_B + BM25_B * (double)dmd->len / avgDocLen;
+  }
+
+  double score = dmd->score * _bm25Recursive(h, lenNorm);
+
+  // no need to factor the distance if the score is already below minimal score
+  if (score < minScore) {
+    return 0;
+  }
+
+  return score / (double)ctx->GetSlop(h);
+}
+
+/* Sum the tf-idf of all the term records of each result. The terms are flattened by the engine, so
+ * unlike _tfidfRecursive this doesn't need to walk the result trees */
+static void _tfidfBatchSum(RSScoringBatch *b) {
+  for (size_t i = 0; i < b->numResults; i++) {
+    double tfidf = 0;
+    for (size_t t = b->termsOffset[i]; t < b->termsOffset[i + 1]; t++) {
+      tfidf += b->termFreqs[t] * (b->terms[t] ? b->terms[t]->idf : 0);
+    }
+    b->scores[i] = tfidf;
+  }
+}
+
+/* Batch version of the TF-IDF scorer */
+void TFIDFBatchScorer(RSScoringFunctionCtx *ctx, RSScoringBatch *b, double minScore) {
+  _tfidfBatchSum(b);
+  for (size_t i = 0; i < b->numResults; i++) {
+    double tfidf = b->scores[i] * b->docScores[i] / (double)b->maxFreqs[i];
+    // no need to factor the distance if tfidf is already below minimal score
+    if (tfidf < minScore || b->docScores[i] == 0) {
+      b->scores[i] = 0;
+      continue;
+    }
+    b->scores[i] = tfidf / (double)ctx->GetSlop(b->results[i]);
+  }
+}
+
+/* Batch version of the BM25 scorer */
+void BM25BatchScorer(RSScoringFunctionCtx *ctx, RSScoringBatch *b, double minScore) {
+  double avgDocLen = ctx->indexStats.avgDocLen;
+  for (size_t i = 0; i < b->numResults; i++) {
+    double lenNorm = 1;
+    if (b->docLens[i] && avgDocLen > 0) {
+      lenNorm = 1 - BM25_B + BM25_B * (double)b->docLens[i] / avgDocLen;
+    }
+    double score = 0;
+    for (size_t t = b->termsOffset[i]; t < b->termsOffset[i + 1]; t++) {
+      double f = (double)b->termFreqs[t];
+      score += (b->terms[t] ? b->terms[t]->bm25_idf : 0) * f * (BM25_K1 + 1) /
+               (f + BM25_K1 * lenNorm);
+    }
+    score *= b->docScores[i];
+
+    // no need to factor the distance if the score is already below minimal score
+    if (score < minScore || b->docScores[i] == 0) {
+      b->scores[i] = 0;
+      continue;
+    }
+    b->scores[i] = score / (double)ctx->GetSlop(b->results[i]);
+  }
+}
+
 double _dismaxRecursive(RSIndexResult *r) {
   // for terms - we return the term frequency
   double ret = 0;
@@ -69,36 +164,29 @@ double DisMaxScorer(RSScoringFunctionCtx *ctx, RSIndexResult *h, RSDocumentMetad
   return _dismaxRecursive(h);
 }
 
+/* Batch version of the DisMax scorer. Unions and intersections are scored differently, so it still
+ * needs the result trees */
+void DisMaxBatchScorer(RSScoringFunctionCtx *ctx, RSScoringBatch *b, double minScore) {
+  for (size_t i = 0; i < b->numResults; i++) {
+    b->scores[i] = _dismaxRecursive(b->results[i]);
+  }
+}
+
 void DefaultStemmerExpand(RSQueryExpanderCtx *ctx, RSToken *token) {
 
-  // we store the stemmer as private data on the first call to expand
-  if (!ctx->privdata) {
-    ctx->privdata = sb_stemmer_new(ctx->language, NULL);
-  }
-  struct sb_stemmer *sb = ctx->privdata;
+  // the stemmer and its cache of stems are shared with the indexing of documents
+  Stemmer *sb = GetSharedStemmer(SnowballStemmer, ctx->language);
   // No stemmer available for this language - just return the node so we won't
   // be called again
   if (!sb) {
     return;
   }
 
-  const sb_symbol *b = (const sb_symbol *)token->str;
-  const sb_symbol *stemmed = sb_stemmer_stem(sb, b, token->len);
-
-  if (stemmed && strncasecmp((const char *)stemmed, token->str, token->len)) {
-
-    int sl = sb_stemmer_length(sb);
-    ctx->ExpandToken(ctx, strndup((const char *)stemmed, sl), sl,
-                     0x0);  // TODO: Set proper flags here
-  }
-
-  // sb_stemmer_delete(sb);
-}
-
-void defaultExpanderFree(void *p) {
-  if (p) {
+  size_t sl;
+  const char *stemmed = sb->Stem(sb->ctx, token->str, token->len, &sl);
 
-    sb_stemmer_delete(p);
+  if (stemmed && strncasecmp(stemmed, token->str, token->len)) {
+    ctx->ExpandToken(ctx, strndup(stemmed, sl), sl, 0x0);  // TODO: Set proper flags here
   }
 }
 
@@ -107,18 +195,26 @@ int DefaultExtensionInit(RSExtensionCtx *ctx) {
 
   /* TF-IDF scorer is the default scorer */
   if (ctx->RegisterScoringFunction(DEFAULT_SCORER_NAME, TFIDFScorer, NULL, NULL) ==
-      REDISEARCH_ERR) {
+          REDISEARCH_ERR ||
+      ctx->RegisterBatchScoringFunction(DEFAULT_SCORER_NAME, TFIDFBatchScorer) == REDISEARCH_ERR) {
     return REDISEARCH_ERR;
   }
 
   /* DisMax-alike scorer */
   if (ctx->RegisterScoringFunction(DISMAX_SCORER_NAME, DisMaxScorer, NULL, NULL) ==
-      REDISEARCH_ERR) {
+          REDISEARCH_ERR ||
+      ctx->RegisterBatchScoringFunction(DISMAX_SCORER_NAME, DisMaxBatchScorer) == REDISEARCH_ERR) {
+    return REDISEARCH_ERR;
+  }
+
+  /* BM25 scorer */
+  if (ctx->RegisterScoringFunction(BM25_SCORER_NAME, BM25Scorer, NULL, NULL) == REDISEARCH_ERR ||
+      ctx->RegisterBatchScoringFunction(BM25_SCORER_NAME, BM25BatchScorer) == REDISEARCH_ERR) {
     return REDISEARCH_ERR;
   }
 
   /* Snowball Stemmer is the default expander */
-  if (ctx->RegisterQueryExpander(DEFAULT_EXPANDER_NAME, DefaultStemmerExpand, defaultExpanderFree,
+  if (ctx->RegisterQueryExpander(DEFAULT_EXPANDER_NAME, DefaultStemmerExpand, NULL,
                                  NULL) == REDISEARCH_ERR) {
     return REDISEARCH_ERR;
   }
@@ -5,6 +5,7 @@
 #define DEFAULT_EXPANDER_NAME "SBSTEM"
 #define DEFAULT_SCORER_NAME "TFIDF"
 #define DISMAX_SCORER_NAME "DISMAX"
+#define BM25_SCORER_NAME "BM25"
 
 int DefaultExtensionInit(RSExtensionCtx *ctx);
 
@@ -31,6 +31,7 @@ int Ext_RegisterScoringFunction(const char *alias, RSScoringFunction func, RSFre
   ctx->privdata = privdata;
   ctx->ff = ff;
   ctx->sf = func;
+  ctx->bsf = NULL;
 
   /* Make sure that two scorers are never registered under the same name */
   if (TrieMap_Find(__scorers, (char *)alias, strlen(alias)) != TRIEMAP_NOTFOUND) {
@@ -42,6 +43,19 @@ int Ext_RegisterScoringFunction(const char *alias, RSScoringFunction func, RSFre
   return REDISEARCH_OK;
 }
 
+/* Register the batch version of an already registered scoring function */
+int Ext_RegisterBatchScoringFunction(const char *alias, RSBatchScoringFunction func) {
+  if (func == NULL || __scorers == NULL) {
+    return REDISEARCH_ERR;
+  }
+  ExtScoringFunctionCtx *ctx = TrieMap_Find(__scorers, (char *)alias, strlen(alias));
+  if (ctx == TRIEMAP_NOTFOUND || ctx == NULL || ctx->bsf != NULL) {
+    return REDISEARCH_ERR;
+  }
+  ctx->bsf = func;
+  return REDISEARCH_OK;
+}
+
 /* Register a aquery expander */
 int Ext_RegisterQueryExpander(const char *alias, RSQueryTokenExpander exp, RSFreeFunction ff,
                               void *privdata) {
@@ -68,6 +82,7 @@ int Extension_Load(const char *name, RSExtensionInitFunc func) {
   RSExtensionCtx ctx = {
       .RegisterScoringFunction = Ext_RegisterScoringFunction,
       .RegisterQueryExpander = Ext_RegisterQueryExpander,
+      .RegisterBatchScoringFunction = Ext_RegisterBatchScoringFunction,
   };
 
   return func(&ctx);
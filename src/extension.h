@@ -9,6 +9,8 @@ void Extensions_Init();
 /* Context for saving a scoring function and its private data and free */
 typedef struct {
   RSScoringFunction sf;
+  // optional batch version of the scoring function
+  RSBatchScoringFunction bsf;
   RSFreeFunction ff;
   void *privdata;
 } ExtScoringFunctionCtx;
@@ -4,78 +4,135 @@
 #include "util/logging.h"
 #include <stdio.h>
 #include <sys/param.h>
+#include <string.h>
 #include "rmalloc.h"
 
+#define FWIDX_INITIAL_BUCKETS 1024
+#define FWIDX_INITIAL_ENTRIES 256
+#define FWIDX_TERMS_BLOCK_SIZE (16 * 1024)
+
 ForwardIndex *NewForwardIndex(Document doc) {
   ForwardIndex *idx = rm_malloc(sizeof(ForwardIndex));
 
-  idx->hits = kh_init(32);
+  idx->entriesCap = FWIDX_INITIAL_ENTRIES;
+  idx->entries = rm_malloc(idx->entriesCap * sizeof(ForwardIndexEntry));
+  idx->numBuckets = FWIDX_INITIAL_BUCKETS;
+  idx->buckets = rm_calloc(idx->numBuckets, sizeof(uint32_t));
+  idx->positionsCap = FWIDX_INITIAL_ENTRIES * 2;
+  idx->positions = rm_malloc(idx->positionsCap * sizeof(ForwardIndexPos));
+  idx->offsets = (Buffer){.data = rm_malloc(FWIDX_INITIAL_ENTRIES * 4),
+                          .cap = FWIDX_INITIAL_ENTRIES * 4,
+                          .offset = 0};
+  idx->terms = arena_new(FWIDX_TERMS_BLOCK_SIZE);
+  idx->numEntries = 0;
+
+  ForwardIndex_Reset(idx, doc);
+  return idx;
+}
+
+void ForwardIndex_Reset(ForwardIndex *idx, Document doc) {
   idx->docScore = doc.score;
   idx->docId = doc.docId;
   idx->totalFreq = 0;
   idx->uniqueTokens = 0;
   idx->maxFreq = 0;
-  idx->stemmer = NewStemmer(SnowballStemmer, doc.language);
+  idx->stemmer = GetSharedStemmer(SnowballStemmer, doc.language);
 
-  return idx;
+  for (uint32_t i = 0; i < idx->numEntries; i++) {
+    idx->buckets[idx->entries[i].bucket] = 0;
+  }
+  idx->numEntries = 0;
+  idx->numPositions = 0;
+  idx->offsets.offset = 0;
+  arena_reset(idx->terms);
 }
 
-void ForwardIndexFree(ForwardIndex *idx) {
-  khiter_t k;
-  for (k = kh_begin(idx->hits); k != kh_end(idx->hits); ++k) {
-    if (kh_exist(idx->hits, k)) {
-      ForwardIndexEntry *ent = kh_value(idx->hits, k);
-      // rm_free((void *)ent->term);
-
-      kh_del(32, idx->hits, k);
-      VVW_Free(ent->vw);
-
-      if (ent->stringFreeable) {
-        rm_free((char *)ent->term);
-      }
-      rm_free(ent);
-    }
+ForwardIndex *ForwardIndex_Reuse(ForwardIndex *idx, Document doc) {
+  if (idx && (idx->entriesCap > FWIDX_MAX_KEPT_ENTRIES ||
+              idx->positionsCap > FWIDX_MAX_KEPT_POSITIONS)) {
+    ForwardIndexFree(idx);
+    idx = NULL;
   }
-  kh_destroy(32, idx->hits);
+  if (idx == NULL) {
+    return NewForwardIndex(doc);
+  }
+  ForwardIndex_Reset(idx, doc);
+  return idx;
+}
 
+void ForwardIndexFree(ForwardIndex *idx) {
   if (idx->stemmer) {
     idx->stemmer->Free(idx->stemmer);
   }
+  rm_free(idx->entries);
+  rm_free(idx->buckets);
+  rm_free(idx->positions);
+  Buffer_Free(&idx->offsets);
+  arena_destroy(idx->terms);
   rm_free(idx);
-  // TODO: check if we need to rm_free each entry separately
 }
 
 // void ForwardIndex_NormalizeFreq(ForwardIndex *idx, ForwardIndexEntry *e) {
 //   e->freq = e->freq / idx->maxFreq;
 // }
 
+/* Double the hash table and re-insert all the entries */
+static void ForwardIndex_Rehash(ForwardIndex *idx) {
+  idx->numBuckets *= 2;
+  idx->buckets = rm_realloc(idx->buckets, idx->numBuckets * sizeof(uint32_t));
+  memset(idx->buckets, 0, idx->numBuckets * sizeof(uint32_t));
+
+  uint32_t mask = idx->numBuckets - 1;
+  for (uint32_t i = 0; i < idx->numEntries; i++) {
+    uint32_t b = idx->entries[i].hash & mask;
+    while (idx->buckets[b]) {
+      b = (b + 1) & mask;
+    }
+    idx->buckets[b] = i + 1;
+    idx->entries[i].bucket = b;
+  }
+}
+
+/* Find the entry of a term, or create it if it's not in the index yet */
+static ForwardIndexEntry *ForwardIndex_GetEntry(ForwardIndex *idx, const char *term, size_t len) {
+  uint32_t hval = fnv_32a_buf((void *)term, len, 0);
+  uint32_t mask = idx->numBuckets - 1;
+  uint32_t b = hval & mask;
+  while (idx->buckets[b]) {
+    ForwardIndexEntry *h = &idx->entries[idx->buckets[b] - 1];
+    if (h->hash == hval && h->len == len && !memcmp(h->term, term, len)) {
+      return h;
+    }
+    b = (b + 1) & mask;
+  }
+
+  if (idx->numEntries == idx->entriesCap) {
+    idx->entriesCap *= 2;
+    idx->entries = rm_realloc(idx->entries, idx->entriesCap * sizeof(ForwardIndexEntry));
+  }
+  ForwardIndexEntry *h = &idx->entries[idx->numEntries++];
+  idx->buckets[b] = idx->numEntries;
+
+  *h = (ForwardIndexEntry){.docId = idx->docId,
+                           .term = arena_strndup(idx->terms, term, len),
+                           .len = len,
+                           .docScore = idx->docScore,
+                           .hash = hval,
+                           .bucket = b,
+                           .firstPos = UINT32_MAX,
+                           .lastPos = UINT32_MAX};
+
+  // keep the table at most half full
+  if (idx->numEntries * 2 > idx->numBuckets) {
+    ForwardIndex_Rehash(idx);
+  }
+  return h;
+}
+
 int forwardIndexTokenFunc(void *ctx, Token t) {
   ForwardIndex *idx = ctx;
 
-  // we hash the string ourselves because khash suckz azz
-  uint32_t hval = fnv_32a_buf((void *)t.s, t.len, 0);
-  // LG_DEBUG("token %.*s, hval %d\n", t.len, t.s, hval);
-  ForwardIndexEntry *h = NULL;
-  khiter_t k = kh_get(32, idx->hits, hval);  // first have to get ieter
-  if (k == kh_end(idx->hits)) {              // k will be equal to kh_end if key not present
-    /// LG_DEBUG("new entry %.*s\n", t.len, t.s);
-    h = rm_calloc(1, sizeof(ForwardIndexEntry));
-    h->docId = idx->docId;
-    h->fieldMask = 0;
-    h->term = t.s;
-    h->len = t.len;
-    h->stringFreeable = t.stringFreeable;
-    h->freq = 0;
-
-    h->vw = NewVarintVectorWriter(4);
-    h->docScore = idx->docScore;
-
-    int ret;
-    k = kh_put(32, idx->hits, hval, &ret);
-    kh_value(idx->hits, k) = h;
-  } else {
-    h = kh_val(idx->hits, k);
-  }
+  ForwardIndexEntry *h = ForwardIndex_GetEntry(idx, t.s, t.len);
 
   h->fieldMask |= (t.fieldId & RS_FIELDMASK_ALL);
   float score = (float)t.score;
@@ -88,32 +145,63 @@ int forwardIndexTokenFunc(void *ctx, Token t) {
   idx->totalFreq += h->freq;
   idx->uniqueTokens++;
   idx->maxFreq = MAX(h->freq, idx->maxFreq);
-  VVW_Write(h->vw, t.pos);
+
+  // chain the position to the term's positions. They are encoded when the index is iterated
+  if (idx->numPositions == idx->positionsCap) {
+    idx->positionsCap *= 2;
+    idx->positions = rm_realloc(idx->positions, idx->positionsCap * sizeof(ForwardIndexPos));
+  }
+  uint32_t p = idx->numPositions++;
+  idx->positions[p] = (ForwardIndexPos){.pos = t.pos, .next = UINT32_MAX};
+  if (h->lastPos == UINT32_MAX) {
+    h->firstPos = p;
+  } else {
+    idx->positions[h->lastPos].next = p;
+  }
+  h->lastPos = p;
 
   // LG_DEBUG("%d) %s, token freq: %f total freq: %f\n", t.pos, t.s, h->freq, idx->totalFreq);
   return 0;
 }
 
 ForwardIndexIterator ForwardIndex_Iterate(ForwardIndex *i) {
+  // encode all the offset vectors into the shared buffer. We only point the entries at their
+  // vectors when we're done, since the buffer might move as it grows
+  BufferWriter bw = NewBufferWriter(&i->offsets);
+  for (uint32_t e = 0; e < i->numEntries; e++) {
+    ForwardIndexEntry *ent = &i->entries[e];
+    size_t start = Buffer_Offset(&i->offsets);
+    ent->vwState.nmemb = 0;
+    ent->vwState.lastValue = 0;
+    for (uint32_t p = ent->firstPos; p != UINT32_MAX; p = i->positions[p].next) {
+      WriteVarint(i->positions[p].pos - ent->vwState.lastValue, &bw);
+      ent->vwState.lastValue = i->positions[p].pos;
+      ent->vwState.nmemb++;
+    }
+    // stash the vector's start in its buffer until the shared buffer stops moving
+    ent->offsetsBuf.offset = Buffer_Offset(&i->offsets) - start;
+    ent->offsetsBuf.cap = start;
+  }
+
+  for (uint32_t e = 0; e < i->numEntries; e++) {
+    ForwardIndexEntry *ent = &i->entries[e];
+    Buffer *b = &ent->offsetsBuf;
+    b->data = i->offsets.data + b->cap;
+    b->cap = b->offset;
+    ent->vwState.bw = (BufferWriter){.buf = b, .pos = b->data + b->offset};
+    ent->vw = &ent->vwState;
+  }
+
   ForwardIndexIterator iter;
   iter.idx = i;
-  iter.k = kh_begin(i->hits);
+  iter.i = 0;
 
   return iter;
 }
 
 ForwardIndexEntry *ForwardIndexIterator_Next(ForwardIndexIterator *iter) {
-  // advance the iterator while it's empty
-  while (iter->k != kh_end(iter->idx->hits) && !kh_exist(iter->idx->hits, iter->k)) {
-    ++iter->k;
+  if (iter->i < iter->idx->numEntries) {
+    return &iter->idx->entries[iter->i++];
   }
-
-  // if we haven't reached the end, return the current iterator's entry
-  if (iter->k != kh_end(iter->idx->hits) && kh_exist(iter->idx->hits, iter->k)) {
-    ForwardIndexEntry *entry = kh_value(iter->idx->hits, iter->k);
-    ++iter->k;
-    return entry;
-  }
-
   return NULL;
-}
\ No newline at end of file
+}
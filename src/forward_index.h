@@ -1,10 +1,11 @@
 #ifndef __FORWARD_INDEX_H__
 #define __FORWARD_INDEX_H__
 #include "redisearch.h"
-#include "util/khash.h"
+#include "buffer.h"
 #include "varint.h"
 #include "tokenize.h"
 #include "document.h"
+#include "util/arena.h"
 
 typedef struct {
   t_docId docId;
@@ -13,36 +14,84 @@ typedef struct {
   uint32_t freq;
   float docScore;
   t_fieldMask fieldMask;
+  // the term's offset vector, valid once the index is iterated
   VarintVectorWriter *vw;
-  int stringFreeable;
+
+  // internal state used while building the index
+  uint32_t hash;
+  uint32_t bucket;
+  uint32_t firstPos;
+  uint32_t lastPos;
+  VarintVectorWriter vwState;
+  Buffer offsetsBuf;
 } ForwardIndexEntry;
 
-KHASH_MAP_INIT_INT(32, ForwardIndexEntry *)
+/* A link in the chain of positions of a single term in the document */
+typedef struct {
+  uint32_t pos;
+  uint32_t next;
+} ForwardIndexPos;
 
 // the quantizationn factor used to encode normalized (0..1) frquencies in the index
 #define FREQ_QUANTIZE_FACTOR 0xFFFF
 
+/* The forward index of a document - the document's unique terms with their frequencies and
+ * positions.
+ * Entries, positions and the hash table are flat arrays, and term strings are copied into an arena.
+ * All of them keep their memory when the index is reset for the next document, so indexing
+ * documents with a reused forward index does not allocate per token. Resetting only clears the
+ * buckets the last document used, so it costs as much as the last document, not the largest one */
 typedef struct {
-  khash_t(32) * hits;
   t_docId docId;
   uint32_t totalFreq;
   uint32_t maxFreq;
   float docScore;
   int uniqueTokens;
   Stemmer *stemmer;
+
+  ForwardIndexEntry *entries;
+  uint32_t numEntries;
+  uint32_t entriesCap;
+
+  // open addressing hash table of entry index + 1, keyed by the full term. 0 marks an empty bucket
+  uint32_t *buckets;
+  uint32_t numBuckets;
+
+  ForwardIndexPos *positions;
+  uint32_t numPositions;
+  uint32_t positionsCap;
+
+  // the encoded offset vectors of all the entries, back to back
+  Buffer offsets;
+  arena_t *terms;
 } ForwardIndex;
 
 typedef struct {
   ForwardIndex *idx;
-  khiter_t k;
+  uint32_t i;
 } ForwardIndexIterator;
 
 int forwardIndexTokenFunc(void *ctx, Token t);
 
+/* An index that grew past this many entries or positions for a document is not kept for the next
+ * one, so a single huge document doesn't pin its memory */
+#define FWIDX_MAX_KEPT_ENTRIES 4096
+#define FWIDX_MAX_KEPT_POSITIONS 16384
+
 void ForwardIndexFree(ForwardIndex *idx);
 ForwardIndex *NewForwardIndex(Document doc);
+
+/* Clear the index for a new document, keeping all the memory it holds */
+void ForwardIndex_Reset(ForwardIndex *idx, Document doc);
+
+/* Get an index for a new document, resetting idx if it's not NULL. If idx grew past the kept
+ * limits, it's freed and a new index of the default size is returned instead */
+ForwardIndex *ForwardIndex_Reuse(ForwardIndex *idx, Document doc);
+
+/* Iterate the index's entries. This encodes the entries' offset vectors, and must be called after
+ * all the document's tokens were added */
 ForwardIndexIterator ForwardIndex_Iterate(ForwardIndex *i);
 ForwardIndexEntry *ForwardIndexIterator_Next(ForwardIndexIterator *iter);
 void ForwardIndex_NormalizeFreq(ForwardIndex *, ForwardIndexEntry *);
 
-#endif
\ No newline at end of file
+#endif
@@ -3,6 +3,9 @@
 #include "rmutil/util.h"
 #include "rmalloc.h"
 #include "id_list.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
 
 #define GEOINDEX_KEY_FMT "geo:%s/%s"
 
@@ -29,6 +32,59 @@ int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, char *slon, char *slat) {
   return REDISMODULE_OK;
 }
 
+/* Parse a coordinate the way redis does - a number with nothing around it */
+static int parseCoord(const char *s, double min, double max) {
+  char *end;
+  if (!*s || isspace((unsigned char)*s)) {
+    return REDISMODULE_ERR;
+  }
+  double d = strtod(s, &end);
+  if (*end || isnan(d) || d < min || d > max) {
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+int GeoIndex_ValidateStrings(const char *slon, const char *slat) {
+  if (parseCoord(slon, GEO_LON_MIN, GEO_LON_MAX) == REDISMODULE_ERR ||
+      parseCoord(slat, GEO_LAT_MIN, GEO_LAT_MAX) == REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+/* The geo index is a plain redis sorted set with the docIds as members, so we rebuild it from
+ * scratch, keeping the geohash scores as is */
+int GeoIndex_Remap(GeoIndex *gi, const t_docId *idMap, t_docId maxId) {
+  RedisModuleString *ks = fmtGeoIndexKey(gi);
+  RedisModuleCtx *ctx = gi->ctx->redisCtx;
+
+  RedisModuleCallReply *rep = RedisModule_Call(ctx, "ZRANGE", "sccc", ks, "0", "-1", "WITHSCORES");
+  if (rep == NULL || RedisModule_CallReplyType(rep) != REDISMODULE_REPLY_ARRAY) {
+    return REDISMODULE_ERR;
+  }
+  size_t len = RedisModule_CallReplyLength(rep);
+  if (len == 0) {
+    return REDISMODULE_OK;
+  }
+  RedisModule_Call(ctx, "DEL", "s", ks);
+
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    long long docId;
+    RedisModuleString *member =
+        RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(rep, i));
+    if (RedisModule_StringToLongLong(member, &docId) == REDISMODULE_ERR || docId <= 0 ||
+        docId > maxId || idMap[docId] == 0) {
+      continue;
+    }
+    RedisModuleString *score =
+        RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(rep, i + 1));
+    RedisModule_Call(ctx, "ZADD", "sss", ks, score,
+                     RedisModule_CreateStringFromLongLong(ctx, (long long)idMap[docId]));
+  }
+  return REDISMODULE_OK;
+}
+
 /* Parse a geo filter from redis arguments. We assume the filter args start at argv[0], and FILTER
  * is not passed to us.
  * The GEO filter syntax is (FILTER) <property> LONG LAT DIST m|km|ft|mi
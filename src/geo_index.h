@@ -12,8 +12,25 @@ typedef struct geoIndex {
   FieldSpec *sp;
 } GeoIndex;
 
+/* Format the redis key of a geo field's index */
+RedisModuleString *fmtGeoIndexKey(GeoIndex *gi);
+
+/* The coordinates redis geo sets accept - GEOADD fails on anything outside of them */
+#define GEO_LON_MIN -180.0
+#define GEO_LON_MAX 180.0
+#define GEO_LAT_MIN -85.05112878
+#define GEO_LAT_MAX 85.05112878
+
 int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, char *slon, char *slat);
 
+/* Check that slon and slat are coordinates GEOADD accepts - plain numbers within the geo limits.
+ * Returns REDISMODULE_OK or ERR */
+int GeoIndex_ValidateStrings(const char *slon, const char *slat);
+
+/* Rewrite the docIds in the geo index after a DocTable compaction. idMap maps each docId up to
+ * maxId to its new docId, or to 0 if the document was deleted. Returns REDISMODULE_OK or ERR */
+int GeoIndex_Remap(GeoIndex *gi, const t_docId *idMap, t_docId maxId);
+
 typedef struct geoFilter {
 
   const char *property;
@@ -0,0 +1,416 @@
+#include "index_gc.h"
+#include "inverted_index.h"
+#include "varint.h"
+#include "rmalloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define GC_ARENA_BLOCK_SIZE (64 * 1024)
+#define GC_INITIAL_SCRATCH 256
+// the arena is not compacted before it has at least this much garbage
+#define GC_MIN_COMPACT_BYTES (4 * GC_ARENA_BLOCK_SIZE)
+
+IndexGC *NewIndexGC() {
+  IndexGC *gc = rm_calloc(1, sizeof(IndexGC));
+  gc->arena = arena_new(GC_ARENA_BLOCK_SIZE);
+  gc->scratchCap = GC_INITIAL_SCRATCH;
+  gc->scratch = rm_malloc(gc->scratchCap * sizeof(uint64_t));
+  Buffer_Init(&gc->enc, GC_INITIAL_SCRATCH);
+  return gc;
+}
+
+void IndexGC_Free(IndexGC *gc) {
+  rm_free(gc->docTerms);
+  arena_destroy(gc->arena);
+  rm_free(gc->dirtyTerms);
+  rm_free(gc->scratch);
+  Buffer_Free(&gc->enc);
+  rm_free(gc);
+}
+
+static void IndexGC_GrowScratch(IndexGC *gc, uint32_t cap) {
+  if (cap > gc->scratchCap) {
+    gc->scratchCap = MAX(cap, gc->scratchCap * 2);
+    gc->scratch = rm_realloc(gc->scratch, gc->scratchCap * sizeof(uint64_t));
+  }
+}
+
+void IndexGC_AddDocTerm(IndexGC *gc, uint32_t dict, uint32_t termId) {
+  IndexGC_GrowScratch(gc, gc->numScratch + 1);
+  gc->scratch[gc->numScratch++] = GC_TERM_KEY(dict, termId);
+}
+
+static int cmpTermKeys(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+#define LIST_HEADER_SIZE (2 * sizeof(uint32_t))
+
+/* The length of the term dictionary part of a term list */
+static inline uint32_t listMainLen(const char *list) {
+  uint32_t len;
+  memcpy(&len, list, sizeof(uint32_t));
+  return len;
+}
+
+/* The length of the field dictionaries part of a term list */
+static inline uint32_t listFieldsLen(const char *list) {
+  uint32_t len;
+  memcpy(&len, list + sizeof(uint32_t), sizeof(uint32_t));
+  return len;
+}
+
+/* The arena bytes taken by a term list */
+static size_t listSize(const char *list) {
+  return LIST_HEADER_SIZE + listMainLen(list) + listFieldsLen(list);
+}
+
+/* Set the term list of a docId, growing the table if needed */
+static void IndexGC_SetDocTerms(IndexGC *gc, t_docId docId, char *list) {
+  if (docId >= gc->docTermsCap) {
+    size_t cap = MAX(docId + 1, gc->docTermsCap * 2);
+    gc->docTerms = rm_realloc(gc->docTerms, cap * sizeof(char *));
+    memset(gc->docTerms + gc->docTermsCap, 0, (cap - gc->docTermsCap) * sizeof(char *));
+    gc->docTermsCap = cap;
+  }
+  if (gc->docTerms[docId]) {
+    gc->deadBytes += listSize(gc->docTerms[docId]);
+  }
+  gc->docTerms[docId] = list;
+}
+
+/* Copy the lists still referenced to a new arena, and release the old one */
+static void IndexGC_Compact(IndexGC *gc) {
+  arena_t *old = gc->arena;
+  gc->arena = arena_new(GC_ARENA_BLOCK_SIZE);
+  for (size_t id = 0; id < gc->docTermsCap; id++) {
+    char *list = gc->docTerms[id];
+    if (list) {
+      size_t size = listSize(list);
+      gc->docTerms[id] = memcpy(arena_alloc(gc->arena, size), list, size);
+    }
+  }
+  arena_destroy(old);
+  gc->deadBytes = 0;
+}
+
+/* Copy the two encoded parts of a term list into the arena, after their lengths */
+static char *IndexGC_CopyList(IndexGC *gc, const char *main, uint32_t mainLen, const char *fields,
+                              uint32_t fieldsLen) {
+  char *list = arena_alloc(gc->arena, LIST_HEADER_SIZE + mainLen + fieldsLen);
+  memcpy(list, &mainLen, sizeof(uint32_t));
+  memcpy(list + sizeof(uint32_t), &fieldsLen, sizeof(uint32_t));
+  memcpy(list + LIST_HEADER_SIZE, main, mainLen);
+  memcpy(list + LIST_HEADER_SIZE + mainLen, fields, fieldsLen);
+  return list;
+}
+
+/* Set one part of the term list of a docId, keeping the other part if it has a list */
+static void IndexGC_SetListPart(IndexGC *gc, t_docId docId, const char *data, uint32_t len,
+                                int fields) {
+  const char *old = docId < gc->docTermsCap ? gc->docTerms[docId] : NULL;
+  uint32_t mainLen = old ? listMainLen(old) : 0;
+  uint32_t fieldsLen = old ? listFieldsLen(old) : 0;
+  const char *main = old ? old + LIST_HEADER_SIZE : "";
+  char *list = fields ? IndexGC_CopyList(gc, main, mainLen, data, len)
+                      : IndexGC_CopyList(gc, data, len, main + mainLen, fieldsLen);
+  IndexGC_SetDocTerms(gc, docId, list);
+}
+
+void IndexGC_EndDoc(IndexGC *gc, t_docId docId) {
+  qsort(gc->scratch, gc->numScratch, sizeof(uint64_t), cmpTermKeys);
+
+  // the terms of the term dictionary come first, as deltas of their ids
+  gc->enc.offset = 0;
+  BufferWriter bw = NewBufferWriter(&gc->enc);
+  uint32_t i = 0, last = 0;
+  for (; i < gc->numScratch && (gc->scratch[i] >> 32) == 0; i++) {
+    WriteVarint((uint32_t)gc->scratch[i] - last, &bw);
+    last = (uint32_t)gc->scratch[i];
+  }
+  size_t mainLen = gc->enc.offset;
+
+  // then the terms of each field dictionary: its number, the number of its terms and their deltas
+  while (i < gc->numScratch) {
+    uint32_t dict = gc->scratch[i] >> 32, end = i;
+    while (end < gc->numScratch && (gc->scratch[end] >> 32) == dict) {
+      end++;
+    }
+    WriteVarint(dict, &bw);
+    WriteVarint(end - i, &bw);
+    for (last = 0; i < end; i++) {
+      WriteVarint((uint32_t)gc->scratch[i] - last, &bw);
+      last = (uint32_t)gc->scratch[i];
+    }
+  }
+  gc->numScratch = 0;
+
+  IndexGC_SetDocTerms(gc, docId,
+                      IndexGC_CopyList(gc, gc->enc.data, mainLen, gc->enc.data + mainLen,
+                                       gc->enc.offset - mainLen));
+}
+
+/* Decode a term list into the scratch space as term keys. Returns the number of terms */
+static uint32_t IndexGC_DecodeList(IndexGC *gc, const char *list) {
+  uint32_t mainLen = listMainLen(list), len = mainLen + listFieldsLen(list);
+  // every term takes at least one byte
+  IndexGC_GrowScratch(gc, len);
+
+  Buffer b = {.data = (char *)list + LIST_HEADER_SIZE, .cap = len, .offset = len};
+  BufferReader br = NewBufferReader(&b);
+  uint32_t n = 0, last = 0;
+  while (br.pos < mainLen) {
+    last += (uint32_t)ReadVarint(&br);
+    gc->scratch[n++] = GC_TERM_KEY(0, last);
+  }
+  while (br.pos < len) {
+    uint32_t dict = ReadVarint(&br);
+    uint32_t count = ReadVarint(&br);
+    last = 0;
+    // restored lists may be malformed, so don't trust the count
+    for (uint32_t i = 0; i < count && br.pos < len && n < gc->scratchCap; i++) {
+      last += (uint32_t)ReadVarint(&br);
+      gc->scratch[n++] = GC_TERM_KEY(dict, last);
+    }
+  }
+  return n;
+}
+
+/* The dictionary entry of a term key, or NULL if its dictionary doesn't have it */
+static TermDictEntry *termKeyEntry(TermDict **dicts, uint32_t numDicts, uint64_t key) {
+  uint32_t dict = key >> 32, termId = (uint32_t)key;
+  if (dict >= numDicts || dicts[dict] == NULL || termId >= dicts[dict]->numEntries) {
+    return NULL;
+  }
+  return &dicts[dict]->entries[termId];
+}
+
+void IndexGC_AddDirty(IndexGC *gc, uint32_t dict, uint32_t termId) {
+  if (gc->numDirty == gc->dirtyCap) {
+    gc->dirtyCap = gc->dirtyCap ? gc->dirtyCap * 2 : 16;
+    gc->dirtyTerms = rm_realloc(gc->dirtyTerms, gc->dirtyCap * sizeof(uint64_t));
+  }
+  gc->dirtyTerms[gc->numDirty++] = GC_TERM_KEY(dict, termId);
+}
+
+void IndexGC_FindDirty(IndexGC *gc, TermDict **dicts, uint32_t numDicts) {
+  gc->numDirty = 0;
+  for (uint32_t d = 0; d < numDicts; d++) {
+    for (uint32_t i = 0; dicts[d] && i < dicts[d]->numEntries; i++) {
+      if (dicts[d]->entries[i].idx->numDeleted) {
+        IndexGC_AddDirty(gc, d, i);
+      }
+    }
+  }
+}
+
+size_t IndexGC_MarkDeleted(IndexGC *gc, TermDict **dicts, uint32_t numDicts, t_docId docId) {
+  if (docId >= gc->docTermsCap || gc->docTerms[docId] == NULL) {
+    return 0;
+  }
+  const char *list = gc->docTerms[docId];
+  uint32_t n = IndexGC_DecodeList(gc, list);
+
+  size_t marked = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    TermDictEntry *e = termKeyEntry(dicts, numDicts, gc->scratch[i]);
+    if (e == NULL) continue;
+    InvertedIndex *idx = e->idx;
+    IndexBlock *blk = &idx->blocks[InvertedIndex_FindBlock(idx, docId)];
+    if (blk->numDeleted >= blk->numDocs) continue;
+    blk->numDeleted++;
+    if (idx->numDeleted++ == 0) {
+      IndexGC_AddDirty(gc, gc->scratch[i] >> 32, (uint32_t)gc->scratch[i]);
+    }
+    marked++;
+  }
+
+  // the document's records are accounted for, it won't be deleted again
+  gc->docTerms[docId] = NULL;
+  gc->deadBytes += listSize(list);
+  if (gc->deadBytes >= GC_MIN_COMPACT_BYTES && gc->deadBytes * 2 > arena_memusage(gc->arena)) {
+    IndexGC_Compact(gc);
+  }
+  return marked;
+}
+
+/* The number of blocks repaired at most in one call, regardless of maxBlocks */
+#define GC_MAX_REPAIR_BLOCKS 64
+
+TermDictEntry *IndexGC_NextDirty(IndexGC *gc, TermDict **dicts, uint32_t numDicts, uint32_t *dict) {
+  // find the dirtiest term, dropping terms that were repaired from the list
+  TermDictEntry *best = NULL;
+  uint32_t i = 0;
+  while (i < gc->numDirty) {
+    TermDictEntry *e = termKeyEntry(dicts, numDicts, gc->dirtyTerms[i]);
+    if (e == NULL || e->idx->numDeleted == 0) {
+      gc->dirtyTerms[i] = gc->dirtyTerms[--gc->numDirty];
+      continue;
+    }
+    if (!best || e->idx->numDeleted > best->idx->numDeleted) {
+      best = e;
+      if (dict) *dict = gc->dirtyTerms[i] >> 32;
+    }
+    i++;
+  }
+  return best;
+}
+
+size_t IndexGC_RepairTerm(InvertedIndex *idx, DocTable *dt, int maxBlocks) {
+  // select its dirtiest blocks, keeping them sorted by their deleted records in descending order
+  uint32_t top[GC_MAX_REPAIR_BLOCKS];
+  int ntop = 0;
+  maxBlocks = MIN(MAX(maxBlocks, 1), GC_MAX_REPAIR_BLOCKS);
+  for (uint32_t b = 0; b < idx->size; b++) {
+    uint16_t nd = idx->blocks[b].numDeleted;
+    if (nd == 0 || (ntop == maxBlocks && nd <= idx->blocks[top[ntop - 1]].numDeleted)) {
+      continue;
+    }
+    int j = ntop < maxBlocks ? ntop++ : ntop - 1;
+    while (j > 0 && idx->blocks[top[j - 1]].numDeleted < nd) {
+      top[j] = top[j - 1];
+      j--;
+    }
+    top[j] = b;
+  }
+
+  if (ntop == 0) {
+    // the counters are off - the deleted records were removed some other way
+    idx->numDeleted = 0;
+  }
+  size_t removed = 0;
+  for (int j = 0; j < ntop; j++) {
+    removed += InvertedIndex_RepairBlock(idx, dt, top[j]);
+  }
+  return removed;
+}
+
+TermDictEntry *IndexGC_RepairNext(IndexGC *gc, TermDict **dicts, uint32_t numDicts, DocTable *dt,
+                                  int maxBlocks, IndexGCRepair *rep) {
+  *rep = (IndexGCRepair){0};
+  TermDictEntry *te = IndexGC_NextDirty(gc, dicts, numDicts, &rep->dict);
+  if (te) {
+    InvertedIndex_MemStats(te->idx, &rep->size, &rep->cap);
+    rep->removed = IndexGC_RepairTerm(te->idx, dt, maxBlocks);
+  }
+  return te;
+}
+
+void IndexGC_Remap(IndexGC *gc, const t_docId *idMap, t_docId maxId) {
+  for (t_docId id = 1; id <= maxId && id < gc->docTermsCap; id++) {
+    char *list = gc->docTerms[id];
+    gc->docTerms[id] = NULL;
+    // ids are only ever moved down, so a moved list is never overwritten before it's read
+    if (list && idMap[id]) {
+      gc->docTerms[idMap[id]] = list;
+    }
+  }
+  gc->numDirty = 0;
+  IndexGC_Compact(gc);
+}
+
+IndexGCStats IndexGC_Stats(IndexGC *gc, TermDict **dicts, uint32_t numDicts) {
+  IndexGCStats st = {0, 0};
+  for (uint32_t i = 0; i < gc->numDirty; i++) {
+    TermDictEntry *e = termKeyEntry(dicts, numDicts, gc->dirtyTerms[i]);
+    if (e && e->idx->numDeleted) {
+      st.dirtyTerms++;
+      st.deletedRecords += e->idx->numDeleted;
+    }
+  }
+  return st;
+}
+
+size_t IndexGC_MemUsage(IndexGC *gc) {
+  return sizeof(IndexGC) + gc->docTermsCap * sizeof(char *) + arena_memusage(gc->arena) +
+         gc->dirtyCap * sizeof(uint64_t) + gc->scratchCap * sizeof(uint64_t) + gc->enc.cap;
+}
+
+size_t IndexGC_Dump(IndexGC *gc, t_docId from, t_docId to, int fields, Buffer *buf) {
+  size_t start = buf->offset;
+  BufferWriter bw = NewBufferWriter(buf);
+  t_docId last = 0;
+  for (t_docId id = from; id <= to && id < gc->docTermsCap; id++) {
+    const char *list = gc->docTerms[id];
+    if (!list || (fields && !listFieldsLen(list))) continue;
+    uint32_t len = fields ? listFieldsLen(list) : listMainLen(list);
+    const char *data = list + LIST_HEADER_SIZE + (fields ? listMainLen(list) : 0);
+    WriteVarint(id - last, &bw);
+    WriteVarint(len, &bw);
+    Buffer_Write(&bw, (char *)data, len);
+    last = id;
+  }
+  return buf->offset - start;
+}
+
+int IndexGC_Restore(IndexGC *gc, const char *data, size_t len, int fields) {
+  Buffer b = {.data = (char *)data, .cap = len, .offset = len};
+  BufferReader br = NewBufferReader(&b);
+  t_docId id = 0;
+  while (br.pos < len) {
+    id += (uint32_t)ReadVarint(&br);
+    uint32_t llen = ReadVarint(&br);
+    if (br.pos + llen > len) {
+      return 0;
+    }
+    IndexGC_SetListPart(gc, id, data + br.pos, llen, fields);
+    br.pos += llen;
+  }
+  return 1;
+}
+
+void IndexGC_RdbSave(RedisModuleIO *rdb, IndexGC *gc) {
+  // trailing documents without terms are not saved
+  size_t n = gc->docTermsCap;
+  while (n > 0 && gc->docTerms[n - 1] == NULL) {
+    n--;
+  }
+  RedisModule_SaveUnsigned(rdb, n);
+  for (size_t i = 0; i < n; i++) {
+    const char *list = gc->docTerms[i];
+    uint32_t len = list ? listMainLen(list) : 0;
+    RedisModule_SaveStringBuffer(rdb, list ? list + LIST_HEADER_SIZE : "", len);
+  }
+
+  // the terms of the field dictionaries follow, only for the documents that have any
+  size_t numFields = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (gc->docTerms[i] && listFieldsLen(gc->docTerms[i])) numFields++;
+  }
+  RedisModule_SaveUnsigned(rdb, numFields);
+  for (size_t i = 0; i < n; i++) {
+    const char *list = gc->docTerms[i];
+    if (!list || !listFieldsLen(list)) continue;
+    RedisModule_SaveUnsigned(rdb, i);
+    RedisModule_SaveStringBuffer(rdb, list + LIST_HEADER_SIZE + listMainLen(list),
+                                 listFieldsLen(list));
+  }
+}
+
+IndexGC *IndexGC_RdbLoad(RedisModuleIO *rdb, int encver) {
+  IndexGC *gc = NewIndexGC();
+  size_t n = RedisModule_LoadUnsigned(rdb);
+  for (size_t i = 0; i < n; i++) {
+    size_t len;
+    char *data = RedisModule_LoadStringBuffer(rdb, &len);
+    if (len) {
+      IndexGC_SetListPart(gc, i, data, len, 0);
+    }
+    rm_free(data);
+  }
+
+  /* Version 14 added the terms of the field dictionaries */
+  if (encver >= 14) {
+    n = RedisModule_LoadUnsigned(rdb);
+    for (size_t i = 0; i < n; i++) {
+      t_docId id = RedisModule_LoadUnsigned(rdb);
+      size_t len;
+      char *data = RedisModule_LoadStringBuffer(rdb, &len);
+      IndexGC_SetListPart(gc, id, data, len, 1);
+      rm_free(data);
+    }
+  }
+  return gc;
+}
@@ -0,0 +1,126 @@
+#ifndef __RS_INDEX_GC_H__
+#define __RS_INDEX_GC_H__
+
+#include <stdint.h>
+#include "redisearch.h"
+#include "buffer.h"
+#include "doc_table.h"
+#include "term_dict.h"
+#include "redismodule.h"
+#include "util/arena.h"
+
+/* Deleting a document only marks it as deleted in the doc table, and its records stay in the
+ * inverted indexes of its terms until they are repaired. The index GC keeps track of where these
+ * records are, so repairs can go straight to the blocks holding the most garbage instead of
+ * sampling terms at random.
+ *
+ * For this the GC keeps the forward terms of every document - the ids of its unique terms in each
+ * of the index's dictionaries, delta encoded and allocated from an arena. The dictionaries are
+ * numbered: 0 is the term dictionary of the index, and i + 1 the dictionary of its i-th field, for
+ * tag fields and text fields with their own postings. When a document is deleted, the block holding
+ * its record in each of its terms is found by docId, and the deleted record counters of the block and
+ * the term's inverted index are incremented. Terms with deleted records are kept in a dirty list.
+ * The term lists of deleted documents are garbage in the arena, and once they take up more than half
+ * of it the live lists are copied to a new arena.
+ *
+ * The GC belongs to an index spec, and is protected by the GIL */
+typedef struct indexGC {
+  // the term list of each docId, or NULL if the document's terms are unknown. A list is the length
+  // of its term dictionary part and of its field dictionaries part, followed by the parts
+  char **docTerms;
+  size_t docTermsCap;
+  arena_t *arena;
+  // the bytes of the arena taken by lists that are no longer referenced
+  size_t deadBytes;
+
+  // the dictionary number and id of the terms that may have deleted records, see GC_TERM_KEY
+  uint64_t *dirtyTerms;
+  uint32_t numDirty;
+  uint32_t dirtyCap;
+
+  // scratch space for the terms of the document being indexed
+  uint64_t *scratch;
+  uint32_t numScratch;
+  uint32_t scratchCap;
+  Buffer enc;
+} IndexGC;
+
+/* A term of dictionary number dict, as kept in the dirty list */
+#define GC_TERM_KEY(dict, termId) (((uint64_t)(dict) << 32) | (uint32_t)(termId))
+
+/* The fragmentation stats of an index */
+typedef struct {
+  size_t dirtyTerms;
+  size_t deletedRecords;
+} IndexGCStats;
+
+IndexGC *NewIndexGC();
+void IndexGC_Free(IndexGC *gc);
+
+/* Record the terms of a newly indexed document: call IndexGC_AddDocTerm with the dictionary number
+ * and id of each of its unique terms, then IndexGC_EndDoc */
+void IndexGC_AddDocTerm(IndexGC *gc, uint32_t dict, uint32_t termId);
+void IndexGC_EndDoc(IndexGC *gc, t_docId docId);
+
+/* Whether the terms of a document are known - it was indexed, and was not deleted since */
+#define IndexGC_HasDoc(gc, docId) ((docId) < (gc)->docTermsCap && (gc)->docTerms[docId] != NULL)
+
+/* Mark the records of a document that is being deleted as garbage in its terms' inverted indexes.
+ * dicts are the index's dictionaries by number, NULL where a number has none. Returns the number of
+ * records marked */
+size_t IndexGC_MarkDeleted(IndexGC *gc, TermDict **dicts, uint32_t numDicts, t_docId docId);
+
+/* Add a term to the dirty list. Called when the term gets its first deleted record */
+void IndexGC_AddDirty(IndexGC *gc, uint32_t dict, uint32_t termId);
+
+/* Rebuild the dirty list from the deleted record counters of the dictionaries */
+void IndexGC_FindDirty(IndexGC *gc, TermDict **dicts, uint32_t numDicts);
+
+/* The entry of the term with the most deleted records, or NULL if no term is known to have any. If
+ * dict is not NULL, it is set to the number of the term's dictionary */
+TermDictEntry *IndexGC_NextDirty(IndexGC *gc, TermDict **dicts, uint32_t numDicts, uint32_t *dict);
+
+/* Repair up to maxBlocks blocks of an inverted index, starting with its dirtiest blocks. Returns the
+ * number of records removed */
+size_t IndexGC_RepairTerm(InvertedIndex *idx, DocTable *dt, int maxBlocks);
+
+/* What IndexGC_RepairNext did to the term it repaired */
+typedef struct {
+  // the number of the term's dictionary
+  uint32_t dict;
+  // the number of records removed
+  size_t removed;
+  // the data size and capacity of the term's inverted index before the repair
+  size_t size;
+  size_t cap;
+} IndexGCRepair;
+
+/* Repair up to maxBlocks blocks of the term with the most deleted records, starting with its
+ * dirtiest blocks. Returns the term's entry, or NULL if no term is known to have deleted records.
+ * What was repaired is set in rep */
+TermDictEntry *IndexGC_RepairNext(IndexGC *gc, TermDict **dicts, uint32_t numDicts, DocTable *dt,
+                                  int maxBlocks, IndexGCRepair *rep);
+
+/* Move the document terms to their new docIds after a DocTable compaction, and forget the dirty
+ * terms - compaction removes the records of all deleted documents. The arena is compacted too */
+void IndexGC_Remap(IndexGC *gc, const t_docId *idMap, t_docId maxId);
+
+IndexGCStats IndexGC_Stats(IndexGC *gc, TermDict **dicts, uint32_t numDicts);
+size_t IndexGC_MemUsage(IndexGC *gc);
+
+/* Serialize the document terms of docIds from to to (inclusive), appending them to buf. The terms
+ * of the term dictionary and the ones of the field dictionaries are serialized apart, by setting
+ * fields. Returns the number of bytes written */
+size_t IndexGC_Dump(IndexGC *gc, t_docId from, t_docId to, int fields, Buffer *buf);
+
+/* Set the document terms serialized by IndexGC_Dump, keeping the other part of their lists. Returns
+ * 0 if the data is malformed */
+int IndexGC_Restore(IndexGC *gc, const char *data, size_t len, int fields);
+
+
+void IndexGC_RdbSave(RedisModuleIO *rdb, IndexGC *gc);
+/* Load the document terms saved with index spec encoding version encver. The dirty list is rebuilt
+ * with IndexGC_FindDirty once the dictionaries are loaded */
+IndexGC *IndexGC_RdbLoad(RedisModuleIO *rdb, int encver);
+
+#endif
@@ -2,6 +2,7 @@
 #include "varint.h"
 #include "rmalloc.h"
 #include <math.h>
+#include <string.h>
 #include <sys/param.h>
 
 /* Allocate a new aggregate result of a given type with a given capacity*/
@@ -109,6 +110,7 @@ void IndexResult_Print(RSIndexResult *r, int depth) {
 RSQueryTerm *NewTerm(RSToken *tok) {
   RSQueryTerm *ret = rm_malloc(sizeof(RSQueryTerm));
   ret->idf = 1;
+  ret->bm25_idf = 0;
   ret->str = tok->str ? rm_strndup(tok->str, tok->len) : NULL;
   ret->len = tok->len;
   ret->flags = tok->flags;
@@ -231,40 +233,82 @@ int IndexResult_MinOffsetDelta(RSIndexResult *r) {
   return dist ? dist : agg->numChildren - 1;
 }
 
-int __indexResult_withinRangeInOrder(RSOffsetIterator *iters, uint32_t *positions, int num,
-                                     int maxSlop) {
+/* The number of offsets decoded on the stack when checking slop. Results with more offsets than
+ * that spill over to the heap */
+#define RS_SLOP_STACK_OFFSETS 1024
+
+/* A flat, decoded list of a result's offsets that the slop checks walk over */
+typedef struct {
+  uint32_t *offsets;
+  size_t len;
+} offsetArray;
+
+/* Advance p until *p >= target, and return it (or end if there is no such offset). We gallop ahead
+ * in doubling steps until we pass the target, and binary search the last step, so skipping far
+ * ahead takes a logarithmic number of comparisons while the next offset is still found right away */
+static inline const uint32_t *offsetArray_skipTo(const uint32_t *p, const uint32_t *end,
+                                                 uint32_t target) {
+  if (p == end || *p >= target) {
+    return p;
+  }
+  size_t step = 1;
+  while (step < (size_t)(end - p) && p[step] < target) {
+    p += step;
+    step <<= 1;
+  }
+  // *p < target, and the first offset >= target is somewhere in (p, hi]
+  const uint32_t *lo = p + 1, *hi = step < (size_t)(end - p) ? p + step : end;
+  while (lo < hi) {
+    const uint32_t *mid = lo + (hi - lo) / 2;
+    if (*mid < target) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Check for an ordered match. For each position of the first term we pick the first position of
+ * every following term that comes after its predecessor, and check the total span between them.
+ * Since all the offsets are sorted, the positions of the following terms never move backwards */
+static int __indexResult_withinRangeInOrder(offsetArray *arrs, int num, int maxSlop) {
+  const uint32_t *cur[num], *end[num];
+  for (int i = 0; i < num; i++) {
+    cur[i] = arrs[i].offsets;
+    end[i] = arrs[i].offsets + arrs[i].len;
+  }
+  uint32_t firstTarget = 0;
+
   while (1) {
+    cur[0] = offsetArray_skipTo(cur[0], end[0], firstTarget);
+    if (cur[0] == end[0]) {
+      return 0;
+    }
+    uint32_t lastPos = *cur[0]++;
+    firstTarget = lastPos + 1;
 
     // we start from the beginning, and a span of 0
     int span = 0;
-    for (int i = 0; i < num; i++) {
-      // take the current position and the position of the previous iterator.
-      // For the first iterator we always advance once
-      uint32_t pos = i ? positions[i] : iters[i].Next(iters[i].ctx);
-      uint32_t lastPos = i ? positions[i - 1] : 0;
-      // printf("Before: i=%d, pos=%d, lastPos %d\n", i, pos, lastPos);
-
-      // read while we are not in order
-      while (pos != RS_OFFSETVECTOR_EOF && pos < lastPos) {
-        pos = iters[i].Next(iters[i].ctx);
-        // printf("Reading: i=%d, pos=%d, lastPos %d\n", i, pos, lastPos);
-      }
-      // printf("i=%d, pos=%d, lastPos %d\n", i, pos, lastPos);
-
+    for (int i = 1; i < num; i++) {
+      cur[i] = offsetArray_skipTo(cur[i], end[i], lastPos);
       // we've read through the entire list and it's not in order relative to the last pos
-      if (pos == RS_OFFSETVECTOR_EOF) {
+      if (cur[i] == end[i]) {
         return 0;
       }
-      positions[i] = pos;
+      uint32_t pos = *cur[i];
 
       // add the diff from the last pos to the total span
-      if (i > 0) {
-        span += ((int)pos - (int)lastPos - 1);
-        // if we are already out of slop - just quit
-        if (span > maxSlop) {
-          break;
+      span += ((int)pos - (int)lastPos - 1);
+      // if we are already out of slop, no position of the first term before pos - i - maxSlop can
+      // make it either, so we skip right to it
+      if (span > maxSlop) {
+        if ((int)pos - i - maxSlop > (int)firstTarget) {
+          firstTarget = pos - i - maxSlop;
         }
+        break;
       }
+      lastPos = pos;
     }
 
     if (span <= maxSlop) {
@@ -275,76 +319,94 @@ int __indexResult_withinRangeInOrder(RSOffsetIterator *iters, uint32_t *position
   return 0;
 }
 
-uint32_t _arrayMin(uint32_t *arr, int len, uint32_t *pos);
-uint32_t _arrayMax(uint32_t *arr, int len, uint32_t *pos);
-
-inline uint32_t _arrayMin(uint32_t *arr, int len, uint32_t *pos) {
-  int m = arr[0];
-  *pos = 0;
-  for (int i = 1; i < len; i++) {
-    if (arr[i] < m) {
-      m = arr[i];
-      *pos = i;
-    }
-  }
-  return m;
-}
-
-inline uint32_t _arrayMax(uint32_t *arr, int len, uint32_t *pos) {
-  int m = arr[0];
-  *pos = 0;
-  for (int i = 1; i < len; i++) {
-    if (arr[i] >= m) {
-      m = arr[i];
-      *pos = i;
-    }
-  }
-  return m;
-}
-
 /* Check the index result for maximal slop, in an unordered fashion.
  * The algorithm is simple - we find the first offsets min and max such that max-min<=maxSlop */
-int __indexResult_withinRangeUnordered(RSOffsetIterator *iters, uint32_t *positions, int num,
-                                       int maxSlop) {
+static int __indexResult_withinRangeUnordered(offsetArray *arrs, int num, int maxSlop) {
+  const uint32_t *cur[num];
+  uint32_t positions[num];
+  uint32_t max = 0;
   for (int i = 0; i < num; i++) {
-    positions[i] = iters[i].Next(iters[i].ctx);
+    if (!arrs[i].len) return 0;
+    cur[i] = arrs[i].offsets;
+    positions[i] = *cur[i];
+    if (positions[i] > max) max = positions[i];
   }
-  uint32_t minPos, maxPos, min, max;
-  // find the max member
-  max = _arrayMax(positions, num, &maxPos);
+  // the widest distance between min and max that still fits in the slop
+  uint32_t window = maxSlop + num - 1;
 
   while (1) {
-
-    // we start from the beginning, and a span of 0
-    min = _arrayMin(positions, num, &minPos);
-    if (min != max) {
-      // calculate max - min
-      int span = (int)max - (int)min - (num - 1);
-      // printf("maxslop %d min %d, max %d, minPos %d, maxPos %d, span %d\n", maxSlop, min, max,
-      //        minPos, maxPos, span);
-      // if it matches the condition - just return success
-      if (span <= maxSlop) {
-        return 1;
+    int minPos = 0;
+    uint32_t min = positions[0];
+    for (int i = 1; i < num; i++) {
+      if (positions[i] < min) {
+        min = positions[i];
+        minPos = i;
       }
     }
 
-    // if we are not meeting the conditions - advance the minimal iterator
-    positions[minPos] = iters[minPos].Next(iters[minPos].ctx);
-    // If the minimal iterator is larger than the max iterator, the minimal iterator is the new
-    // maximal iterator.
-    if (positions[minPos] != RS_OFFSETVECTOR_EOF && positions[minPos] > max) {
-      maxPos = minPos;
-      max = positions[maxPos];
+    // if it matches the condition - just return success
+    if (min != max && max - min <= window) {
+      return 1;
+    }
 
-    } else if (positions[minPos] == RS_OFFSETVECTOR_EOF) {
+    // if we are not meeting the conditions - advance the minimal term. The other terms never move
+    // backwards, so it needs to get at least within the window of the current max to match
+    uint32_t target = max > min + window ? max - window : min + 1;
+    const uint32_t *end = arrs[minPos].offsets + arrs[minPos].len;
+    cur[minPos] = offsetArray_skipTo(cur[minPos], end, target);
+    if (cur[minPos] == end) {
       // this means we've reached the end
-      break;
+      return 0;
+    }
+    positions[minPos] = *cur[minPos];
+    // If the minimal term is now larger than the max, it is the new max
+    if (positions[minPos] > max) {
+      max = positions[minPos];
     }
   }
 
   return 0;
 }
 
+/* Decode all the offsets of a result into a flat array, using buf if it has room for them or a
+ * heap allocated array otherwise. Term offsets are decoded in bulk right from their varint
+ * buffer, aggregates are merged through their offset iterator. Returns 1 if the array was
+ * allocated and needs to be freed */
+static int indexResult_decodeOffsets(RSIndexResult *r, offsetArray *arr, uint32_t *buf,
+                                     size_t bufCap) {
+  if (r->type == RSResultType_Term) {
+    // every offset takes at least one byte, so the encoded length bounds the number of offsets
+    size_t cap = r->term.offsets.len;
+    int allocated = cap > bufCap;
+    arr->offsets = allocated ? rm_malloc(cap * sizeof(uint32_t)) : buf;
+    arr->len = VV_Decode(r->term.offsets.data, r->term.offsets.len, arr->offsets);
+    return allocated;
+  }
+
+  int allocated = 0;
+  size_t cap = bufCap;
+  arr->offsets = buf;
+  arr->len = 0;
+  RSOffsetIterator it = RSIndexResult_IterateOffsets(r);
+  uint32_t pos;
+  while ((pos = it.Next(it.ctx)) != RS_OFFSETVECTOR_EOF) {
+    if (arr->len == cap) {
+      cap = MAX(cap * 2, 16);
+      if (allocated) {
+        arr->offsets = rm_realloc(arr->offsets, cap * sizeof(uint32_t));
+      } else {
+        uint32_t *heap = rm_malloc(cap * sizeof(uint32_t));
+        memcpy(heap, buf, arr->len * sizeof(uint32_t));
+        arr->offsets = heap;
+        allocated = 1;
+      }
+    }
+    arr->offsets[arr->len++] = pos;
+  }
+  it.Free(it.ctx);
+  return allocated;
+}
+
 /** Test the result offset vectors to see if they fall within a max "slop" or distance between the
  * terms. That is the total number of non matched offsets between the terms is no bigger than
  * maxSlop.
@@ -358,28 +420,33 @@ int IndexResult_IsWithinRange(RSIndexResult *ir, int maxSlop, int inOrder) {
   RSAggregateResult *r = &ir->agg;
   int num = r->numChildren;
 
-  // Fill a list of iterators and the last read positions
-  RSOffsetIterator iters[num];
-  uint32_t positions[num];
+  // Decode the offsets of all the children into flat arrays, on the stack as long as they fit
+  uint32_t stackBuf[RS_SLOP_STACK_OFFSETS];
+  size_t used = 0;
+  offsetArray arrs[num];
+  int allocated[num];
   int n = 0;
   for (int i = 0; i < num; i++) {
-    // collect only iterators for nodes that can have offsets
+    // collect only nodes that can have offsets
     if (RSIndexResult_HasOffsets(r->children[i])) {
-      iters[n] = RSIndexResult_IterateOffsets(r->children[i]);
-      positions[n] = 0;
+      allocated[n] = indexResult_decodeOffsets(r->children[i], &arrs[n], stackBuf + used,
+                                               RS_SLOP_STACK_OFFSETS - used);
+      if (!allocated[n]) used += arrs[n].len;
       n++;
     }
   }
 
-  int rc;
-  // cal the relevant algorithm based on ordered/unordered condition
-  if (inOrder)
-    rc = __indexResult_withinRangeInOrder(iters, positions, n, maxSlop);
-  else
-    rc = __indexResult_withinRangeUnordered(iters, positions, n, maxSlop);
-  // printf("slop result for %d: %d\n", ir->docId, rc);
+  int rc = 1;
+  // call the relevant algorithm based on ordered/unordered condition
+  if (n > 1) {
+    if (inOrder)
+      rc = __indexResult_withinRangeInOrder(arrs, n, maxSlop);
+    else
+      rc = __indexResult_withinRangeUnordered(arrs, n, maxSlop);
+  }
+
   for (int i = 0; i < n; i++) {
-    iters[i].Free(iters[i].ctx);
+    if (allocated[i]) rm_free(arrs[i].offsets);
   }
   return rc;
 }
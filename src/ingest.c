@@ -0,0 +1,150 @@
+#include "ingest.h"
+#include "inverted_index.h"
+#include "term_dict.h"
+#include "rmalloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define INGEST_INITIAL_RECORDS 256
+
+static struct {
+  size_t maxDocs;
+  long long maxLatencyNS;
+} __ingestLimits = {INGEST_DEFAULT_GROUP_SIZE, INGEST_DEFAULT_GROUP_LATENCY_MS * 1000000LL};
+
+void IngestGroup_SetLimits(size_t maxDocs, long long maxLatencyMS) {
+  __ingestLimits.maxDocs = MAX(maxDocs, 1);
+  __ingestLimits.maxLatencyNS = maxLatencyMS * 1000000LL;
+}
+
+IngestGroup *NewIngestGroup() {
+  IngestGroup *g = rm_calloc(1, sizeof(IngestGroup));
+  g->recordsCap = INGEST_INITIAL_RECORDS;
+  g->records = rm_malloc(g->recordsCap * sizeof(IngestRecord));
+  g->sorted = rm_malloc(g->recordsCap * sizeof(IngestRecord));
+  Buffer_Init(&g->offsets, INGEST_INITIAL_RECORDS);
+  return g;
+}
+
+void IngestGroup_Free(IngestGroup *g) {
+  rm_free(g->records);
+  rm_free(g->sorted);
+  Buffer_Free(&g->offsets);
+  rm_free(g);
+}
+
+void IngestGroup_AddRecord(IngestGroup *g, uint32_t termId, ForwardIndexEntry *ent) {
+  if (g->numRecords == g->recordsCap) {
+    g->recordsCap *= 2;
+    g->records = rm_realloc(g->records, g->recordsCap * sizeof(IngestRecord));
+    g->sorted = rm_realloc(g->sorted, g->recordsCap * sizeof(IngestRecord));
+  }
+  IngestRecord *rec = &g->records[g->numRecords++];
+  rec->termId = termId;
+  rec->freq = ent->freq;
+  rec->docId = ent->docId;
+  rec->fieldMask = ent->fieldMask;
+  rec->offsetsPos = g->offsets.offset;
+  rec->offsetsLen = ent->vw->bw.buf->offset;
+  rec->numOffsets = ent->vw->nmemb;
+
+  BufferWriter bw = NewBufferWriter(&g->offsets);
+  Buffer_Write(&bw, ent->vw->bw.buf->data, rec->offsetsLen);
+}
+
+int IngestGroup_EndDoc(IngestGroup *g, t_docId docId) {
+  if (g->numDocs++ == 0) {
+    g->firstId = docId;
+    clock_gettime(CLOCK_MONOTONIC, &g->firstAdded);
+  }
+  if (g->numDocs >= __ingestLimits.maxDocs) {
+    return 1;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long waitedNS = 1000000000LL * (now.tv_sec - g->firstAdded.tv_sec) +
+                       (now.tv_nsec - g->firstAdded.tv_nsec);
+  return waitedNS >= __ingestLimits.maxLatencyNS;
+}
+
+/* Sort the records by term with an LSD radix sort on the term ids, a byte at a time. The records of
+ * every document are added after the ones of the previous document and the sort is stable, so the
+ * records of each term stay sorted by docId */
+static void IngestGroup_Sort(IngestGroup *g) {
+  uint32_t maxTerm = 0;
+  for (size_t i = 0; i < g->numRecords; i++) {
+    maxTerm = MAX(maxTerm, g->records[i].termId);
+  }
+
+  IngestRecord *src = g->records, *dst = g->sorted;
+  for (int shift = 0; shift < 32 && (maxTerm >> shift); shift += 8) {
+    size_t pos[256] = {0};
+    for (size_t i = 0; i < g->numRecords; i++) {
+      pos[(src[i].termId >> shift) & 0xff]++;
+    }
+    size_t total = 0;
+    for (int b = 0; b < 256; b++) {
+      size_t n = pos[b];
+      pos[b] = total;
+      total += n;
+    }
+    for (size_t i = 0; i < g->numRecords; i++) {
+      dst[pos[(src[i].termId >> shift) & 0xff]++] = src[i];
+    }
+    IngestRecord *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+  g->records = src;
+  g->sorted = dst;
+}
+
+size_t IngestGroup_Commit(IngestGroup *g, IndexSpec *sp) {
+  if (g->numDocs == 0) {
+    return 0;
+  }
+  IngestGroup_Sort(g);
+
+  TermDict *td = sp->termDict;
+  IndexStats *st = &sp->stats;
+  size_t i = 0;
+  while (i < g->numRecords) {
+    InvertedIndex *idx = td->entries[g->records[i].termId].idx;
+
+    // the records go to the last block, and to new ones after it - the full blocks are sealed
+    uint32_t lastBlock = idx->size ? idx->size - 1 : 0;
+    size_t cap = idx->size ? idx->blocks[lastBlock].data->cap : 0;
+
+    uint32_t termId = g->records[i].termId;
+    for (; i < g->numRecords && g->records[i].termId == termId; i++) {
+      IngestRecord *rec = &g->records[i];
+      RSOffsetVector offsets = {g->offsets.data + rec->offsetsPos, rec->offsetsLen};
+      st->invertedSize += InvertedIndex_WriteRecord(idx, rec->docId, rec->fieldMask, rec->freq,
+                                                    &offsets);
+      st->numRecords++;
+      if (sp->flags & Index_StoreTermOffsets) {
+        st->offsetVecsSize += rec->offsetsLen;
+        st->offsetVecRecords += rec->numOffsets;
+      }
+    }
+
+    size_t newCap = 0;
+    for (uint32_t b = lastBlock; b < idx->size; b++) {
+      newCap += idx->blocks[b].data->cap;
+    }
+    st->invertedCap = st->invertedCap + newCap - cap;
+  }
+
+  size_t n = g->numDocs;
+  g->numRecords = 0;
+  g->numDocs = 0;
+  g->firstId = 0;
+  g->offsets.offset = 0;
+  return n;
+}
+
+size_t IngestGroup_MemUsage(IngestGroup *g) {
+  return sizeof(IngestGroup) + 2 * g->recordsCap * sizeof(IngestRecord) + g->offsets.cap;
+}
@@ -0,0 +1,78 @@
+#ifndef __RS_INGEST_H__
+#define __RS_INGEST_H__
+
+#include <stdint.h>
+#include <time.h>
+#include "redisearch.h"
+#include "buffer.h"
+#include "forward_index.h"
+#include "spec.h"
+
+/* Added documents are not written to the inverted indexes of their terms one at a time. Their
+ * records are appended to the ingestion group of the index, and the group is committed once it
+ * holds enough documents, once its oldest document waited long enough, or before anything reads the
+ * index - every command that loads the index, other than the ones adding documents, commits it.
+ *
+ * Committing radix sorts the records of the group by term, so each inverted index is opened and
+ * written once per group, with all its new records back to back, instead of once per document.
+ * Document ids are assigned in order when documents are added and the sort is stable, so the records
+ * of every term are still written in increasing docId order.
+ *
+ * Numeric, geo and sortable values are not grouped, they are indexed right away. The group belongs
+ * to an index spec, and is protected by the GIL */
+
+/* The default limits of a group, set with the INGEST_GROUP_SIZE and INGEST_GROUP_LATENCY module
+ * arguments. A group of 1 document commits every document as it's added, which is the default -
+ * bigger groups index faster, but the command that commits a group pays for all of it */
+#define INGEST_DEFAULT_GROUP_SIZE 1
+#define INGEST_DEFAULT_GROUP_LATENCY_MS 10
+
+/* A pending record of a term in a document */
+typedef struct {
+  uint32_t termId;
+  uint32_t freq;
+  t_docId docId;
+  t_fieldMask fieldMask;
+  // the encoded offset vector of the record, in the group's offsets buffer
+  size_t offsetsPos;
+  uint32_t offsetsLen;
+  uint32_t numOffsets;
+} IngestRecord;
+
+typedef struct ingestGroup {
+  IngestRecord *records;
+  size_t numRecords;
+  size_t recordsCap;
+  // scratch space for sorting the records
+  IngestRecord *sorted;
+  Buffer offsets;
+
+  size_t numDocs;
+  // the first docId in the group
+  t_docId firstId;
+  // when the first document of the group was added
+  struct timespec firstAdded;
+} IngestGroup;
+
+/* Set the limits of all the groups: the number of documents a group is committed at, and the time
+ * in milliseconds its first document waits at most. The wait is only checked as documents are
+ * added, an idle group is committed by the next read */
+void IngestGroup_SetLimits(size_t maxDocs, long long maxLatencyMS);
+
+IngestGroup *NewIngestGroup();
+void IngestGroup_Free(IngestGroup *g);
+
+/* Add the record of a forward index entry of the document being added, with the dictionary id of
+ * its term */
+void IngestGroup_AddRecord(IngestGroup *g, uint32_t termId, ForwardIndexEntry *ent);
+
+/* End the document being added. Returns 1 if the group is due to be committed */
+int IngestGroup_EndDoc(IngestGroup *g, t_docId docId);
+
+/* Write all the pending records to the inverted indexes of their terms in the spec's dictionary,
+ * updating the spec's stats, and empty the group. Returns the number of documents committed */
+size_t IngestGroup_Commit(IngestGroup *g, IndexSpec *sp);
+
+size_t IngestGroup_MemUsage(IngestGroup *g);
+
+#endif
@@ -2,11 +2,13 @@
 #include "math.h"
 #include "varint.h"
 #include <stdio.h>
+#include <sys/param.h>
 #include "rmalloc.h"
 #include "qint.h"
 
 #define INDEX_BLOCK_SIZE 100
-#define INDEX_BLOCK_INITIAL_CAP 2
+// the smallest size class, anything smaller would take as much memory anyway
+#define INDEX_BLOCK_INITIAL_CAP 8
 
 #define INDEX_LAST_BLOCK(idx) (idx->blocks[idx->size - 1])
 #define IR_CURRENT_BLOCK(ir) (ir->idx->blocks[ir->currentBlock])
@@ -21,7 +23,8 @@ void InvertedIndex_AddBlock(InvertedIndex *idx, t_docId firstId) {
 
   idx->size++;
   idx->blocks = rm_realloc(idx->blocks, idx->size * sizeof(IndexBlock));
-  idx->blocks[idx->size - 1] = (IndexBlock){.firstId = firstId, .lastId = 0, .numDocs = 0};
+  idx->blocks[idx->size - 1] =
+      (IndexBlock){.firstId = firstId, .lastId = 0, .numDocs = 0, .numDeleted = 0};
   INDEX_LAST_BLOCK(idx).data = NewBuffer(INDEX_BLOCK_INITIAL_CAP);
 }
 
@@ -32,6 +35,7 @@ InvertedIndex *NewInvertedIndex(IndexFlags flags, int initBlock) {
   idx->lastId = 0;
   idx->flags = flags;
   idx->numDocs = 0;
+  idx->numDeleted = 0;
   if (initBlock) {
     InvertedIndex_AddBlock(idx, 0);
   }
@@ -55,7 +59,7 @@ void InvertedIndex_Free(void *ctx) {
 size_t writeEntry(BufferWriter *bw, IndexFlags idxflags, t_docId docId, t_fieldMask fieldMask,
                   uint32_t freq, uint32_t offsetsSz, RSOffsetVector *offsets) {
   size_t sz = 0;
-  switch (idxflags & (Index_StoreFieldFlags | Index_StoreTermOffsets)) {
+  switch (idxflags & INDEX_STORAGE_MASK) {
     // Full encoding - docId, freq, flags, offset
     case Index_StoreTermOffsets | Index_StoreFieldFlags:
       sz = qint_encode4(bw, docId, (uint32_t)freq, (uint32_t)fieldMask, (uint32_t)offsetsSz);
@@ -72,6 +76,29 @@ size_t writeEntry(BufferWriter *bw, IndexFlags idxflags, t_docId docId, t_fieldM
     case Index_StoreFieldFlags:
       sz = qint_encode3(bw, docId, (uint32_t)freq, (uint32_t)fieldMask);
       break;
+
+    // Wide field masks don't fit in the qint, so they follow it as varints
+    case Index_StoreTermOffsets | Index_StoreFieldFlags | Index_WideSchema:
+      sz = qint_encode3(bw, docId, (uint32_t)freq, (uint32_t)offsetsSz);
+      sz += WriteVarintFieldMask(fieldMask, bw);
+      sz += Buffer_Write(bw, offsets->data, offsetsSz);
+      break;
+
+    case Index_StoreFieldFlags | Index_WideSchema:
+      sz = qint_encode2(bw, docId, (uint32_t)freq);
+      sz += WriteVarintFieldMask(fieldMask, bw);
+      break;
+
+    // Without field flags the mask isn't stored, wide or not
+    case Index_StoreTermOffsets | Index_WideSchema:
+      sz = qint_encode3(bw, docId, (uint32_t)freq, (uint32_t)offsetsSz);
+      sz += Buffer_Write(bw, offsets->data, offsetsSz);
+      break;
+
+    // Store just the docId delta, without the frequency
+    case Index_DocIdsOnly:
+      sz = WriteVarint(docId, bw);
+      break;
     // Store neither -we store just freq and docId
     default:
       sz = qint_encode2(bw, docId, (uint32_t)freq);
@@ -84,36 +111,65 @@ size_t writeEntry(BufferWriter *bw, IndexFlags idxflags, t_docId docId, t_fieldM
 /* Write a forward-index entry to an index writer */
 size_t InvertedIndex_WriteEntry(InvertedIndex *idx,
                                 ForwardIndexEntry *ent) {  // VVW_Truncate(ent->vw);
+  RSOffsetVector offsets = (RSOffsetVector){ent->vw->bw.buf->data, ent->vw->bw.buf->offset};
+  return InvertedIndex_WriteRecord(idx, ent->docId, ent->fieldMask, ent->freq, &offsets);
+}
 
-  // printf("writing %s docId %d, lastDocId %d\n", ent->term, ent->docId, idx->lastId);
+size_t InvertedIndex_WriteRecord(InvertedIndex *idx, t_docId docId, t_fieldMask fieldMask,
+                                 uint32_t freq, RSOffsetVector *offsets) {
   IndexBlock *blk = &INDEX_LAST_BLOCK(idx);
 
   // see if we need to grow the current block
   if (blk->numDocs >= INDEX_BLOCK_SIZE) {
-    InvertedIndex_AddBlock(idx, ent->docId);
+    InvertedIndex_AddBlock(idx, docId);
     blk = &INDEX_LAST_BLOCK(idx);
   }
   // // this is needed on the first block
   if (blk->firstId == 0) {
-    blk->firstId = ent->docId;
+    blk->firstId = docId;
   }
   size_t ret = 0;
 
-  RSOffsetVector offsets = (RSOffsetVector){ent->vw->bw.buf->data, ent->vw->bw.buf->offset};
-
   BufferWriter bw = NewBufferWriter(blk->data);
 
-  ret = writeEntry(&bw, idx->flags, ent->docId - blk->lastId, ent->fieldMask, ent->freq,
-                   offsets.len, &offsets);
+  ret = writeEntry(&bw, idx->flags, docId - blk->lastId, fieldMask, freq, offsets->len, offsets);
 
-  idx->lastId = ent->docId;
-  blk->lastId = ent->docId;
+  idx->lastId = docId;
+  blk->lastId = docId;
   ++blk->numDocs;
   ++idx->numDocs;
 
+  // a full block is never written again unless it's repaired, so give back its slack now
+  if (blk->numDocs == INDEX_BLOCK_SIZE) {
+    IndexBlock_Seal(blk);
+  }
+
   return ret;
 }
 
+void IndexBlock_Seal(IndexBlock *blk) {
+  if (blk->data->cap > blk->data->offset && blk->data->offset > 0) {
+    Buffer_Truncate(blk->data, 0);
+  }
+}
+
+size_t InvertedIndex_Seal(InvertedIndex *idx) {
+  size_t freed = 0;
+  for (uint32_t i = 0; i < idx->size; i++) {
+    size_t cap = idx->blocks[i].data->cap;
+    IndexBlock_Seal(&idx->blocks[i]);
+    freed += cap - idx->blocks[i].data->cap;
+  }
+  return freed;
+}
+
+void InvertedIndex_MemStats(InvertedIndex *idx, size_t *size, size_t *cap) {
+  for (uint32_t i = 0; i < idx->size; i++) {
+    *size += idx->blocks[i].data->offset;
+    *cap += idx->blocks[i].data->cap;
+  }
+}
+
 inline int IR_HasNext(void *ctx) {
   IndexReader *ir = ctx;
   return !ir->atEnd;
@@ -121,6 +177,7 @@ inline int IR_HasNext(void *ctx) {
 
 void indexReader_advanceBlock(IndexReader *ir) {
   ir->currentBlock++;
+  ir->numBlocks++;
   ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
   ir->lastId = 0;  // IR_CURRENT_BLOCK(ir).firstId;
 }
@@ -130,33 +187,58 @@ inline size_t readEntry(BufferReader *__restrict__ br, IndexFlags idxflags, RSIn
 
   size_t startPos = BufferReader_Offset(br);
 
+  uint32_t mask;
   switch ((uint32_t)idxflags) {
     // Full encoding - load docId, freq, flags, offset
     case Index_StoreTermOffsets | Index_StoreFieldFlags:
-
-      // size_t sz =
-      //     streamvbyte_decode((const uint8_t *)BufferReader_Current(br), arr, 4);
-      qint_decode(br, (uint32_t *)res, 4);
+      qint_decode4(br, &res->docId, &res->freq, &mask, &res->offsetsSz);
+      res->fieldMask = mask;
       res->term.offsets = (RSOffsetVector){.data = BufferReader_Current(br), .len = res->offsetsSz};
       Buffer_Skip(br, res->offsetsSz);
-
       break;
 
     // load term offsets but not field flags
     case Index_StoreTermOffsets:
+    case Index_StoreTermOffsets | Index_WideSchema:
       qint_decode3(br, &res->docId, &res->freq, &res->offsetsSz);
+      res->fieldMask = RS_FIELDMASK_ALL;
       res->term.offsets = (RSOffsetVector){.data = BufferReader_Current(br), .len = res->offsetsSz};
       Buffer_Skip(br, res->offsetsSz);
       break;
 
     // Load field mask but not term offsets
     case Index_StoreFieldFlags:
-      qint_decode(br, (uint32_t *)res, 3);
+      qint_decode3(br, &res->docId, &res->freq, &mask);
+      res->fieldMask = mask;
+      break;
+
+    // Load the wide field mask after the qint
+    case Index_StoreTermOffsets | Index_StoreFieldFlags | Index_WideSchema:
+      qint_decode3(br, &res->docId, &res->freq, &res->offsetsSz);
+      res->fieldMask = ReadVarintFieldMask(br);
+      res->term.offsets = (RSOffsetVector){.data = BufferReader_Current(br), .len = res->offsetsSz};
+      Buffer_Skip(br, res->offsetsSz);
+      break;
+
+    case Index_StoreFieldFlags | Index_WideSchema:
+      qint_decode2(br, &res->docId, &res->freq);
+      res->fieldMask = ReadVarintFieldMask(br);
       break;
 
-    // Load neither -we load just freq and docId
+    // Load the docId alone. Every document in the index matches it once, in all fields
+    case Index_DocIdsOnly:
+      res->docId = ReadVarint(br);
+      res->freq = 1;
+      res->fieldMask = RS_FIELDMASK_ALL;
+      res->offsetsSz = 0;
+      res->term.offsets = (RSOffsetVector){.data = NULL, .len = 0};
+      break;
+
+    // Load neither -we load just freq and docId. Without a stored mask the record matches all the
+    // fields the reader was opened for
     default:
-      qint_decode(br, (uint32_t *)res, 2);
+      qint_decode2(br, &res->docId, &res->freq);
+      res->fieldMask = RS_FIELDMASK_ALL;
       break;
   }
 
@@ -181,6 +263,7 @@ int IR_Read(void *ctx, RSIndexResult **e) {
     }
 
     readEntry(br, ir->readFlags, ir->record, ir->singleWordMode);
+    ++ir->numDecoded;
     ir->lastId = ir->record->docId += ir->lastId;
 
     // The record doesn't match the field filter. Continue to the next one
@@ -248,6 +331,7 @@ int indexReader_skipToBlock(IndexReader *ir, t_docId docId) {
   ir->currentBlock = i;
 
 found:
+  ir->numBlocks++;
   ir->lastId = 0;
   ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
   return 1;
@@ -319,6 +403,9 @@ IndexReader *NewIndexReader(InvertedIndex *idx, DocTable *docTable, t_fieldMask
   if (term) {
     // compute IDF based on num of docs in the header
     ret->term->idf = logb(1.0F + docTable->size / (idx->numDocs ? idx->numDocs : (double)1));
+    // and the BM25 flavor of it, so the scorer doesn't need to compute it for every result
+    double numDocs = docTable->size, termDocs = idx->numDocs;
+    ret->term->bm25_idf = log(1.0F + (numDocs - termDocs + 0.5F) / (termDocs + 0.5F));
   }
 
   ret->record = NewTokenRecord(term);
@@ -327,10 +414,12 @@ IndexReader *NewIndexReader(InvertedIndex *idx, DocTable *docTable, t_fieldMask
   ret->len = 0;
   ret->singleWordMode = singleWordMode;
   ret->atEnd = 0;
+  ret->numDecoded = 0;
+  ret->numBlocks = 1;
 
   ret->fieldMask = fieldMask;
   ret->flags = flags;
-  ret->readFlags = (uint32_t)flags & (Index_StoreFieldFlags | Index_StoreTermOffsets);
+  ret->readFlags = (uint32_t)flags & INDEX_STORAGE_MASK;
   ret->br = NewBufferReader(IR_CURRENT_BLOCK(ret).data);
   return ret;
 }
@@ -390,7 +479,7 @@ int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags) {
   int frags = 0;
 
   while (!BufferReader_AtEnd(&br)) {
-    size_t sz = readEntry(&br, flags & (Index_StoreFieldFlags | Index_StoreTermOffsets), res, 0);
+    size_t sz = readEntry(&br, flags & INDEX_STORAGE_MASK, res, 0);
     lastReadId = res->docId += lastReadId;
     RSDocumentMetadata *md = DocTable_Get(dt, res->docId);
 
@@ -420,16 +509,235 @@ int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags) {
   return frags;
 }
 
+int InvertedIndex_RepairBlock(InvertedIndex *idx, DocTable *dt, uint32_t blockIdx) {
+  IndexBlock *blk = &idx->blocks[blockIdx];
+  int rep = IndexBlock_Repair(blk, dt, idx->flags);
+  idx->numDocs -= MIN((uint32_t)rep, idx->numDocs);
+  // records of documents deleted before they were tracked are removed too, so don't go below 0
+  idx->numDeleted -= MIN(blk->numDeleted, idx->numDeleted);
+  blk->numDeleted = 0;
+  return rep;
+}
+
 int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock, int num) {
   int n = 0;
   while (startBlock < idx->size && (num <= 0 || n < num)) {
-    int rep = IndexBlock_Repair(&idx->blocks[startBlock], dt, idx->flags);
-    if (rep) {
-      // printf("Repaired %d holes in block %d\n", rep, startBlock);
-    }
+    InvertedIndex_RepairBlock(idx, dt, startBlock);
     n++;
     startBlock++;
   }
 
   return startBlock < idx->size ? startBlock : 0;
-}
\ No newline at end of file
+}
+
+uint32_t InvertedIndex_FindBlock(InvertedIndex *idx, t_docId docId) {
+  // the last block starting at or before docId
+  uint32_t lo = 0, hi = idx->size;
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (idx->blocks[mid].firstId <= docId) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+size_t InvertedIndex_Remap(InvertedIndex *idx, const t_docId *idMap, t_docId maxId) {
+  IndexBlock *oldBlocks = idx->blocks;
+  uint32_t oldSize = idx->size;
+  IndexFlags readFlags = idx->flags & INDEX_STORAGE_MASK;
+
+  idx->blocks = NULL;
+  idx->size = 0;
+  idx->lastId = 0;
+  idx->numDocs = 0;
+  idx->numDeleted = 0;
+  InvertedIndex_AddBlock(idx, 0);
+
+  RSIndexResult *res = NewTokenRecord(NULL);
+  size_t removed = 0;
+  for (uint32_t i = 0; i < oldSize; i++) {
+    BufferReader br = NewBufferReader(oldBlocks[i].data);
+    t_docId lastReadId = 0;
+    while (!BufferReader_AtEnd(&br)) {
+      readEntry(&br, readFlags, res, 0);
+      lastReadId = res->docId += lastReadId;
+      t_docId newId = res->docId <= maxId ? idMap[res->docId] : 0;
+      if (!newId) {
+        removed++;
+        continue;
+      }
+
+      IndexBlock *blk = &INDEX_LAST_BLOCK(idx);
+      if (blk->numDocs >= INDEX_BLOCK_SIZE) {
+        IndexBlock_Seal(blk);
+        InvertedIndex_AddBlock(idx, newId);
+        blk = &INDEX_LAST_BLOCK(idx);
+      }
+      if (blk->firstId == 0) {
+        blk->firstId = newId;
+      }
+      // the record's offsets still point into the old block, which is freed only after we're done
+      BufferWriter bw = NewBufferWriter(blk->data);
+      writeEntry(&bw, idx->flags, newId - blk->lastId, res->fieldMask, res->freq,
+                 res->term.offsets.len, &res->term.offsets);
+      blk->lastId = newId;
+      ++blk->numDocs;
+      ++idx->numDocs;
+      idx->lastId = newId;
+    }
+    indexBlock_Free(&oldBlocks[i]);
+  }
+  rm_free(oldBlocks);
+  IndexResult_Free(res);
+  return removed;
+}
+
+size_t InvertedIndex_EncodeBlocks(InvertedIndex *idx, Buffer *buf) {
+  // a varint takes 5 bytes at most
+  size_t cap = buf->offset + idx->size * 4 * 5;
+  for (uint32_t i = 0; i < idx->size; i++) {
+    cap += idx->blocks[i].data->offset;
+  }
+  if (buf->cap < cap) {
+    buf->data = rm_realloc(buf->data, cap);
+    buf->cap = cap;
+  }
+  size_t start = buf->offset;
+  BufferWriter bw = NewBufferWriter(buf);
+
+  // the header table
+  for (uint32_t i = 0; i < idx->size; i++) {
+    IndexBlock *blk = &idx->blocks[i];
+    WriteVarint(blk->firstId, &bw);
+    WriteVarint(blk->lastId - blk->firstId, &bw);
+    WriteVarint(blk->numDocs, &bw);
+    WriteVarint(blk->data->offset, &bw);
+  }
+  // followed by the data of all the blocks
+  for (uint32_t i = 0; i < idx->size; i++) {
+    Buffer_Write(&bw, idx->blocks[i].data->data, idx->blocks[i].data->offset);
+  }
+  return buf->offset - start;
+}
+
+int InvertedIndex_DecodeBlocks(InvertedIndex *idx, uint32_t numBlocks, const char *data,
+                               size_t len) {
+  // every block header takes at least 4 bytes, so a count the data can't hold is rejected before
+  // anything is allocated for it
+  if (numBlocks > len / 4) {
+    return 0;
+  }
+  Buffer b = {.data = (char *)data, .cap = len, .offset = len};
+  BufferReader br = NewBufferReader(&b);
+  IndexBlock *blocks = rm_calloc(numBlocks, sizeof(IndexBlock));
+  uint32_t *lens = rm_malloc(numBlocks * sizeof(uint32_t));
+  size_t dataLen = 0;
+
+  // the blocks hold increasing docIds, up to the last docId of the index. Empty blocks have no
+  // docIds to check
+  uint32_t n = 0, firstId, delta, numDocs, prevId = 0;
+  for (; n < numBlocks; n++) {
+    IndexBlock *blk = &blocks[n];
+    if (!ReadVarintChecked(&br, &firstId) || !ReadVarintChecked(&br, &delta) ||
+        !ReadVarintChecked(&br, &numDocs) || !ReadVarintChecked(&br, &lens[n]) ||
+        numDocs > UINT16_MAX) {
+      break;
+    }
+    blk->firstId = firstId;
+    blk->lastId = firstId + delta;
+    blk->numDocs = numDocs;
+    if (numDocs && (blk->lastId < firstId || blk->lastId > idx->lastId || firstId < prevId)) {
+      break;
+    }
+    if (numDocs) prevId = blk->lastId;
+    dataLen += lens[n];
+  }
+  if (n != numBlocks || br.pos + dataLen != len) {
+    rm_free(lens);
+    rm_free(blocks);
+    return 0;
+  }
+
+  const char *p = data + br.pos;
+  for (uint32_t i = 0; i < numBlocks; i++) {
+    blocks[i].data = NewBuffer(lens[i]);
+    memcpy(blocks[i].data->data, p, lens[i]);
+    blocks[i].data->offset = lens[i];
+    p += lens[i];
+  }
+  rm_free(lens);
+  idx->blocks = blocks;
+  idx->size = numBlocks;
+  return 1;
+}
+
+size_t InvertedIndex_Dump(InvertedIndex *idx, Buffer *buf) {
+  size_t start = buf->offset;
+  BufferWriter bw = NewBufferWriter(buf);
+  WriteVarint(idx->flags, &bw);
+  WriteVarint(idx->lastId, &bw);
+  WriteVarint(idx->numDocs, &bw);
+  WriteVarint(idx->size, &bw);
+
+  // the deleted record counters of the blocks, if there are any
+  WriteVarint(idx->numDeleted, &bw);
+  for (uint32_t i = 0; i < idx->size && idx->numDeleted; i++) {
+    WriteVarint(idx->blocks[i].numDeleted, &bw);
+  }
+
+  InvertedIndex_EncodeBlocks(idx, buf);
+  return buf->offset - start;
+}
+
+/* The flags an inverted index may have at all */
+#define INDEX_KNOWN_FLAGS                                                                    \
+  (Index_StoreTermOffsets | Index_StoreFieldFlags | Index_StoreScoreIndexes |             \
+   Index_HasCustomStopwords | Index_HasLegacyTermKeys | Index_DocIdsOnly | Index_WideSchema)
+
+InvertedIndex *InvertedIndex_Restore(const char *data, size_t len, IndexFlags flags,
+                                     IndexFlags mask) {
+  Buffer b = {.data = (char *)data, .cap = len, .offset = len};
+  BufferReader br = NewBufferReader(&b);
+  uint32_t idxFlags, lastId, numDocs, numBlocks, numDeleted;
+  if (!ReadVarintChecked(&br, &idxFlags) || !ReadVarintChecked(&br, &lastId) ||
+      !ReadVarintChecked(&br, &numDocs) || !ReadVarintChecked(&br, &numBlocks) ||
+      !ReadVarintChecked(&br, &numDeleted)) {
+    return NULL;
+  }
+  // the records must be encoded the way the index they're restored to reads them, and the block
+  // count must fit in the data before anything is allocated for it
+  if ((idxFlags & ~INDEX_KNOWN_FLAGS) || (idxFlags & mask) != (flags & mask) ||
+      numBlocks > len - br.pos) {
+    return NULL;
+  }
+
+  uint16_t *deleted = NULL;
+  if (numDeleted) {
+    deleted = rm_malloc(numBlocks * sizeof(uint16_t));
+    for (uint32_t i = 0; i < numBlocks; i++) {
+      uint32_t nd;
+      if (!ReadVarintChecked(&br, &nd) || nd > UINT16_MAX) {
+        rm_free(deleted);
+        return NULL;
+      }
+      deleted[i] = nd;
+    }
+  }
+
+  InvertedIndex *idx = NewInvertedIndex(idxFlags, 0);
+  idx->lastId = lastId;
+  idx->numDocs = numDocs;
+  idx->numDeleted = numDeleted;
+  if (!InvertedIndex_DecodeBlocks(idx, numBlocks, data + br.pos, len - br.pos)) {
+    rm_free(deleted);
+    InvertedIndex_Free(idx);
+    return NULL;
+  }
+  for (uint32_t i = 0; i < numBlocks && deleted; i++) {
+    idx->blocks[i].numDeleted = MIN(deleted[i], idx->blocks[i].numDocs);
+  }
+  rm_free(deleted);
+  return idx;
+}
@@ -12,10 +12,16 @@
 #include <stdint.h>
 
 /* A single block of data in the index. The index is basically a list of blocks we iterate */
+// the flags that determine how records are encoded
+#define INDEX_STORAGE_MASK \
+  (Index_StoreFieldFlags | Index_StoreTermOffsets | Index_DocIdsOnly | Index_WideSchema)
+
 typedef struct {
   t_docId firstId;
   t_docId lastId;
   uint16_t numDocs;
+  // the number of records of deleted documents in the block, until it is repaired
+  uint16_t numDeleted;
 
   Buffer *data;
 } IndexBlock;
@@ -26,12 +32,59 @@ typedef struct {
   IndexFlags flags;
   t_docId lastId;
   uint32_t numDocs;
+  // the number of records of deleted documents in all the blocks
+  uint32_t numDeleted;
 } InvertedIndex;
 
 InvertedIndex *NewInvertedIndex(IndexFlags flags, int initBlock);
 void InvertedIndex_Free(void *idx);
 int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock, int num);
 
+/* Remove the records of deleted documents from a single block, resetting its deleted record count.
+ * Returns the number of records removed */
+int InvertedIndex_RepairBlock(InvertedIndex *idx, DocTable *dt, uint32_t blockIdx);
+
+/* Right-size the buffer of a block to its data. Full blocks are sealed as soon as they fill up */
+void IndexBlock_Seal(IndexBlock *blk);
+
+/* Seal all the blocks of an index, including the last one - which will have to grow again on the
+ * next write. Returns the number of bytes released */
+size_t InvertedIndex_Seal(InvertedIndex *idx);
+
+/* Add the total size of the data in the blocks of an index to *size, and the total capacity of their
+ * buffers to *cap */
+void InvertedIndex_MemStats(InvertedIndex *idx, size_t *size, size_t *cap);
+
+/* Find the block that holds the record of a docId, if the index has it */
+uint32_t InvertedIndex_FindBlock(InvertedIndex *idx, t_docId docId);
+
+/* Rewrite the index after a DocTable compaction. idMap maps each docId up to maxId to its new
+ * docId, or to 0 if the document was deleted and its records should be dropped. The records are
+ * re-packed into full blocks. Returns the number of records removed */
+size_t InvertedIndex_Remap(InvertedIndex *idx, const t_docId *idMap, t_docId maxId);
+
+/* Encode all the blocks of an index as one contiguous stream, appended to buf: a table of varint
+ * block headers (firstId, lastId delta, numDocs and data length), followed by the data of all the
+ * blocks. Returns the length of the stream */
+size_t InvertedIndex_EncodeBlocks(InvertedIndex *idx, Buffer *buf);
+
+/* Load the blocks of an index from a stream written by InvertedIndex_EncodeBlocks. The index must
+ * have no blocks, and its lastId set. The block headers are checked - their count and data lengths
+ * against the stream, and their docIds against each other and lastId - but the records in the
+ * blocks are not decoded. Returns 0 and leaves the index as it is if a check fails */
+int InvertedIndex_DecodeBlocks(InvertedIndex *idx, uint32_t numBlocks, const char *data,
+                               size_t len);
+
+/* Serialize an entire index - its header, deleted record counters and blocks - appending it to buf,
+ * for AOF rewrite. Returns the number of bytes written */
+size_t InvertedIndex_Dump(InvertedIndex *idx, Buffer *buf);
+
+/* Create an index from data written by InvertedIndex_Dump, whose flags under mask must be those of
+ * flags - the storage flags of the index it's restored into. The header and blocks are checked as by
+ * InvertedIndex_DecodeBlocks. Returns NULL if a check fails */
+InvertedIndex *InvertedIndex_Restore(const char *data, size_t len, IndexFlags flags,
+                                     IndexFlags mask);
+
 /* An IndexReader wraps an inverted index record for reading and iteration */
 typedef struct indexReadCtx {
   // the underlying data buffer
@@ -59,6 +112,10 @@ typedef struct indexReadCtx {
   RSQueryTerm *term;
 
   int atEnd;
+
+  // the number of records decoded and blocks visited, for profiling
+  size_t numDecoded;
+  uint32_t numBlocks;
 } IndexReader;
 
 /* Write a ForwardIndexEntry into an indexWriter, updating its score and skip
@@ -66,6 +123,11 @@ typedef struct indexReadCtx {
  * Returns the number of bytes written to the index */
 size_t InvertedIndex_WriteEntry(InvertedIndex *idx, ForwardIndexEntry *ent);
 
+/* Write a single record to the index. The docId must be higher than the last docId in the index.
+ * Returns the number of bytes written */
+size_t InvertedIndex_WriteRecord(InvertedIndex *idx, t_docId docId, t_fieldMask fieldMask,
+                                 uint32_t freq, RSOffsetVector *offsets);
+
 /* Create a new index reader on an inverted index buffer,
 * optionally with a skip index, docTable and scoreIndex.
 * If singleWordMode is set to 1, we ignore the skip index and use the score
@@ -0,0 +1,46 @@
+#include "lazy_free.h"
+#include "dep/thpool/thpool.h"
+#include "rmalloc.h"
+
+/* A single thread is enough - freeing is not urgent, and it shouldn't compete with the query
+ * threads */
+static threadpool lazyFreeThreadPool = NULL;
+static size_t lazyFreePending = 0;
+
+typedef struct {
+  LazyFreeFunc freeFunc;
+  void *value;
+} LazyFreeJob;
+
+static void lazyFree_run(void *arg) {
+  LazyFreeJob *job = arg;
+  job->freeFunc(job->value);
+  rm_free(job);
+  __sync_fetch_and_sub(&lazyFreePending, 1);
+}
+
+void LazyFree(LazyFreeFunc freeFunc, void *value, size_t effort) {
+  if (effort <= LAZYFREE_THRESHOLD) {
+    freeFunc(value);
+    return;
+  }
+
+  if (lazyFreeThreadPool == NULL) {
+    lazyFreeThreadPool = thpool_init(1);
+  }
+  LazyFreeJob *job = rm_malloc(sizeof(*job));
+  job->freeFunc = freeFunc;
+  job->value = value;
+  __sync_fetch_and_add(&lazyFreePending, 1);
+  thpool_add_work(lazyFreeThreadPool, lazyFree_run, job);
+}
+
+size_t LazyFree_Pending() {
+  return __sync_fetch_and_add(&lazyFreePending, 0);
+}
+
+void LazyFree_Wait() {
+  if (lazyFreeThreadPool) {
+    thpool_wait(lazyFreeThreadPool);
+  }
+}
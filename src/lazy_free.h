@@ -0,0 +1,26 @@
+#ifndef __RS_LAZY_FREE_H__
+#define __RS_LAZY_FREE_H__
+
+#include <stdlib.h>
+
+/* Freeing a big index can take seconds, blocking redis while it's done. Values whose freeing effort
+ * is above this threshold are freed on a background thread instead. The effort is roughly the number
+ * of allocations the value holds */
+#define LAZYFREE_THRESHOLD 64
+
+typedef void (*LazyFreeFunc)(void *value);
+
+/* Free a value with freeFunc. If effort is above LAZYFREE_THRESHOLD the value is freed on the lazy
+ * free thread, otherwise it's freed right away.
+ *
+ * The value must no longer be reachable by anything but the free function, which must only release
+ * memory - it runs without the GIL */
+void LazyFree(LazyFreeFunc freeFunc, void *value, size_t effort);
+
+/* The number of values waiting to be freed or being freed on the lazy free thread */
+size_t LazyFree_Pending();
+
+/* Wait for all the pending values to be freed */
+void LazyFree_Wait();
+
+#endif
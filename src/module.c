@@ -27,8 +27,79 @@
 #include "extension.h"
 #include "ext/default.h"
 #include "search_request.h"
+#include "cursor.h"
+#include "query_cache.h"
+#include "result_cache.h"
+#include "term_dict.h"
+#include "lazy_free.h"
+#include "index_gc.h"
+#include "ingest.h"
+#include "tag_index.h"
 #include "rmalloc.h"
 
+/* Take a deleted document out of an index: mark its records as garbage, and take it out of the
+ * index stats */
+static void unindexDocument(IndexSpec *sp, t_docId docId, uint32_t len) {
+  sp->generation++;
+  // a document of a shared table may have been added through other indexes only
+  if (sp->docTableName && !IndexGC_HasDoc(sp->gc, docId)) {
+    return;
+  }
+  // the GC finds the document's records in the inverted indexes, so they have to be there
+  if (sp->ingest->numDocs && docId >= sp->ingest->firstId) {
+    IngestGroup_Commit(sp->ingest, sp);
+  }
+  TermDict *dicts[SPEC_MAX_DICTS];
+  IndexGC_MarkDeleted(sp->gc, dicts, IndexSpec_Dicts(sp, dicts), docId);
+  if (sp->stats.numDocuments) sp->stats.numDocuments--;
+  sp->stats.totalDocsLen -= MIN(len, sp->stats.totalDocsLen);
+}
+
+/* Mark a document as deleted in the index and take it out of the index stats. A document of a
+ * shared table is taken out of all the indexes sharing it. Returns 1 if the document was in the
+ * index, 0 if not */
+static int deleteDocument(IndexSpec *sp, const char *key) {
+  t_docId docId = DocTable_GetId(sp->docs, key);
+  uint32_t len = docId ? DocTable_Get(sp->docs, docId)->len : 0;
+
+  int rc = DocTable_Delete(sp->docs, key);
+  if (rc == 1 && !sp->docTableName) {
+    unindexDocument(sp, docId, len);
+  } else if (rc == 1) {
+    size_t pos = 0;
+    IndexSpec *other;
+    while ((other = IndexSpec_NextSharer(sp->docTableName, &pos))) {
+      // the other indexes get the table when they are loaded, and may still hold an old one
+      other->docs = sp->docs;
+      unindexDocument(other, docId, len);
+    }
+  }
+  return rc;
+}
+
+/* Write the forward index of a text field with its own postings to the field's dictionary. These
+ * records are not grouped - every term of the field has an index of its own, so there's nothing to
+ * gain from sorting them */
+static void indexFieldPostings(IndexSpec *sp, FieldSpec *fs, ForwardIndex *fidx) {
+  IndexFlags flags = IndexSpec_FieldPostingsFlags(sp);
+  ForwardIndexIterator it = ForwardIndex_Iterate(fidx);
+  ForwardIndexEntry *entry;
+  while ((entry = ForwardIndexIterator_Next(&it)) != NULL) {
+    if (IndexSpec_AddTerm(sp, entry->term, entry->len)) {
+      sp->stats.numTerms += 1;
+      sp->stats.termsSize += entry->len;
+    }
+    TermDictEntry *te = TermDict_Open(fs->dict, entry->term, entry->len, flags);
+    IndexGC_AddDocTerm(sp->gc, IndexSpec_FieldDictNum(sp, fs), te - fs->dict->entries);
+    InvertedIndex_WriteEntry(te->idx, entry);
+    sp->stats.numRecords++;
+    if (sp->flags & Index_StoreTermOffsets) {
+      sp->stats.offsetVecsSize += entry->vw->bw.buf->offset;
+      sp->stats.offsetVecRecords += entry->vw->nmemb;
+    }
+  }
+}
+
 /* Add a parsed document to the index. If replace is set, we will add it be deleting an older
  * version of it first */
 int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int nosave,
@@ -37,11 +108,28 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
 
   // if we're in replace mode, first we need to try and delete the older version of the document
   if (replace) {
-    DocTable_Delete(&ctx->spec->docs, RedisModule_StringPtrLen(doc.docKey, NULL));
+    deleteDocument(ctx->spec, RedisModule_StringPtrLen(doc.docKey, NULL));
   }
 
-  doc.docId = DocTable_Put(&ctx->spec->docs, RedisModule_StringPtrLen(doc.docKey, NULL), doc.score,
-                           0, doc.payload, doc.payloadSize);
+  IndexSpec *sp = ctx->spec;
+  const char *key = RedisModule_StringPtrLen(doc.docKey, NULL);
+  if (sp->docTableName && sp->docs->maxDocId < sp->lastDocId) {
+    *errorString = "The shared document table of the index was deleted";
+    return REDISMODULE_ERR;
+  }
+  doc.docId = DocTable_Put(sp->docs, key, doc.score, 0, doc.payload, doc.payloadSize);
+
+  // a document already in a shared table was added by another index, and keeps its docId and
+  // metadata. It can be added to this index too, as long as its docIds keep increasing
+  int inTable = 0;
+  if (doc.docId == 0 && sp->docTableName) {
+    doc.docId = DocTable_GetId(sp->docs, key);
+    inTable = doc.docId > sp->lastDocId;
+    if (!inTable) {
+      *errorString = "Document already in index, or older than its last document";
+      return REDISMODULE_ERR;
+    }
+  }
 
   // Make sure the document is not already in the index - it needs to be
   // incremental!
@@ -49,6 +137,10 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
     *errorString = "Document already in index";
     return REDISMODULE_ERR;
   }
+  if (sp->docTableName) {
+    sp->lastDocId = doc.docId;
+  }
+  ctx->spec->generation++;
 
   // first save the document as hash
   if (nosave == 0 && Redis_SaveDocument(ctx, &doc) != REDISMODULE_OK) {
@@ -56,7 +148,13 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
     return REDISMODULE_ERR;
   }
 
-  ForwardIndex *idx = NewForwardIndex(doc);
+  // The forward index is reused across documents, so that its memory is recycled instead of being
+  // allocated per token. Documents are only indexed with the GIL held, so sharing it is safe
+  static ForwardIndex *idx = NULL;
+  idx = ForwardIndex_Reuse(idx, doc);
+  // the fields with their own postings are tokenized one at a time into their own forward index
+  static ForwardIndex *fieldIdx = NULL;
+  uint32_t maxFreq = 0;
   RSSortingVector *sv = NULL;
   if (ctx->spec->sortables) {
     sv = NewSortingVector(ctx->spec->sortables->len);
@@ -86,8 +184,16 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
           RSSortingVector_Put(sv, fs->sortIdx, (void *)c, RS_SORTABLE_STR);
         }
 
+        if (fs->ownPostings) {
+          fieldIdx = ForwardIndex_Reuse(fieldIdx, doc);
+          totalTokens = tokenize(c, fs->weight, fs->id, fieldIdx, forwardIndexTokenFunc,
+                                 fieldIdx->stemmer, totalTokens, ctx->spec->stopwords, fs->charTable);
+          maxFreq = MAX(maxFreq, fieldIdx->maxFreq);
+          indexFieldPostings(ctx->spec, fs, fieldIdx);
+          break;
+        }
         totalTokens = tokenize(c, fs->weight, fs->id, idx, forwardIndexTokenFunc, idx->stemmer,
-                               totalTokens, ctx->spec->stopwords);
+                               totalTokens, ctx->spec->stopwords, fs->charTable);
         break;
       case F_NUMERIC: {
         double score;
@@ -126,15 +232,31 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
 
       break;
 
+      case F_TAG:
+        if (sv && fs->sortable) {
+          RSSortingVector_Put(sv, fs->sortIdx, (void *)c, RS_SORTABLE_STR);
+        }
+        // tags are not grouped, their records are tiny and go straight to their indexes
+        TagIndex_Index(fs, c, doc.docId, ctx->spec->gc, IndexSpec_FieldDictNum(ctx->spec, fs));
+        break;
+
       default:
         break;
     }
   }
 
-  RSDocumentMetadata *md = DocTable_Get(&ctx->spec->docs, doc.docId);
-  md->maxFreq = idx->maxFreq;
+  RSDocumentMetadata *md = DocTable_Get(ctx->spec->docs, doc.docId);
+  uint32_t docLen = MIN(totalTokens, 0xFFFFFF);
+  // a document added to several indexes keeps the largest of its lengths and frequencies in them
+  if (inTable) {
+    md->maxFreq = MAX(md->maxFreq, MAX(idx->maxFreq, maxFreq));
+    md->len = MAX(md->len, docLen);
+  } else {
+    md->maxFreq = MAX(idx->maxFreq, maxFreq);
+    md->len = docLen;
+  }
   if (sv) {
-    DocTable_SetSortingVector(&ctx->spec->docs, doc.docId, sv);
+    DocTable_SetSortingVector(ctx->spec->docs, doc.docId, sv);
   }
 
   // printf("totaltokens :%d\n", totalTokens);
@@ -146,48 +268,140 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
     while (entry != NULL) {
       // ForwardIndex_NormalizeFreq(idx, entry);
       int isNew = IndexSpec_AddTerm(ctx->spec, entry->term, entry->len);
-      InvertedIndex *invidx = Redis_OpenInvertedIndex(ctx, entry->term, entry->len, 1);
+      TermDict *td = ctx->spec->termDict;
+      TermDictEntry *te = TermDict_Open(td, entry->term, entry->len, ctx->spec->flags);
+      // remember the document's terms, so we know where its records are if it's deleted
+      IndexGC_AddDocTerm(ctx->spec->gc, 0, te - td->entries);
       if (isNew) {
         ctx->spec->stats.numTerms += 1;
         ctx->spec->stats.termsSize += entry->len;
       }
-      size_t sz = InvertedIndex_WriteEntry(invidx, entry);
-
-      /*******************************************
-      * update stats for the index
-      ********************************************/
-
-      /* record the change in capacity of the buffer */
-      // ctx->spec->stats.invertedCap += w->bw.buf->cap - cap;
-      // ctx->spec->stats.skipIndexesSize += w->skipIndexWriter.buf->cap - skcap;
-      // ctx->spec->stats.scoreIndexesSize += w->scoreWriter.bw.buf->cap - sccap;
-      /* record the actual size consumption change */
-      ctx->spec->stats.invertedSize += sz;
-
-      ctx->spec->stats.numRecords++;
-      /* increment the number of terms if this is a new term*/
-
-      /* Record the space saved for offset vectors */
-      if (ctx->spec->flags & Index_StoreTermOffsets) {
-        ctx->spec->stats.offsetVecsSize += entry->vw->bw.buf->offset;
-        ctx->spec->stats.offsetVecRecords += entry->vw->nmemb;
-      }
-      // Redis_CloseWriter(w);
+      IngestGroup_AddRecord(ctx->spec->ingest, te - td->entries, entry);
 
       entry = ForwardIndexIterator_Next(&it);
     }
+
+    // the records and their stats go to the inverted indexes when the group is committed
+    if (IngestGroup_EndDoc(ctx->spec->ingest, doc.docId)) {
+      IngestGroup_Commit(ctx->spec->ingest, ctx->spec);
+    }
     // ctx->spec->stats->numDocuments += 1;
   }
+  // the terms of the fields with their own dictionaries are recorded even without any text terms
+  IndexGC_EndDoc(ctx->spec->gc, doc.docId);
   ctx->spec->stats.numDocuments += 1;
-  ForwardIndexFree(idx);
+  ctx->spec->stats.totalDocsLen += docLen;
   return REDISMODULE_OK;
 
 error:
-  ForwardIndexFree(idx);
-
+  // the field records written before the error stay in their dictionaries
+  IndexGC_EndDoc(ctx->spec->gc, doc.docId);
+  if (sv) {
+    SortingVector_Free(sv);
+  }
   return REDISMODULE_ERR;
 }
 
+/* Update the numeric, geo and sortable values of a document already in the index in place. The
+ * document keeps its docId and its text postings are not touched, so full-text fields cannot be
+ * updated this way.
+ *
+ * All the values are validated before anything is changed. The geo values are then applied first,
+ * since adding them to their redis geo sets is the only update that can still fail - if it does,
+ * the document, its hash and the other values are left as they were */
+int UpdateDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int nosave) {
+  RSDocumentMetadata *md = DocTable_Get(ctx->spec->docs, doc.docId);
+  if (md == NULL || (md->flags & Document_Deleted)) {
+    *errorString = "Document not in index";
+    return REDISMODULE_ERR;
+  }
+
+  double nums[doc.numFields];
+  // the lon and lat of geo values, split in place at their separator until they're indexed
+  char *lons[doc.numFields], *lats[doc.numFields], seps[doc.numFields];
+  FieldSpec *fields[doc.numFields];
+  for (int i = 0; i < doc.numFields; i++) {
+    FieldSpec *fs = IndexSpec_GetField(ctx->spec, doc.fields[i].name, strlen(doc.fields[i].name));
+    fields[i] = fs;
+    if (fs == NULL) continue;
+
+    switch (fs->type) {
+      case F_FULLTEXT:
+        *errorString = "Full-text fields cannot be updated in place";
+        return REDISMODULE_ERR;
+      case F_TAG:
+        *errorString = "Tag fields cannot be updated in place";
+        return REDISMODULE_ERR;
+      case F_NUMERIC:
+        if (RedisModule_StringToDouble(doc.fields[i].text, &nums[i]) == REDISMODULE_ERR) {
+          *errorString = "Could not parse numeric index value";
+          return REDISMODULE_ERR;
+        }
+        break;
+      case F_GEO: {
+        char *c = (char *)RedisModule_StringPtrLen(doc.fields[i].text, NULL);
+        char *pos = strpbrk(c, " ,");
+        if (!pos) {
+          *errorString = "Invalid lon/lat format. Use \"lon lat\" or \"lon,lat\"";
+          return REDISMODULE_ERR;
+        }
+        seps[i] = *pos;
+        *pos = '\0';
+        lons[i] = c;
+        lats[i] = pos + 1;
+        if (GeoIndex_ValidateStrings(lons[i], lats[i]) == REDISMODULE_ERR) {
+          *pos = seps[i];
+          *errorString = "Invalid lon/lat value";
+          return REDISMODULE_ERR;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  int changed = 0;
+  for (int i = 0; i < doc.numFields; i++) {
+    if (fields[i] == NULL || fields[i]->type != F_GEO) continue;
+    // GEOADD of an existing docId member just moves it
+    GeoIndex gi = {.ctx = ctx, .sp = fields[i]};
+    int rc = GeoIndex_AddStrings(&gi, doc.docId, lons[i], lats[i]);
+    // the hash keeps the value as it was given
+    lats[i][-1] = seps[i];
+    if (rc == REDISMODULE_ERR) {
+      // an earlier geo value may have been moved already
+      ctx->spec->generation += changed;
+      *errorString = "Could not index geo value";
+      return REDISMODULE_ERR;
+    }
+    changed = 1;
+  }
+
+  if (nosave == 0 && Redis_SaveDocument(ctx, &doc) != REDISMODULE_OK) {
+    ctx->spec->generation += changed;
+    *errorString = "Could not save document data";
+    return REDISMODULE_ERR;
+  }
+  ctx->spec->generation++;
+
+  for (int i = 0; i < doc.numFields; i++) {
+    FieldSpec *fs = fields[i];
+    if (fs == NULL || fs->type != F_NUMERIC) continue;
+
+    NumericRangeTree *rt = OpenNumericIndex(ctx, fs->name);
+    NumericRangeTree_Update(rt, doc.docId, nums[i]);
+    if (md->sortVector && fs->sortable) {
+      RSSortingVector_Put(md->sortVector, fs->sortIdx, &nums[i], RS_SORTABLE_NUM);
+    }
+  }
+
+  if (doc.payload) {
+    DocTable_SetPayload(ctx->spec->docs, doc.docId, doc.payload, doc.payloadSize);
+  }
+  return REDISMODULE_OK;
+}
+
 /*
 ## FT.ADD <index> <docId> <score> [NOSAVE] [REPLACE] [LANGUAGE <lang>] [PAYLOAD {payload}] FIELDS
 <field>
@@ -249,7 +463,7 @@ int AddDocumentCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 
   RedisModule_AutoMemory(ctx);
 
-  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
+  IndexSpec *sp = IndexSpec_LoadForAdd(ctx, RedisModule_StringPtrLen(argv[1], NULL));
   if (sp == NULL) {
     RedisModule_ReplyWithError(ctx, "Unknown Index name");
     goto cleanup;
@@ -310,6 +524,76 @@ cleanup:
   return REDISMODULE_OK;
 }
 
+/*
+## FT.UPDATE <index> <docId> [NOSAVE] [PAYLOAD {payload}] [FIELDS <field> <value> ....]
+Update the numeric and geo fields (and with them the sortable values) and the payload of a document
+already in the index, in place.
+
+Unlike FT.ADD with REPLACE, the document keeps its docId, and its full-text postings are not
+touched, so only the changed values are re-indexed. Because of that, full-text fields cannot be
+updated with this command.
+
+## Parameters:
+
+    - index: The Fulltext index name. The index must be first created with FT.CREATE
+
+    - docId: The id of a document already in the index
+
+    - NOSAVE: If set, we will not update the saved document hash, only the index
+
+    - PAYLOAD payload: If set, replaces the document's payload
+
+    - FIELDS: Following the FIELDS specifier, we are looking for pairs of <field> <value> to be
+      updated. Fields that are not in the index spec are only saved in the document hash
+
+Returns OK on success, or an error if something went wrong.
+*/
+int UpdateDocumentCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  int nosave = RMUtil_ArgExists("NOSAVE", argv, argc, 1);
+  int fieldsIdx = RMUtil_ArgExists("FIELDS", argv, argc, 1);
+  int payloadIdx = RMUtil_ArgExists("PAYLOAD", argv, argc, 1);
+
+  if (argc < 5 || (fieldsIdx == 0 && payloadIdx == 0) ||
+      (fieldsIdx && (argc - fieldsIdx) % 2 == 0) || (nosave && nosave != 3)) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  RedisModule_AutoMemory(ctx);
+
+  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
+  if (sp == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+
+  RedisSearchCtx sctx = {ctx, sp};
+
+  // Parse the optional payload field
+  const char *payload = NULL;
+  size_t payloadSize = 0;
+  RMUtil_ParseArgsAfter("PAYLOAD", argv, argc, "b", &payload, &payloadSize);
+
+  int numFields = fieldsIdx ? (argc - fieldsIdx) / 2 : 0;
+  Document doc = NewDocument(argv[2], 0, numFields, DEFAULT_LANGUAGE, payload, payloadSize);
+  doc.docId = DocTable_GetId(sp->docs, RedisModule_StringPtrLen(argv[2], NULL));
+
+  for (int i = 0; i < numFields; i++) {
+    doc.fields[i].name = RedisModule_StringPtrLen(argv[fieldsIdx + 1 + 2 * i], NULL);
+    doc.fields[i].text = argv[fieldsIdx + 2 + 2 * i];
+  }
+
+  const char *msg = NULL;
+  if (doc.docId == 0) {
+    RedisModule_ReplyWithError(ctx, "Document not in index");
+  } else if (UpdateDocument(&sctx, doc, &msg, nosave) == REDISMODULE_ERR) {
+    RedisModule_ReplyWithError(ctx, msg ? msg : "Could not update document");
+  } else {
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+  free(doc.fields);
+
+  return REDISMODULE_OK;
+}
+
 /* FT.SETPAYLOAD {index} {docId} {payload} */
 int SetPayloadCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
@@ -327,7 +611,7 @@ int SetPayloadCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   }
 
   /* Find the document by its key */
-  t_docId docId = DocTable_GetId(&sp->docs, RedisModule_StringPtrLen(argv[2], NULL));
+  t_docId docId = DocTable_GetId(sp->docs, RedisModule_StringPtrLen(argv[2], NULL));
   if (docId == 0) {
     RedisModule_ReplyWithError(ctx, "Document not in index");
     goto cleanup;
@@ -336,10 +620,11 @@ int SetPayloadCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   size_t mdlen;
   const char *md = RedisModule_StringPtrLen(argv[3], &mdlen);
 
-  if (DocTable_SetPayload(&sp->docs, docId, md, mdlen) == 0) {
+  if (DocTable_SetPayload(sp->docs, docId, md, mdlen) == 0) {
     RedisModule_ReplyWithError(ctx, "Could not set payload ¯\\_(ツ)_/¯");
     goto cleanup;
   }
+  sp->generation++;
 
   RedisModule_ReplyWithSimpleString(ctx, "OK");
 cleanup:
@@ -347,60 +632,136 @@ cleanup:
   return REDISMODULE_OK;
 }
 
-/* FT.REPAIR {index} {term} {offset}
- * Repair a key or select a random key for repair.
+/* Apply the change in the data size and buffer capacity of an inverted index that was repaired in
+ * place to the index stats, given its size and capacity before the repair */
+static void updateInvertedStats(IndexSpec *sp, InvertedIndex *idx, size_t size, size_t cap) {
+  size_t newSize = 0, newCap = 0;
+  InvertedIndex_MemStats(idx, &newSize, &newCap);
+  sp->stats.invertedSize -= MIN(size - newSize, sp->stats.invertedSize);
+  sp->stats.invertedCap -= MIN(cap - newCap, sp->stats.invertedCap);
+}
+
+/* FT.REPAIR [{index} [{term} {offset}]]
+ * Remove the records of deleted documents from the index.
+ *
+ * With just an index, we repair the term with the most records of deleted documents, starting with
+ * its dirtiest blocks. Without an index, we do this for the next index in turn, so that repeated
+ * calls go over all the indexes. The returned values are the index, the term repaired (or null if
+ * the index has no known deleted records), and the number of deleted records still left in the
+ * index - calling FT.REPAIR until it returns 0 cleans the whole index.
+ *
+ * If term is set, we repair the given term, starting at the given block offset. The returned values
+ * are the index, the term repaired, and the block offset we stopped at. If we did not finish covering
+ * the entire block range, we return the block we stopped at, a-la SCAN. If we finished all the
+ * term's blocks, we return 0, which means we can go on to the next term.
  *
- * If term is set, we repair the key for the given term. If not, we select a random term key.
- * If offset is set, we start repairing at the given block offset.
- * The returned values are the term repaired, and the block offset we stopped at.
  * In order not to block redis for too long, we work at 10 blocks at most.
- * If we did not finish covering the entire block range, we return the block we stopped at, a-la
- * SCAN. If we finished all the term's blocks, we return 0, which means we can go on to the next
- * term
  */
 int RepairCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx);
-  if (argc != 1 && argc != 4) return RedisModule_WrongArity(ctx);
+  if (argc != 1 && argc != 2 && argc != 4) return RedisModule_WrongArity(ctx);
 
-  const char *term = NULL;
-  size_t len = 0;
-  long long startBlock = 0;
-  RedisSearchCtx sctx = {ctx, NULL};
-
-  if (argc != 4) {
-    term = Redis_SelectRandomTerm(&sctx, &len);
+  IndexSpec *sp;
+  if (argc == 1) {
+    sp = Redis_SelectNextIndex(ctx);
+    if (sp == NULL) {
+      return RedisModule_ReplyWithError(ctx, "Could not find an index");
+    }
   } else {
-
-    sctx.spec = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
-    if (sctx.spec == NULL) {
+    sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
+    if (sp == NULL) {
       return RedisModule_ReplyWithError(ctx, "Unknown Index name");
     }
+  }
 
-    term = RedisModule_StringPtrLen(argv[2], &len);
+  if (argc != 4) {
+    TermDict *dicts[SPEC_MAX_DICTS];
+    uint32_t numDicts = IndexSpec_Dicts(sp, dicts);
+    IndexGCRepair rep;
+    TermDictEntry *te = IndexGC_RepairNext(sp->gc, dicts, numDicts, sp->docs, 10, &rep);
+    if (te) {
+      // only the indexes of the term dictionary are in the size stats
+      if (rep.dict == 0) updateInvertedStats(sp, te->idx, rep.size, rep.cap);
+      // and the records of tags are not counted
+      if (rep.dict == 0 || sp->fields[rep.dict - 1].type == F_FULLTEXT) {
+        sp->stats.numRecords -= MIN(rep.removed, sp->stats.numRecords);
+      }
+    }
 
-    if (RedisModule_StringToLongLong(argv[3], &startBlock) == REDISMODULE_ERR || startBlock < 0) {
-      return RedisModule_ReplyWithError(ctx, "Invalid start offset");
+    RedisModule_ReplyWithArray(ctx, 3);
+    RedisModule_ReplyWithStringBuffer(ctx, sp->name, strlen(sp->name));
+    if (te) {
+      RedisModule_Log(ctx, "debug", "Repaired %zd records of term %s", rep.removed, te->term);
+      RedisModule_ReplyWithStringBuffer(ctx, te->term, te->len);
+    } else {
+      RedisModule_ReplyWithNull(ctx);
     }
+    return RedisModule_ReplyWithLongLong(ctx,
+                                         IndexGC_Stats(sp->gc, dicts, numDicts).deletedRecords);
   }
-  if (!term || sctx.spec == NULL) {
-    return RedisModule_ReplyWithError(ctx, "Could not find a term");
+
+  size_t len;
+  const char *term = RedisModule_StringPtrLen(argv[2], &len);
+  long long startBlock = 0;
+  if (RedisModule_StringToLongLong(argv[3], &startBlock) == REDISMODULE_ERR || startBlock < 0) {
+    return RedisModule_ReplyWithError(ctx, "Invalid start offset");
   }
-  // printf("Selected idx %s term %.*s\n", sctx.spec->name, (int)len, term);
 
   RedisModule_Log(ctx, "debug", "Repairing term %.*s", (int)len, term);
 
-  InvertedIndex *idx = Redis_OpenInvertedIndex(&sctx, term, len, 1);
+  RedisSearchCtx sctx = {ctx, sp};
+  InvertedIndex *idx = Redis_OpenInvertedIndex(&sctx, term, len, 0);
   if (idx == NULL) {
     return RedisModule_ReplyWithError(ctx, "Could not open term index");
   }
 
-  int rc = InvertedIndex_Repair(idx, &sctx.spec->docs, startBlock, 10);
+  uint32_t numDocs = idx->numDocs;
+  size_t size = 0, cap = 0;
+  InvertedIndex_MemStats(idx, &size, &cap);
+  int rc = InvertedIndex_Repair(idx, sp->docs, startBlock, 10);
+  sp->stats.numRecords -= MIN(numDocs - idx->numDocs, sp->stats.numRecords);
+  updateInvertedStats(sp, idx, size, cap);
+
   RedisModule_ReplyWithArray(ctx, 3);
-  RedisModule_ReplyWithStringBuffer(ctx, sctx.spec->name, strlen(sctx.spec->name));
+  RedisModule_ReplyWithStringBuffer(ctx, sp->name, strlen(sp->name));
   RedisModule_ReplyWithStringBuffer(ctx, term, len);
   return RedisModule_ReplyWithLongLong(ctx, rc);
 }
 
+/* FT.COMPACT {index}
+*  Reclaim the document ids of deleted documents. The live documents are renumbered densely in
+*  their original order, and all the index's term, numeric and geo records are rewritten to the new
+*  ids, dropping the records of deleted documents.
+*
+*  This keeps the doc table and the id space proportional to the live documents on update heavy
+*  indexes, where every REPLACE burns a new document id.
+*
+*  **WARNING**: This rewrites the entire index and blocks redis while doing so.
+*
+*  Returns the number of document ids reclaimed
+*/
+int CompactIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
+  if (argc != 2) return RedisModule_WrongArity(ctx);
+
+  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
+  if (sp == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+
+  // renumbering the documents of a shared table would take the docIds of the other indexes with it
+  if (sp->docTableName) {
+    return RedisModule_ReplyWithError(ctx,
+                                      "Indexes with a shared document table can't be compacted");
+  }
+
+  RedisSearchCtx sctx = {ctx, sp};
+  sp->generation++;
+  // the snapshots of the cursors hold the old docIds
+  Cursors_PurgeIndex(sp);
+  return RedisModule_ReplyWithLongLong(ctx, (long long)Redis_CompactIndex(&sctx));
+}
+
 #define __reply_kvnum(n, k, v)                 \
   RedisModule_ReplyWithSimpleString(ctx, k);   \
   RedisModule_ReplyWithDouble(ctx, (double)v); \
@@ -436,6 +797,23 @@ int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     __reply_kvstr(nn, "type", SpecTypeNames[sp->fields[i].type]);
     if (sp->fields[i].type == F_FULLTEXT) {
       __reply_kvnum(nn, "weight", sp->fields[i].weight);
+      if (sp->fields[i].separators) {
+        __reply_kvstr(nn, "separators", sp->fields[i].separators);
+      }
+      if (sp->fields[i].ownPostings) {
+        size_t size = 0, cap = 0;
+        FieldSpec_DictMemStats(&sp->fields[i], &size, &cap);
+        RedisModule_ReplyWithSimpleString(ctx, SPEC_OWNPOSTINGS_STR);
+        ++nn;
+        __reply_kvnum(nn, "num_terms", sp->fields[i].dict->numEntries);
+        __reply_kvnum(nn, "postings_sz_mb", size / (float)0x100000);
+      }
+    } else if (sp->fields[i].type == F_TAG) {
+      size_t size = 0, cap = 0;
+      FieldSpec_DictMemStats(&sp->fields[i], &size, &cap);
+      __reply_kvstr(nn, "separators", sp->fields[i].separators);
+      __reply_kvnum(nn, "num_tags", sp->fields[i].dict->numEntries);
+      __reply_kvnum(nn, "tags_sz_mb", size / (float)0x100000);
     }
     if (sp->fields[i].sortable) {
       RedisModule_ReplyWithSimpleString(ctx, "SORTABLE");
@@ -446,21 +824,31 @@ int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   n += 2;
 
   __reply_kvnum(n, "num_docs", sp->stats.numDocuments);
-  __reply_kvnum(n, "max_doc_id", sp->docs.maxDocId);
+  __reply_kvnum(n, "max_doc_id", sp->docs->maxDocId);
+  if (sp->docTableName) {
+    __reply_kvstr(n, "doc_table", sp->docTableName);
+  }
   __reply_kvnum(n, "num_terms", sp->stats.numTerms);
   __reply_kvnum(n, "num_records", sp->stats.numRecords);
   __reply_kvnum(n, "inverted_sz_mb", sp->stats.invertedSize / (float)0x100000);
   __reply_kvnum(n, "inverted_cap_mb", sp->stats.invertedCap / (float)0x100000);
 
-  __reply_kvnum(n, "inverted_cap_ovh", 0);
-  //(float)(sp->stats.invertedCap - sp->stats.invertedSize) / (float)sp->stats.invertedCap);
+  // the fraction of the buffers' capacity that is allocated but unused
+  __reply_kvnum(n, "inverted_cap_ovh",
+                sp->stats.invertedCap > sp->stats.invertedSize
+                    ? (float)(sp->stats.invertedCap - sp->stats.invertedSize) /
+                          (float)sp->stats.invertedCap
+                    : 0);
 
   __reply_kvnum(n, "offset_vectors_sz_mb", sp->stats.offsetVecsSize / (float)0x100000);
   __reply_kvnum(n, "skip_index_size_mb", sp->stats.skipIndexesSize / (float)0x100000);
   __reply_kvnum(n, "score_index_size_mb", sp->stats.scoreIndexesSize / (float)0x100000);
 
-  __reply_kvnum(n, "doc_table_size_mb", sp->docs.memsize / (float)0x100000);
-  __reply_kvnum(n, "key_table_size_mb", TrieMap_MemUsage(sp->docs.dim.tm) / (float)0x100000);
+  __reply_kvnum(n, "doc_table_size_mb", sp->docs->memsize / (float)0x100000);
+  __reply_kvnum(n, "key_table_size_mb", TrieMap_MemUsage(sp->docs->dim.tm) / (float)0x100000);
+  __reply_kvnum(n, "term_dict_size_mb", TermDict_MemUsage(sp->termDict) / (float)0x100000);
+  __reply_kvnum(n, "doc_len_avg",
+                (float)sp->stats.totalDocsLen / (float)MAX(1, sp->stats.numDocuments));
   __reply_kvnum(n, "records_per_doc_avg",
                 (float)sp->stats.numRecords / (float)sp->stats.numDocuments);
   __reply_kvnum(n, "bytes_per_record_avg",
@@ -470,6 +858,37 @@ int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   __reply_kvnum(n, "offset_bits_per_record_avg",
                 8.0F * (float)sp->stats.offsetVecsSize / (float)sp->stats.offsetVecRecords);
 
+  // the stem caches are shared by all indexes
+  StemCacheStats stc = GetStemCacheStats();
+  __reply_kvnum(n, "stem_cache_entries", stc.entries);
+  __reply_kvnum(n, "stem_cache_hit_rate",
+                (float)stc.hits / (float)MAX(1, stc.hits + stc.misses));
+
+  // so is the query cache
+  QueryCacheStats qcs = GetQueryCacheStats();
+  __reply_kvnum(n, "query_cache_entries", qcs.entries);
+  __reply_kvnum(n, "query_cache_hit_rate",
+                (float)qcs.hits / (float)MAX(1, qcs.hits + qcs.misses));
+
+  // and the result cache
+  ResultCacheStats rcs = GetResultCacheStats();
+  __reply_kvnum(n, "result_cache_entries", rcs.entries);
+  __reply_kvnum(n, "result_cache_memory_mb", rcs.memsize / (float)0x100000);
+  __reply_kvnum(n, "result_cache_hit_rate",
+                (float)rcs.hits / (float)MAX(1, rcs.hits + rcs.misses));
+
+  // the records of deleted documents not repaired yet
+  TermDict *dicts[SPEC_MAX_DICTS];
+  IndexGCStats gcs = IndexGC_Stats(sp->gc, dicts, IndexSpec_Dicts(sp, dicts));
+  __reply_kvnum(n, "gc_dirty_terms", gcs.dirtyTerms);
+  __reply_kvnum(n, "gc_deleted_records", gcs.deletedRecords);
+  __reply_kvnum(n, "gc_fragmentation",
+                (float)gcs.deletedRecords / (float)MAX(1, sp->stats.numRecords));
+  __reply_kvnum(n, "gc_doc_terms_size_mb", IndexGC_MemUsage(sp->gc) / (float)0x100000);
+
+  // the number of dropped indexes still being freed in the background
+  __reply_kvnum(n, "lazy_free_pending", LazyFree_Pending());
+
   RedisModule_ReplySetArrayLength(ctx, n);
   return REDISMODULE_OK;
 }
@@ -545,12 +964,135 @@ int DTAddCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   if (argc == 6) {
     payload = RedisModule_StringPtrLen(argv[5], &payloadSize);
   }
-  t_docId d = DocTable_Put(&sp->docs, RedisModule_StringPtrLen(argv[2], NULL), (float)score,
+  t_docId d = DocTable_Put(sp->docs, RedisModule_StringPtrLen(argv[2], NULL), (float)score,
                            (u_char)flags, payload, payloadSize);
+  sp->generation++;
 
   return RedisModule_ReplyWithLongLong(ctx, d);
 }
 
+/* FT.RESTORE {key} {DOCS|TERM|FIELD|DOCTERMS|FIELDTERMS|STATS|LASTID|LEGACYTERMS|NUMERIC|INVIDX|
+*                    DOCTABLE} ...
+*
+*  **WARNING**:  Do NOT use this command, it is for internal use in AOF rewriting only!!!!
+*
+*  Installs a part of an index as it was serialized on AOF rewrite, without re-indexing anything:
+*   - DOCS {data}: a chunk of the document table of the index {key}, in docId order
+*   - TERM {term} {data}: the inverted index of a term
+*   - FIELD {field} {term} {data}: the inverted index of a tag of a tag field, or of a term of a
+*     text field with its own postings. TAG is the same, as written by older versions
+*   - DOCTERMS {data}: the terms of a chunk of documents, used by the GC
+*   - FIELDTERMS {data}: the terms of a chunk of documents in the field dictionaries, used by the GC
+*   - STATS {num_docs} ... : the index stats
+*   - LASTID {docId}: the last docId added to an index with a shared document table
+*   - LEGACYTERMS: the index's terms are still in INVIDX keys, to be moved into it on first use
+*   - NUMERIC {data}: a chunk of the entries of the numeric index in {key}, in docId order
+*   - INVIDX {data}: an inverted index saved in its own key {key} by older versions
+*   - DOCTABLE {data}: a chunk of the shared document table in {key}, in docId order. {key} must be
+*     the key of a shared table, as named by DOCTABLE_KEY_FMT
+*
+*  Returns OK on success
+*/
+int RestoreCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RedisModule_AutoMemory(ctx);
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+
+  const char *section = RedisModule_StringPtrLen(argv[2], NULL);
+  size_t len;
+  const char *data = RedisModule_StringPtrLen(argv[argc - 1], &len);
+
+  // the numeric and legacy inverted indexes are keys of their own
+  if (!strcasecmp(section, "NUMERIC") || !strcasecmp(section, "INVIDX")) {
+    if (argc != 4) return RedisModule_WrongArity(ctx);
+    int numeric = !strcasecmp(section, "NUMERIC");
+    RedisModuleType *type = numeric ? NumericIndexType : InvertedIndexType;
+    RedisModuleKey *k = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    int ktype = RedisModule_KeyType(k);
+    if (ktype != REDISMODULE_KEYTYPE_EMPTY && RedisModule_ModuleTypeGetType(k) != type) {
+      return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+
+    if (numeric) {
+      NumericRangeTree *t;
+      if (ktype == REDISMODULE_KEYTYPE_EMPTY) {
+        t = NewNumericRangeTree();
+        RedisModule_ModuleTypeSetValue(k, NumericIndexType, t);
+      } else {
+        t = RedisModule_ModuleTypeGetValue(k);
+      }
+      if (NumericRangeTree_Restore(t, data, len) < 0) {
+        return RedisModule_ReplyWithError(ctx, "Could not restore numeric index");
+      }
+    } else {
+      // the indexes of older versions never have docId only or wide records
+      InvertedIndex *idx;
+      if (ktype != REDISMODULE_KEYTYPE_EMPTY ||
+          !(idx = InvertedIndex_Restore(data, len, 0, Index_DocIdsOnly | Index_WideSchema))) {
+        return RedisModule_ReplyWithError(ctx, "Could not restore inverted index");
+      }
+      RedisModule_ModuleTypeSetValue(k, InvertedIndexType, idx);
+    }
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+
+  // so is a shared document table
+  if (!strcasecmp(section, "DOCTABLE")) {
+    if (argc != 4) return RedisModule_WrongArity(ctx);
+    // only the key of a shared table, named by DOCTABLE_KEY_FMT, may be restored to
+    size_t klen, plen = strlen(DOCTABLE_KEY_PREFIX);
+    const char *key = RedisModule_StringPtrLen(argv[1], &klen);
+    if (klen <= plen || strncmp(key, DOCTABLE_KEY_PREFIX, plen) || strlen(key) != klen) {
+      return RedisModule_ReplyWithError(ctx, "Not a document table key");
+    }
+    DocTable *t = DocTable_OpenShared(ctx, key + plen, 1);
+    if (t == NULL) {
+      return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+    if (DocTable_Restore(t, data, len) < 0) {
+      return RedisModule_ReplyWithError(ctx, "Could not restore document table");
+    }
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+
+  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
+  if (sp == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+
+  int ok = 0;
+  if (!strcasecmp(section, "DOCS") && argc == 4) {
+    ok = !sp->docTableName && DocTable_Restore(sp->docs, data, len) >= 0;
+  } else if (!strcasecmp(section, "TERM") && argc == 5) {
+    size_t tlen;
+    const char *term = RedisModule_StringPtrLen(argv[3], &tlen);
+    ok = IndexSpec_RestoreTerm(sp, term, tlen, data, len);
+  } else if ((!strcasecmp(section, "FIELD") || !strcasecmp(section, "TAG")) && argc == 6) {
+    size_t tlen;
+    const char *term = RedisModule_StringPtrLen(argv[4], &tlen);
+    ok = IndexSpec_RestoreFieldTerm(sp, RedisModule_StringPtrLen(argv[3], NULL), term, tlen, data,
+                                    len);
+  } else if (!strcasecmp(section, "DOCTERMS") && argc == 4) {
+    ok = IndexGC_Restore(sp->gc, data, len, 0);
+  } else if (!strcasecmp(section, "FIELDTERMS") && argc == 4) {
+    ok = IndexGC_Restore(sp->gc, data, len, 1);
+  } else if (!strcasecmp(section, "STATS")) {
+    ok = IndexSpec_RestoreStats(sp, argv + 3, argc - 3);
+  } else if (!strcasecmp(section, "LASTID") && argc == 4) {
+    long long id;
+    ok = sp->docTableName && RedisModule_StringToLongLong(argv[3], &id) == REDISMODULE_OK &&
+         id >= 0;
+    if (ok) sp->lastDocId = id;
+  } else if (!strcasecmp(section, "LEGACYTERMS") && argc == 3) {
+    sp->flags |= Index_HasLegacyTermKeys;
+    ok = 1;
+  }
+  if (!ok) {
+    return RedisModule_ReplyWithError(ctx, "Could not restore index");
+  }
+  sp->generation++;
+  return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
 /* FT.DEL {index} {doc_id}
 *  Delete a document from the index. Returns 1 if the document was in the index, or 0 if not.
 *
@@ -566,10 +1108,7 @@ int DeleteCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return RedisModule_ReplyWithError(ctx, "Unknown Index name");
   }
 
-  int rc = DocTable_Delete(&sp->docs, RedisModule_StringPtrLen(argv[2], NULL));
-  if (rc == 1) {
-    sp->stats.numDocuments--;
-  }
+  int rc = deleteDocument(sp, RedisModule_StringPtrLen(argv[2], NULL));
   return RedisModule_ReplyWithLongLong(ctx, rc);
 }
 
@@ -614,7 +1153,7 @@ int AddHashCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
   RedisModule_AutoMemory(ctx);
 
-  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
+  IndexSpec *sp = IndexSpec_LoadForAdd(ctx, RedisModule_StringPtrLen(argv[1], NULL));
   if (sp == NULL) {
     RedisModule_ReplyWithError(ctx, "Unknown Index name");
     goto cleanup;
@@ -723,6 +1262,11 @@ terms.
 
    - INORDER: Phrase terms must appear in the document in the same order as in the query.
 
+   - WITHCURSOR [MAXIDLE {ms}]: If set, all the results of the query are kept on the server in a
+     cursor, and the reply is a pair of the first page of results and the cursor id. The following
+     pages are read with FT.CURSOR READ. A cursor that is not read for MAXIDLE milliseconds (5
+     minutes by default) is deleted.
+
    - LANGUAGE lang: If set, we use a stemmer for the supplied langauge.
 Defaults
 to English.
@@ -760,11 +1304,130 @@ int SearchCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return RedisModule_ReplyWithError(ctx, err);
   }
 
+  // a search repeated on an index that hasn't changed since is replied from the result cache
+  req->cacheKey = ResultCache_RequestKey(req, sctx->spec);
+  if (req->cacheKey && ResultCache_Reply(ctx, sctx->spec, req->cacheKey)) {
+    RSSearchRequest_Free(req);
+    SearchCtx_Free(sctx);
+    return REDISMODULE_OK;
+  }
+
   int rc = RSSearchRequest_Process(ctx, req);
   SearchCtx_Free(sctx);
   return rc;
 }
 
+/*
+## FT.PROFILE {index} {query} [search arguments ...]
+
+Run a search like FT.SEARCH, and report where the time went along with its results. Accepts the
+same arguments as FT.SEARCH, except for WITHCURSOR which is ignored.
+
+### Returns:
+
+    An array of two elements - the FT.SEARCH reply, and the profile of the query. The profile is an
+    array of name/value pairs with the time of each phase of the query (parse, expand, execute,
+    score and serialize), the number of results scored and offered to the top-N heap, and the tree
+    of iterators that executed it, each with its time, reads, skips and hits, and for term readers
+    the number of records decoded and index blocks touched.
+*/
+int ProfileCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  RedisModule_AutoMemory(ctx);
+  RedisSearchCtx *sctx = NewSearchCtx(ctx, argv[1]);
+  if (sctx == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+
+  char *err;
+  RSSearchRequest *req = ParseRequest(sctx, argv, argc, &err);
+  SearchCtx_Free(sctx);
+  if (req == NULL) {
+    return RedisModule_ReplyWithError(ctx, err);
+  }
+  req->flags |= Search_Profile;
+  req->flags &= ~Search_WithCursor;
+
+  return RSSearchRequest_Process(ctx, req);
+}
+
+/*
+## FT.CURSOR READ {index} {cursor_id} [COUNT {count}]
+## FT.CURSOR DEL {index} {cursor_id}
+
+Read the next page of results of a cursor created with FT.SEARCH ... WITHCURSOR, or delete a cursor
+that is not needed anymore.
+
+### Parameters:
+
+   - index: the index the cursor was created on
+
+   - cursor_id: the id of the cursor, as returned by FT.SEARCH or the last FT.CURSOR READ
+
+   - COUNT count: the number of results to read. Defaults to the LIMIT of the original search
+
+### Returns:
+
+    READ returns an array of the page of results, in the same format as FT.SEARCH, and the cursor
+    id to continue reading with. The id is 0 when the cursor has been exhausted, in which case it
+    has already been deleted. DEL returns OK, or an error if the cursor does not exist.
+*/
+int CursorCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 4 && argc != 6) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  RedisModule_AutoMemory(ctx);
+
+  long long id;
+  if (RedisModule_StringToLongLong(argv[3], &id) != REDISMODULE_OK || id <= 0) {
+    return RedisModule_ReplyWithError(ctx, "Bad cursor id");
+  }
+
+  if (RMUtil_StringEqualsCaseC(argv[1], "DEL")) {
+    if (argc != 4) {
+      return RedisModule_WrongArity(ctx);
+    }
+    if (!Cursors_Delete(id)) {
+      return RedisModule_ReplyWithError(ctx, "Cursor does not exist");
+    }
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+
+  if (!RMUtil_StringEqualsCaseC(argv[1], "READ")) {
+    return RedisModule_ReplyWithError(ctx, "Unknown cursor subcommand");
+  }
+
+  Cursor *c = Cursors_Find(id);
+  if (c == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Cursor does not exist");
+  }
+  if (strcmp(c->req->indexName, RedisModule_StringPtrLen(argv[2], NULL))) {
+    return RedisModule_ReplyWithError(ctx, "Cursor belongs to another index");
+  }
+
+  long long count = c->req->num;
+  if (argc == 6 && (!RMUtil_StringEqualsCaseC(argv[4], "COUNT") ||
+                    RedisModule_StringToLongLong(argv[5], &count) != REDISMODULE_OK || count <= 0)) {
+    return RedisModule_ReplyWithError(ctx, "Bad argument for `COUNT`");
+  }
+
+  RedisSearchCtx *sctx = NewSearchCtx(ctx, argv[2]);
+  if (sctx == NULL || sctx->spec != c->spec) {
+    // the index was dropped since the cursor was created
+    Cursors_Delete(id);
+    if (sctx) SearchCtx_Free(sctx);
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+
+  Cursor_Reply(c, sctx, count);
+  SearchCtx_Free(sctx);
+  return REDISMODULE_OK;
+}
+
 /*
 ## FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX]
     SCHEMA {field} [TEXT [WEIGHT {weight}]] | [NUMERIC] ...
@@ -817,12 +1480,19 @@ int CreateIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 
   // check that the key is empty
   if (k == NULL || (RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY)) {
+    IndexSpec_Free(sp);
     if (RedisModule_ModuleTypeGetType(k) != IndexSpecType)
       return RedisModule_ReplyWithError(ctx, "Wrong type for index key");
     else
       return RedisModule_ReplyWithError(ctx, "Index already exists. Drop it first!");
   }
 
+  // the shared document table is created along with its first index
+  if (sp->docTableName && !(sp->docs = DocTable_OpenShared(ctx, sp->docTableName, 1))) {
+    IndexSpec_Free(sp);
+    return RedisModule_ReplyWithError(ctx, "Wrong type for document table key");
+  }
+
   RedisModule_ModuleTypeSetValue(k, IndexSpecType, sp);
 
   return RedisModule_ReplyWithSimpleString(ctx, "OK");
@@ -834,14 +1504,9 @@ int CreateIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 *  we can optimize memory consumption by trimming all index buffers to their
 * actual size.
 *
-*  Warning 1: This will delete score indexes for small words (n < 5000), so
-* updating the index
-* after
-*  optimizing it might lead to screwed up results (TODO: rebuild score indexes
-* if needed).
-*  The simple solution to that is to call optimize again after adding
-* documents
-* to the index.
+*  Warning 1: Blocks are sealed when they fill up, so this only trims the last
+* block of every term - which will have to grow again if documents are added
+* after optimizing.
 *
 *  Warning 2: This blocks redis for a long time. Do not run it on production
 * instances
@@ -860,21 +1525,28 @@ int OptimizeIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
     return RedisModule_ReplyWithError(ctx, "Unknown Index name");
   }
 
-  /* Zero the stats in sp that are affected by optimization */
-  sp->stats.invertedCap = 0;
-  sp->stats.invertedSize = 0;
+  // full blocks are sealed as they fill up, so only the last block of each term has slack
+  TermDict *td = sp->termDict;
+  size_t freed = 0;
+  for (uint32_t i = 0; i < td->numEntries; i++) {
+    freed += InvertedIndex_Seal(td->entries[i].idx);
+  }
+  // so do the ones of the fields' own dictionaries - most tags have a single block, the last one
+  for (int i = 0; i < sp->numFields; i++) {
+    TermDict *dict = sp->fields[i].dict;
+    if (!dict) continue;
+    for (uint32_t j = 0; j < dict->numEntries; j++) {
+      freed += InvertedIndex_Seal(dict->entries[j].idx);
+    }
+  }
+  RedisModule_Log(ctx, "notice", "Optimized index %s, released %zd bytes", sp->name, freed);
+
+  /* Update the stats in sp that are affected by optimization */
+  IndexSpec_UpdateInvertedStats(sp);
   sp->stats.scoreIndexesSize = 0;
   sp->stats.skipIndexesSize = 0;
 
-  RedisSearchCtx sctx = {ctx, sp};
-
-  RedisModuleString *pf = fmtRedisTermKey(&sctx, "*", 1);
-  size_t len;
-  const char *prefix = RedisModule_StringPtrLen(pf, &len);
-
-  // RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-  int num = Redis_ScanKeys(ctx, prefix, Redis_OptimizeScanHandler, &sctx);
-  return RedisModule_ReplyWithLongLong(ctx, num);
+  return RedisModule_ReplyWithLongLong(ctx, td->numEntries);
 }
 
 /*
@@ -1182,6 +1854,37 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
     }
   }
 
+  /* Set the memory limit of the result cache. 0 disables it */
+  if (argc > 0 && RMUtil_ArgIndex("RESULTCACHE_MAXMEM", argv, argc) >= 0) {
+    long long maxmem = -1;
+    RMUtil_ParseArgsAfter("RESULTCACHE_MAXMEM", argv, argc, "l", &maxmem);
+    if (maxmem < 0) {
+      RedisModule_Log(ctx, "warning", "Invalid RESULTCACHE_MAXMEM, expected a number of bytes");
+      return REDISMODULE_ERR;
+    }
+    ResultCache_SetMaxMemory(maxmem);
+    RedisModule_Log(ctx, "notice", "Result cache memory limit set to %lld bytes", maxmem);
+  }
+
+  /* Set the limits of the ingestion groups of the indexes - the number of documents, and the time
+   * in milliseconds, documents are grouped for before they're committed */
+  long long groupSize = INGEST_DEFAULT_GROUP_SIZE, groupLatency = INGEST_DEFAULT_GROUP_LATENCY_MS;
+  if (argc > 0 && RMUtil_ArgIndex("INGEST_GROUP_SIZE", argv, argc) >= 0) {
+    groupSize = -1;
+    RMUtil_ParseArgsAfter("INGEST_GROUP_SIZE", argv, argc, "l", &groupSize);
+  }
+  if (argc > 0 && RMUtil_ArgIndex("INGEST_GROUP_LATENCY", argv, argc) >= 0) {
+    groupLatency = -1;
+    RMUtil_ParseArgsAfter("INGEST_GROUP_LATENCY", argv, argc, "l", &groupLatency);
+  }
+  if (groupSize < 1 || groupLatency < 0) {
+    RedisModule_Log(ctx, "warning",
+                    "Invalid INGEST_GROUP_SIZE or INGEST_GROUP_LATENCY, expected a number of "
+                    "documents and of milliseconds");
+    return REDISMODULE_ERR;
+  }
+  IngestGroup_SetLimits(groupSize, groupLatency);
+
   // Register the default hard coded extension
   if (Extension_Load("DEFAULT", DefaultExtensionInit) == REDISEARCH_ERR) {
     RedisModule_Log(ctx, "warning", "Could not register default extension");
@@ -1197,8 +1900,13 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
 
   RM_TRY(NumericIndexType_Register, ctx);
 
+  RM_TRY(DocTable_RegisterType, ctx);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_ADD_CMD, AddDocumentCommand, "write deny-oom", 1, 1, 1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_UPDATE_CMD, UpdateDocumentCommand, "write deny-oom", 1,
+         1, 1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_SETPAYLOAD_CMD, SetPayloadCommand, "write deny-oom", 1,
          1, 1);
 
@@ -1206,21 +1914,29 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_DTADD_CMD, DTAddCommand, "write deny-oom", 1, 1, 1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_RESTORE_CMD, RestoreCommand, "write deny-oom", 1, 1,
+         1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_DEL_CMD, DeleteCommand, "write", 1, 1, 1);
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_REPAIR_CMD, RepairCommand, "write", 0, 0, -1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_COMPACT_CMD, CompactIndexCommand, "write", 1, 1, 1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_SEARCH_CMD, SearchCommand, "readonly deny-oom", 1, 1,
          1);
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_CREATE_CMD, CreateIndexCommand, "write", 1, 1, 1);
 
-  // if (RedisModule_CreateCommand, ctx, RS_OPTIMIZE_CMD, OptimizeIndexCommand, "write", 1, 1, 1) ==
-  //     REDISMODULE_ERR)
-  //   return REDISMODULE_ERR;
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_OPTIMIZE_CMD, OptimizeIndexCommand, "write", 1, 1, 1);
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_DROP_CMD, DropIndexCommand, "write", 1, 1, 1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_CURSOR_CMD, CursorCommand, "readonly", 2, 2, 1);
+
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_PROFILE_CMD, ProfileCommand, "readonly deny-oom", 1, 1,
+         1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_INFO_CMD, IndexInfoCommand, "readonly", 1, 1, 1);
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_EXPLAIN_CMD, QueryExplainCommand, "readonly", 1, 1, 1);
@@ -3,7 +3,10 @@
 #include "rmutil/vector.h"
 #include "index.h"
 #include <math.h>
+#include <string.h>
 #include "redismodule.h"
+#include "lazy_free.h"
+#include "varint.h"
 //#include "tests/time_sample.h"
 #define NR_EXPONENT 4
 #define NR_MAXRANGE_CARD 2500
@@ -54,6 +57,20 @@ int NumericRange_Overlaps(NumericRange *n, double min, double max) {
   return rc;
 }
 
+/* Returns the offset of the first entry in the range with a docId not lower than docId */
+static uint32_t NumericRange_Find(NumericRange *n, t_docId docId) {
+  uint32_t bottom = 0, top = n->size;
+  while (bottom < top) {
+    uint32_t i = (bottom + top) / 2;
+    if (n->entries[i].docId < docId) {
+      bottom = i + 1;
+    } else {
+      top = i;
+    }
+  }
+  return bottom;
+}
+
 int NumericRange_Add(NumericRange *n, t_docId docId, double value, int checkCard) {
   // printf("Adding %d %f to %f..%f\n", docId, value, n->minVal, n->maxVal);
   if (n->size >= n->cap) {
@@ -76,10 +93,28 @@ int NumericRange_Add(NumericRange *n, t_docId docId, double value, int checkCard
 
   if (add) ++n->card;
 
-  n->entries[n->size++] = (NumericRangeEntry){.docId = docId, .value = value};
+  // entries are kept sorted by docId. New documents are always appended, but an in-place update
+  // re-adds an older docId, which we insert at its place
+  uint32_t pos = n->size;
+  if (pos && n->entries[pos - 1].docId > docId) {
+    pos = NumericRange_Find(n, docId);
+    memmove(&n->entries[pos + 1], &n->entries[pos], (n->size - pos) * sizeof(NumericRangeEntry));
+  }
+  n->entries[pos] = (NumericRangeEntry){.docId = docId, .value = value};
+  n->size++;
   return n->card;
 }
 
+int NumericRange_Delete(NumericRange *n, t_docId docId) {
+  uint32_t pos = NumericRange_Find(n, docId);
+  if (pos == n->size || n->entries[pos].docId != docId) {
+    return 0;
+  }
+  memmove(&n->entries[pos], &n->entries[pos + 1], (n->size - pos - 1) * sizeof(NumericRangeEntry));
+  n->size--;
+  return 1;
+}
+
 double NumericRange_Split(NumericRange *n, NumericRangeNode **lp, NumericRangeNode **rp) {
   // TimeSample ts;
   // TimeSampler_Start(&ts);
@@ -262,6 +297,23 @@ Vector *NumericRangeTree_Find(NumericRangeTree *t, double min, double max) {
   return NumericRangeNode_FindRange(t->root, min, max);
 }
 
+static void __recursiveAddLeaves(Vector *v, NumericRangeNode *n) {
+  if (!n) return;
+  if (__isLeaf(n)) {
+    Vector_Push(v, n->range);
+    return;
+  }
+  // left holds the values below the node's split value, and right the rest
+  __recursiveAddLeaves(v, n->left);
+  __recursiveAddLeaves(v, n->right);
+}
+
+Vector *NumericRangeTree_Leaves(NumericRangeTree *t) {
+  Vector *leaves = NewVector(NumericRange *, 8);
+  __recursiveAddLeaves(leaves, t->root);
+  return leaves;
+}
+
 void NumericRangeNode_Traverse(NumericRangeNode *n,
                                void (*callback)(NumericRangeNode *n, void *ctx), void *ctx) {
 
@@ -275,6 +327,67 @@ void NumericRangeNode_Traverse(NumericRangeNode *n,
   }
 }
 
+struct __niRemapCtx {
+  const t_docId *idMap;
+  t_docId maxId;
+  size_t removed;
+};
+
+void __numericIndex_remapCallback(NumericRangeNode *n, void *ctx) {
+  struct __niRemapCtx *rctx = ctx;
+  if (!n->range) return;
+
+  // the map is monotonic, so the entries stay sorted by docId
+  NumericRange *rng = n->range;
+  uint32_t j = 0;
+  for (uint32_t i = 0; i < rng->size; i++) {
+    t_docId docId = rng->entries[i].docId;
+    t_docId newId = docId <= rctx->maxId ? rctx->idMap[docId] : 0;
+    if (newId) {
+      rng->entries[j++] = (NumericRangeEntry){.docId = newId, .value = rng->entries[i].value};
+    }
+  }
+  // only count leaf entries, inner nodes hold copies of their children's entries
+  if (__isLeaf(n)) {
+    rctx->removed += rng->size - j;
+  }
+  rng->size = j;
+}
+
+size_t NumericRangeTree_Remap(NumericRangeTree *t, const t_docId *idMap, t_docId maxId) {
+  struct __niRemapCtx ctx = {idMap, maxId, 0};
+  NumericRangeNode_Traverse(t->root, __numericIndex_remapCallback, &ctx);
+  t->numEntries -= ctx.removed;
+  return ctx.removed;
+}
+
+struct __niDeleteCtx {
+  t_docId docId;
+  size_t removed;
+};
+
+void __numericIndex_deleteCallback(NumericRangeNode *n, void *ctx) {
+  struct __niDeleteCtx *dctx = ctx;
+  if (!n->range) return;
+
+  // only count leaf entries, inner nodes hold copies of their children's entries
+  if (NumericRange_Delete(n->range, dctx->docId) && __isLeaf(n)) {
+    dctx->removed++;
+  }
+}
+
+size_t NumericRangeTree_Delete(NumericRangeTree *t, t_docId docId) {
+  struct __niDeleteCtx ctx = {docId, 0};
+  NumericRangeNode_Traverse(t->root, __numericIndex_deleteCallback, &ctx);
+  t->numEntries -= ctx.removed;
+  return ctx.removed;
+}
+
+int NumericRangeTree_Update(NumericRangeTree *t, t_docId docId, double value) {
+  NumericRangeTree_Delete(t, docId);
+  return NumericRangeTree_Add(t, docId, value);
+}
+
 void NumericRangeTree_Free(NumericRangeTree *t) {
   NumericRangeNode_Free(t->root);
   RedisModule_Free(t);
@@ -590,12 +703,87 @@ void NumericIndexType_RdbSave(RedisModuleIO *rdb, void *value) {
   NumericRangeNode_Traverse(t->root, __numericIndex_rdbSaveCallback, &ctx);
 }
 
+NumericRangeEntry *NumericRangeTree_Entries(NumericRangeTree *t, size_t *num) {
+  NumericRangeEntry *entries = malloc(MAX(t->numEntries, 1) * sizeof(NumericRangeEntry));
+  size_t n = 0;
+  Vector *leaves = NumericRangeTree_Leaves(t);
+  for (size_t i = 0; i < Vector_Size(leaves); i++) {
+    NumericRange *rng;
+    Vector_Get(leaves, i, &rng);
+    if (!rng) continue;
+    for (uint32_t j = 0; j < rng->size && n < t->numEntries; j++) {
+      entries[n++] = rng->entries[j];
+    }
+  }
+  Vector_Free(leaves);
+
+  qsort(entries, n, sizeof(NumericRangeEntry), __cmd_docId);
+  *num = n;
+  return entries;
+}
+
+size_t NumericRangeTree_DumpEntries(const NumericRangeEntry *entries, size_t num, Buffer *buf) {
+  size_t start = buf->offset;
+  BufferWriter bw = NewBufferWriter(buf);
+  t_docId last = 0;
+  for (size_t i = 0; i < num; i++) {
+    WriteVarint(entries[i].docId - last, &bw);
+    Buffer_Write(&bw, (void *)&entries[i].value, sizeof(double));
+    last = entries[i].docId;
+  }
+  return buf->offset - start;
+}
+
+int NumericRangeTree_Restore(NumericRangeTree *t, const char *data, size_t len) {
+  Buffer b = {.data = (char *)data, .cap = len, .offset = len};
+  BufferReader br = NewBufferReader(&b);
+
+  // make sure all the entries are there before adding any of them
+  int n = 0;
+  while (br.pos < len) {
+    ReadVarint(&br);
+    if (br.pos + sizeof(double) > len) {
+      return -1;
+    }
+    br.pos += sizeof(double);
+    n++;
+  }
+
+  Buffer_Seek(&br, 0);
+  t_docId docId = 0;
+  for (int i = 0; i < n; i++) {
+    docId += (uint32_t)ReadVarint(&br);
+    double value;
+    Buffer_Read(&br, &value, sizeof(double));
+    NumericRangeTree_Add(t, docId, value);
+  }
+  return n;
+}
+
 void NumericIndexType_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+  NumericRangeTree *t = value;
+  size_t num;
+  NumericRangeEntry *entries = NumericRangeTree_Entries(t, &num);
+
+  Buffer buf;
+  Buffer_Init(&buf, 0);
+  for (size_t i = 0; i < num; i += NUMERICINDEX_AOF_CHUNK) {
+    buf.offset = 0;
+    NumericRangeTree_DumpEntries(entries + i, MIN(num - i, NUMERICINDEX_AOF_CHUNK), &buf);
+    RedisModule_EmitAOF(aof, "FT.RESTORE", "scb", key, "NUMERIC", buf.data, buf.offset);
+  }
+  Buffer_Free(&buf);
+  free(entries);
 }
 void NumericIndexType_Digest(RedisModuleDigest *digest, void *value) {
 }
 
+static void __numericIndex_free(void *value) {
+  NumericRangeTree_Free(value);
+}
+
 void NumericIndexType_Free(void *value) {
   NumericRangeTree *t = value;
-  NumericRangeTree_Free(t);
+  // big trees are freed on the lazy free thread, so dropping an index doesn't block redis
+  LazyFree(__numericIndex_free, t, t->numRanges);
 }
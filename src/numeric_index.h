@@ -9,6 +9,7 @@
 #include "redismodule.h"
 #include "search_ctx.h"
 #include "numeric_filter.h"
+#include "buffer.h"
 
 #define RT_LEAF_CARDINALITY_MAX 500
 
@@ -100,6 +101,10 @@ struct indexIterator *NewNumericFilterIterator(NumericRangeTree *t, NumericFilte
  * No deduplication is done */
 int NumericRange_Add(NumericRange *r, t_docId docId, double value, int checkCard);
 
+/* Remove a document's entry from a numeric range node. The range's boundaries and cardinality are
+ * left as they are. Returns 1 if the document was found in the range, 0 otherwise */
+int NumericRange_Delete(NumericRange *r, t_docId docId);
+
 /* Split n into two ranges, lp for left, and rp for right. We split by the median score */
 double NumericRange_Split(NumericRange *n, NumericRangeNode **lp, NumericRangeNode **rp);
 
@@ -123,13 +128,44 @@ NumericRangeTree *NewNumericRangeTree();
 /* Add a value to a tree. Returns 0 if no nodes were split, 1 if we splitted nodes */
 int NumericRangeTree_Add(NumericRangeTree *t, t_docId docId, double value);
 
+/* Remove all the entries of a document from the tree. Since we do not know the document's current
+ * value, every range is searched for it. Returns the number of entries removed */
+size_t NumericRangeTree_Delete(NumericRangeTree *t, t_docId docId);
+
+/* Replace a document's value in the tree in place, keeping its docId. Returns 0 if no nodes were
+ * split, 1 if we splitted nodes */
+int NumericRangeTree_Update(NumericRangeTree *t, t_docId docId, double value);
+
 /* Recursively find all the leaves under tree's root, that correspond to a given min-max range.
  * Returns a vector with range node pointers. */
 Vector *NumericRangeTree_Find(NumericRangeTree *t, double min, double max);
 
+/* All the leaf ranges of the tree, ordered by value. Leaves don't overlap, so this is the order of
+ * all the tree's entries by value, up to the order within each leaf. Returns a vector of range
+ * pointers */
+Vector *NumericRangeTree_Leaves(NumericRangeTree *t);
+
+/* Rewrite the docIds of the tree's entries after a DocTable compaction. idMap maps each docId up to
+ * maxId to its new docId, or to 0 if the document was deleted and its entries should be dropped.
+ * Returns the number of entries removed from the tree */
+size_t NumericRangeTree_Remap(NumericRangeTree *t, const t_docId *idMap, t_docId maxId);
+
 /* Free the tree and all nodes */
 void NumericRangeTree_Free(NumericRangeTree *t);
 
+/* All the entries of the tree, sorted by docId. The caller must free the array */
+NumericRangeEntry *NumericRangeTree_Entries(NumericRangeTree *t, size_t *num);
+
+/* Serialize entries sorted by docId, appending them to buf. Returns the number of bytes written */
+size_t NumericRangeTree_DumpEntries(const NumericRangeEntry *entries, size_t num, Buffer *buf);
+
+/* Add the entries serialized by NumericRangeTree_DumpEntries to the tree. Returns the number of
+ * entries added, or -1 if the data is malformed */
+int NumericRangeTree_Restore(NumericRangeTree *t, const char *data, size_t len);
+
+/* The number of entries in each FT.RESTORE command emitted on AOF rewrite */
+#define NUMERICINDEX_AOF_CHUNK 10000
+
 extern RedisModuleType *NumericIndexType;
 
 NumericRangeTree *OpenNumericIndex(RedisSearchCtx *ctx, const char *fname);
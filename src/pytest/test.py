@@ -3,6 +3,7 @@ import redis
 import unittest
 from hotels import hotels
 import random
+import time
 
 
 class SearchTestCase(ModuleTestCase('../redisearch.so')):
@@ -18,10 +19,11 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                                             'body', 'lorem ist ipsum'))
 
             for _ in r.retry_with_rdb_reload():
-                prefix = 'ft'
-                self.assertExists(r, prefix + ':idx/hello')
-                self.assertExists(r, prefix + ':idx/world')
-                self.assertExists(r, prefix + ':idx/lorem')
+                # the terms are kept in the index, not in keys of their own
+                self.assertListEqual([], r.keys('ft:*'))
+                for term in ('hello', 'world', 'lorem'):
+                    res = r.execute_command('ft.search', 'idx', term, 'nocontent')
+                    self.assertListEqual([1L, 'doc1'], res)
 
     def testUnion(self):
 
@@ -209,6 +211,61 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                 self.assertEqual(1, res[0])
                 self.assertEqual('doc1', res[1])
 
+    def testUpdate(self):
+
+        with self.redis() as r:
+            r.flushdb()
+
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text', 'price', 'numeric', 'sortable'))
+            for i in range(10):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'f', 'hello world', 'price', i))
+
+            self.assertOk(r.execute_command('ft.update', 'idx', 'doc3', 'payload', 'cheap',
+                                            'fields', 'price', 100))
+            with self.assertResponseError():
+                r.execute_command('ft.update', 'idx', 'doc3', 'fields', 'f', 'goodbye')
+            with self.assertResponseError():
+                r.execute_command('ft.update', 'idx', 'doc3', 'fields', 'price', 'foo')
+            with self.assertResponseError():
+                r.execute_command('ft.update', 'idx', 'nosuchdoc', 'fields', 'price', 1)
+
+            for _ in r.retry_with_rdb_reload():
+                res = r.execute_command(
+                    'ft.search', 'idx', 'hello @price:[50 200]', 'nocontent', 'withpayloads')
+                self.assertListEqual([1L, 'doc3', 'cheap'], res)
+
+                res = r.execute_command(
+                    'ft.search', 'idx', 'hello @price:[3 3]', 'nocontent')
+                self.assertListEqual([0L], res)
+
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'sortby', 'price', 'desc', 'limit', 0, 2)
+                self.assertListEqual([10L, 'doc3', 'doc9'], res)
+
+                self.assertEqual('100', r.hget('doc3', 'price'))
+
+            # an invalid geo value fails the update before anything else is changed
+            self.assertOk(r.execute_command(
+                'ft.create', 'places', 'schema', 'loc', 'geo', 'n', 'numeric'))
+            self.assertOk(r.execute_command('ft.add', 'places', 'place1', 1.0, 'fields',
+                                            'loc', '1.5,2.5', 'n', 1))
+            with self.assertResponseError():
+                r.execute_command('ft.update', 'places', 'place1', 'fields',
+                                  'n', 2, 'loc', '1.5,100')
+            self.assertEqual('1', r.hget('place1', 'n'))
+            self.assertEqual('1.5,2.5', r.hget('place1', 'loc'))
+            self.assertListEqual([1L, 'place1'], r.execute_command(
+                'ft.search', 'places', '@n:[1 1]', 'nocontent'))
+
+            self.assertOk(r.execute_command('ft.update', 'places', 'place1', 'fields',
+                                            'n', 2, 'loc', '3.5 4.5'))
+            self.assertEqual('3.5 4.5', r.hget('place1', 'loc'))
+            self.assertListEqual([1L, 'place1'], r.execute_command(
+                'ft.search', 'places', '@n:[2 2]', 'geofilter', 'loc', 3.5, 4.5, 1, 'km',
+                'nocontent'))
+
     def testDrop(self):
         with self.redis() as r:
             r.flushdb()
@@ -219,13 +276,169 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                 self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
                                                 'f', 'hello world', 'n', 666))
 
+            # the documents, the numeric index and the index spec - terms don't have keys
             keys = r.keys('*')
-            self.assertEqual(204, len(keys))
+            self.assertEqual(202, len(keys))
 
             self.assertOk(r.execute_command('ft.drop', 'idx'))
             keys = r.keys('*')
             self.assertEqual(0, len(keys))
 
+    def testDropRecreate(self):
+        with self.redis() as r:
+            r.flushdb()
+            for _ in range(3):
+                self.assertOk(r.execute_command(
+                    'ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric', 'loc', 'geo'))
+
+                for i in range(1000):
+                    self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                    'f', 'hello world %d' % i, 'n', i,
+                                                    'loc', '-0.441,51.458'))
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(1000, res[0])
+
+                # the index and its numeric and geo keys are gone, and the name is free again
+                self.assertOk(r.execute_command('ft.drop', 'idx'))
+                self.assertListEqual([], r.keys('*'))
+                with self.assertResponseError():
+                    r.execute_command('ft.search', 'idx', 'hello')
+
+    def testTermDictionary(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text'))
+
+            for i in range(100):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'f', 'hello world term%d' % i))
+
+            for _ in r.retry_with_rdb_reload():
+                self.assertListEqual([], r.keys('ft:*'))
+                self.assertEqual(101, len(r.keys('*')))
+
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(100, res[0])
+                res = r.execute_command('ft.search', 'idx', 'term42', 'nocontent')
+                self.assertListEqual([1L, 'doc42'], res)
+
+                info = r.execute_command('ft.info', 'idx')
+                res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+                self.assertGreaterEqual(int(res['num_terms']), 102)
+                self.assertEqual(int(res['num_terms']), r.execute_command('ft.optimize', 'idx'))
+                self.assertTrue(float(res['term_dict_size_mb']) > 0)
+
+    def testOptimize(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text'))
+
+            for i in range(250):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'f', 'hello world term%d' % i))
+
+            info = r.execute_command('ft.info', 'idx')
+            res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+            self.assertGreater(float(res['inverted_cap_mb']), float(res['inverted_sz_mb']))
+            self.assertGreater(float(res['inverted_cap_ovh']), 0)
+
+            # trimming the last block of every term leaves no slack
+            self.assertEqual(int(res['num_terms']), r.execute_command('ft.optimize', 'idx'))
+            info = r.execute_command('ft.info', 'idx')
+            res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+            self.assertEqual(res['inverted_cap_mb'], res['inverted_sz_mb'])
+            self.assertEqual(0, float(res['inverted_cap_ovh']))
+
+            res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 0)
+            self.assertEqual(250, res[0])
+
+    def testRepair(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text'))
+
+            for i in range(300):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'f', 'hello world' if i % 3 else 'hello there'))
+            for i in range(0, 300, 3):
+                self.assertEqual(1, r.execute_command('ft.del', 'idx', 'doc%d' % i))
+
+            for _ in r.retry_with_rdb_reload():
+                info = r.execute_command('ft.info', 'idx')
+                res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+                if int(res['gc_deleted_records']) == 0:
+                    continue
+                # every deleted doc left a record in "hello" and one in "there"
+                self.assertEqual(200, int(res['gc_deleted_records']))
+                self.assertEqual(2, int(res['gc_dirty_terms']))
+
+                # the dirtiest terms are repaired first, 10 blocks at a time
+                left = 200
+                repaired = []
+                while left:
+                    rep = r.execute_command('ft.repair', 'idx')
+                    self.assertEqual('idx', rep[0])
+                    self.assertLess(rep[2], left)
+                    repaired.append(rep[1])
+                    left = rep[2]
+                self.assertSetEqual(set(['hello', 'there']), set(repaired))
+                self.assertListEqual(['idx', None, 0L], r.execute_command('ft.repair', 'idx'))
+
+                info = r.execute_command('ft.info', 'idx')
+                res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+                self.assertEqual(0, int(res['gc_dirty_terms']))
+                self.assertEqual(0, float(res['gc_fragmentation']))
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(200, res[0])
+                self.assertListEqual([0L], r.execute_command('ft.search', 'idx', 'there'))
+
+    def testAofRewrite(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command('ft.create', 'idx', 'stopwords', 1, 'foo',
+                                            'schema', 't', 'text', 'price', 'numeric', 'sortable'))
+            for i in range(3000):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0,
+                                                'payload', 'pl%d' % i, 'fields',
+                                                't', 'hello foo world%d' % (i % 10),
+                                                'price', i))
+            for i in range(0, 3000, 7):
+                self.assertEqual(1, r.execute_command('ft.del', 'idx', 'doc%d' % i))
+
+            queries = [['hello', 'limit', 0, 20],
+                       ['world3', 'sortby', 'price', 'desc', 'withpayloads'],
+                       ['hello @price:[100 200]', 'sortby', 'price', 'nocontent', 'limit', 0, 200],
+                       ['foo'],
+                       ['hel*', 'nocontent', 'limit', 0, 0]]
+            before = [r.execute_command('ft.search', 'idx', *q) for q in queries]
+            info = r.execute_command('ft.info', 'idx')
+            before_info = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+
+            # rewrite the AOF and load the index back from it
+            self.assertOk(r.execute_command('config', 'set', 'appendonly', 'yes'))
+            while int(r.info('persistence')['aof_rewrite_in_progress']) or \
+                    int(r.info('persistence')['aof_rewrite_scheduled']):
+                time.sleep(0.1)
+            self.assertOk(r.execute_command('debug', 'loadaof'))
+
+            after = [r.execute_command('ft.search', 'idx', *q) for q in queries]
+            self.assertListEqual(before, after)
+            info = r.execute_command('ft.info', 'idx')
+            after_info = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+            for k in ('num_docs', 'num_terms', 'num_records', 'max_doc_id', 'gc_deleted_records'):
+                self.assertEqual(before_info[k], after_info[k])
+
+            # the restored index keeps working
+            self.assertOk(r.execute_command('ft.add', 'idx', 'newdoc', 1.0, 'fields',
+                                            't', 'hello world3', 'price', 5000))
+            res = r.execute_command('ft.search', 'idx', 'world3', 'sortby', 'price', 'desc',
+                                    'nocontent', 'limit', 0, 1)
+            self.assertListEqual([before[1][0] + 1, 'newdoc'], res)
+            self.assertOk(r.execute_command('config', 'set', 'appendonly', 'no'))
+
     def testCustomStopwords(self):
         with self.redis() as r:
             r.flushdb()
@@ -594,6 +807,250 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                 self.assertEqual(3, res[0])
                 self.assertIn('hotel94', res)
 
+    def testTags(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command('ft.create', 'idx', 'schema', 'title', 'text',
+                                            'tags', 'tag', 'genre', 'tag', 'separators', ';'))
+
+            colors = ['Red', 'Green', 'Blue']
+            for i in range(30):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'title', 'hello world',
+                                                'tags', '%s, Running,%s' % (colors[i % 3], colors[i % 3]),
+                                                'genre', 'Sci-Fi; drama,comedy' if i < 10 else 'drama'))
+            self.assertOk(r.execute_command('ft.add', 'idx', 'doc30', 1.0, 'fields',
+                                            'title', 'red running shoes'))
+
+            for _ in r.retry_with_rdb_reload():
+                # tags match exactly and case insensitively, and are not stemmed
+                res = r.execute_command('ft.search', 'idx', '@tags:red', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(10, res[0])
+                res = r.execute_command('ft.search', 'idx', '@tags:run', 'nocontent')
+                self.assertEqual(0, res[0])
+                res = r.execute_command('ft.search', 'idx', '@tags:running', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(30, res[0])
+
+                # a tag set is a union of tags
+                res = r.execute_command('ft.search', 'idx', 'hello @tags:(red|blue)', 'nocontent',
+                                        'limit', 0, 0)
+                self.assertEqual(20, res[0])
+                res = r.execute_command('ft.search', 'idx', 'hello -@tags:(red|blue)', 'nocontent',
+                                        'limit', 0, 0)
+                self.assertEqual(10, res[0])
+
+                # punctuation in tags is queried as spaces, in an exact phrase
+                res = r.execute_command('ft.search', 'idx', '@genre:"sci fi"', 'nocontent',
+                                        'limit', 0, 0)
+                self.assertEqual(10, res[0])
+                res = r.execute_command('ft.search', 'idx', '@genre:drama', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(20, res[0])
+
+                # text fields don't see the tags, and tag fields don't see the text
+                res = r.execute_command('ft.search', 'idx', 'red', 'nocontent')
+                self.assertEqual([1L, 'doc30'], res)
+                res = r.execute_command('ft.search', 'idx', '@title|tags:red', 'nocontent',
+                                        'limit', 0, 0)
+                self.assertEqual(11, res[0])
+
+                info = r.execute_command('ft.info', 'idx')
+                res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+                fields = {f[0]: f[1:] for f in res['fields']}
+                self.assertEqual(['type', 'TAG', 'separators', ','], fields['tags'][:4])
+                self.assertEqual(4, float(fields['tags'][5]))
+
+            self.assertEqual('@tags:TAG{red}\n',
+                             r.execute_command('ft.explain', 'idx', '@tags:red'))
+            self.assertEqual(1, r.execute_command('ft.del', 'idx', 'doc0'))
+            res = r.execute_command('ft.search', 'idx', '@tags:red', 'nocontent', 'limit', 0, 0)
+            self.assertEqual(9, res[0])
+
+    def testOwnPostings(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command('ft.create', 'idx', 'schema', 'title', 'text',
+                                            'ownpostings', 'body', 'text'))
+            for i in range(20):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'title', 'hello world' if i < 5 else 'foo bar',
+                                                'body', 'hello there'))
+
+            for _ in r.retry_with_rdb_reload():
+                res = r.execute_command('ft.search', 'idx', '@title:hello', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(5, res[0])
+                res = r.execute_command('ft.search', 'idx', '@title:"hello world"', 'nocontent',
+                                        'limit', 0, 0)
+                self.assertEqual(5, res[0])
+                res = r.execute_command('ft.search', 'idx', '@body:hello', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(20, res[0])
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(20, res[0])
+                res = r.execute_command('ft.search', 'idx', 'foo', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(15, res[0])
+                res = r.execute_command('ft.search', 'idx', '@body:foo', 'nocontent')
+                self.assertEqual([0L], res)
+                res = r.execute_command('ft.search', 'idx', 'wor*', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(5, res[0])
+
+                info = r.execute_command('ft.info', 'idx')
+                res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+                fields = {f[0]: f[1:] for f in res['fields']}
+                self.assertEqual('OWNPOSTINGS', fields['title'][4])
+                self.assertEqual(4, float(fields['title'][6]))
+
+    def testRepairFieldDicts(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command('ft.create', 'idx', 'schema', 'title', 'text',
+                                            'ownpostings', 'tags', 'tag'))
+            for i in range(30):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'title', 'hello', 'tags', 'red' if i % 3 else 'blue'))
+            for i in range(0, 30, 3):
+                self.assertEqual(1, r.execute_command('ft.del', 'idx', 'doc%d' % i))
+
+            for _ in r.retry_with_rdb_reload():
+                info = r.execute_command('ft.info', 'idx')
+                res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+                if int(res['gc_deleted_records']) == 0:
+                    continue
+                # every deleted doc left a record in the title's "hello" and in the tag "blue"
+                self.assertEqual(20, int(res['gc_deleted_records']))
+                self.assertEqual(2, int(res['gc_dirty_terms']))
+
+                repaired = []
+                left = 20
+                while left:
+                    rep = r.execute_command('ft.repair', 'idx')
+                    self.assertLess(rep[2], left)
+                    repaired.append(rep[1])
+                    left = rep[2]
+                self.assertSetEqual(set(['hello', 'blue']), set(repaired))
+                self.assertListEqual(['idx', None, 0L], r.execute_command('ft.repair', 'idx'))
+
+                res = r.execute_command('ft.search', 'idx', '@tags:blue', 'nocontent')
+                self.assertEqual([0L], res)
+                res = r.execute_command('ft.search', 'idx', '@title:hello', 'nocontent',
+                                        'limit', 0, 0)
+                self.assertEqual(20, res[0])
+
+    def testWideSchema(self):
+        with self.redis() as r:
+            r.flushdb()
+            args = []
+            for i in range(80):
+                args += ['f%d' % i, 'text']
+            self.assertOk(r.execute_command('ft.create', 'idx', 'schema', *args))
+            for i in range(10):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'f%d' % (i * 8), 'hello', 'f79', 'world'))
+
+            for _ in r.retry_with_rdb_reload():
+                res = r.execute_command('ft.search', 'idx', '@f72:hello', 'nocontent')
+                self.assertEqual([1L, 'doc9'], res)
+                res = r.execute_command('ft.search', 'idx', '@f79:world', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(10, res[0])
+                res = r.execute_command('ft.search', 'idx', 'hello', 'infields', 2, 'f40', 'f48',
+                                        'nocontent', 'limit', 0, 0)
+                self.assertEqual(2, res[0])
+            self.assertEqual('@f72|f79:hello\n',
+                             r.execute_command('ft.explain', 'idx', '@f72|f79:hello'))
+
+    def testSharedDocTable(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command('ft.create', 'idx_en', 'doctable', 'products',
+                                            'schema', 'title', 'text'))
+            self.assertOk(r.execute_command('ft.create', 'idx_attrs', 'doctable', 'products',
+                                            'schema', 'price', 'numeric'))
+            self.assertOk(r.execute_command('ft.create', 'idx_own', 'schema', 'price', 'numeric'))
+            with self.assertResponseError():
+                r.execute_command('ft.create', 'idx_sort', 'doctable', 'products',
+                                  'schema', 'price', 'numeric', 'sortable')
+            for i in range(10):
+                self.assertOk(r.execute_command('ft.add', 'idx_en', 'doc%d' % i, 1.0, 'fields',
+                                                'title', 'hello world' if i % 2 else 'foo bar'))
+            for i in range(10):
+                self.assertOk(r.execute_command('ft.add', 'idx_attrs', 'doc%d' % i, 1.0, 'fields',
+                                                'price', i * 10))
+                self.assertOk(r.execute_command('ft.add', 'idx_own', 'doc%d' % i, 1.0, 'fields',
+                                                'price', i * 10))
+
+            # a document can't be added twice, or before the last document of the index
+            with self.assertResponseError():
+                r.execute_command('ft.add', 'idx_attrs', 'doc3', 1.0, 'fields', 'price', 1)
+            self.assertOk(r.execute_command('ft.add', 'idx_en', 'late1', 1.0, 'fields',
+                                            'title', 'hello'))
+            self.assertOk(r.execute_command('ft.add', 'idx_en', 'late2', 1.0, 'fields',
+                                            'title', 'hello'))
+            self.assertOk(r.execute_command('ft.add', 'idx_attrs', 'late2', 1.0, 'fields',
+                                            'price', 5))
+            with self.assertResponseError():
+                r.execute_command('ft.add', 'idx_attrs', 'late1', 1.0, 'fields', 'price', 5)
+
+            for _ in r.retry_with_rdb_reload():
+                # the documents are stored once, and have the same ids in both indexes
+                self.assertEqual(1, r.exists('dt:products'))
+                for idx in ('idx_en', 'idx_attrs'):
+                    info = r.execute_command('ft.info', idx)
+                    res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+                    self.assertEqual('products', res['doc_table'])
+                    self.assertEqual(12, float(res['max_doc_id']))
+
+                res = r.execute_command('ft.search', 'idx_en', 'hello', 'nocontent',
+                                        'intersect', 'idx_attrs', '@price:[0 50]')
+                self.assertEqual(4, res[0])
+                self.assertEqual(['doc1', 'doc3', 'doc5', 'late2'], sorted(res[1:]))
+                res = r.execute_command('ft.search', 'idx_attrs', '@price:[0 50]', 'nocontent',
+                                        'intersect', 'idx_en', 'hello',
+                                        'intersect', 'idx_en', 'world')
+                self.assertEqual(3, res[0])
+                res = r.execute_command('ft.search', 'idx_en', 'hello', 'nocontent',
+                                        'intersect', 'idx_attrs', '@price:[1000 2000]')
+                self.assertEqual([0L], res)
+
+                # the indexes must share the table
+                with self.assertResponseError():
+                    r.execute_command('ft.search', 'idx_en', 'hello', 'intersect', 'idx_own',
+                                      '@price:[0 50]')
+                with self.assertResponseError():
+                    r.execute_command('ft.search', 'idx_en', 'hello', 'intersect', 'nosuchidx',
+                                      'foo')
+
+            # deleting a document deletes it from all the indexes sharing the table, including
+            # their cached results and stats
+            res = r.execute_command('ft.search', 'idx_en', 'hello', 'nocontent', 'limit', 0, 0)
+            self.assertEqual(7, res[0])
+            self.assertEqual(1, r.execute_command('ft.del', 'idx_attrs', 'doc1'))
+            res = r.execute_command('ft.search', 'idx_en', 'hello', 'nocontent', 'limit', 0, 0)
+            self.assertEqual(6, res[0])
+            info = r.execute_command('ft.info', 'idx_en')
+            res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+            self.assertEqual(11, float(res['num_docs']))
+            self.assertEqual(2, int(res['gc_deleted_records']))
+
+            # and so does replacing it
+            res = r.execute_command('ft.search', 'idx_en', 'foo', 'nocontent', 'limit', 0, 0)
+            self.assertEqual(5, res[0])
+            self.assertOk(r.execute_command('ft.add', 'idx_attrs', 'doc0', 1.0, 'replace',
+                                            'fields', 'price', 7))
+            res = r.execute_command('ft.search', 'idx_en', 'foo', 'nocontent', 'limit', 0, 0)
+            self.assertEqual(4, res[0])
+            with self.assertResponseError():
+                r.execute_command('ft.compact', 'idx_en')
+
+            # dropping an index keeps the table and the documents for the others
+            self.assertOk(r.execute_command('ft.drop', 'idx_attrs'))
+            self.assertEqual(1, r.exists('dt:products'))
+            self.assertEqual(1, r.exists('doc3'))
+            res = r.execute_command('ft.search', 'idx_en', 'hello', 'nocontent', 'limit', 0, 0)
+            self.assertEqual(6, res[0])
+
+            # a document table is only ever restored to the key of a shared table
+            with self.assertResponseError():
+                r.execute_command('ft.restore', 'products', 'doctable', '')
+            self.assertEqual(0, r.exists('products'))
+
     def testAddHash(self):
 
         with self.redis() as r:
@@ -695,6 +1152,32 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                 res = r.execute_command(
                     'ft.search', 'idx', 'foo', 'scorer', 'NOSUCHSCORER')
 
+    def testBM25(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'title', 'text'))
+            self.assertOk(r.execute_command('ft.add', 'idx', 'long', 1.0, 'fields',
+                                            'title', 'hello ' + ' '.join('word%d' % i for i in range(50))))
+            self.assertOk(r.execute_command('ft.add', 'idx', 'short', 1.0, 'fields',
+                                            'title', 'hello world'))
+
+            # BM25 prefers the shorter document with the same term frequency
+            res = r.execute_command(
+                'ft.search', 'idx', 'hello', 'nocontent', 'scorer', 'BM25', 'withscores')
+            self.assertEqual(2, res[0])
+            self.assertEqual('short', res[1])
+            self.assertEqual('long', res[3])
+            self.assertGreater(float(res[2]), float(res[4]))
+
+            # the average document length is maintained as documents are added and deleted
+            info = r.execute_command('ft.info', 'idx')
+            avg = float(info[info.index('doc_len_avg') + 1])
+            self.assertGreater(avg, 2)
+            self.assertEqual(1, r.execute_command('ft.del', 'idx', 'long'))
+            info = r.execute_command('ft.info', 'idx')
+            self.assertEqual(2, float(info[info.index('doc_len_avg') + 1]))
+
     def testFieldSelectors(self):
 
         with self.redis() as r:
@@ -984,6 +1467,155 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
             _, pair = pair
             self.assertEqual(None, pair[1])
 
+    def testCursor(self):
+        self.assertCmdOk('ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric', 'sortable')
+        for i in range(25):
+            self.assertCmdOk('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                             'f', 'hello world', 'n', i)
+
+        # page through all the results, and make sure each page continues the previous one
+        res, cid = self.cmd('ft.search', 'idx', 'hello', 'nocontent', 'sortby', 'n',
+                            'limit', 0, 10, 'withcursor')
+        self.assertEqual(25, res[0])
+        ids = res[1:]
+        self.assertEqual(10, len(ids))
+        self.assertTrue(cid > 0)
+
+        res, cid2 = self.cmd('ft.cursor', 'read', 'idx', cid)
+        self.assertEqual(cid, cid2)
+        ids += res[1:]
+        self.assertEqual(20, len(ids))
+
+        # the last page exhausts the cursor, which is then deleted
+        res, cid2 = self.cmd('ft.cursor', 'read', 'idx', cid, 'count', 100)
+        self.assertEqual(0, cid2)
+        ids += res[1:]
+        self.assertEqual(['doc%d' % i for i in range(25)], ids)
+        with self.assertResponseError():
+            self.cmd('ft.cursor', 'read', 'idx', cid)
+
+        # deleted documents are skipped
+        res, cid = self.cmd('ft.search', 'idx', 'hello', 'nocontent', 'sortby', 'n',
+                            'limit', 0, 5, 'withcursor')
+        self.assertEqual(1, self.cmd('ft.del', 'idx', 'doc5'))
+        res, _ = self.cmd('ft.cursor', 'read', 'idx', cid)
+        self.assertEqual(['doc%d' % i for i in range(6, 11)], res[1:])
+
+        with self.assertResponseError():
+            self.cmd('ft.cursor', 'read', 'other', cid)
+        self.assertOk(self.cmd('ft.cursor', 'del', 'idx', cid))
+        with self.assertResponseError():
+            self.cmd('ft.cursor', 'del', 'idx', cid)
+
+        # a query whose results fit in the first page does not keep a cursor
+        res, cid = self.cmd('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 100,
+                            'withcursor')
+        self.assertEqual(0, cid)
+        self.assertEqual(25, len(res))
+
+    def testQueryCache(self):
+        self.assertCmdOk('ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric')
+        for i in range(10):
+            self.assertCmdOk('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                             'f', 'running dogs' if i % 2 else 'hello world', 'n', i)
+
+        # repeated queries are served from the cache, and must not be affected by the filters
+        # and modifiers of the previous ones
+        for _ in range(3):
+            self.assertEqual(5, self.cmd('ft.search', 'idx', 'run', 'nocontent')[0])
+            self.assertEqual(1, self.cmd('ft.search', 'idx', 'run', 'nocontent',
+                                         'filter', 'n', 0, 1)[0])
+            self.assertEqual(0, self.cmd('ft.search', 'idx', 'run', 'nocontent', 'verbatim')[0])
+            self.assertEqual(2, self.cmd('ft.search', 'idx', '  run   @n:[5 8] ', 'nocontent')[0])
+
+        info = self.cmd('ft.info', 'idx')
+        res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+        self.assertTrue(int(res['query_cache_entries']) > 0)
+        self.assertTrue(float(res['query_cache_hit_rate']) > 0)
+
+    def testProfile(self):
+        self.assertCmdOk('ft.create', 'idx', 'schema', 'f', 'text')
+        for i in range(100):
+            self.assertCmdOk('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                             'f', 'hello world' if i % 2 else 'hello there')
+
+        res, profile = self.cmd('ft.profile', 'idx', 'hello world', 'nocontent', 'limit', 0, 5)
+        self.assertEqual(50, res[0])
+        self.assertEqual(6, len(res))
+        self.assertEqual(res, self.cmd('ft.search', 'idx', 'hello world', 'nocontent',
+                                       'limit', 0, 5))
+
+        prof = {profile[i]: profile[i + 1] for i in range(0, len(profile), 2)}
+        for k in ('parse_time_ms', 'expand_time_ms', 'execute_time_ms', 'score_time_ms',
+                  'serialize_time_ms'):
+            self.assertTrue(float(prof[k]) >= 0)
+        self.assertEqual(50, int(float(prof['results_scored'])))
+        self.assertEqual(50, int(float(prof['heap_offers'])))
+
+        root = prof['iterators']
+        root = {root[i]: root[i + 1] for i in range(0, len(root), 2)}
+        self.assertEqual('INTERSECT', root['iterator'])
+        self.assertEqual(50, int(float(root['hits'])))
+        self.assertEqual(2, len(root['children']))
+
+        with self.assertResponseError():
+            self.cmd('ft.profile', 'nosuchidx', 'hello')
+
+    def testSortedScan(self):
+        self.assertCmdOk('ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric', 'sortable')
+        N = 5000
+        for i in range(N):
+            self.assertCmdOk('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                             'f', 'hello world' if i % 100 else 'hello there', 'n', (i * 7919) % N)
+        byValue = {(i * 7919) % N: 'doc%d' % i for i in range(N)}
+
+        # a query matching most of the index is executed by scanning the sort field in order
+        for asc in (True, False):
+            res, profile = self.cmd('ft.profile', 'idx', 'hello', 'nocontent',
+                                    'sortby', 'n', 'asc' if asc else 'desc', 'limit', 0, 10)
+            values = range(10) if asc else range(N - 1, N - 11, -1)
+            self.assertEqual([byValue[v] for v in values], res[1:])
+            prof = {profile[i]: profile[i + 1] for i in range(0, len(profile), 2)}
+            self.assertTrue(int(float(prof['sorted_scan_ranges'])) > 0)
+            self.assertTrue(int(float(prof['sorted_scan_ranges'])) < N / 10)
+
+        # a selective query just reads all of its matches
+        res, profile = self.cmd('ft.profile', 'idx', 'there', 'nocontent',
+                                'sortby', 'n', 'desc', 'limit', 0, 5)
+        self.assertEqual(50, res[0])
+        expected = sorted(((i * 7919) % N for i in range(0, N, 100)), reverse=True)[:5]
+        self.assertEqual([byValue[v] for v in expected], res[1:])
+        prof = {profile[i]: profile[i + 1] for i in range(0, len(profile), 2)}
+        self.assertEqual(0, int(float(prof['sorted_scan_ranges'])))
+
+    def testResultCache(self):
+        self.assertCmdOk('ft.create', 'idx', 'schema', 'f', 'text')
+        for i in range(10):
+            self.assertCmdOk('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields', 'f', 'hello world')
+
+        res = self.cmd('ft.search', 'idx', 'hello', 'withscores')
+        self.assertEqual(10, res[0])
+        # a repeated search is replied from the cache, the same as the first time
+        self.assertEqual(res, self.cmd('ft.search', 'idx', ' hello ', 'withscores'))
+        self.assertEqual(3, len(self.cmd('ft.search', 'idx', 'hello', 'nocontent',
+                                         'limit', 0, 2)))
+
+        # writes to the index invalidate its cached replies
+        self.assertCmdOk('ft.add', 'idx', 'doc10', 1.0, 'fields', 'f', 'hello there')
+        self.assertEqual(11, self.cmd('ft.search', 'idx', 'hello', 'withscores')[0])
+        self.assertEqual(1, self.cmd('ft.del', 'idx', 'doc10'))
+        self.assertEqual(10, self.cmd('ft.search', 'idx', 'hello', 'withscores')[0])
+        args = ('ft.search', 'idx', 'hello', 'nocontent', 'withpayloads', 'inkeys', 1, 'doc0')
+        self.assertEqual([1, 'doc0', None], self.cmd(*args))
+        self.assertOk(self.cmd('ft.setpayload', 'idx', 'doc0', 'foo'))
+        self.assertEqual([1, 'doc0', 'foo'], self.cmd(*args))
+
+        info = self.cmd('ft.info', 'idx')
+        res = {info[i]: info[i + 1] for i in range(0, len(info), 2)}
+        self.assertTrue(int(res['result_cache_entries']) > 0)
+        self.assertTrue(float(res['result_cache_memory_mb']) > 0)
+        self.assertTrue(float(res['result_cache_hit_rate']) > 0)
+
 
 def grouper(iterable, n, fillvalue=None):
     "Collect data into fixed-length chunks or blocks"
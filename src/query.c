@@ -15,6 +15,8 @@
 #include "ext/default.h"
 #include "rmutil/sds.h"
 #include "concurrent_ctx.h"
+#include "util/arena.h"
+#include "tag_index.h"
 
 #define MAX_PREFIX_EXPANSIONS 200
 
@@ -70,13 +72,66 @@ void QueryNode_Free(QueryNode *n) {
     case QN_PREFX:
       QueryTokenNode_Free(&n->pfx);
       break;
+    case QN_TAG:
+      QueryTokenNode_Free(&n->tag);
+      break;
     case QN_GEO:
     case QN_IDS:
+    case QN_INDEX:
       break;
   }
   free(n);
 }
 
+static QueryNode **QueryNode_CloneChildren(QueryNode **children, int num) {
+  if (!num) return NULL;
+  QueryNode **ret = malloc(num * sizeof(QueryNode *));
+  for (int i = 0; i < num; i++) {
+    ret[i] = QueryNode_Clone(children[i]);
+  }
+  return ret;
+}
+
+QueryNode *QueryNode_Clone(QueryNode *n) {
+  if (!n) return NULL;
+  QueryNode *ret = malloc(sizeof(QueryNode));
+  *ret = *n;
+  switch (n->type) {
+    case QN_TOKEN:
+      ret->tn.str = n->tn.str ? strndup(n->tn.str, n->tn.len) : NULL;
+      break;
+    case QN_PREFX:
+      ret->pfx.str = n->pfx.str ? strndup(n->pfx.str, n->pfx.len) : NULL;
+      break;
+    case QN_TAG:
+      ret->tag.str = n->tag.str ? strndup(n->tag.str, n->tag.len) : NULL;
+      break;
+    case QN_PHRASE:
+      ret->pn.children = QueryNode_CloneChildren(n->pn.children, n->pn.numChildren);
+      break;
+    case QN_UNION:
+      ret->un.children = QueryNode_CloneChildren(n->un.children, n->un.numChildren);
+      break;
+    case QN_NUMERIC:
+      ret->nn.nf = malloc(sizeof(NumericFilter));
+      *ret->nn.nf = *n->nn.nf;
+      if (n->nn.nf->fieldName) ret->nn.nf->fieldName = strdup(n->nn.nf->fieldName);
+      break;
+    case QN_NOT:
+      ret->not.child = QueryNode_Clone(n->not.child);
+      break;
+    case QN_OPTIONAL:
+      ret->opt.child = QueryNode_Clone(n->opt.child);
+      break;
+    case QN_GEO:
+    case QN_IDS:
+    case QN_INDEX:
+      // filters are not owned by their nodes
+      break;
+  }
+  return ret;
+}
+
 static QueryNode *NewQueryNode(QueryNodeType type) {
   QueryNode *s = calloc(1, sizeof(QueryNode));
   s->type = type;
@@ -108,6 +163,16 @@ QueryNode *NewPrefixNode(Query *q, const char *s, size_t len) {
   return ret;
 }
 
+/* Create a tag node of a tag, taking ownership of the string and normalizing it */
+static QueryNode *NewTagNode(char *s, size_t len, t_fieldMask fieldMask) {
+  QueryNode *ret = NewQueryNode(QN_TAG);
+  len = TagIndex_Normalize(s, len);
+  s[len] = '\0';
+  ret->tag = (QueryTagNode){.str = s, .len = len, .expanded = 0, .flags = 0};
+  ret->fieldMask = fieldMask;
+  return ret;
+}
+
 QueryNode *NewUnionNode() {
   QueryNode *ret = NewQueryNode(QN_UNION);
   ret->fieldMask = 0;
@@ -190,6 +255,47 @@ void Query_SetIdFilter(Query *q, IdFilter *f) {
   Query_SetFilterNode(q, NewIdFilterNode(f));
 }
 
+void Query_SetIndexFilter(Query *q, Query *other) {
+  QueryNode *qn = NewQueryNode(QN_INDEX);
+  qn->in.q = other;
+  Query_SetFilterNode(q, qn);
+}
+
+/* Open an iterator of a term in the fields of a mask. The fields with their own postings are read
+ * from their own inverted indexes, and the other fields from the shared one, which isn't read at all
+ * if the mask only selects fields with their own postings. Returns a union if the term is read from
+ * more than one index, or NULL if none of them has it */
+static IndexIterator *Query_OpenTermIterator(Query *q, RSToken *tok, t_fieldMask fm,
+                                             int singleWordMode) {
+  IndexSpec *sp = q->ctx->spec;
+  IndexIterator **its = calloc(sp->numFields + 1, sizeof(IndexIterator *));
+  int n = 0;
+  t_fieldMask shared = fm;
+  for (int i = 0; i < sp->numFields; i++) {
+    FieldSpec *fs = &sp->fields[i];
+    if (!fs->ownPostings) continue;
+    shared &= ~fs->id;
+    if (!(fs->id & fm)) continue;
+    IndexReader *ir = Redis_OpenFieldReader(q->ctx, fs, tok, q->docTable);
+    if (ir) {
+      its[n++] = NewReadIterator(ir);
+    }
+  }
+  if (shared) {
+    // the score index only counts the documents of the shared index
+    IndexReader *ir = Redis_OpenReader(q->ctx, tok, q->docTable, singleWordMode && !n, shared);
+    if (ir) {
+      its[n++] = NewReadIterator(ir);
+    }
+  }
+  if (n <= 1) {
+    IndexIterator *ret = n ? its[0] : NULL;
+    free(its);
+    return ret;
+  }
+  return NewUnionIterator(its, n, q->docTable, 0);
+}
+
 IndexIterator *Query_EvalTokenNode(Query *q, QueryNode *qn) {
   if (qn->type != QN_TOKEN) {
     return NULL;
@@ -200,13 +306,7 @@ IndexIterator *Query_EvalTokenNode(Query *q, QueryNode *qn) {
 
   int isSingleWord = q->numTokens == 1 && q->fieldMask == RS_FIELDMASK_ALL;
 
-  IndexReader *ir =
-      Redis_OpenReader(q->ctx, &qn->tn, q->docTable, isSingleWord, q->fieldMask & qn->fieldMask);
-  if (ir == NULL) {
-    return NULL;
-  }
-
-  return NewReadIterator(ir);
+  return Query_OpenTermIterator(q, &qn->tn, q->fieldMask & qn->fieldMask, isSingleWord);
 }
 
 /* Ealuate a prefix node by expanding all its possible matches and creating one big UNION on all of
@@ -244,13 +344,22 @@ static IndexIterator *Query_EvalPrefixNode(Query *q, QueryNode *qn) {
     tok.str = runesToStr(rstr, slen, &tok.len);
 
     // Open an index reader
-    IndexReader *ir = Redis_OpenReader(q->ctx, &tok, q->docTable, 0, q->fieldMask & qn->fieldMask);
-
-    free(tok.str);
-    if (!ir) continue;
+    IndexIterator *ir = Query_OpenTermIterator(q, &tok, q->fieldMask & qn->fieldMask, 0);
+    if (!ir) {
+      free(tok.str);
+      continue;
+    }
 
     // Add the reader to the iterator array
-    its[itsSz++] = NewReadIterator(ir);
+    its[itsSz] = ir;
+    if (q->profile) {
+      sds label = sdscatlen(sdsnew("TERM "), tok.str, tok.len);
+      QueryProfileNode *pn = QueryProfile_EnterNode(q->profile, label);
+      sdsfree(label);
+      its[itsSz] = QueryProfile_LeaveNode(q->profile, pn, its[itsSz]);
+    }
+    free(tok.str);
+    itsSz++;
     if (itsSz == itsCap) {
       itsCap *= 2;
       its = realloc(its, itsCap * sizeof(*its));
@@ -346,6 +455,39 @@ static IndexIterator *Query_EvalIdFilterNode(Query *q, QueryIdFilterNode *node)
   return NewIdFilterIterator(node->f);
 }
 
+/* The other query is evaluated on its own index, and profiled as a single node of this one */
+static IndexIterator *Query_EvalIndexNode(Query *q, QueryIndexNode *node) {
+  Query *other = node->q;
+  return other->root ? Query_EvalNode(other, other->root) : NULL;
+}
+
+/* Evaluate a tag node into the reader of its tag's index in each of the tag fields it selects, or a
+ * union of them if there are several */
+static IndexIterator *Query_EvalTagNode(Query *q, QueryNode *qn) {
+  if (qn->type != QN_TAG || !q->ctx || !q->ctx->spec) {
+    return NULL;
+  }
+  IndexSpec *sp = q->ctx->spec;
+  t_fieldMask fm = q->fieldMask & qn->fieldMask;
+
+  IndexIterator **its = calloc(sp->numFields, sizeof(IndexIterator *));
+  int n = 0;
+  for (int i = 0; i < sp->numFields; i++) {
+    FieldSpec *fs = &sp->fields[i];
+    if (fs->type != F_TAG || !(fs->id & fm)) continue;
+    IndexIterator *it = TagIndex_OpenReader(fs, q->docTable, &qn->tag);
+    if (it) {
+      its[n++] = it;
+    }
+  }
+  if (n <= 1) {
+    IndexIterator *ret = n ? its[0] : NULL;
+    free(its);
+    return ret;
+  }
+  return NewUnionIterator(its, n, q->docTable, 0);
+}
+
 static IndexIterator *Query_EvalUnionNode(Query *q, QueryNode *qn) {
   if (qn->type != QN_UNION) {
     return NULL;
@@ -377,7 +519,7 @@ static IndexIterator *Query_EvalUnionNode(Query *q, QueryNode *qn) {
   return ret;
 }
 
-IndexIterator *Query_EvalNode(Query *q, QueryNode *n) {
+static IndexIterator *Query_evalNode(Query *q, QueryNode *n) {
   switch (n->type) {
     case QN_TOKEN:
       return Query_EvalTokenNode(q, n);
@@ -397,11 +539,57 @@ IndexIterator *Query_EvalNode(Query *q, QueryNode *n) {
       return Query_EvalGeofilterNode(q, &n->gn);
     case QN_IDS:
       return Query_EvalIdFilterNode(q, &n->fn);
+    case QN_TAG:
+      return Query_EvalTagNode(q, n);
+    case QN_INDEX:
+      return Query_EvalIndexNode(q, &n->in);
   }
 
   return NULL;
 }
 
+/* Describe a query node for the profile of its iterator */
+static sds QueryNode_ProfileLabel(QueryNode *n) {
+  switch (n->type) {
+    case QN_TOKEN:
+      return sdscatlen(sdsnew(n->tn.expanded ? "TERM(expanded) " : "TERM "), n->tn.str, n->tn.len);
+    case QN_PREFX:
+      return sdscat(sdscatlen(sdsnew("PREFIX "), n->pfx.str, n->pfx.len), "*");
+    case QN_PHRASE:
+      return sdsnew(n->pn.exact ? "EXACT" : "INTERSECT");
+    case QN_UNION:
+      return sdsnew("UNION");
+    case QN_NOT:
+      return sdsnew("NOT");
+    case QN_OPTIONAL:
+      return sdsnew("OPTIONAL");
+    case QN_NUMERIC:
+      return sdscatprintf(sdsnew("NUMERIC "), "%s [%g %g]", n->nn.nf->fieldName, n->nn.nf->min,
+                          n->nn.nf->max);
+    case QN_GEO:
+      return sdscatprintf(sdsnew("GEO "), "%s", n->gn.gf->property);
+    case QN_IDS:
+      return sdsnew("IDS");
+    case QN_TAG:
+      return sdscatlen(sdsnew("TAG "), n->tag.str, n->tag.len);
+    case QN_INDEX:
+      return sdscat(sdsnew("INDEX "), n->in.q->ctx->spec->name);
+  }
+  return sdsnew("UNKNOWN");
+}
+
+IndexIterator *Query_EvalNode(Query *q, QueryNode *n) {
+  if (!q->profile) {
+    return Query_evalNode(q, n);
+  }
+
+  // profiled queries wrap the iterator of every node, in the same tree as the nodes
+  sds label = QueryNode_ProfileLabel(n);
+  QueryProfileNode *pn = QueryProfile_EnterNode(q->profile, label);
+  sdsfree(label);
+  return QueryProfile_LeaveNode(q->profile, pn, Query_evalNode(q, n));
+}
+
 void QueryPhraseNode_AddChild(QueryNode *parent, QueryNode *child) {
   QueryPhraseNode *pn = &parent->pn;
   // printf("parent mask %x, child mask %x\n", parent->fieldMask, child->fieldMask);
@@ -438,7 +626,7 @@ Query *NewQueryFromRequest(RSSearchRequest *req) {
                req->flags & Search_NoStopwrods ? NULL : req->sctx->spec->stopwords, req->expander,
                req->slop, req->flags & Search_InOrder, req->scorer, req->payload, req->sortBy);
 
-  q->docTable = &req->sctx->spec->docs;
+  q->docTable = req->sctx->spec->docs;
 
   return q;
 }
@@ -467,8 +655,18 @@ Query *NewQuery(RedisSearchCtx *ctx, const char *query, size_t len, int offset,
 
   /* Get the scorer - falling back to TF-IDF scoring if not found */
   ret->scorer = NULL;
+  ret->batchScorer = NULL;
   ret->scorerCtx.privdata = NULL;
   ret->scorerCtx.payload = payload;
+  ret->scorerCtx.indexStats = (RSIndexStats){0};
+  if (ctx && ctx->spec) {
+    IndexStats *st = &ctx->spec->stats;
+    ret->scorerCtx.indexStats = (RSIndexStats){
+        .numDocs = st->numDocuments,
+        .numTerms = st->numTerms,
+        .avgDocLen = st->numDocuments ? (double)st->totalDocsLen / (double)st->numDocuments : 0,
+    };
+  }
   ret->scorerFree = NULL;
   ExtScoringFunctionCtx *scx =
       Extensions_GetScoringFunction(&ret->scorerCtx, scorer ? scorer : DEFAULT_SCORER_NAME);
@@ -478,6 +676,7 @@ Query *NewQuery(RedisSearchCtx *ctx, const char *query, size_t len, int offset,
   if (scx) {
 
     ret->scorer = scx->sf;
+    ret->batchScorer = scx->bsf;
     ret->scorerFree = scx->ff;
   }
 
@@ -522,6 +721,124 @@ void Query_Expand(Query *q) {
   }
 }
 
+/* Drop the children of a phrase or union node resolved to NULL. Returns the number left */
+static int resolvedChildren(QueryNode **children, int num) {
+  int n = 0;
+  for (int i = 0; i < num; i++) {
+    if (children[i]) children[n++] = children[i];
+  }
+  return n;
+}
+
+/* Resolve a node under a field mask. A token or an exact phrase whose field mask selects tag fields
+ * becomes a tag node, or a union of itself and a tag node if the mask selects text fields too.
+ *
+ * Stopwords are parsed like any other term, since tags keep them. The stopword tokens that don't
+ * become tags are dropped here, and so are the nodes they leave without children. Returns NULL if
+ * nothing is left of the node */
+static QueryNode *QueryNode_Resolve(Query *q, QueryNode *n, t_fieldMask mask, t_fieldMask tagMask) {
+  t_fieldMask fm = n->fieldMask & mask;
+  // a node without a modifier keeps the default mask, and only searches the text fields
+  int tagged = fm != RS_FIELDMASK_ALL && (fm & tagMask);
+  QueryNode *tag = NULL;
+
+  switch (n->type) {
+    case QN_TOKEN:
+      if (tagged) {
+        tag = NewTagNode(strndup(n->tn.str, n->tn.len), n->tn.len, fm & tagMask);
+      }
+      if (StopWordList_Contains(q->stopwords, n->tn.str, n->tn.len)) {
+        q->numTokens--;
+        QueryNode_Free(n);
+        return tag;
+      }
+      break;
+
+    case QN_PHRASE: {
+      // the words of an exact phrase are a single multi-word tag
+      int words = tagged && n->pn.exact;
+      size_t len = 0;
+      for (int i = 0; i < n->pn.numChildren && words; i++) {
+        words = n->pn.children[i]->type == QN_TOKEN;
+        if (words) len += n->pn.children[i]->tn.len + 1;
+      }
+      if (words && len) {
+        char *s = malloc(len);
+        size_t pos = 0;
+        for (int i = 0; i < n->pn.numChildren; i++) {
+          if (i) s[pos++] = ' ';
+          memcpy(s + pos, n->pn.children[i]->tn.str, n->pn.children[i]->tn.len);
+          pos += n->pn.children[i]->tn.len;
+        }
+        tag = NewTagNode(s, pos, fm & tagMask);
+        // the text part of the phrase, if any, is still matched without its stopwords
+      }
+      for (int i = 0; i < n->pn.numChildren; i++) {
+        n->pn.children[i] = QueryNode_Resolve(q, n->pn.children[i], tag ? fm & ~tagMask : fm,
+                                              tag ? 0 : tagMask);
+      }
+      n->pn.numChildren = resolvedChildren(n->pn.children, n->pn.numChildren);
+      if (!n->pn.numChildren) {
+        QueryNode_Free(n);
+        return tag;
+      }
+      break;
+    }
+
+    case QN_UNION:
+      for (int i = 0; i < n->un.numChildren; i++) {
+        n->un.children[i] = QueryNode_Resolve(q, n->un.children[i], fm, tagMask);
+      }
+      n->un.numChildren = resolvedChildren(n->un.children, n->un.numChildren);
+      if (!n->un.numChildren) {
+        QueryNode_Free(n);
+        return NULL;
+      }
+      break;
+
+    case QN_NOT:
+    case QN_OPTIONAL:
+      if (n->not.child) {
+        n->not.child = QueryNode_Resolve(q, n->not.child, fm, tagMask);
+      }
+      // negating or making optional nothing is nothing
+      if (!n->not.child) {
+        QueryNode_Free(n);
+        return NULL;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  if (!tag) {
+    return n;
+  }
+  if (!(fm & ~tagMask)) {
+    QueryNode_Free(n);
+    return tag;
+  }
+  n->fieldMask = fm & ~tagMask;
+  QueryNode *un = NewUnionNode();
+  QueryUnionNode_AddChild(un, n);
+  QueryUnionNode_AddChild(un, tag);
+  return un;
+}
+
+QueryNode *Query_ResolveTags(Query *q, QueryNode *root) {
+  if (!root) {
+    return root;
+  }
+  t_fieldMask tagMask = 0;
+  for (int i = 0; q->ctx && q->ctx->spec && i < q->ctx->spec->numFields; i++) {
+    if (q->ctx->spec->fields[i].type == F_TAG) {
+      tagMask |= q->ctx->spec->fields[i].id;
+    }
+  }
+  return QueryNode_Resolve(q, root, RS_FIELDMASK_ALL, tagMask);
+}
+
 static sds doPad(sds s, int len) {
   if (!len) return s;
 
@@ -539,15 +856,16 @@ static sds QueryNode_DumpSds(sds s, Query *q, QueryNode *qs, int depth) {
   }
 
   if (qs->fieldMask && qs->fieldMask != RS_FIELDMASK_ALL && qs->type != QN_NUMERIC &&
-      qs->type != QN_IDS) {
+      qs->type != QN_IDS && qs->type != QN_INDEX) {
     if (!q->ctx) {
-      s = sdscatprintf(s, "@%x", qs->fieldMask);
+      // without an index there are no field names to print, only the low bits of the mask
+      s = sdscatprintf(s, "@%llx", (unsigned long long)qs->fieldMask);
     } else {
       s = sdscat(s, "@");
-      uint32_t fm = qs->fieldMask;
+      t_fieldMask fm = qs->fieldMask;
       int i = 0, n = 0;
       while (fm) {
-        uint32_t bit = (fm & 1) << i;
+        t_fieldMask bit = (fm & 1) << i;
         if (bit) {
           char *f = GetFieldNameByBit(q->ctx->spec, bit);
           s = sdscatprintf(s, "%s%s", n ? "|" : "", f ? f : "n/a");
@@ -577,6 +895,10 @@ static sds QueryNode_DumpSds(sds s, Query *q, QueryNode *qs, int depth) {
       s = sdscatprintf(s, "PREFIX{%s*", (char *)qs->pfx.str);
       break;
 
+    case QN_TAG:
+      s = sdscatprintf(s, "TAG{%s", (char *)qs->tag.str);
+      break;
+
     case QN_NOT:
       s = sdscat(s, "NOT{\n");
       s = QueryNode_DumpSds(s, q, qs->not.child, depth + 1);
@@ -613,6 +935,15 @@ static sds QueryNode_DumpSds(sds s, Query *q, QueryNode *qs, int depth) {
         s = sdscatprintf(s, "%d,", qs->fn.f->ids[i]);
       }
       break;
+    case QN_INDEX: {
+      // the other query's fields are named by its own index
+      Query *other = qs->in.q;
+      s = sdscatprintf(s, "INDEX %s {\n", other->ctx->spec->name);
+      if (other->root) {
+        s = QueryNode_DumpSds(s, other, other->root, depth + 1);
+      }
+      s = doPad(s, depth);
+    } break;
   }
 
   s = sdscat(s, "}\n");
@@ -685,6 +1016,358 @@ static int sortByCmp(const void *e1, const void *e2, const void *udata) {
   return RSSortingVector_Cmp(h1->sv, h2->sv, (RSSortingKey *)sk);
 }
 
+/* Collections bigger than this are not kept for reuse, so that one huge LIMIT doesn't pin memory */
+#define TOPN_MAX_CACHED 10000
+
+/* The memory of a top-N collection - the heap and a contiguous array holding all of its hits. At
+ * most N hits are in the heap and one more is being filled, so N + 1 hits are all we ever need.
+ * It is kept per thread and reused by the queries running on it, so collecting results does no
+ * allocations once a thread has served a query with as many results */
+typedef struct {
+  heap_t *heap;
+  heapResult *hits;
+  size_t cap;
+  size_t used;
+  // set for unbounded collections, that keep all the hits in a growing heap. Their hits come from
+  // the arena since the heap holds pointers to them
+  arena_t *arena;
+} topNCollector;
+
+static __thread topNCollector __topN = {0};
+
+/* Get this thread's collector, ready for collecting n hits */
+static topNCollector *topNCollector_Get(size_t n,
+                                        int (*cmp)(const void *, const void *, const void *),
+                                        const void *udata) {
+  topNCollector *c = &__topN;
+  if (n > c->cap) {
+    free(c->heap);
+    free(c->hits);
+    c->cap = n;
+    c->heap = malloc(heap_sizeof(n));
+    c->hits = malloc((n + 1) * sizeof(heapResult));
+  }
+  heap_init(c->heap, cmp, udata, n);
+  c->used = 0;
+  return c;
+}
+
+/* Get a new collector that keeps all the hits it is offered, for queries that collect all of their
+ * results */
+static topNCollector *topNCollector_GetUnbounded(int (*cmp)(const void *, const void *,
+                                                            const void *),
+                                                 const void *udata) {
+  topNCollector *c = malloc(sizeof(*c));
+  *c = (topNCollector){.heap = heap_new(cmp, udata), .arena = arena_new(0)};
+  return c;
+}
+
+/* Take an unused hit from the collector */
+static inline heapResult *topNCollector_NewHit(topNCollector *c) {
+  if (c->arena) {
+    return arena_alloc(c->arena, sizeof(heapResult));
+  }
+  return &c->hits[c->used++];
+}
+
+/* Done with the collector. Very big collections are released instead of being kept for reuse */
+static void topNCollector_Release(topNCollector *c) {
+  if (c->arena) {
+    heap_free(c->heap);
+    arena_destroy(c->arena);
+    free(c);
+    return;
+  }
+  if (c->cap > TOPN_MAX_CACHED) {
+    free(c->heap);
+    free(c->hits);
+    *c = (topNCollector){0};
+  }
+}
+
+/* Offer a hit to the top-N heap. Returns the hit if it didn't make it into the heap, or the hit it
+ * pushed out of the heap, so it can be reused for the next result. Returns NULL if the heap kept
+ * the hit and was not full yet, which is always the case for unbounded collections */
+static heapResult *offerHit(topNCollector *c, heapResult *h, RSSortingKey *sortKey,
+                            double *minScore) {
+  if (c->arena) {
+    heap_offer(&c->heap, h);
+    return NULL;
+  }
+
+  heap_t *pq = c->heap;
+  if (heap_count(pq) < heap_size(pq)) {
+    heap_offerx(pq, h);
+    if (heap_count(pq) == heap_size(pq)) {
+      heapResult *minh = heap_peek(pq);
+      *minScore = minh->score;
+    }
+    return NULL;
+  }
+
+  /* In SORTBY mode - compare the hit with the lowest ranked entry in the heap */
+  if (sortKey) {
+    heapResult *minh = heap_peek(pq);
+
+    /* if the current hit should be in the heap - remoe the lowest hit and add the new hit */
+    if (sortByCmp(h, minh, sortKey) < 0) {
+      heapResult *ret = heap_poll(pq);
+      heap_offerx(pq, h);
+      return ret;
+    }
+    /* The current should not enter the pool, so just leave it as is */
+    return h;
+  }
+
+  /* In Scored mode - compare scores with the lowest ranked result */
+  if (h->score >= *minScore) {
+    heapResult *ret = heap_poll(pq);
+    heap_offerx(pq, h);
+
+    // get the new min score
+    heapResult *minh = heap_peek(pq);
+    *minScore = minh->score;
+    return ret;
+  }
+  return h;
+}
+
+/* The engine side of a scoring batch - the arrays handed to batch scoring functions, and the
+ * storage behind them. Results read from the iterators are reused by the next read, so the batch
+ * keeps copies of the result trees in an arena that is reset on every flush */
+typedef struct {
+  RSScoringBatch batch;
+  t_docId docIds[RS_SCORING_BATCH_SIZE];
+  RSDocumentMetadata *dmds[RS_SCORING_BATCH_SIZE];
+  float docScores[RS_SCORING_BATCH_SIZE];
+  uint32_t maxFreqs[RS_SCORING_BATCH_SIZE];
+  uint32_t docLens[RS_SCORING_BATCH_SIZE];
+  RSIndexResult *results[RS_SCORING_BATCH_SIZE];
+  size_t termsOffset[RS_SCORING_BATCH_SIZE + 1];
+  double scores[RS_SCORING_BATCH_SIZE];
+  size_t termsCap;
+  arena_t *arena;
+} scoringBatch;
+
+static void scoringBatch_Init(scoringBatch *b) {
+  b->termsCap = RS_SCORING_BATCH_SIZE * 4;
+  b->arena = arena_new(0);
+  b->batch = (RSScoringBatch){
+      .numResults = 0,
+      .docIds = b->docIds,
+      .dmds = b->dmds,
+      .docScores = b->docScores,
+      .maxFreqs = b->maxFreqs,
+      .docLens = b->docLens,
+      .results = b->results,
+      .termsOffset = b->termsOffset,
+      .termFreqs = malloc(b->termsCap * sizeof(uint32_t)),
+      .terms = malloc(b->termsCap * sizeof(RSQueryTerm *)),
+      .scores = b->scores,
+  };
+  b->termsOffset[0] = 0;
+}
+
+static void scoringBatch_Free(scoringBatch *b) {
+  free(b->batch.termFreqs);
+  free(b->batch.terms);
+  arena_destroy(b->arena);
+}
+
+/* Copy a result tree into the batch arena, flattening its term records into the term arrays */
+static RSIndexResult *scoringBatch_copyResult(scoringBatch *b, RSIndexResult *r, size_t *numTerms) {
+  RSIndexResult *c = arena_alloc(b->arena, sizeof(RSIndexResult));
+  *c = *r;
+
+  switch (r->type) {
+    case RSResultType_Term:
+      if (*numTerms == b->termsCap) {
+        b->termsCap *= 2;
+        b->batch.termFreqs = realloc(b->batch.termFreqs, b->termsCap * sizeof(uint32_t));
+        b->batch.terms = realloc(b->batch.terms, b->termsCap * sizeof(RSQueryTerm *));
+      }
+      b->batch.termFreqs[*numTerms] = r->freq;
+      b->batch.terms[*numTerms] = r->term.term;
+      ++*numTerms;
+      break;
+
+    case RSResultType_Intersection:
+    case RSResultType_Union:
+      c->agg.childrenCap = r->agg.numChildren;
+      c->agg.children = arena_alloc(b->arena, MAX(1, r->agg.numChildren) * sizeof(RSIndexResult *));
+      for (int i = 0; i < r->agg.numChildren; i++) {
+        c->agg.children[i] = scoringBatch_copyResult(b, r->agg.children[i], numTerms);
+      }
+      break;
+
+    default:
+      break;
+  }
+  return c;
+}
+
+/* Add a result to the batch. Returns 1 if the batch is full and needs to be flushed */
+static int scoringBatch_Add(scoringBatch *b, RSIndexResult *r, RSDocumentMetadata *dmd) {
+  size_t i = b->batch.numResults++;
+  size_t numTerms = b->termsOffset[i];
+  b->docIds[i] = r->docId;
+  b->dmds[i] = dmd;
+  b->docScores[i] = dmd->score;
+  b->maxFreqs[i] = dmd->maxFreq;
+  b->docLens[i] = dmd->len;
+  b->results[i] = scoringBatch_copyResult(b, r, &numTerms);
+  b->termsOffset[i + 1] = numTerms;
+  return b->batch.numResults == RS_SCORING_BATCH_SIZE;
+}
+
+/* Score all the results in the batch and offer them to the heap, then empty the batch */
+static heapResult *scoringBatch_Flush(scoringBatch *b, Query *q, topNCollector *topN,
+                                      heapResult *pooledHit, double *minScore) {
+  if (b->batch.numResults == 0) {
+    return pooledHit;
+  }
+
+  QueryProfile *prof = q->profile;
+  double start = prof ? QueryProfile_Now() : 0;
+  q->batchScorer(&q->scorerCtx, &b->batch, *minScore);
+  if (prof) {
+    prof->scoreTime += QueryProfile_Now() - start;
+    prof->numScored += b->batch.numResults;
+  }
+
+  for (size_t i = 0; i < b->batch.numResults; i++) {
+    heapResult *h = pooledHit ? pooledHit : topNCollector_NewHit(topN);
+    h->docId = b->docIds[i];
+    h->score = b->scores[i];
+    h->sv = NULL;
+    pooledHit = offerHit(topN, h, NULL, minScore);
+    if (prof) {
+      prof->numOffered++;
+      prof->numInserted += pooledHit != h;
+    }
+  }
+
+  b->batch.numResults = 0;
+  arena_reset(b->arena);
+  return pooledHit;
+}
+
+/* Sorted queries first read this many matches the usual way, and estimate from them how many
+ * documents the query matches, to choose whether to go on by scanning the sort field in order */
+#define SORTED_SCAN_PROBE 1000
+
+/* The cost of checking one document of the sort field's index against the query in a sorted scan,
+ * relative to reading one match in a full scan. Every document is a skip on the query's iterators,
+ * and they are rebuilt for every range of the index */
+#define SORTED_SCAN_DOC_COST 4
+
+/* The numeric index of the field a query is sorted by, if the query can be executed by scanning the
+ * index in sort order */
+static NumericRangeTree *Query_sortedScanIndex(Query *q) {
+  if (!q->sortKey || q->collectLimit || !q->ctx || !q->ctx->redisCtx) {
+    return NULL;
+  }
+  IndexSpec *sp = q->ctx->spec;
+  for (int i = 0; i < sp->numFields; i++) {
+    FieldSpec *fs = &sp->fields[i];
+    if (!fs->sortable || fs->sortIdx != q->sortKey->index) continue;
+    if (fs->type != F_NUMERIC) {
+      return NULL;
+    }
+
+    NumericRangeTree *t = OpenNumericIndex(q->ctx, fs->name);
+    // documents without a value are not in the numeric index, and ascending sorts put them first.
+    // So an ascending scan needs every document to have a value
+    if (t && q->sortKey->ascending && t->numEntries < sp->docs->maxDocId) {
+      return NULL;
+    }
+    return t;
+  }
+  return NULL;
+}
+
+/* The sort value of a hit, for comparing with the bounds of numeric ranges. Documents without a
+ * value sort before all values when ascending and after them when descending, so they compare as
+ * minus infinity either way */
+static double heapResult_sortValue(heapResult *h, RSSortingKey *sk) {
+  RSSortableValue *v = h->sv ? RSSortingVector_Get(h->sv, sk) : NULL;
+  return v && v->type == RS_SORTABLE_NUM ? v->num : NF_NEGATIVE_INFINITY;
+}
+
+/* Go on with a sorted query by scanning the leaf ranges of the sort field's numeric index in sort
+ * order, intersecting each with a fresh copy of the query's iterators. The matches up to docId
+ * probedUpTo were already offered to the heap. The scan stops once the heap is full and no document
+ * in the next range can make it in.
+ *
+ * Returns 1 if the heap holds the final results, or 0 if there may still be matches without a value
+ * that belong in it. Those are not in the numeric index, so the caller has to look for them */
+static int Query_sortedScan(Query *q, NumericRangeTree *t, topNCollector *topN,
+                            t_docId probedUpTo, heapResult **pooledHit, double *minScore) {
+  static NumericFilter allValues = {.min = NF_NEGATIVE_INFINITY,
+                                    .max = NF_INFINITY,
+                                    .inclusiveMin = 1,
+                                    .inclusiveMax = 1};
+  RSSortingKey *sk = q->sortKey;
+  DocTable *dt = q->ctx->spec->docs;
+  heap_t *pq = topN->heap;
+  ConcurrentSearchCtx *cxc = &q->conc;
+
+  // the iterators are rebuilt for every range, so they are left out of the profile
+  QueryProfile *prof = q->profile;
+  q->profile = NULL;
+
+  Vector *leaves = NumericRangeTree_Leaves(t);
+  int n = Vector_Size(leaves);
+  int done = 0;
+  for (int i = 0; i < n && !done; i++) {
+    NumericRange *rng;
+    Vector_Get(leaves, sk->ascending ? i : n - 1 - i, &rng);
+
+    if (heap_count(pq) == heap_size(pq)) {
+      double worst = heapResult_sortValue(heap_peek(pq), sk);
+      if (sk->ascending ? worst <= rng->minVal : worst >= rng->maxVal) {
+        done = 1;
+        break;
+      }
+    }
+
+    IndexIterator *qit = rng->size ? Query_EvalNode(q, q->root) : NULL;
+    if (!qit) continue;
+    IndexIterator **its = calloc(2, sizeof(IndexIterator *));
+    its[0] = NewNumericRangeIterator(rng, &allValues);
+    its[1] = qit;
+    IndexIterator *it = NewIntersecIterator(its, 2, dt, RS_FIELDMASK_ALL, -1, 0);
+
+    RSIndexResult *r;
+    int rc;
+    while ((rc = it->Read(it->ctx, &r)) != INDEXREAD_EOF) {
+      if (rc == INDEXREAD_NOTFOUND || !r || r->docId <= probedUpTo) continue;
+
+      RSDocumentMetadata *dmd = DocTable_Get(dt, r->docId);
+      if (!dmd || dmd->flags & Document_Deleted) continue;
+
+      heapResult *h = *pooledHit ? *pooledHit : topNCollector_NewHit(topN);
+      h->docId = r->docId;
+      h->sv = dmd->sortVector;
+      h->score = 0;
+      *pooledHit = offerHit(topN, h, sk, minScore);
+      if (prof) {
+        prof->numOffered++;
+        prof->numInserted += *pooledHit != h;
+      }
+      CONCURRENT_CTX_TICK(cxc);
+    }
+    it->Free(it);
+    if (prof) prof->sortedScanRanges++;
+  }
+
+  q->profile = prof;
+  Vector_Free(leaves);
+  // having scanned all the ranges, all the matches with a value were seen. Ascending scans are only
+  // made when all documents have one
+  return done || sk->ascending;
+}
+
 QueryResult *Query_Execute(Query *query) {
   // QueryNode_Print(query, query->root, 0);
   QueryResult *res = malloc(sizeof(QueryResult));
@@ -710,27 +1393,34 @@ QueryResult *Query_Execute(Query *query) {
 
   int num = query->offset + query->limit;
 
-  heap_t *pq = malloc(heap_sizeof(num));
-  if (sortByMode) {
-    heap_init(pq, sortByCmp, query->sortKey, num);
-  } else {
-    heap_init(pq, cmpHits, NULL, num);
-  }
+  int (*cmp)(const void *, const void *, const void *) = sortByMode ? sortByCmp : cmpHits;
+  topNCollector *topN = query->collectLimit ? topNCollector_GetUnbounded(cmp, query->sortKey)
+                                            : topNCollector_Get(num, cmp, query->sortKey);
 
   heapResult *pooledHit = NULL;
   double minScore = 0;
   int numDeleted = 0;
   RSIndexResult *r = NULL;
   ConcurrentSearchCtx *cxc = &query->conc;
+  QueryProfile *prof = query->profile;
+
+  // if the scorer can score whole blocks of results, we collect them into batches
+  scoringBatch *batch = NULL;
+  if (!sortByMode && query->batchScorer) {
+    batch = malloc(sizeof(scoringBatch));
+    scoringBatch_Init(batch);
+  }
+
+  // a sorted query may switch to scanning its sort field in order, once it has read enough
+  // matches to tell if that's cheaper. If that scan can't find the matches without a value, the
+  // rest of the query only looks for those
+  NumericRangeTree *sortedIndex = sortByMode ? Query_sortedScanIndex(query) : NULL;
+  size_t numMatched = 0;
+  int sortedScanDone = 0;
+  int nilOnly = 0;
 
   // iterate the root iterator and push everything to the PQ
   while (1) {
-    // TODO - Use static allocation
-    if (pooledHit == NULL) {
-      pooledHit = malloc(sizeof(heapResult));
-    }
-    heapResult *h = pooledHit;
-
     // Read the next result from the execution tree
     int rc = it->Read(it->ctx, &r);
 
@@ -741,7 +1431,7 @@ QueryResult *Query_Execute(Query *query) {
       continue;
     }
 
-    RSDocumentMetadata *dmd = DocTable_Get(&query->ctx->spec->docs, r->docId);
+    RSDocumentMetadata *dmd = DocTable_Get(query->ctx->spec->docs, r->docId);
 
     // skip deleted documents
     if (!dmd || dmd->flags & Document_Deleted) {
@@ -749,10 +1439,39 @@ QueryResult *Query_Execute(Query *query) {
       continue;
     }
 
+    if (nilOnly) {
+      RSSortableValue *v =
+          dmd->sortVector ? RSSortingVector_Get(dmd->sortVector, query->sortKey) : NULL;
+      if (v && v->type != RS_SORTABLE_NIL) continue;
+    }
+
+    if (batch) {
+      // the batch holds pointers into the index, so we only let other threads run once it's flushed
+      if (scoringBatch_Add(batch, r, dmd)) {
+        pooledHit = scoringBatch_Flush(batch, query, topN, pooledHit, &minScore);
+        if (query->collectLimit && heap_count(topN->heap) > query->collectLimit) {
+          break;
+        }
+        CONCURRENT_CTX_TICK_N(cxc, RS_SCORING_BATCH_SIZE);
+      }
+      continue;
+    }
+
+    if (pooledHit == NULL) {
+      pooledHit = topNCollector_NewHit(topN);
+    }
+    heapResult *h = pooledHit;
+
     /* Call the query scoring function to calculate the score */
     if (sortByMode) {
       h->sv = dmd->sortVector;
       h->score = 0;
+    } else if (prof) {
+      double start = QueryProfile_Now();
+      h->score = query->scorer(&query->scorerCtx, r, dmd, minScore);
+      prof->scoreTime += QueryProfile_Now() - start;
+      prof->numScored++;
+      h->sv = NULL;
     } else {
       h->score = query->scorer(&query->scorerCtx, r, dmd, minScore);
       h->sv = NULL;
@@ -761,54 +1480,54 @@ QueryResult *Query_Execute(Query *query) {
 
     CONCURRENT_CTX_TICK(cxc);
 
-    if (heap_count(pq) < heap_size(pq)) {
-      heap_offerx(pq, h);
-      pooledHit = NULL;
-      if (heap_count(pq) == heap_size(pq)) {
-        heapResult *minh = heap_peek(pq);
-        minScore = minh->score;
-      }
-    } else {
-      /* In SORTBY mode - compare the hit with the lowest ranked entry in the heap */
-      if (sortByMode) {
-        heapResult *minh = heap_peek(pq);
+    pooledHit = offerHit(topN, h, query->sortKey, &minScore);
+    if (prof) {
+      prof->numOffered++;
+      prof->numInserted += pooledHit != h;
+    }
 
-        /* if the current hit should be in the heap - remoe the lowest hit and add the new hit */
-        if (sortByCmp(h, minh, query->sortKey) < 0) {
-          pooledHit = heap_poll(pq);
-          heap_offerx(pq, h);
-        } else {
-          /* The current should not enter the pool, so just leave it as is */
-          pooledHit = h;
-        }
+    if (query->collectLimit && heap_count(topN->heap) > query->collectLimit) {
+      res->errorString = QUERY_ERROR_TOO_MANY_RESULTS_STR;
+      break;
+    }
 
-      } else {
-        /* In Scored mode - compare scores with the lowest ranked result */
-        if (h->score >= minScore) {
-          pooledHit = heap_poll(pq);
-          heap_offerx(pq, h);
-
-          // get the new min score
-          heapResult *minh = heap_peek(pq);
-          minScore = minh->score;
-        } else {
-          pooledHit = h;
+    if (sortedIndex && ++numMatched == SORTED_SCAN_PROBE) {
+      // the matches are spread over the docIds, so the probe's reach tells how many there are. The
+      // scan checks maxDocId / estimate documents of the sort field's index per match it needs
+      t_docId maxDocId = query->ctx->spec->docs->maxDocId;
+      double estimate = (double)numMatched * maxDocId / h->docId;
+      double scanCost = SORTED_SCAN_DOC_COST * (double)num * maxDocId / estimate;
+      if (scanCost < estimate - numMatched) {
+        if (Query_sortedScan(query, sortedIndex, topN, h->docId, &pooledHit, &minScore)) {
+          res->totalResults = (size_t)estimate;
+          sortedScanDone = 1;
+          break;
         }
+        nilOnly = 1;
       }
+      sortedIndex = NULL;
     }
   }
 
-  //  IndexResult_Free(r);
-  if (pooledHit) {
-    // IndexResult_Free(pooledHit);
-    free(pooledHit);
-    pooledHit = NULL;
+  if (batch) {
+    pooledHit = scoringBatch_Flush(batch, query, topN, pooledHit, &minScore);
+    scoringBatch_Free(batch);
+    free(batch);
+  }
+
+  // a sorted scan stops early, so it can only estimate the total
+  if (!sortedScanDone) {
+    res->totalResults = it->Len(it->ctx) - numDeleted;
   }
-  res->totalResults = it->Len(it->ctx) - numDeleted;
   it->Free(it);
 
+  heap_t *pq = topN->heap;
+  if (query->collectLimit && !res->errorString && heap_count(pq) > query->collectLimit) {
+    res->errorString = QUERY_ERROR_TOO_MANY_RESULTS_STR;
+  }
+
   // if not enough results - just return nothing now
-  if (heap_count(pq) <= query->offset) {
+  if (res->errorString || (!query->collectLimit && heap_count(pq) <= query->offset)) {
     res->numResults = 0;
     res->results = NULL;
     goto cleanup;
@@ -817,7 +1536,8 @@ QueryResult *Query_Execute(Query *query) {
   // Reverse the results into the final result
 
   // first - calculate the number of results in the heap matching our paging
-  size_t n = MIN(heap_count(pq) - query->offset, query->limit);
+  size_t n = query->collectLimit ? heap_count(pq)
+                                 : MIN(heap_count(pq) - query->offset, query->limit);
   res->numResults = n;
   res->results = calloc(n, sizeof(ResultEntry));
   // printf("offset %zd, limit %zd, num %d\n", query->offset, query->limit, res->numResults);
@@ -826,7 +1546,7 @@ QueryResult *Query_Execute(Query *query) {
   for (int i = 0; i < n; ++i) {
     heapResult *h = heap_poll(pq);
     // LG_DEBUG("Popping %d freq %f\n", h->docId, h->totalFreq);
-    RSDocumentMetadata *dmd = DocTable_Get(&query->ctx->spec->docs, h->docId);
+    RSDocumentMetadata *dmd = DocTable_Get(query->ctx->spec->docs, h->docId);
     RSSortableValue *sv = NULL;
     if (dmd) {
       // For sort key based queries, the score is the inverse of the rank
@@ -836,19 +1556,18 @@ QueryResult *Query_Execute(Query *query) {
         sv = RSSortingVector_Get(h->sv, query->sortKey);
       }
       res->results[n - i - 1] =
-          (ResultEntry){.id = dmd->key, .score = h->score, .payload = dmd->payload, .sortKey = sv};
+          (ResultEntry){.id = dmd->key,
+                        .docId = h->docId,
+                        .score = h->score,
+                        .payload = dmd->payload,
+                        .sortKey = sv};
     }
-    free(h);
   }
 
 cleanup:
-  // if we still have something in the heap (meaning offset > 0), we need to poll...
-  while (heap_count(pq) > 0) {
-    heapResult *h = heap_poll(pq);
-    free(h);
-  }
-
-  heap_free(pq);
+  // the hits all live in the collector, so whatever is left in the heap (meaning offset > 0) is
+  // simply dropped with it
+  topNCollector_Release(topN);
   return res;
 }
 
@@ -857,15 +1576,16 @@ void QueryResult_Free(QueryResult *q) {
   free(q);
 }
 
-int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest *req) {
+int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest *req,
+                          ReplyRecorder *rr) {
   RedisModuleCtx *ctx = sctx->redisCtx;
 
   if (r->errorString != NULL) {
     return RedisModule_ReplyWithError(ctx, r->errorString);
   }
 
-  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-  RedisModule_ReplyWithLongLong(ctx, (long long)r->totalResults);
+  ReplyRecorder_Array(rr, ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  ReplyRecorder_LongLong(rr, ctx, (long long)r->totalResults);
   size_t arrlen = 1;
 
   const int with_docs = !(req->flags & Search_NoContent);
@@ -889,20 +1609,20 @@ int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest
 
     ++arrlen;
 
-    RedisModule_ReplyWithStringBuffer(ctx, result->id, strlen(result->id));
+    ReplyRecorder_StringBuffer(rr, ctx, result->id, strlen(result->id));
 
     if (req->flags & Search_WithScores) {
       ++arrlen;
-      RedisModule_ReplyWithDouble(ctx, result->score);
+      ReplyRecorder_Double(rr, ctx, result->score);
     }
 
     if (req->flags & Search_WithPayloads) {
       ++arrlen;
       const RSPayload *payload = result->payload;
       if (payload) {
-        RedisModule_ReplyWithStringBuffer(ctx, payload->data, payload->len);
+        ReplyRecorder_StringBuffer(rr, ctx, payload->data, payload->len);
       } else {
-        RedisModule_ReplyWithNull(ctx);
+        ReplyRecorder_Null(rr, ctx);
       }
     }
 
@@ -911,25 +1631,25 @@ int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest
       const RSSortableValue *sortkey = result->sortKey;
       if (sortkey) {
         if (sortkey->type == RS_SORTABLE_NUM) {
-          RedisModule_ReplyWithDouble(ctx, sortkey->num);
+          ReplyRecorder_Double(rr, ctx, sortkey->num);
         } else {
           // RS_SORTABLE_NIL, RS_SORTABLE_STR
-          RedisModule_ReplyWithStringBuffer(ctx, sortkey->str, strlen(sortkey->str));
+          ReplyRecorder_StringBuffer(rr, ctx, sortkey->str, strlen(sortkey->str));
         }
       } else {
-        RedisModule_ReplyWithNull(ctx);
+        ReplyRecorder_Null(rr, ctx);
       }
     }
 
     if (with_docs) {
       ++arrlen;
-      RedisModule_ReplyWithArray(ctx, doc.numFields * 2);
+      ReplyRecorder_Array(rr, ctx, doc.numFields * 2);
       for (size_t j = 0; j < doc.numFields; ++j) {
-        RedisModule_ReplyWithStringBuffer(ctx, doc.fields[j].name, strlen(doc.fields[j].name));
+        ReplyRecorder_StringBuffer(rr, ctx, doc.fields[j].name, strlen(doc.fields[j].name));
         if (doc.fields[j].text) {
-          RedisModule_ReplyWithString(ctx, doc.fields[j].text);
+          ReplyRecorder_String(rr, ctx, doc.fields[j].text);
         } else {
-          RedisModule_ReplyWithNull(ctx);
+          ReplyRecorder_Null(rr, ctx);
         }
       }
       if (rkey) {
@@ -939,7 +1659,7 @@ int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest
     }
   }
 
-  RedisModule_ReplySetArrayLength(ctx, arrlen);
+  ReplyRecorder_SetArrayLength(rr, ctx, arrlen);
 
   return REDISMODULE_OK;
 }
@@ -17,6 +17,8 @@
 #include "rmutil/sds.h"
 #include "search_request.h"
 #include "concurrent_ctx.h"
+#include "query_profile.h"
+#include "result_cache.h"
 
 /* A Query represents the parse tree and execution plan for a single search
  * query */
@@ -56,6 +58,8 @@ typedef struct RSQuery {
 
   // Custom scorer
   RSScoringFunction scorer;
+  // optional batch version of the scorer, used when set
+  RSBatchScoringFunction batchScorer;
   RSFreeFunction scorerFree;
   RSScoringFunctionCtx scorerCtx;
 
@@ -67,10 +71,18 @@ typedef struct RSQuery {
   StopWordList *stopwords;
 
   RSPayload payload;
+
+  /* If not 0, the query collects all of its results instead of a LIMIT page of them, for creating
+   * a cursor. Collecting more results than this fails the query */
+  size_t collectLimit;
+
+  /* If set, the query is profiled into it. Not owned by the query */
+  QueryProfile *profile;
 } Query;
 
 typedef struct {
   const char *id;
+  t_docId docId;
   double score;
   RSPayload *payload;
   RSSortableValue *sortKey;
@@ -85,8 +97,10 @@ typedef struct queryResult {
   char *errorString;
 } QueryResult;
 
-/* Serialize a query result to the redis client. Returns REDISMODULE_OK/ERR */
-int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *ctx, RSSearchRequest *req);
+/* Serialize a query result to the redis client. If rr is not NULL, the reply is also recorded in it.
+ * Returns REDISMODULE_OK/ERR */
+int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *ctx, RSSearchRequest *req,
+                          ReplyRecorder *rr);
 
 /* Evaluate a query stage and prepare it for execution. As execution is lazy
 this doesn't
@@ -95,6 +109,8 @@ IndexIterator *Query_EvalNode(Query *q, QueryNode *n);
 
 /* Free the query execution stage and its children recursively */
 void QueryNode_Free(QueryNode *n);
+/* Deep copy a query node and its children */
+QueryNode *QueryNode_Clone(QueryNode *n);
 QueryNode *NewTokenNode(Query *q, const char *s, size_t len);
 QueryNode *NewTokenNodeExpanded(Query *q, const char *s, size_t len, RSTokenFlags flags);
 QueryNode *NewPhraseNode(int exact);
@@ -107,6 +123,9 @@ QueryNode *NewIdFilterNode(IdFilter *flt);
 void Query_SetNumericFilter(Query *q, NumericFilter *nf);
 void Query_SetGeoFilter(Query *q, GeoFilter *gf);
 void Query_SetIdFilter(Query *q, IdFilter *f);
+/* Intersect the query with the query of another index sharing its document table. The other query
+ * is not owned by this one, and must outlive it */
+void Query_SetIndexFilter(Query *q, Query *other);
 
 /* Return a string representation of the query parse tree. The string should be freed by the caller
  */
@@ -116,6 +135,7 @@ const char *Query_DumpExplain(Query *q);
 void QueryNode_Print(Query *q, QueryNode *qs, int depth);
 
 #define QUERY_ERROR_INTERNAL_STR "Internal error processing query"
+#define QUERY_ERROR_TOO_MANY_RESULTS_STR "Too many results held by cursors"
 #define QUERY_ERROR_INTERNAL -1
 
 /* Initialize a new query object from user input. This does not parse the query
@@ -138,4 +158,9 @@ void QueryResult_Free(QueryResult *q);
 
 QueryNode *Query_Parse(Query *q, char **err);
 
+/* Resolve the tokens and exact phrases of a parsed query that select tag fields into tag nodes,
+ * and drop the stopwords outside of tags. Called by Query_Parse. Returns the new root, which is NULL
+ * if nothing is left of the query */
+QueryNode *Query_ResolveTags(Query *q, QueryNode *root);
+
 #endif
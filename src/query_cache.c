@@ -0,0 +1,204 @@
+#include "query_cache.h"
+#include "rmalloc.h"
+#include "util/fnv.h"
+#include <string.h>
+#include <ctype.h>
+
+/* A cached query tree. Entries are chained in their hash bucket, and in a list kept in LRU order */
+typedef struct queryCacheEntry {
+  char *key;
+  size_t keylen;
+  uint32_t hash;
+  IndexSpec *spec;
+
+  QueryNode *root;
+  int numTokens;
+
+  struct queryCacheEntry *bucketNext;
+  struct queryCacheEntry *prev;
+  struct queryCacheEntry *next;
+} queryCacheEntry;
+
+#define QUERY_CACHE_BUCKETS (QUERY_CACHE_SIZE * 2)
+
+static struct {
+  queryCacheEntry *buckets[QUERY_CACHE_BUCKETS];
+  // the most and least recently used entries
+  queryCacheEntry *head;
+  queryCacheEntry *tail;
+  QueryCacheStats stats;
+} __queryCache = {0};
+
+/* The fields of the query that shape its tree, besides the query string and the language */
+typedef struct {
+  IndexSpec *spec;
+  StopWordList *stopwords;
+  RSQueryTokenExpander expander;
+  void *expanderPrivdata;
+} queryCacheKeyHeader;
+
+/* Write the cache key of a query into buf, which must be big enough for the header, the language
+ * and the query. Whitespace only separates tokens, so runs of it are collapsed into one space and
+ * queries that differ only in spacing share an entry */
+static size_t queryCache_makeKey(Query *q, char *buf) {
+  queryCacheKeyHeader hdr = {
+      .spec = q->ctx ? q->ctx->spec : NULL,
+      .stopwords = q->stopwords,
+      .expander = q->expander,
+      .expanderPrivdata = q->expander ? q->expCtx.privdata : NULL,
+  };
+  memcpy(buf, &hdr, sizeof(hdr));
+  char *p = buf + sizeof(hdr);
+
+  size_t langlen = strlen(q->language);
+  memcpy(p, q->language, langlen + 1);
+  p += langlen + 1;
+
+  int space = 1;
+  for (size_t i = 0; i < q->len; i++) {
+    if (isspace((unsigned char)q->raw[i])) {
+      if (!space) *p++ = ' ';
+      space = 1;
+    } else {
+      *p++ = q->raw[i];
+      space = 0;
+    }
+  }
+  if (space && p > buf + sizeof(hdr) + langlen + 1 && p[-1] == ' ') {
+    p--;
+  }
+  return p - buf;
+}
+
+static void queryCache_unlink(queryCacheEntry *e) {
+  if (e->prev) {
+    e->prev->next = e->next;
+  } else {
+    __queryCache.head = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  } else {
+    __queryCache.tail = e->prev;
+  }
+  e->prev = e->next = NULL;
+}
+
+static void queryCache_pushFront(queryCacheEntry *e) {
+  e->prev = NULL;
+  e->next = __queryCache.head;
+  if (__queryCache.head) {
+    __queryCache.head->prev = e;
+  } else {
+    __queryCache.tail = e;
+  }
+  __queryCache.head = e;
+}
+
+static queryCacheEntry *queryCache_find(const char *key, size_t keylen, uint32_t hash) {
+  queryCacheEntry *e = __queryCache.buckets[hash % QUERY_CACHE_BUCKETS];
+  while (e) {
+    if (e->hash == hash && e->keylen == keylen && !memcmp(e->key, key, keylen)) {
+      return e;
+    }
+    e = e->bucketNext;
+  }
+  return NULL;
+}
+
+/* Remove an entry from the cache and free it */
+static void queryCache_remove(queryCacheEntry *e) {
+  queryCacheEntry **pp = &__queryCache.buckets[e->hash % QUERY_CACHE_BUCKETS];
+  while (*pp != e) {
+    pp = &(*pp)->bucketNext;
+  }
+  *pp = e->bucketNext;
+  queryCache_unlink(e);
+
+  QueryNode_Free(e->root);
+  free(e->key);
+  free(e);
+  __queryCache.stats.entries--;
+}
+
+static void queryCache_add(Query *q, const char *key, size_t keylen, uint32_t hash) {
+  if (__queryCache.stats.entries == QUERY_CACHE_SIZE) {
+    queryCache_remove(__queryCache.tail);
+  }
+
+  queryCacheEntry *e = malloc(sizeof(*e));
+  *e = (queryCacheEntry){
+      .key = malloc(keylen),
+      .keylen = keylen,
+      .hash = hash,
+      .spec = q->ctx ? q->ctx->spec : NULL,
+      .root = QueryNode_Clone(q->root),
+      .numTokens = q->numTokens,
+  };
+  memcpy(e->key, key, keylen);
+
+  size_t b = hash % QUERY_CACHE_BUCKETS;
+  e->bucketNext = __queryCache.buckets[b];
+  __queryCache.buckets[b] = e;
+  queryCache_pushFront(e);
+  __queryCache.stats.entries++;
+}
+
+QueryNode *Query_ParseCached(Query *q, char **err) {
+  *err = NULL;
+  if (q->len > QUERY_CACHE_MAX_QUERY_LEN) {
+    if (Query_Parse(q, err)) {
+      Query_Expand(q);
+    }
+    return q->root;
+  }
+
+  char key[sizeof(queryCacheKeyHeader) + strlen(q->language) + 1 + q->len];
+  size_t keylen = queryCache_makeKey(q, key);
+  uint32_t hash = fnv_32a_buf(key, keylen, 0);
+
+  queryCacheEntry *e = queryCache_find(key, keylen, hash);
+  if (e) {
+    __queryCache.stats.hits++;
+    queryCache_unlink(e);
+    queryCache_pushFront(e);
+    q->root = QueryNode_Clone(e->root);
+    q->numTokens = e->numTokens;
+    return q->root;
+  }
+
+  __queryCache.stats.misses++;
+  if (!Query_Parse(q, err)) {
+    return NULL;
+  }
+
+  // an expander that sets the query payload does more than shape the tree, so its queries can't be
+  // replayed from the cache
+  RSPayload payload = q->payload;
+  Query_Expand(q);
+  if (q->payload.data == payload.data && q->payload.len == payload.len) {
+    queryCache_add(q, key, keylen, hash);
+  }
+  return q->root;
+}
+
+void QueryCache_PurgeIndex(IndexSpec *sp) {
+  queryCacheEntry *e = __queryCache.head;
+  while (e) {
+    queryCacheEntry *next = e->next;
+    if (e->spec == sp) {
+      queryCache_remove(e);
+    }
+    e = next;
+  }
+}
+
+void QueryCache_Clear() {
+  while (__queryCache.head) {
+    queryCache_remove(__queryCache.head);
+  }
+}
+
+QueryCacheStats GetQueryCacheStats() {
+  return __queryCache.stats;
+}
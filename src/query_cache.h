@@ -0,0 +1,42 @@
+#ifndef __RS_QUERY_CACHE_H__
+#define __RS_QUERY_CACHE_H__
+
+#include <stdlib.h>
+#include "query.h"
+#include "spec.h"
+
+/* The query cache keeps the parsed and expanded trees of recently used queries, so that parsing and
+ * expanding a hot query is replaced by copying its tree.
+ *
+ * Entries are keyed by the index, the query string with its whitespace normalized, and everything
+ * else that shapes the tree - the language, stopword list and expander. Filters given as command
+ * arguments are added to the tree after it is taken from the cache, so they are not part of the key.
+ *
+ * The cache is shared by all indexes, and is protected by the GIL */
+
+/* The maximal number of cached queries. The least recently used query is evicted beyond it */
+#define QUERY_CACHE_SIZE 4096
+
+/* Queries longer than this are not cached */
+#define QUERY_CACHE_MAX_QUERY_LEN 1024
+
+typedef struct {
+  size_t hits;
+  size_t misses;
+  size_t entries;
+} QueryCacheStats;
+
+/* Parse and expand the query, like Query_Parse followed by Query_Expand, taking a copy of the tree
+ * from the cache if the query was seen before. Returns the root of the tree, or NULL if the query
+ * could not be parsed or is empty, with err set as Query_Parse does */
+QueryNode *Query_ParseCached(Query *q, char **err);
+
+/* Drop all the cached queries of an index that is being freed */
+void QueryCache_PurgeIndex(IndexSpec *sp);
+
+/* Drop all the cached queries */
+void QueryCache_Clear();
+
+QueryCacheStats GetQueryCacheStats();
+
+#endif
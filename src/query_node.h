@@ -8,6 +8,7 @@ struct RSQueryNode;
 struct numericFilter;
 struct geoFilter;
 struct idFilter;
+struct RSQuery;
 
 /* The types of query nodes */
 typedef enum {
@@ -34,6 +35,12 @@ typedef enum {
 
   /* Id Filter node */
   QN_IDS,
+
+  /* Tag node, an exact tag of tag fields */
+  QN_TAG,
+
+  /* The query of another index sharing the document table */
+  QN_INDEX,
 } QueryNodeType;
 
 /* A prhase node represents a list of nodes with intersection between them, or a phrase in the case
@@ -62,6 +69,10 @@ typedef RSToken QueryTokenNode;
 
 typedef RSToken QueryPrefixNode;
 
+/* A tag node holds a normalized tag, looked up in the tag indexes of the tag fields in its field
+ * mask. It is never expanded */
+typedef RSToken QueryTagNode;
+
 /* A node with a numeric filter */
 typedef struct { struct numericFilter *nf; } QueryNumericNode;
 
@@ -69,6 +80,10 @@ typedef struct { struct geoFilter *gf; } QueryGeofilterNode;
 
 typedef struct { struct idFilter *f; } QueryIdFilterNode;
 
+/* A node evaluated by a query of another index. The query is parsed on its own index, and its
+ * iterator reads that index - the two share their docIds */
+typedef struct { struct RSQuery *q; } QueryIndexNode;
+
 /* QueryNode reqresents any query node in the query tree. It has a type to resolve which node it is,
  * and a union of all possible nodes  */
 typedef struct RSQueryNode {
@@ -82,8 +97,10 @@ typedef struct RSQueryNode {
     QueryNotNode not;
     QueryOptionalNode opt;
     QueryPrefixNode pfx;
+    QueryTagNode tag;
+    QueryIndexNode in;
   };
-  uint32_t fieldMask;
+  t_fieldMask fieldMask;
   /* The node type, for resolving the union access */
   QueryNodeType type;
 } QueryNode;
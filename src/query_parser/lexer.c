@@ -418,9 +418,9 @@ _eof_trans:
     tok.s = ts;
     tok.numval = 0;
     tok.pos = ts-q->raw;
-    if (!StopWordList_Contains(q->stopwords, tok.s, tok.len)) {
-        RSQuery_Parse(pParser, TERM, tok, &ctx);
-    } 
+    // stopwords are parsed like any term, tags keep them. The ones outside of tags are dropped
+    // when the tags are resolved
+    RSQuery_Parse(pParser, TERM, tok, &ctx);
     if (!ctx.ok) {
       {p++; goto _out; }
     }
@@ -472,9 +472,9 @@ _eof_trans:
     tok.s = ts;
     tok.numval = 0;
     tok.pos = ts-q->raw;
-    if (!StopWordList_Contains(q->stopwords, tok.s, tok.len)) {
-        RSQuery_Parse(pParser, TERM, tok, &ctx);
-    } 
+    // stopwords are parsed like any term, tags keep them. The ones outside of tags are dropped
+    // when the tags are resolved
+    RSQuery_Parse(pParser, TERM, tok, &ctx);
     if (!ctx.ok) {
       {p++; goto _out; }
     }
@@ -529,6 +529,8 @@ _again:
   }
 
   if (ctx.root) {
+    // the parser doesn't know the field types, tokens under tag fields are resolved after it
+    ctx.root = Query_ResolveTags(q, ctx.root);
     q->root = ctx.root;
   }
   return ctx.root;
@@ -148,9 +148,9 @@ main := |*
     tok.s = ts;
     tok.numval = 0;
     tok.pos = ts-q->raw;
-    if (!StopWordList_Contains(q->stopwords, tok.s, tok.len)) {
-        RSQuery_Parse(pParser, TERM, tok, &ctx);
-    } 
+    // stopwords are parsed like any term, tags keep them. The ones outside of tags are dropped
+    // when the tags are resolved
+    RSQuery_Parse(pParser, TERM, tok, &ctx);
     if (!ctx.ok) {
       fbreak;
     }
@@ -190,6 +190,8 @@ QueryNode *Query_Parse(Query *q, char **err) {
   }
 
   if (ctx.root) {
+    // the parser doesn't know the field types, tokens under tag fields are resolved after it
+    ctx.root = Query_ResolveTags(q, ctx.root);
     q->root = ctx.root;
   }
   return ctx.root;
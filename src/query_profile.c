@@ -0,0 +1,184 @@
+#include "query_profile.h"
+#include "inverted_index.h"
+#include "rmalloc.h"
+#include <string.h>
+#include <time.h>
+
+double QueryProfile_Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+QueryProfile *NewQueryProfile() {
+  return calloc(1, sizeof(QueryProfile));
+}
+
+static void queryProfileNode_Free(QueryProfileNode *n) {
+  for (size_t i = 0; i < n->numChildren; i++) {
+    queryProfileNode_Free(n->children[i]);
+  }
+  free(n->children);
+  free(n->label);
+  free(n);
+}
+
+void QueryProfile_Free(QueryProfile *p) {
+  if (p->root) {
+    queryProfileNode_Free(p->root);
+  }
+  free(p);
+}
+
+QueryProfileNode *QueryProfile_EnterNode(QueryProfile *p, const char *label) {
+  QueryProfileNode *n = calloc(1, sizeof(QueryProfileNode));
+  n->label = strdup(label);
+  n->parent = p->current;
+  if (p->current) {
+    QueryProfileNode *parent = p->current;
+    parent->children =
+        realloc(parent->children, (parent->numChildren + 1) * sizeof(QueryProfileNode *));
+    parent->children[parent->numChildren++] = n;
+  } else if (!p->root) {
+    p->root = n;
+  }
+  p->current = n;
+  return n;
+}
+
+/* The profiling iterator, forwarding all calls to the wrapped iterator */
+typedef struct {
+  IndexIterator *child;
+  QueryProfileNode *node;
+} profileIterator;
+
+static int PI_Read(void *ctx, RSIndexResult **e) {
+  profileIterator *pi = ctx;
+  double start = QueryProfile_Now();
+  int rc = pi->child->Read(pi->child->ctx, e);
+  pi->node->time += QueryProfile_Now() - start;
+  pi->node->numReads++;
+  if (rc == INDEXREAD_OK) pi->node->numHits++;
+  return rc;
+}
+
+static int PI_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit) {
+  profileIterator *pi = ctx;
+  double start = QueryProfile_Now();
+  int rc = pi->child->SkipTo(pi->child->ctx, docId, hit);
+  pi->node->time += QueryProfile_Now() - start;
+  pi->node->numSkips++;
+  if (rc == INDEXREAD_OK) pi->node->numHits++;
+  return rc;
+}
+
+static RSIndexResult *PI_Current(void *ctx) {
+  profileIterator *pi = ctx;
+  return pi->child->Current(pi->child->ctx);
+}
+
+static t_docId PI_LastDocId(void *ctx) {
+  profileIterator *pi = ctx;
+  return pi->child->LastDocId(pi->child->ctx);
+}
+
+static int PI_HasNext(void *ctx) {
+  profileIterator *pi = ctx;
+  return pi->child->HasNext(pi->child->ctx);
+}
+
+static size_t PI_Len(void *ctx) {
+  profileIterator *pi = ctx;
+  return pi->child->Len(pi->child->ctx);
+}
+
+static void PI_Free(IndexIterator *it) {
+  profileIterator *pi = it->ctx;
+  // term readers know how much of the index they decoded, and the node outlives them
+  if (pi->child->Read == IR_Read) {
+    IndexReader *ir = pi->child->ctx;
+    pi->node->isReader = 1;
+    pi->node->numDecoded = ir->numDecoded;
+    pi->node->numBlocks = ir->numBlocks;
+  }
+  pi->child->Free(pi->child);
+  free(pi);
+  free(it);
+}
+
+IndexIterator *QueryProfile_LeaveNode(QueryProfile *p, QueryProfileNode *n, IndexIterator *it) {
+  p->current = n->parent;
+  if (!it) {
+    return NULL;
+  }
+
+  profileIterator *pi = malloc(sizeof(*pi));
+  pi->child = it;
+  pi->node = n;
+
+  IndexIterator *ret = malloc(sizeof(IndexIterator));
+  *ret = (IndexIterator){
+      .ctx = pi,
+      .Current = PI_Current,
+      .Read = PI_Read,
+      .SkipTo = PI_SkipTo,
+      .LastDocId = PI_LastDocId,
+      .HasNext = PI_HasNext,
+      .Free = PI_Free,
+      .Len = PI_Len,
+  };
+  return ret;
+}
+
+#define __reply_kvnum(n, k, v)                 \
+  RedisModule_ReplyWithSimpleString(ctx, k);   \
+  RedisModule_ReplyWithDouble(ctx, (double)v); \
+  n += 2
+
+static void queryProfileNode_Reply(QueryProfileNode *node, RedisModuleCtx *ctx) {
+  size_t n = 0;
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  RedisModule_ReplyWithSimpleString(ctx, "iterator");
+  RedisModule_ReplyWithSimpleString(ctx, node->label);
+  n += 2;
+  __reply_kvnum(n, "time_ms", node->time * 1000);
+  __reply_kvnum(n, "reads", node->numReads);
+  __reply_kvnum(n, "skips", node->numSkips);
+  __reply_kvnum(n, "hits", node->numHits);
+  if (node->isReader) {
+    __reply_kvnum(n, "records_decoded", node->numDecoded);
+    __reply_kvnum(n, "blocks_touched", node->numBlocks);
+  }
+  if (node->numChildren) {
+    RedisModule_ReplyWithSimpleString(ctx, "children");
+    RedisModule_ReplyWithArray(ctx, node->numChildren);
+    for (size_t i = 0; i < node->numChildren; i++) {
+      queryProfileNode_Reply(node->children[i], ctx);
+    }
+    n += 2;
+  }
+  RedisModule_ReplySetArrayLength(ctx, n);
+}
+
+void QueryProfile_Reply(QueryProfile *p, RedisModuleCtx *ctx) {
+  size_t n = 0;
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  __reply_kvnum(n, "parse_time_ms", p->parseTime * 1000);
+  __reply_kvnum(n, "expand_time_ms", p->expandTime * 1000);
+  __reply_kvnum(n, "execute_time_ms", p->executeTime * 1000);
+  __reply_kvnum(n, "score_time_ms", p->scoreTime * 1000);
+  __reply_kvnum(n, "serialize_time_ms", p->serializeTime * 1000);
+  __reply_kvnum(n, "results_scored", p->numScored);
+  __reply_kvnum(n, "heap_offers", p->numOffered);
+  __reply_kvnum(n, "heap_inserts", p->numInserted);
+  __reply_kvnum(n, "sorted_scan_ranges", p->sortedScanRanges);
+
+  RedisModule_ReplyWithSimpleString(ctx, "iterators");
+  if (p->root) {
+    queryProfileNode_Reply(p->root, ctx);
+  } else {
+    RedisModule_ReplyWithNull(ctx);
+  }
+  n += 2;
+  RedisModule_ReplySetArrayLength(ctx, n);
+}
@@ -0,0 +1,75 @@
+#ifndef __RS_QUERY_PROFILE_H__
+#define __RS_QUERY_PROFILE_H__
+
+#include <stdlib.h>
+#include "index_iterator.h"
+#include "redismodule.h"
+
+/* Query profiling, for FT.PROFILE. A profiled query wraps the iterator of every query node with an
+ * iterator counting and timing the calls to it, and times the phases of the query around it -
+ * parsing, expansion, execution, scoring and serialization.
+ *
+ * All times are wall clock times. Iterator times include the time spent in their children, and the
+ * execution time includes the time the query yielded the GIL to other clients */
+
+/* The counters of a single iterator in the profiled execution tree */
+typedef struct queryProfileNode {
+  /* A description of the node, e.g. its type and term */
+  char *label;
+
+  size_t numReads;
+  size_t numSkips;
+  /* The number of reads and skips that returned a result */
+  size_t numHits;
+  /* The number of index records decoded and index blocks touched. Only set for term readers */
+  size_t numDecoded;
+  size_t numBlocks;
+  int isReader;
+  /* Time spent in the iterator, in seconds */
+  double time;
+
+  struct queryProfileNode *parent;
+  struct queryProfileNode **children;
+  size_t numChildren;
+} QueryProfileNode;
+
+typedef struct {
+  /* The times of the query phases, in seconds */
+  double parseTime;
+  double expandTime;
+  double executeTime;
+  double scoreTime;
+  double serializeTime;
+
+  /* The number of results scored, and the number of them offered to / kept by the top-N heap */
+  size_t numScored;
+  size_t numOffered;
+  size_t numInserted;
+
+  /* The number of ranges of the sort field's index scanned, if the query was executed by scanning
+   * it in sort order */
+  size_t sortedScanRanges;
+
+  /* The root of the iterator tree, and the node whose iterator is being built */
+  QueryProfileNode *root;
+  QueryProfileNode *current;
+} QueryProfile;
+
+QueryProfile *NewQueryProfile();
+void QueryProfile_Free(QueryProfile *p);
+
+/* The current time in seconds, from a monotonic clock */
+double QueryProfile_Now();
+
+/* Start profiling a new iterator as a child of the one being built. The label is copied */
+QueryProfileNode *QueryProfile_EnterNode(QueryProfile *p, const char *label);
+
+/* Done building the iterator of a node. Wraps the iterator (which may be NULL) with a profiling
+ * iterator updating the node, and returns the wrapped iterator */
+IndexIterator *QueryProfile_LeaveNode(QueryProfile *p, QueryProfileNode *n, IndexIterator *it);
+
+/* Reply with the profile, as an array of name/value pairs. The iterators are a nested array of
+ * name/value pairs each, their children in a "children" array */
+void QueryProfile_Reply(QueryProfile *p, RedisModuleCtx *ctx);
+
+#endif
@@ -1,7 +1,12 @@
 #include "redis_index.h"
 #include "doc_table.h"
+#include "numeric_index.h"
+#include "geo_index.h"
 #include "redismodule.h"
 #include "inverted_index.h"
+#include "term_dict.h"
+#include "index_gc.h"
+#include "tag_index.h"
 #include "rmutil/strings.h"
 #include "rmutil/util.h"
 #include "util/logging.h"
@@ -11,15 +16,29 @@
 RedisModuleType *InvertedIndexType;
 
 void *InvertedIndex_RdbLoad(RedisModuleIO *rdb, int encver) {
-  if (encver != 0) {
+  if (encver > INVERTED_INDEX_ENCVER) {
     return NULL;
   }
   InvertedIndex *idx = NewInvertedIndex(RedisModule_LoadUnsigned(rdb), 0);
   idx->lastId = RedisModule_LoadUnsigned(rdb);
   idx->numDocs = RedisModule_LoadUnsigned(rdb);
-  idx->size = RedisModule_LoadUnsigned(rdb);
-  idx->blocks = rm_calloc(idx->size, sizeof(IndexBlock));
+  uint32_t numBlocks = RedisModule_LoadUnsigned(rdb);
+
+  // version 1 keeps all the blocks in a single stream
+  if (encver >= 1) {
+    size_t len;
+    char *data = RedisModule_LoadStringBuffer(rdb, &len);
+    int ok = InvertedIndex_DecodeBlocks(idx, numBlocks, data, len);
+    rm_free(data);
+    if (!ok) {
+      InvertedIndex_Free(idx);
+      return NULL;
+    }
+    return idx;
+  }
 
+  idx->size = numBlocks;
+  idx->blocks = rm_calloc(idx->size, sizeof(IndexBlock));
   for (uint32_t i = 0; i < idx->size; i++) {
     IndexBlock *blk = &idx->blocks[i];
     blk->firstId = RedisModule_LoadUnsigned(rdb);
@@ -41,18 +60,20 @@ void InvertedIndex_RdbSave(RedisModuleIO *rdb, void *value) {
   RedisModule_SaveUnsigned(rdb, idx->numDocs);
   RedisModule_SaveUnsigned(rdb, idx->size);
 
-  for (uint32_t i = 0; i < idx->size; i++) {
-    IndexBlock *blk = &idx->blocks[i];
-    RedisModule_SaveUnsigned(rdb, blk->firstId);
-    RedisModule_SaveUnsigned(rdb, blk->lastId);
-    RedisModule_SaveUnsigned(rdb, blk->numDocs);
-    RedisModule_SaveStringBuffer(rdb, blk->data->data, blk->data->offset);
-  }
+  Buffer stream;
+  Buffer_Init(&stream, 0);
+  size_t len = InvertedIndex_EncodeBlocks(idx, &stream);
+  RedisModule_SaveStringBuffer(rdb, stream.data, len);
+  Buffer_Free(&stream);
 }
 void InvertedIndex_Digest(RedisModuleDigest *digest, void *value) {
 }
 void InvertedIndex_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
-  // NOT IMPLEMENTED YET
+  Buffer buf;
+  Buffer_Init(&buf, 0);
+  InvertedIndex_Dump(value, &buf);
+  RedisModule_EmitAOF(aof, "FT.RESTORE", "scb", key, "INVIDX", buf.data, buf.offset);
+  Buffer_Free(&buf);
 }
 
 int InvertedIndex_RegisterType(RedisModuleCtx *ctx) {
@@ -62,7 +83,7 @@ int InvertedIndex_RegisterType(RedisModuleCtx *ctx) {
                                .aof_rewrite = InvertedIndex_AofRewrite,
                                .free = InvertedIndex_Free};
 
-  InvertedIndexType = RedisModule_CreateDataType(ctx, "ft_invidx", 0, &tm);
+  InvertedIndexType = RedisModule_CreateDataType(ctx, "ft_invidx", INVERTED_INDEX_ENCVER, &tm);
   if (InvertedIndexType == NULL) {
     RedisModule_Log(ctx, "error", "Could not create inverted index type");
     return REDISMODULE_ERR;
@@ -105,75 +126,19 @@ void SearchCtx_Free(RedisSearchCtx *sctx) {
   rm_free(sctx);
 }
 /*
- * Select a random term from the index that matches the index prefix and inveted key format.
- * It tries RANDOMKEY 10 times and returns NULL if it can't find anything.
+ * Select the next index to work on, walking the live indexes round-robin so that repeated calls
+ * cover all of them. Returns NULL if there is no index.
  */
-const char *Redis_SelectRandomTermByIndex(RedisSearchCtx *ctx, size_t *tlen) {
-
-  RedisModuleString *pf = fmtRedisTermKey(ctx, "", 0);
-  size_t pflen;
-  const char *prefix = RedisModule_StringPtrLen(pf, &pflen);
-
-  for (int i = 0; i < 10; i++) {
-    RedisModuleCallReply *rep = RedisModule_Call(ctx->redisCtx, "RANDOMKEY", "");
-    if (rep == NULL || RedisModule_CallReplyType(rep) != REDISMODULE_REPLY_STRING) {
-      break;
-    }
-
-    // get the key and see if it matches the prefix
-    size_t len;
-    const char *kstr = RedisModule_CallReplyStringPtr(rep, &len);
-    if (!strncmp(kstr, prefix, pflen)) {
-      *tlen = len - pflen;
-      return kstr + pflen;
+IndexSpec *Redis_SelectNextIndex(RedisModuleCtx *ctx) {
+  IndexSpec *first = NULL, *sp;
+  while ((sp = IndexSpec_NextLive()) && sp != first) {
+    if (!first) first = sp;
+    // load it by name, so that its terms are migrated out of the keyspace if needed
+    IndexSpec *loaded = IndexSpec_Load(ctx, sp->name, 1);
+    if (loaded) {
+      return loaded;
     }
   }
-  *tlen = 0;
-  return NULL;
-}
-
-const char *Redis_SelectRandomTerm(RedisSearchCtx *ctx, size_t *tlen) {
-
-  for (int i = 0; i < 5; i++) {
-    RedisModuleCallReply *rep = RedisModule_Call(ctx->redisCtx, "RANDOMKEY", "");
-    if (rep == NULL || RedisModule_CallReplyType(rep) != REDISMODULE_REPLY_STRING) {
-      break;
-    }
-
-    // get the key and see if it matches the prefix
-    size_t len;
-    RedisModuleString *krstr = RedisModule_CreateStringFromCallReply(rep);
-    char *kstr = (char *)RedisModule_StringPtrLen(krstr, &len);
-    if (!strncmp(kstr, TERM_KEY_PREFIX, strlen(TERM_KEY_PREFIX))) {
-      // check to see that the key is indeed an inverted index record
-      RedisModuleKey *k = RedisModule_OpenKey(ctx->redisCtx, krstr, REDISMODULE_READ);
-      if (k == NULL || (RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY &&
-                        RedisModule_ModuleTypeGetType(k) != InvertedIndexType)) {
-        continue;
-      }
-      RedisModule_CloseKey(k);
-      size_t offset = strlen(TERM_KEY_PREFIX);
-      char *idx = kstr + offset;
-      while (offset < len && kstr[offset] != '/') {
-        offset++;
-      }
-      if (offset < len) {
-        kstr[offset++] = '\0';
-      }
-      char *term = kstr + offset;
-      *tlen = len - offset;
-      // printf("Found index %s and term %sm len %zd\n", idx, term, *tlen);
-      IndexSpec *sp = IndexSpec_Load(ctx->redisCtx, idx, 1);
-      // printf("Spec: %p\n", sp);
-
-      if (sp == NULL) {
-        continue;
-      }
-      ctx->spec = sp;
-      return term;
-    }
-  }
-
   return NULL;
 }
 // ScoreIndex *LoadRedisScoreIndex(RedisSearchCtx *ctx, const char *term, size_t len) {
@@ -186,49 +151,34 @@ const char *Redis_SelectRandomTerm(RedisSearchCtx *ctx, size_t *tlen) {
 
 InvertedIndex *Redis_OpenInvertedIndex(RedisSearchCtx *ctx, const char *term, size_t len,
                                        int write) {
-  RedisModuleString *termKey = fmtRedisTermKey(ctx, term, len);
-  RedisModuleKey *k = RedisModule_OpenKey(ctx->redisCtx, termKey,
-                                          REDISMODULE_READ | (write ? REDISMODULE_WRITE : 0));
-
-  RedisModule_FreeString(ctx->redisCtx, termKey);
-
-  // check that the key is empty
-  if (k == NULL || (RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY &&
-                    RedisModule_ModuleTypeGetType(k) != InvertedIndexType)) {
-    return NULL;
-  }
-
-  // on write mode, for an empty key we simply create a new index key
-  if (RedisModule_KeyType(k) == REDISMODULE_KEYTYPE_EMPTY) {
-
-    if (write) {
-      InvertedIndex *idx = NewInvertedIndex(ctx->spec->flags, 1);
-      RedisModule_ModuleTypeSetValue(k, InvertedIndexType, idx);
-      return idx;
-    } else {
-      return NULL;
-    }
+  // on write mode, for a new term we simply create a new index
+  if (write) {
+    return TermDict_Open(ctx->spec->termDict, term, len, ctx->spec->flags)->idx;
   }
-
-  return RedisModule_ModuleTypeGetValue(k);
+  return TermDict_Get(ctx->spec->termDict, term, len);
 }
 
 IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSToken *tok, DocTable *dt, int singleWordMode,
                               t_fieldMask fieldMask) {
 
-  RedisModuleString *termKey = fmtRedisTermKey(ctx, tok->str, tok->len);
-  RedisModuleKey *k = RedisModule_OpenKey(ctx->redisCtx, termKey, REDISMODULE_READ);
-  RedisModule_FreeString(ctx->redisCtx, termKey);
+  InvertedIndex *idx = TermDict_Get(ctx->spec->termDict, tok->str, tok->len);
   // we do not allow empty indexes when loading an existing index
-  if (k == NULL || RedisModule_KeyType(k) == REDISMODULE_KEYTYPE_EMPTY ||
-      RedisModule_ModuleTypeGetType(k) != InvertedIndexType) {
+  if (idx == NULL) {
     return NULL;
   }
 
-  InvertedIndex *idx = RedisModule_ModuleTypeGetValue(k);
   return NewIndexReader(idx, dt, fieldMask, ctx->spec->flags, NewTerm(tok), singleWordMode);
 }
 
+IndexReader *Redis_OpenFieldReader(RedisSearchCtx *ctx, FieldSpec *fs, RSToken *tok, DocTable *dt) {
+  InvertedIndex *idx = TermDict_Get(fs->dict, tok->str, tok->len);
+  if (idx == NULL) {
+    return NULL;
+  }
+  // all the records are of the field, so there's nothing to filter
+  return NewIndexReader(idx, dt, RS_FIELDMASK_ALL, idx->flags, NewTerm(tok), 0);
+}
+
 // void Redis_CloseReader(IndexReader *r) {
 //   // we don't call IR_Free because it frees the underlying memory right now
 
@@ -402,70 +352,89 @@ end:
   return num;
 }
 
-int Redis_OptimizeScanHandler(RedisModuleCtx *ctx, RedisModuleString *kn, void *opaque) {
-  // extract the term from the key
-  RedisSearchCtx *sctx = opaque;
-  RedisModuleString *pf = fmtRedisTermKey(sctx, "", 0);
-  size_t pflen, len;
-  RedisModule_StringPtrLen(pf, &pflen);
-
-  char *k = (char *)RedisModule_StringPtrLen(kn, &len);
-  k += pflen;
-
-  // Open the index writer for the term
-  InvertedIndex *w = Redis_OpenInvertedIndex(sctx, k, len - pflen, 1);
-  if (w) {
-    // InvertedIndex_Optimize(w);
-    // // Truncate the main index buffer to its final size
-    // Buffer_Truncate(w->) w->bw.Truncate(w->bw.buf, 0);
-    // sctx->spec->stats.invertedCap += w->bw.buf->cap;
-    // sctx->spec->stats.invertedSize += w->bw.buf->offset;
-
-    // // for small entries, delete the score index
-    // if (w->ndocs < SCOREINDEX_DELETE_THRESHOLD) {
-    //   RedisBufferCtx *bctx = w->scoreWriter.bw.buf->ctx;
-    //   RedisModule_DeleteKey(bctx->key);
-    //   RedisModule_CloseKey(bctx->key);
-    //   bctx->key = NULL;
-    // } else {
-    //   // truncate the score index to its final size
-    //   w->scoreWriter.bw.Truncate(w->scoreWriter.bw.buf, 0);
-    //   sctx->spec->stats.scoreIndexesSize += w->scoreWriter.bw.buf->cap;
-    // }
-
-    // // truncate the skip index
-    // w->skipIndexWriter.Truncate(w->skipIndexWriter.buf, 0);
-    // sctx->spec->stats.skipIndexesSize += w->skipIndexWriter.buf->cap;
-
-    // Redis_CloseWriter(w);
+typedef struct {
+  IndexSpec *sp;
+  size_t prefixLen;
+  size_t numMigrated;
+} MigrateScanCtx;
+
+static int Redis_MigrateScanHandler(RedisModuleCtx *ctx, RedisModuleString *kn, void *opaque) {
+  MigrateScanCtx *mctx = opaque;
+  RedisModuleKey *k = RedisModule_OpenKey(ctx, kn, REDISMODULE_READ | REDISMODULE_WRITE);
+  if (k == NULL || RedisModule_ModuleTypeGetType(k) != InvertedIndexType) {
+    return REDISMODULE_OK;
   }
 
-  RedisModule_FreeString(ctx, pf);
+  size_t len;
+  const char *kstr = RedisModule_StringPtrLen(kn, &len);
 
+  // take the blocks out of the key's index, so deleting the key doesn't free them
+  InvertedIndex *old = RedisModule_ModuleTypeGetValue(k);
+  InvertedIndex *idx = rm_malloc(sizeof(InvertedIndex));
+  *idx = *old;
+  old->blocks = NULL;
+  old->size = 0;
+
+  if (TermDict_Add(mctx->sp->termDict, kstr + mctx->prefixLen, len - mctx->prefixLen, idx)) {
+    mctx->numMigrated++;
+  } else {
+    InvertedIndex_Free(idx);
+  }
+  RedisModule_DeleteKey(k);
+  RedisModule_CloseKey(k);
   return REDISMODULE_OK;
 }
 
-int Redis_DropScanHandler(RedisModuleCtx *ctx, RedisModuleString *kn, void *opaque) {
-  // extract the term from the key
-  RedisSearchCtx *sctx = opaque;
-  RedisModuleString *pf = fmtRedisTermKey(sctx, "", 0);
-  size_t pflen, len;
-  RedisModule_StringPtrLen(pf, &pflen);
+size_t Redis_MigrateTermKeys(RedisModuleCtx *ctx, IndexSpec *sp) {
+  RedisSearchCtx sctx = {ctx, sp};
+  RedisModuleString *pf = fmtRedisTermKey(&sctx, "", 0);
+  MigrateScanCtx mctx = {.sp = sp, .numMigrated = 0};
+  RedisModule_StringPtrLen(pf, &mctx.prefixLen);
+  RedisModule_FreeString(ctx, pf);
 
-  char *k = (char *)RedisModule_StringPtrLen(kn, &len);
-  k += pflen;
-  // char *term = strndup(k, len - pflen);
+  pf = fmtRedisTermKey(&sctx, "*", 1);
+  Redis_ScanKeys(ctx, RedisModule_StringPtrLen(pf, NULL), Redis_MigrateScanHandler, &mctx);
+  RedisModule_FreeString(ctx, pf);
 
-  RedisModuleString *sck = fmtRedisScoreIndexKey(sctx, k, len - pflen);
-  RedisModuleString *sik = fmtRedisSkipIndexKey(sctx, k, len - pflen);
+  RedisModule_Log(ctx, "notice", "Moved %zd term keys of index %s into its term dictionary",
+                  mctx.numMigrated, sp->name);
+  return mctx.numMigrated;
+}
 
-  RedisModule_Call(ctx, "DEL", "sss", kn, sck, sik);
+size_t Redis_CompactIndex(RedisSearchCtx *ctx) {
+  DocTable *dt = ctx->spec->docs;
+  t_docId maxId = dt->maxDocId;
+  t_docId *idMap = DocTable_Compact(dt);
+  if (!idMap) {
+    return 0;
+  }
 
-  RedisModule_FreeString(ctx, sck);
-  RedisModule_FreeString(ctx, sik);
-  // free(term);
+  TermDict *td = ctx->spec->termDict;
+  for (uint32_t i = 0; i < td->numEntries; i++) {
+    ctx->spec->stats.numRecords -= InvertedIndex_Remap(td->entries[i].idx, idMap, maxId);
+  }
 
-  return REDISMODULE_OK;
+  for (size_t i = 0; i < ctx->spec->numFields; i++) {
+    FieldSpec *fs = ctx->spec->fields + i;
+    if (fs->type == F_NUMERIC) {
+      NumericRangeTree *t = OpenNumericIndex(ctx, fs->name);
+      if (t) NumericRangeTree_Remap(t, idMap, maxId);
+    } else if (fs->type == F_GEO) {
+      GeoIndex gi = {.ctx = ctx, .sp = fs};
+      GeoIndex_Remap(&gi, idMap, maxId);
+    } else if (fs->dict) {
+      size_t removed = FieldSpec_RemapDict(fs, idMap, maxId);
+      // the records of tags are not counted in the stats, the ones of text fields are
+      if (fs->type == F_FULLTEXT) {
+        ctx->spec->stats.numRecords -= removed;
+      }
+    }
+  }
+  IndexGC_Remap(ctx->spec->gc, idMap, maxId);
+  IndexSpec_UpdateInvertedStats(ctx->spec);
+
+  rm_free(idMap);
+  return maxId - dt->maxDocId;
 }
 
 static int Redis_DeleteKey(RedisModuleCtx *ctx, RedisModuleString *s) {
@@ -478,33 +447,42 @@ static int Redis_DeleteKey(RedisModuleCtx *ctx, RedisModuleString *s) {
   return 0;
 }
 
+/* Delete a key of a native redis type with UNLINK, so redis frees a big value in the background.
+ * Falls back to deleting it right away if UNLINK is not supported */
+static void Redis_UnlinkKey(RedisModuleCtx *ctx, RedisModuleString *s) {
+  RedisModuleCallReply *r = RedisModule_Call(ctx, "UNLINK", "s", s);
+  if (r == NULL || RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ERROR) {
+    Redis_DeleteKey(ctx, s);
+  }
+}
+
 int Redis_DropIndex(RedisSearchCtx *ctx, int deleteDocuments) {
 
-  if (deleteDocuments) {
+  // the documents of a shared table may be in other indexes, so they and the table are kept
+  if (deleteDocuments && !ctx->spec->docTableName) {
 
-    DocTable *dt = &ctx->spec->docs;
+    DocTable *dt = ctx->spec->docs;
 
-    for (size_t i = 1; i < dt->size; i++) {
-      Redis_DeleteKey(ctx->redisCtx, RedisModule_CreateString(ctx->redisCtx, dt->docs[i].key,
-                                                              strlen(dt->docs[i].key)));
+    for (t_docId i = 1; i < dt->size; i++) {
+      const char *key = DocTable_Entry(dt, i)->key;
+      Redis_DeleteKey(ctx->redisCtx, RedisModule_CreateString(ctx->redisCtx, key, strlen(key)));
     }
   }
 
-  RedisModuleString *pf = fmtRedisTermKey(ctx, "*", 1);
-  const char *prefix = RedisModule_StringPtrLen(pf, NULL);
-
-  // // Delete the actual index sub keys
-  Redis_ScanKeys(ctx->redisCtx, prefix, Redis_DropScanHandler, ctx);
-
-  // Delete the numeric indexes
+  // Delete the numeric and geo indexes. These are the only keys the index owns besides its spec,
+  // and are named after its fields, so we don't need to look for them
   for (size_t i = 0; i < ctx->spec->numFields; i++) {
-    const FieldSpec *spec = ctx->spec->fields + i;
-    if (spec->type == F_NUMERIC) {
-      Redis_DeleteKey(ctx->redisCtx, fmtRedisNumericIndexKey(ctx, spec->name));
+    FieldSpec *fs = ctx->spec->fields + i;
+    if (fs->type == F_NUMERIC) {
+      Redis_DeleteKey(ctx->redisCtx, fmtRedisNumericIndexKey(ctx, fs->name));
+    } else if (fs->type == F_GEO) {
+      GeoIndex gi = {.ctx = ctx, .sp = fs};
+      Redis_UnlinkKey(ctx->redisCtx, fmtGeoIndexKey(&gi));
     }
   }
 
-  // Delete the index spec
+  // Delete the index spec. This frees its term dictionary along with it, in the background if it's
+  // big, so the index name can be reused right away
   int deleted = Redis_DeleteKey(
       ctx->redisCtx,
       RedisModule_CreateStringPrintf(ctx->redisCtx, INDEX_SPEC_KEY_FMT, ctx->spec->name));
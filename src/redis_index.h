@@ -7,21 +7,25 @@
 #include "search_ctx.h"
 #include "spec.h"
 
-/* Open an inverted index reader on a redis DMA string, for a specific term.
+/* Open an inverted index reader on the index's term dictionary, for a specific term.
  * If singleWordMode is set to 1, we do not load the skip index, only the score index
  */
 IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSToken *tok, DocTable *dt,
                               int singleWordMode, t_fieldMask fieldMask);
 
+/* Open a reader of a term in the postings of a text field with its own postings. Returns NULL if
+ * the field has no records of the term */
+IndexReader *Redis_OpenFieldReader(RedisSearchCtx *ctx, FieldSpec *fs, RSToken *tok, DocTable *dt);
+
 InvertedIndex *Redis_OpenInvertedIndex(RedisSearchCtx *ctx, const char *term, size_t len,
                                        int write);
 void Redis_CloseReader(IndexReader *r);
 
 /*
- * Select a random term from the index that matches the index prefix and inveted key format.
- * It tries RANDOMKEY 10 times and returns NULL if it can't find anything.
+ * Select the next index to work on. The live indexes are walked round-robin, so repeated calls
+ * cover all of them. Returns NULL if there is no index.
  */
-const char *Redis_SelectRandomTerm(RedisSearchCtx *ctx, size_t *tlen);
+IndexSpec *Redis_SelectNextIndex(RedisModuleCtx *ctx);
 
 #define TERM_KEY_FORMAT "ft:%s/%.*s"
 #define TERM_KEY_PREFIX "ft:"
@@ -33,24 +37,29 @@ typedef int (*ScanFunc)(RedisModuleCtx *ctx, RedisModuleString *keyName, void *o
 /* Scan the keyspace with MATCH for a prefix, and call ScanFunc for each key found */
 int Redis_ScanKeys(RedisModuleCtx *ctx, const char *prefix, ScanFunc f, void *opaque);
 
-/* Optimize the buffers of a speicif term hit */
-int Redis_OptimizeScanHandler(RedisModuleCtx *ctx, RedisModuleString *kn, void *opaque);
-
 /* Drop the index and all the associated keys.
 *
 *  If deleteDocuments is non zero, we will delete the saved documents (if they exist).
 *  Only set this if there are no other indexes in the same redis instance.
+*  The keys the index owns are found by its schema without scanning the keyspace, and a big index's
+*  memory is freed in the background, so the index name can be reused right away.
 */
 int Redis_DropIndex(RedisSearchCtx *ctx, int deleteDocuments);
 
-/* Drop all the index's internal keys using this scan handler */
-int Redis_DropScanHandler(RedisModuleCtx *ctx, RedisModuleString *kn, void *opaque);
+/* Compact the index's docIds, dropping deleted documents from the doc table and renumbering the live
+ * ones densely, then rewriting all the term, numeric and geo indexes to the new ids.
+ * Returns the number of document ids reclaimed */
+size_t Redis_CompactIndex(RedisSearchCtx *ctx);
+
+/* Move the term keys of an index loaded from an older RDB into its term dictionary, deleting the
+ * keys. Returns the number of terms moved */
+size_t Redis_MigrateTermKeys(RedisModuleCtx *ctx, IndexSpec *sp);
 
 /* Collect memory stas on the index */
 int Redis_StatsScanHandler(RedisModuleCtx *ctx, RedisModuleString *kn, void *opaque);
 /**
-* Format redis key for a term.
-* TODO: Add index name to it
+* Format redis key for a term. Terms are no longer kept in redis keys, this is only used to find the
+* keys of indexes saved by older versions
 */
 RedisModuleString *fmtRedisTermKey(RedisSearchCtx *ctx, const char *term, size_t len);
 RedisModuleString *fmtRedisSkipIndexKey(RedisSearchCtx *ctx, const char *term, size_t len);
@@ -58,6 +67,10 @@ RedisModuleString *fmtRedisNumericIndexKey(RedisSearchCtx *ctx, const char *fiel
 
 extern RedisModuleType *InvertedIndexType;
 
+/* The encoding version of inverted indexes. Version 0 saved each block separately, version 1 saves
+ * all the blocks of an index as one stream */
+#define INVERTED_INDEX_ENCVER 1
+
 void InvertedIndex_Free(void *idx);
 void *InvertedIndex_RdbLoad(RedisModuleIO *rdb, int encver);
 void InvertedIndex_RdbSave(RedisModuleIO *rdb, void *value);
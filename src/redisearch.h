@@ -6,16 +6,24 @@
 
 typedef uint32_t t_docId;
 typedef uint32_t t_offset;
-typedef uint32_t t_fieldMask;
 
-#define RSFieldMask_Contains(mask, n) (((1 << (n - 1)) & mask) != 0)
+/* A field mask has a bit for every text or tag field of the index, so its width is the limit on
+ * the number of those fields. 128 bits where the compiler supports it, 64 bits otherwise, or when
+ * built with RS_NO_U128 */
+#if defined(__SIZEOF_INT128__) && !defined(RS_NO_U128)
+typedef __uint128_t t_fieldMask;
+#else
+typedef uint64_t t_fieldMask;
+#endif
+
+#define RSFieldMask_Contains(mask, n) ((((t_fieldMask)1 << ((n)-1)) & (mask)) != 0)
 
 struct RSSortingVector;
 
 #define REDISEARCH_ERR 1
 #define REDISEARCH_OK 0
 
-#define RS_FIELDMASK_ALL 0xFFFFFFFF
+#define RS_FIELDMASK_ALL ((t_fieldMask)~(t_fieldMask)0)
 
 /* A payload object is set either by a query expander or by the user, and can be used to process
  * scores. For examples, it can be a feature vector that is then compared to a feature vector
@@ -157,6 +165,9 @@ typedef struct {
   /* Inverse document frequency of the term in the index. See
    * https://en.wikipedia.org/wiki/Tf%E2%80%93idf */
   double idf;
+  /* The BM25 variant of the term's inverse document frequency, see
+   * https://en.wikipedia.org/wiki/Okapi_BM25 */
+  double bm25_idf;
   /* Flags given by the engine or by the query expander */
   RSTokenFlags flags;
 } RSQueryTerm;
@@ -203,11 +214,6 @@ typedef struct {
 
 typedef struct RSIndexResult {
 
-  /******************************************************************************
-   * IMPORTANT: The order of the following 4 variables must remain the same, and all
-   * their type aliases must remain uint32_t. The record is decoded by casting it
-   * to an array of 4 uint32_t integers to avoid redunadnt memcpy
-   *******************************************************************************/
   /* The docuId of the result */
   t_docId docId;
 
@@ -221,10 +227,6 @@ typedef struct RSIndexResult {
    * directly into memory */
   uint32_t offsetsSz;
 
-  /*******************************************************************************
-   * END OF the "magic 4 uints" section
-   ********************************************************************************/
-
   union {
     RSAggregateResult agg;
     RSTermRecord term;
@@ -242,6 +244,16 @@ int RSIndexResult_HasOffsets(RSIndexResult *res);
 
 int RSIndexResult_IsAggregate(RSIndexResult *r);
 
+/* Index-wide statistics available to scoring functions, taken when the query starts */
+typedef struct {
+  /* The number of documents in the index */
+  size_t numDocs;
+  /* The number of unique terms in the index */
+  size_t numTerms;
+  /* The average number of tokens in a document of the index */
+  double avgDocLen;
+} RSIndexStats;
+
 /* The context given to a scoring function. It includes the payload set by the user or expander, the
  * private data set by the extensionm and callback functions */
 typedef struct {
@@ -252,12 +264,49 @@ typedef struct {
   /* The GetSlop() calback. Returns the cumulative "slop" or distance between the query terms, that
    * can be used to factor the result score */
   int (*GetSlop)(RSIndexResult *res);
+  /* Statistics of the index being searched */
+  RSIndexStats indexStats;
 } RSScoringFunctionCtx;
 
 /* RSScoringFunction is a callback type for query custom scoring function modules */
 typedef double (*RSScoringFunction)(RSScoringFunctionCtx *ctx, RSIndexResult *res,
                                     RSDocumentMetadata *dmd, double minScore);
 
+/* The maximal number of results given to a batch scoring function at once */
+#define RS_SCORING_BATCH_SIZE 64
+
+/* A block of results given to a batch scoring function. The per-result arrays all have numResults
+ * entries. The term records of each result are flattened into the term arrays - the terms of
+ * result i are at indexes termsOffset[i] up to termsOffset[i + 1] */
+typedef struct {
+  size_t numResults;
+
+  /* Per result arrays */
+  t_docId *docIds;
+  RSDocumentMetadata **dmds;
+  /* The document score, max frequency and length, copied from the document metadata */
+  float *docScores;
+  uint32_t *maxFreqs;
+  uint32_t *docLens;
+  /* The full result trees. They are only valid for the duration of the call */
+  RSIndexResult **results;
+  /* Where the terms of each result begin in the term arrays, has numResults + 1 entries */
+  size_t *termsOffset;
+
+  /* Per term record arrays */
+  uint32_t *termFreqs;
+  RSQueryTerm **terms;
+
+  /* The output array, the scoring function should set the score of result i in scores[i] */
+  double *scores;
+} RSScoringBatch;
+
+/* RSBatchScoringFunction is an optional callback scoring a whole block of results at once, letting
+ * scorers work in tight loops over arrays. minScore is the minimal score of the results collected
+ * so far */
+typedef void (*RSBatchScoringFunction)(RSScoringFunctionCtx *ctx, RSScoringBatch *batch,
+                                       double minScore);
+
 /* The extension registeration context, containing the callbacks avaliable to the extension for
  * registering query expanders and scorers. */
 typedef struct RSExtensionCtx {
@@ -265,6 +314,9 @@ typedef struct RSExtensionCtx {
                                  void *privdata);
   int (*RegisterQueryExpander)(const char *alias, RSQueryTokenExpander exp, RSFreeFunction ff,
                                void *privdata);
+  /* Add a batch version to an already registered scoring function. When it exists, the engine
+   * scores results with it, in blocks of up to RS_SCORING_BATCH_SIZE results */
+  int (*RegisterBatchScoringFunction)(const char *alias, RSBatchScoringFunction func);
 } RSExtensionCtx;
 
 /* An extension initialization function  */
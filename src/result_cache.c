@@ -0,0 +1,401 @@
+#include "result_cache.h"
+#include "rmalloc.h"
+#include "util/fnv.h"
+#include <string.h>
+#include <ctype.h>
+
+/* The operations of a recorded reply. Each is a single byte followed by its arguments */
+typedef enum {
+  ReplyOp_Array = 1,   // long long length
+  ReplyOp_String,      // uint32_t length, bytes
+  ReplyOp_Double,      // double
+  ReplyOp_LongLong,    // long long
+  ReplyOp_Null,
+} replyOp;
+
+void ReplyRecorder_Init(ReplyRecorder *rr) {
+  Buffer_Init(&rr->buf, 256);
+  rr->bw = NewBufferWriter(&rr->buf);
+  rr->depth = 0;
+  rr->failed = 0;
+}
+
+void ReplyRecorder_Free(ReplyRecorder *rr) {
+  if (rr->buf.data) {
+    Buffer_Free(&rr->buf);
+    rr->buf.data = NULL;
+  }
+}
+
+static void replyRecorder_writeOp(ReplyRecorder *rr, replyOp op) {
+  char c = op;
+  Buffer_Write(&rr->bw, &c, 1);
+}
+
+void ReplyRecorder_Array(ReplyRecorder *rr, RedisModuleCtx *ctx, long len) {
+  if (ctx) RedisModule_ReplyWithArray(ctx, len);
+  if (!rr) return;
+
+  replyRecorder_writeOp(rr, ReplyOp_Array);
+  if (len == REDISMODULE_POSTPONED_ARRAY_LEN) {
+    if (rr->depth == REPLY_RECORDER_MAX_DEPTH) {
+      rr->failed = 1;
+      return;
+    }
+    rr->postponed[rr->depth++] = Buffer_Offset(&rr->buf);
+  }
+  long long ll = len;
+  Buffer_Write(&rr->bw, &ll, sizeof(ll));
+}
+
+void ReplyRecorder_SetArrayLength(ReplyRecorder *rr, RedisModuleCtx *ctx, long len) {
+  if (ctx) RedisModule_ReplySetArrayLength(ctx, len);
+  if (!rr) return;
+
+  if (rr->depth == 0) {
+    rr->failed = 1;
+    return;
+  }
+  long long ll = len;
+  Buffer_WriteAt(&rr->bw, rr->postponed[--rr->depth], &ll, sizeof(ll));
+}
+
+void ReplyRecorder_StringBuffer(ReplyRecorder *rr, RedisModuleCtx *ctx, const char *str,
+                                size_t len) {
+  if (ctx) RedisModule_ReplyWithStringBuffer(ctx, str, len);
+  if (!rr) return;
+
+  replyRecorder_writeOp(rr, ReplyOp_String);
+  uint32_t l = len;
+  Buffer_Write(&rr->bw, &l, sizeof(l));
+  Buffer_Write(&rr->bw, (void *)str, len);
+}
+
+void ReplyRecorder_String(ReplyRecorder *rr, RedisModuleCtx *ctx, RedisModuleString *str) {
+  if (ctx) RedisModule_ReplyWithString(ctx, str);
+  if (!rr) return;
+
+  size_t len;
+  const char *s = RedisModule_StringPtrLen(str, &len);
+  ReplyRecorder_StringBuffer(rr, NULL, s, len);
+}
+
+void ReplyRecorder_Double(ReplyRecorder *rr, RedisModuleCtx *ctx, double d) {
+  if (ctx) RedisModule_ReplyWithDouble(ctx, d);
+  if (!rr) return;
+
+  replyRecorder_writeOp(rr, ReplyOp_Double);
+  Buffer_Write(&rr->bw, &d, sizeof(d));
+}
+
+void ReplyRecorder_LongLong(ReplyRecorder *rr, RedisModuleCtx *ctx, long long ll) {
+  if (ctx) RedisModule_ReplyWithLongLong(ctx, ll);
+  if (!rr) return;
+
+  replyRecorder_writeOp(rr, ReplyOp_LongLong);
+  Buffer_Write(&rr->bw, &ll, sizeof(ll));
+}
+
+void ReplyRecorder_Null(ReplyRecorder *rr, RedisModuleCtx *ctx) {
+  if (ctx) RedisModule_ReplyWithNull(ctx);
+  if (!rr) return;
+
+  replyRecorder_writeOp(rr, ReplyOp_Null);
+}
+
+void ReplyRecorder_Replay(Buffer *reply, RedisModuleCtx *ctx) {
+  const char *p = reply->data;
+  const char *end = reply->data + reply->offset;
+  while (p < end) {
+    replyOp op = *p++;
+    switch (op) {
+      case ReplyOp_Array: {
+        long long len;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        RedisModule_ReplyWithArray(ctx, len);
+        break;
+      }
+      case ReplyOp_String: {
+        uint32_t len;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        RedisModule_ReplyWithStringBuffer(ctx, p, len);
+        p += len;
+        break;
+      }
+      case ReplyOp_Double: {
+        double d;
+        memcpy(&d, p, sizeof(d));
+        p += sizeof(d);
+        RedisModule_ReplyWithDouble(ctx, d);
+        break;
+      }
+      case ReplyOp_LongLong: {
+        long long ll;
+        memcpy(&ll, p, sizeof(ll));
+        p += sizeof(ll);
+        RedisModule_ReplyWithLongLong(ctx, ll);
+        break;
+      }
+      case ReplyOp_Null:
+        RedisModule_ReplyWithNull(ctx);
+        break;
+    }
+  }
+}
+
+/* A cached reply. Entries are chained in their hash bucket, and in a list kept in LRU order */
+typedef struct resultCacheEntry {
+  sds key;
+  uint32_t hash;
+  IndexSpec *spec;
+  uint64_t generation;
+
+  Buffer reply;
+  size_t memsize;
+
+  struct resultCacheEntry *bucketNext;
+  struct resultCacheEntry *prev;
+  struct resultCacheEntry *next;
+} resultCacheEntry;
+
+#define RESULT_CACHE_BUCKETS 8192
+
+static struct {
+  resultCacheEntry *buckets[RESULT_CACHE_BUCKETS];
+  // the most and least recently used entries
+  resultCacheEntry *head;
+  resultCacheEntry *tail;
+  size_t maxmem;
+  ResultCacheStats stats;
+} __resultCache = {.maxmem = RESULT_CACHE_DEFAULT_MAXMEM};
+
+static void resultCache_unlink(resultCacheEntry *e) {
+  if (e->prev) {
+    e->prev->next = e->next;
+  } else {
+    __resultCache.head = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  } else {
+    __resultCache.tail = e->prev;
+  }
+  e->prev = e->next = NULL;
+}
+
+static void resultCache_pushFront(resultCacheEntry *e) {
+  e->prev = NULL;
+  e->next = __resultCache.head;
+  if (__resultCache.head) {
+    __resultCache.head->prev = e;
+  } else {
+    __resultCache.tail = e;
+  }
+  __resultCache.head = e;
+}
+
+static resultCacheEntry *resultCache_find(sds key, uint32_t hash) {
+  resultCacheEntry *e = __resultCache.buckets[hash % RESULT_CACHE_BUCKETS];
+  while (e) {
+    if (e->hash == hash && sdslen(e->key) == sdslen(key) && !memcmp(e->key, key, sdslen(key))) {
+      return e;
+    }
+    e = e->bucketNext;
+  }
+  return NULL;
+}
+
+/* Remove an entry from the cache and free it */
+static void resultCache_remove(resultCacheEntry *e) {
+  resultCacheEntry **pp = &__resultCache.buckets[e->hash % RESULT_CACHE_BUCKETS];
+  while (*pp != e) {
+    pp = &(*pp)->bucketNext;
+  }
+  *pp = e->bucketNext;
+  resultCache_unlink(e);
+
+  __resultCache.stats.entries--;
+  __resultCache.stats.memsize -= e->memsize;
+  Buffer_Free(&e->reply);
+  sdsfree(e->key);
+  free(e);
+}
+
+static void resultCache_evict(size_t maxmem) {
+  while (__resultCache.tail && __resultCache.stats.memsize > maxmem) {
+    resultCache_remove(__resultCache.tail);
+  }
+}
+
+void ResultCache_SetMaxMemory(size_t maxmem) {
+  __resultCache.maxmem = maxmem;
+  resultCache_evict(maxmem);
+}
+
+static sds resultCache_appendStr(sds key, const char *s, size_t len) {
+  uint32_t l = s ? len : UINT32_MAX;
+  key = sdscatlen(key, &l, sizeof(l));
+  return s ? sdscatlen(key, s, len) : key;
+}
+
+#define resultCache_append(key, v) sdscatlen(key, &(v), sizeof(v))
+
+sds ResultCache_RequestKey(RSSearchRequest *req, IndexSpec *sp) {
+  // the generation of the index doesn't cover the other indexes a search is intersected with
+  if (__resultCache.maxmem == 0 || (req->flags & (Search_WithCursor | Search_Profile)) ||
+      req->numIntersects) {
+    return NULL;
+  }
+
+  sds key = sdsMakeRoomFor(sdsempty(), 128 + req->qlen);
+  key = resultCache_append(key, sp);
+  key = resultCache_append(key, req->flags);
+  key = resultCache_append(key, req->offset);
+  key = resultCache_append(key, req->num);
+  key = resultCache_append(key, req->fieldMask);
+  key = resultCache_append(key, req->slop);
+
+  int sortBy[2] = {-1, 0};
+  if (req->sortBy) {
+    sortBy[0] = req->sortBy->index;
+    sortBy[1] = req->sortBy->ascending;
+  }
+  key = resultCache_append(key, sortBy);
+
+  key = resultCache_appendStr(key, req->language, req->language ? strlen(req->language) : 0);
+  key = resultCache_appendStr(key, req->expander, req->expander ? strlen(req->expander) : 0);
+  key = resultCache_appendStr(key, req->scorer, req->scorer ? strlen(req->scorer) : 0);
+  key = resultCache_appendStr(key, req->payload.data, req->payload.len);
+
+  key = resultCache_append(key, req->nretfields);
+  for (size_t i = 0; i < req->nretfields; i++) {
+    key = resultCache_appendStr(key, req->retfields[i], strlen(req->retfields[i]));
+  }
+
+  size_t nfilters = req->numericFilters ? Vector_Size(req->numericFilters) : 0;
+  key = resultCache_append(key, nfilters);
+  for (size_t i = 0; i < nfilters; i++) {
+    NumericFilter *nf;
+    Vector_Get(req->numericFilters, i, &nf);
+    key = resultCache_appendStr(key, nf->fieldName, strlen(nf->fieldName));
+    double range[2] = {nf->min, nf->max};
+    int incl[2] = {nf->inclusiveMin, nf->inclusiveMax};
+    key = resultCache_append(key, range);
+    key = resultCache_append(key, incl);
+  }
+
+  GeoFilter *gf = req->geoFilter;
+  key = resultCache_appendStr(key, gf ? gf->property : NULL, gf ? strlen(gf->property) : 0);
+  if (gf) {
+    double geo[3] = {gf->lat, gf->lon, gf->radius};
+    key = resultCache_append(key, geo);
+    key = resultCache_appendStr(key, gf->unit, strlen(gf->unit));
+  }
+
+  // the id filter is resolved to docIds when the request is parsed
+  t_offset nids = req->idFilter ? req->idFilter->size : 0;
+  key = resultCache_append(key, nids);
+  if (nids) {
+    key = sdscatlen(key, req->idFilter->ids, nids * sizeof(t_docId));
+  }
+
+  // whitespace only separates tokens, so runs of it are collapsed into one space
+  int space = 1;
+  for (size_t i = 0; i < req->qlen; i++) {
+    if (isspace((unsigned char)req->rawQuery[i])) {
+      if (!space) key = sdscatlen(key, " ", 1);
+      space = 1;
+    } else {
+      key = sdscatlen(key, &req->rawQuery[i], 1);
+      space = 0;
+    }
+  }
+  return key;
+}
+
+Buffer *ResultCache_Get(IndexSpec *sp, sds key) {
+  uint32_t hash = fnv_32a_buf(key, sdslen(key), 0);
+  resultCacheEntry *e = resultCache_find(key, hash);
+  if (e && e->generation != sp->generation) {
+    resultCache_remove(e);
+    e = NULL;
+  }
+  if (!e) {
+    __resultCache.stats.misses++;
+    return NULL;
+  }
+
+  __resultCache.stats.hits++;
+  resultCache_unlink(e);
+  resultCache_pushFront(e);
+  return &e->reply;
+}
+
+int ResultCache_Reply(RedisModuleCtx *ctx, IndexSpec *sp, sds key) {
+  Buffer *reply = ResultCache_Get(sp, key);
+  if (!reply) {
+    return 0;
+  }
+  ReplyRecorder_Replay(reply, ctx);
+  return 1;
+}
+
+void ResultCache_Put(IndexSpec *sp, uint64_t generation, sds key, ReplyRecorder *rr) {
+  size_t memsize = sizeof(resultCacheEntry) + sdslen(key) + Buffer_Offset(&rr->buf);
+  if (rr->failed || rr->depth || generation != sp->generation ||
+      memsize > __resultCache.maxmem / RESULT_CACHE_MAX_ENTRY_FRACTION) {
+    ReplyRecorder_Free(rr);
+    sdsfree(key);
+    return;
+  }
+
+  uint32_t hash = fnv_32a_buf(key, sdslen(key), 0);
+  resultCacheEntry *old = resultCache_find(key, hash);
+  if (old) {
+    resultCache_remove(old);
+  }
+  resultCache_evict(__resultCache.maxmem - memsize);
+
+  resultCacheEntry *e = malloc(sizeof(*e));
+  *e = (resultCacheEntry){
+      .key = key,
+      .hash = hash,
+      .spec = sp,
+      .generation = generation,
+      .reply = rr->buf,
+      .memsize = memsize,
+  };
+  // the reply is kept for good, so it is trimmed to its size
+  Buffer_Truncate(&e->reply, 0);
+  rr->buf.data = NULL;
+
+  size_t b = hash % RESULT_CACHE_BUCKETS;
+  e->bucketNext = __resultCache.buckets[b];
+  __resultCache.buckets[b] = e;
+  resultCache_pushFront(e);
+  __resultCache.stats.entries++;
+  __resultCache.stats.memsize += memsize;
+}
+
+void ResultCache_PurgeIndex(IndexSpec *sp) {
+  resultCacheEntry *e = __resultCache.head;
+  while (e) {
+    resultCacheEntry *next = e->next;
+    if (e->spec == sp) {
+      resultCache_remove(e);
+    }
+    e = next;
+  }
+}
+
+void ResultCache_Clear() {
+  while (__resultCache.head) {
+    resultCache_remove(__resultCache.head);
+  }
+}
+
+ResultCacheStats GetResultCacheStats() {
+  return __resultCache.stats;
+}
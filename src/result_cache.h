@@ -0,0 +1,97 @@
+#ifndef __RS_RESULT_CACHE_H__
+#define __RS_RESULT_CACHE_H__
+
+#include <stdlib.h>
+#include "buffer.h"
+#include "spec.h"
+#include "search_request.h"
+#include "redismodule.h"
+#include "rmutil/sds.h"
+
+/* The result cache keeps the replies of recently run searches, so that a search repeated on an
+ * index that hasn't changed since replays the recorded reply instead of running again.
+ *
+ * Entries are keyed by the index and every field of the search request, with the whitespace of the
+ * query string normalized. Every write to an index bumps its generation, and an entry is only valid
+ * for the generation it was recorded at - stale entries are dropped when they are looked up, or
+ * evicted from the least recently used end when the cache is over its memory limit.
+ *
+ * Document contents are loaded from the document hashes when replying, so a document hash changed
+ * directly and not through the module is not noticed by the cache.
+ *
+ * The cache is shared by all indexes, and is protected by the GIL */
+
+/* The default memory limit of the cache, set with the RESULTCACHE_MAXMEM module argument. A limit
+ * of 0 disables the cache */
+#define RESULT_CACHE_DEFAULT_MAXMEM (64 * 1024 * 1024)
+
+/* Replies bigger than this fraction of the memory limit are not cached */
+#define RESULT_CACHE_MAX_ENTRY_FRACTION 16
+
+/* The deepest nesting of postponed length arrays a recorder can track */
+#define REPLY_RECORDER_MAX_DEPTH 8
+
+typedef struct {
+  size_t hits;
+  size_t misses;
+  size_t entries;
+  size_t memsize;
+} ResultCacheStats;
+
+/* A reply recorder records a reply as it is sent to the client, so it can be cached and replayed.
+ * The ReplyRecorder_* reply functions reply on ctx, and record the reply if the recorder is not
+ * NULL. ctx may be NULL to only record */
+typedef struct {
+  Buffer buf;
+  BufferWriter bw;
+  /* The offsets of the lengths of the postponed length arrays still open */
+  size_t postponed[REPLY_RECORDER_MAX_DEPTH];
+  int depth;
+  /* Set if something could not be recorded */
+  int failed;
+} ReplyRecorder;
+
+void ReplyRecorder_Init(ReplyRecorder *rr);
+void ReplyRecorder_Free(ReplyRecorder *rr);
+
+void ReplyRecorder_Array(ReplyRecorder *rr, RedisModuleCtx *ctx, long len);
+void ReplyRecorder_SetArrayLength(ReplyRecorder *rr, RedisModuleCtx *ctx, long len);
+void ReplyRecorder_StringBuffer(ReplyRecorder *rr, RedisModuleCtx *ctx, const char *str,
+                                size_t len);
+void ReplyRecorder_String(ReplyRecorder *rr, RedisModuleCtx *ctx, RedisModuleString *str);
+void ReplyRecorder_Double(ReplyRecorder *rr, RedisModuleCtx *ctx, double d);
+void ReplyRecorder_LongLong(ReplyRecorder *rr, RedisModuleCtx *ctx, long long ll);
+void ReplyRecorder_Null(ReplyRecorder *rr, RedisModuleCtx *ctx);
+
+/* Replay a recorded reply on ctx */
+void ReplyRecorder_Replay(Buffer *reply, RedisModuleCtx *ctx);
+
+/* Set the memory limit of the cache in bytes, evicting entries above it. 0 disables the cache */
+void ResultCache_SetMaxMemory(size_t maxmem);
+
+/* The cache key of a request on an index, or NULL if the cache is disabled or the request can't be
+ * cached, i.e. it opens a cursor or is profiled. The key is freed with sdsfree */
+sds ResultCache_RequestKey(RSSearchRequest *req, IndexSpec *sp);
+
+/* The recorded reply of a request key, if it is cached and recorded at the index's current
+ * generation. A stale entry is dropped. The reply belongs to the cache */
+Buffer *ResultCache_Get(IndexSpec *sp, sds key);
+
+/* Reply with the cached reply of a request key. Returns 1 if it was replied, 0 if it is not cached
+ * or stale */
+int ResultCache_Reply(RedisModuleCtx *ctx, IndexSpec *sp, sds key);
+
+/* Cache the reply recorded by rr for a request key, as of the given index generation. The cache
+ * takes the key and the recorded reply, and the recorder is left empty. Replies recorded before
+ * a write to the index, or that are too big, are not cached and freed */
+void ResultCache_Put(IndexSpec *sp, uint64_t generation, sds key, ReplyRecorder *rr);
+
+/* Drop all the cached replies of an index that is being freed */
+void ResultCache_PurgeIndex(IndexSpec *sp);
+
+/* Drop all the cached replies */
+void ResultCache_Clear();
+
+ResultCacheStats GetResultCacheStats();
+
+#endif
@@ -6,6 +6,9 @@
 #include "extension.h"
 #include "query.h"
 #include "concurrent_ctx.h"
+#include "cursor.h"
+#include "query_cache.h"
+#include "result_cache.h"
 #include "redismodule.h"
 #include "rmalloc.h"
 #include <sys/param.h>
@@ -66,6 +69,7 @@ RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int
       .flags = RS_DEFAULT_QUERY_FLAGS,
       .slop = -1,
       .fieldMask = RS_FIELDMASK_ALL,
+      .cursorMaxIdle = RS_CURSOR_DEFAULT_MAXIDLE,
   };
 
   // Detect "NOCONTENT"
@@ -92,6 +96,18 @@ RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int
     req->slop = __INT_MAX__;
   }
 
+  // Parse WITHCURSOR and its optional MAXIDLE
+  if (RMUtil_ArgExists("WITHCURSOR", argv, argc, 3)) {
+    req->flags |= Search_WithCursor;
+    if (RMUtil_ArgExists("MAXIDLE", argv, argc, 3)) {
+      if (RMUtil_ParseArgsAfter("MAXIDLE", argv, argc, "l", &req->cursorMaxIdle) != REDISMODULE_OK ||
+          req->cursorMaxIdle <= 0) {
+        *errStr = "Bad argument for `MAXIDLE`";
+        goto err;
+      }
+    }
+  }
+
   // Parse LIMIT argument
   long long first = 0, limit = 10;
   RMUtil_ParseArgsAfter("LIMIT", argv, argc, "ll", &req->offset, &req->num);
@@ -111,7 +127,8 @@ RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int
       goto err;
     }
     req->fieldMask = IndexSpec_ParseFieldMask(ctx->spec, vargs, nargs);
-    RedisModule_Log(ctx->redisCtx, "debug", "Parsed field mask: 0x%x", req->fieldMask);
+    RedisModule_Log(ctx->redisCtx, "debug", "Parsed field mask: 0x%llx",
+                    (unsigned long long)req->fieldMask);
   }
 
   // Parse numeric filter. currently only one supported
@@ -193,7 +210,7 @@ RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int
       *errStr = "Bad argument for `INKEYS`";
       goto err;
     }
-    req->idFilter = NewIdFilter(vargs, nargs, &ctx->spec->docs);
+    req->idFilter = NewIdFilter(vargs, nargs, ctx->spec->docs);
   }
 
   // parse RETURN argument
@@ -209,6 +226,22 @@ RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int
     }
   }
 
+  // parse the INTERSECT arguments, which can be repeated
+  for (int i = 3; i < argc; i++) {
+    if (!RMUtil_StringEqualsCaseC(argv[i], "INTERSECT")) continue;
+    if (i + 2 >= argc) {
+      *errStr = "Bad argument for `INTERSECT`";
+      goto err;
+    }
+    req->intersects = realloc(req->intersects, (req->numIntersects + 1) * sizeof(RSIntersect));
+    RSIntersect *in = &req->intersects[req->numIntersects++];
+    in->indexName = strdup(RedisModule_StringPtrLen(argv[i + 1], NULL));
+    const char *qs = RedisModule_StringPtrLen(argv[i + 2], &in->qlen);
+    in->rawQuery = strndup(qs, in->qlen);
+    in->query = NULL;
+    i += 2;
+  }
+
   req->rawQuery = (char *)RedisModule_StringPtrLen(argv[2], &req->qlen);
   req->rawQuery = strndup(req->rawQuery, req->qlen);
   return req;
@@ -258,6 +291,18 @@ void RSSearchRequest_Free(RSSearchRequest *req) {
     Vector_Free(req->numericFilters);
   }
 
+  for (size_t i = 0; i < req->numIntersects; i++) {
+    RSIntersect *in = &req->intersects[i];
+    free(in->indexName);
+    free(in->rawQuery);
+    if (in->query) {
+      RedisSearchCtx *sctx = in->query->ctx;
+      Query_Free(in->query);
+      SearchCtx_Free(sctx);
+    }
+  }
+  free(req->intersects);
+
   if (req->retfields) {
     for (size_t ii = 0; ii < req->nretfields; ++ii) {
       free((void *)req->retfields[ii]);
@@ -269,13 +314,52 @@ void RSSearchRequest_Free(RSSearchRequest *req) {
     SearchCtx_Free(req->sctx);
   }
 
+  if (req->cacheKey) {
+    sdsfree(req->cacheKey);
+  }
+
   free(req);
 }
 
+/* Parse the query of an INTERSECT argument on its index, and intersect the request's query with it.
+ * The index must share the document table of the searched one. Returns REDISMODULE_ERR after
+ * replying with an error if it can't */
+static int addIntersect(RedisModuleCtx *ctx, RSSearchRequest *req, Query *q, RSIntersect *in) {
+  RedisSearchCtx *sctx =
+      NewSearchCtx(ctx, RedisModule_CreateString(ctx, in->indexName, strlen(in->indexName)));
+  if (!sctx) {
+    RedisModule_ReplyWithError(ctx, "Unknown Index name");
+    return REDISMODULE_ERR;
+  }
+  if (!sctx->spec->docTableName || sctx->spec->docs != req->sctx->spec->docs) {
+    SearchCtx_Free(sctx);
+    RedisModule_ReplyWithError(ctx, "Intersected indexes must share a document table");
+    return REDISMODULE_ERR;
+  }
+
+  in->query = NewQuery(sctx, in->rawQuery, in->qlen, 0, req->num, RS_FIELDMASK_ALL,
+                       req->flags & Search_Verbatim, req->language,
+                       req->flags & Search_NoStopwrods ? NULL : sctx->spec->stopwords,
+                       req->expander, -1, 0, NULL, req->payload, NULL);
+  in->query->docTable = sctx->spec->docs;
+
+  // a query that's empty, like one of stopwords only, matches nothing
+  char *err = NULL;
+  if (!Query_ParseCached(in->query, &err) && err) {
+    RedisModule_ReplyWithError(ctx, err);
+    free(err);
+    return REDISMODULE_ERR;
+  }
+  Query_SetIndexFilter(q, in->query);
+  return REDISMODULE_OK;
+}
+
 void threadProcessQuery(void *p) {
   RSSearchRequest *req = p;
-  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(req->bc);
+  RedisModuleBlockedClient *bc = req->bc;
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
   RedisModule_AutoMemory(ctx);
+  QueryProfile *prof = NULL;
 
   RedisModule_ThreadSafeContextLock(ctx);
 
@@ -286,9 +370,30 @@ void threadProcessQuery(void *p) {
     goto end;
   }
 
+  // the reply can only be cached if nothing was written to the index while it was computed, and
+  // the query yields the GIL while executing
+  uint64_t generation = req->sctx->spec->generation;
+
   Query *q = NewQueryFromRequest(req);
-  char *err;
-  if (!Query_Parse(q, &err)) {
+  char *err = NULL;
+
+  // profiled queries are parsed and expanded without the cache, so both phases can be timed
+  QueryNode *root;
+  if (req->flags & Search_Profile) {
+    prof = q->profile = NewQueryProfile();
+    double start = QueryProfile_Now();
+    root = Query_Parse(q, &err);
+    prof->parseTime = QueryProfile_Now() - start;
+    if (root) {
+      start = QueryProfile_Now();
+      Query_Expand(q);
+      prof->expandTime = QueryProfile_Now() - start;
+    }
+  } else {
+    root = Query_ParseCached(q, &err);
+  }
+
+  if (!root) {
 
     if (err) {
       RedisModule_Log(ctx, "debug", "Error parsing query: %s", err);
@@ -303,8 +408,6 @@ void threadProcessQuery(void *p) {
     goto end;
   }
 
-  Query_Expand(q);
-
   if (req->geoFilter) {
     Query_SetGeoFilter(q, req->geoFilter);
   }
@@ -326,21 +429,66 @@ void threadProcessQuery(void *p) {
     req->numericFilters = NULL;
   }
 
+  for (size_t i = 0; i < req->numIntersects; i++) {
+    if (addIntersect(ctx, req, q, &req->intersects[i]) == REDISMODULE_ERR) {
+      Query_Free(q);
+      goto end;
+    }
+  }
+
+  // With a cursor, we collect all the results, as much as the cursors' budget allows
+  if (req->flags & Search_WithCursor) {
+    q->collectLimit = Cursors_Budget();
+    if (q->collectLimit == 0) {
+      RedisModule_ReplyWithError(ctx, QUERY_ERROR_TOO_MANY_RESULTS_STR);
+      Query_Free(q);
+      goto end;
+    }
+  }
+
   // Execute the query
+  double start = prof ? QueryProfile_Now() : 0;
   QueryResult *r = Query_Execute(q);
   if (r == NULL) {
     RedisModule_ReplyWithError(ctx, QUERY_ERROR_INTERNAL_STR);
     goto end;
   }
+  Query_Free(q);
+  if (prof) {
+    prof->executeTime = QueryProfile_Now() - start;
+  }
 
-  QueryResult_Serialize(r, req->sctx, req);
+  if ((req->flags & Search_WithCursor) && !r->errorString) {
+    // the cursor takes the request and replies with the first page. If that's all there is, it is
+    // deleted right away
+    RedisSearchCtx *sctx = req->sctx;
+    Cursor *c = Cursors_Create(req, r, MIN(req->offset, r->numResults), req->cursorMaxIdle);
+    req = NULL;
+    Cursor_Reply(c, sctx, c->req->num);
+    SearchCtx_Free(sctx);
+  } else if (prof) {
+    // the profile follows the results, so it can include their serialization
+    RedisModule_ReplyWithArray(ctx, 2);
+    start = QueryProfile_Now();
+    QueryResult_Serialize(r, req->sctx, req, NULL);
+    prof->serializeTime = QueryProfile_Now() - start;
+    QueryProfile_Reply(prof, ctx);
+  } else if (req->cacheKey && !r->errorString) {
+    ReplyRecorder rr;
+    ReplyRecorder_Init(&rr);
+    QueryResult_Serialize(r, req->sctx, req, &rr);
+    ResultCache_Put(req->sctx->spec, generation, req->cacheKey, &rr);
+    req->cacheKey = NULL;
+  } else {
+    QueryResult_Serialize(r, req->sctx, req, NULL);
+  }
   QueryResult_Free(r);
-  Query_Free(q);
 
 end:
+  if (prof) QueryProfile_Free(prof);
   RedisModule_ThreadSafeContextUnlock(ctx);
-  RedisModule_UnblockClient(req->bc, NULL);
-  RSSearchRequest_Free(req);
+  RedisModule_UnblockClient(bc, NULL);
+  if (req) RSSearchRequest_Free(req);
   RedisModule_FreeThreadSafeContext(ctx);
 
   return;
@@ -7,6 +7,7 @@
 #include "geo_index.h"
 #include "id_filter.h"
 #include "sortable.h"
+#include "rmutil/sds.h"
 
 typedef enum {
   Search_NoContent = 0x01,
@@ -20,10 +21,25 @@ typedef enum {
 
   Search_WithSortKeys = 0x40,
 
+  Search_WithCursor = 0x80,
+
+  /* Set by FT.PROFILE */
+  Search_Profile = 0x100,
+
 } RSSearchFlags;
 
 #define RS_DEFAULT_QUERY_FLAGS 0x00
 
+/* The query of another index sharing the document table of the searched one, given with
+ * INTERSECT {index} {query}. The results must match it too */
+typedef struct {
+  char *indexName;
+  char *rawQuery;
+  size_t qlen;
+  /* The query, once it's parsed on its index */
+  struct RSQuery *query;
+} RSIntersect;
+
 typedef struct {
   /* The index name - since we need to open the spec in a side thread */
   char *indexName;
@@ -67,6 +83,15 @@ typedef struct {
 
   RSSortingKey *sortBy;
 
+  RSIntersect *intersects;
+  size_t numIntersects;
+
+  /* WITHCURSOR idle time before the cursor expires, in milliseconds */
+  long long cursorMaxIdle;
+
+  /* The result cache key of the request, if its reply is to be cached */
+  sds cacheKey;
+
 } RSSearchRequest;
 
 RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int argc,
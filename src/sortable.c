@@ -82,6 +82,10 @@ char *normalizeStr(const char *str) {
 /* Put a value in the sorting vector */
 void RSSortingVector_Put(RSSortingVector *tbl, int idx, void *p, int type) {
   if (idx <= 255) {
+    // when overwriting a value, release the string it might be holding
+    if (tbl->values[idx].type == RS_SORTABLE_STR) {
+      rm_free(tbl->values[idx].str);
+    }
     switch (type) {
       case RS_SORTABLE_NUM:
         tbl->values[idx].num = *(double *)p;
@@ -169,6 +173,70 @@ RSSortingVector *SortingVector_RdbLoad(RedisModuleIO *rdb, int encver) {
   return vec;
 }
 
+void SortingVector_Dump(RSSortingVector *v, BufferWriter *bw) {
+  unsigned char len = v->len;
+  Buffer_Write(bw, &len, 1);
+  for (int i = 0; i < v->len; i++) {
+    RSSortableValue *val = &v->values[i];
+    unsigned char type = val->type;
+    Buffer_Write(bw, &type, 1);
+    switch (val->type) {
+      case RS_SORTABLE_STR: {
+        // strings are written with their null terminator
+        uint32_t slen = strlen(val->str) + 1;
+        Buffer_Write(bw, &slen, sizeof(slen));
+        Buffer_Write(bw, val->str, slen);
+        break;
+      }
+      case RS_SORTABLE_NUM:
+        Buffer_Write(bw, &val->num, sizeof(double));
+        break;
+      case RS_SORTABLE_NIL:
+      default:
+        break;
+    }
+  }
+}
+
+RSSortingVector *SortingVector_Restore(BufferReader *br) {
+  unsigned char len = 0;
+  if (!Buffer_Read(br, &len, 1) || len == 0) {
+    return NULL;
+  }
+  RSSortingVector *vec = NewSortingVector(len);
+  for (int i = 0; i < len; i++) {
+    unsigned char type;
+    if (!Buffer_Read(br, &type, 1)) goto error;
+    switch (type) {
+      case RS_SORTABLE_STR: {
+        uint32_t slen;
+        if (!Buffer_Read(br, &slen, sizeof(slen)) || slen == 0) goto error;
+        char *str = rm_malloc(slen);
+        if (!Buffer_Read(br, str, slen)) {
+          rm_free(str);
+          goto error;
+        }
+        str[slen - 1] = '\0';
+        vec->values[i].str = str;
+        break;
+      }
+      case RS_SORTABLE_NUM:
+        if (!Buffer_Read(br, &vec->values[i].num, sizeof(double))) goto error;
+        break;
+      case RS_SORTABLE_NIL:
+        break;
+      default:
+        goto error;
+    }
+    vec->values[i].type = type;
+  }
+  return vec;
+
+error:
+  SortingVector_Free(vec);
+  return NULL;
+}
+
 /* Create a new sortin table of a given length */
 RSSortingTable *NewSortingTable(int len) {
   RSSortingTable *tbl = rm_calloc(1, sizeof(RSSortingTable) + len * sizeof(const char *));
@@ -1,6 +1,7 @@
 #ifndef __RS_SORTABLE_H__
 #define __RS_SORTABLE_H__
 #include "redismodule.h"
+#include "buffer.h"
 
 /* Sortables - embedded sorting fields. When creating a schema we can specify fields that will be
  * sortable.
@@ -96,4 +97,10 @@ void SortingVector_RdbSave(RedisModuleIO *rdb, RSSortingVector *v);
 /* Load a sorting vector from RDB */
 RSSortingVector *SortingVector_RdbLoad(RedisModuleIO *rdb, int encver);
 
+/* Serialize a sorting vector into a buffer, for AOF rewrite */
+void SortingVector_Dump(RSSortingVector *v, BufferWriter *bw);
+
+/* Read a sorting vector written by SortingVector_Dump. Returns NULL if the data is malformed */
+RSSortingVector *SortingVector_Restore(BufferReader *br);
+
 #endif
\ No newline at end of file
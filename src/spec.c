@@ -4,12 +4,83 @@
 #include "util/logging.h"
 #include "rmutil/vector.h"
 #include "trie/trie_type.h"
+#include "query_cache.h"
+#include "result_cache.h"
+#include "cursor.h"
+#include "redis_index.h"
+#include "term_dict.h"
+#include "lazy_free.h"
+#include "index_gc.h"
+#include "ingest.h"
+#include "tag_index.h"
 #include <math.h>
 #include <ctype.h>
 #include "rmalloc.h"
 
 RedisModuleType *IndexSpecType;
 
+/* A flat list of indexes, protected by the GIL. There are few indexes, so a flat array is all we
+ * need */
+typedef struct {
+  IndexSpec **specs;
+  size_t len;
+  size_t cap;
+} SpecList;
+
+/* The indexes with a shared document table, so a document deleted through one of them can be taken
+ * out of all the others */
+static SpecList __sharers = {0};
+
+/* All the live indexes, and the position of the next one IndexSpec_NextLive returns */
+static SpecList __specs = {0};
+static size_t __nextLive = 0;
+
+static void SpecList_Add(SpecList *l, IndexSpec *sp) {
+  if (l->len == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 8;
+    l->specs = rm_realloc(l->specs, l->cap * sizeof(IndexSpec *));
+  }
+  l->specs[l->len++] = sp;
+}
+
+static void SpecList_Remove(SpecList *l, IndexSpec *sp) {
+  for (size_t i = 0; i < l->len; i++) {
+    if (l->specs[i] == sp) {
+      l->specs[i] = l->specs[--l->len];
+      return;
+    }
+  }
+}
+
+/* Register a newly created or loaded index */
+static void IndexSpec_Register(IndexSpec *sp) {
+  SpecList_Add(&__specs, sp);
+  if (sp->docTableName) SpecList_Add(&__sharers, sp);
+}
+
+static void IndexSpec_Unregister(IndexSpec *sp) {
+  SpecList_Remove(&__specs, sp);
+  if (sp->docTableName) SpecList_Remove(&__sharers, sp);
+}
+
+IndexSpec *IndexSpec_NextLive() {
+  if (__specs.len == 0) {
+    return NULL;
+  }
+  if (__nextLive >= __specs.len) __nextLive = 0;
+  return __specs.specs[__nextLive++];
+}
+
+IndexSpec *IndexSpec_NextSharer(const char *name, size_t *pos) {
+  while (*pos < __sharers.len) {
+    IndexSpec *sp = __sharers.specs[(*pos)++];
+    if (!strcmp(sp->docTableName, name)) {
+      return sp;
+    }
+  }
+  return NULL;
+}
+
 /*
 * Get a field spec by field name. Case insensitive!
 * Return the field spec if found, NULL if not
@@ -25,7 +96,7 @@ inline FieldSpec *IndexSpec_GetField(IndexSpec *spec, const char *name, size_t l
   return NULL;
 };
 
-uint32_t IndexSpec_GetFieldBit(IndexSpec *spec, const char *name, size_t len) {
+t_fieldMask IndexSpec_GetFieldBit(IndexSpec *spec, const char *name, size_t len) {
   FieldSpec *sp = IndexSpec_GetField(spec, name, len);
   if (!sp) return 0;
 
@@ -37,7 +108,7 @@ int IndexSpec_GetFieldSortingIndex(IndexSpec *sp, const char *name, size_t len)
   return RSSortingTable_GetFieldIdx(sp->sortables, name);
 }
 
-char *GetFieldNameByBit(IndexSpec *sp, uint32_t id) {
+char *GetFieldNameByBit(IndexSpec *sp, t_fieldMask id) {
   for (int i = 0; i < sp->numFields; i++) {
     if (sp->fields[i].id == id) {
       return sp->fields[i].name;
@@ -51,8 +122,8 @@ char *GetFieldNameByBit(IndexSpec *sp, uint32_t id) {
 * Returns REDISMODULE_ERR if there's a parsing error.
 * The command only receives the relvant part of argv.
 *
-* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX]
-    SCHEMA {field} [TEXT [WEIGHT {weight}]] | [NUMERIC]
+* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX] [DOCTABLE {name}]
+    SCHEMA {field} [TEXT [WEIGHT {weight}] [SEPARATORS {chars}] [OWNPOSTINGS]] | [NUMERIC]
 */
 IndexSpec *IndexSpec_ParseRedisArgs(RedisModuleCtx *ctx, RedisModuleString *name,
                                     RedisModuleString **argv, int argc, char **err) {
@@ -96,6 +167,10 @@ int __parseFieldSpec(const char **argv, int *offset, int argc, FieldSpec *sp) {
   if (*offset >= argc) return 0;
   sp->sortIdx = -1;
   sp->sortable = 0;
+  sp->separators = NULL;
+  sp->charTable = NULL;
+  sp->ownPostings = 0;
+  sp->dict = NULL;
   // the field name comes here
   sp->name = rm_strdup(argv[*offset]);
 
@@ -125,6 +200,23 @@ int __parseFieldSpec(const char **argv, int *offset, int argc, FieldSpec *sp) {
       ++*offset;
     }
 
+    // custom separators for tokenizing this field
+    if (*offset < argc && !strcasecmp(argv[*offset], SPEC_SEPARATORS_STR)) {
+      if (++*offset == argc || !*argv[*offset]) return 0;
+
+      sp->separators = rm_strdup(argv[*offset]);
+      sp->charTable = NewTokenizerCharTable(sp->separators);
+      ++*offset;
+    }
+
+    // the field's terms get their own inverted indexes, so queries on the field alone only read
+    // its own records
+    if (*offset < argc && !strcasecmp(argv[*offset], SPEC_OWNPOSTINGS_STR)) {
+      sp->ownPostings = 1;
+      sp->dict = NewTermDict(0);
+      ++*offset;
+    }
+
   } else if (!strcasecmp(argv[*offset], NUMERIC_STR)) {
     sp->type = F_NUMERIC;
     sp->weight = 0.0;
@@ -134,6 +226,20 @@ int __parseFieldSpec(const char **argv, int *offset, int argc, FieldSpec *sp) {
     sp->type = F_GEO;
     sp->weight = 0;
     ++*offset;
+
+  } else if (!strcasecmp(argv[*offset], SPEC_TAG_STR)) {  // tag field
+    sp->type = F_TAG;
+    sp->weight = 0;
+    ++*offset;
+
+    const char *seps = TAG_DEFAULT_SEPARATORS;
+    if (*offset < argc && !strcasecmp(argv[*offset], SPEC_SEPARATORS_STR)) {
+      if (++*offset == argc || !*argv[*offset]) return 0;
+      seps = argv[(*offset)++];
+    }
+    sp->separators = rm_strdup(seps);
+    sp->charTable = NewTokenizerCharTable(sp->separators);
+    sp->dict = NewTermDict(0);
   } else {  // not numeric and not text - nothing more supported currently
     return 0;
   }
@@ -158,8 +264,9 @@ void _spec_buildSortingTable(IndexSpec *spec, int len) {
     }
   }
 }
-/* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX]
-    SCHEMA {field} [TEXT [WEIGHT {weight}]] | [NUMERIC]
+/* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX] [DOCTABLE {name}]
+    SCHEMA {field} [TEXT [WEIGHT {weight}] [SEPARATORS {chars}] [OWNPOSTINGS]] | [NUMERIC] |
+    [GEO] | [TAG [SEPARATORS {chars}]]
   */
 IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char **err) {
 
@@ -196,6 +303,19 @@ IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char *
     spec->stopwords = DefaultStopWordList();
   }
 
+  // an index sharing a document table gets it when it's loaded, it doesn't have one of its own
+  int dtIndex = __findOffset(SPEC_DOCTABLE_STR, argv, argc);
+  if (dtIndex >= 0 && dtIndex < schemaOffset) {
+    if (dtIndex + 1 >= schemaOffset || !*argv[dtIndex + 1]) {
+      *err = "Invalid document table name";
+      goto failure;
+    }
+    DocTable_Free(spec->docs);
+    rm_free(spec->docs);
+    spec->docs = NULL;
+    spec->docTableName = rm_strdup(argv[dtIndex + 1]);
+  }
+
   t_fieldMask id = 1;
   int sortIdx = 0;
 
@@ -207,9 +327,16 @@ IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char *
       goto failure;
     }
 
-    if (spec->fields[spec->numFields].type == F_FULLTEXT) {
-      spec->fields[spec->numFields].id = id;
-      id *= 2;
+    // tag fields get a bit too, so queries can select them with the same @field syntax
+    FieldSpec *fs = &spec->fields[spec->numFields];
+    if (fs->type == F_FULLTEXT || fs->type == F_TAG) {
+      fs->id = id;
+      // the records of the shared inverted indexes only store the bits of the text fields using
+      // them, and those only fit in the qint with the docId as long as they fit in 32 bits
+      if (fs->type == F_FULLTEXT && !fs->ownPostings && (id >> 32)) {
+        spec->flags |= Index_WideSchema;
+      }
+      id <<= 1;
     }
     if (spec->fields[spec->numFields].sortable) {
       spec->fields[spec->numFields].sortIdx = sortIdx++;
@@ -220,12 +347,23 @@ IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char *
       goto failure;
     }
   }
+  if (i < argc) {
+    *err = "Too many fields";
+    goto failure;
+  }
+
+  // the sort vectors are kept in the documents' metadata, which is laid out by a single index
+  if (sortIdx > 0 && spec->docTableName) {
+    *err = "Sortable fields are not supported with a shared document table";
+    goto failure;
+  }
 
   /* If we have sortable fields, create a sorting lookup table */
   if (sortIdx > 0) {
     _spec_buildSortingTable(spec, sortIdx);
   }
 
+  IndexSpec_Register(spec);
   return spec;
 
 failure:  // on failure free the spec fields array and return an error
@@ -238,16 +376,40 @@ int IndexSpec_AddTerm(IndexSpec *sp, const char *term, size_t len) {
   return Trie_InsertStringBuffer(sp->terms, (char *)term, len, 1, 1, NULL);
 }
 
-void IndexSpec_Free(void *ctx) {
+/* Free everything the spec holds. This only releases memory, so it can run on the lazy free
+ * thread */
+static void IndexSpec_FreeInternals(void *ctx) {
   IndexSpec *spec = ctx;
 
   if (spec->terms) {
     TrieType_Free(spec->terms);
   }
-  DocTable_Free(&spec->docs);
+  if (spec->termDict) {
+    TermDict_Free(spec->termDict);
+  }
+  if (spec->gc) {
+    IndexGC_Free(spec->gc);
+  }
+  if (spec->ingest) {
+    IngestGroup_Free(spec->ingest);
+  }
+  // a shared document table belongs to its own key
+  if (spec->docTableName) {
+    rm_free(spec->docTableName);
+  } else if (spec->docs) {
+    DocTable_Free(spec->docs);
+    rm_free(spec->docs);
+  }
   if (spec->fields != NULL) {
     for (int i = 0; i < spec->numFields; i++) {
       rm_free(spec->fields[i].name);
+      if (spec->fields[i].separators) {
+        rm_free(spec->fields[i].separators);
+        rm_free(spec->fields[i].charTable);
+      }
+      if (spec->fields[i].dict) {
+        TermDict_Free(spec->fields[i].dict);
+      }
     }
     rm_free(spec->fields);
   }
@@ -259,8 +421,35 @@ void IndexSpec_Free(void *ctx) {
   rm_free(spec);
 }
 
+void IndexSpec_Free(void *ctx) {
+  IndexSpec *spec = ctx;
+
+  // cached queries refer to the spec's fields and stopwords, and cursors to the spec itself
+  QueryCache_PurgeIndex(spec);
+  ResultCache_PurgeIndex(spec);
+  Cursors_PurgeIndex(spec);
+  IndexSpec_Unregister(spec);
+  IndexSpec_FreeInternals(spec);
+}
+
+void IndexSpec_LazyFree(void *ctx) {
+  IndexSpec *spec = ctx;
+
+  // the caches, cursors and index lists are protected by the GIL, so they are purged right away
+  QueryCache_PurgeIndex(spec);
+  ResultCache_PurgeIndex(spec);
+  Cursors_PurgeIndex(spec);
+  IndexSpec_Unregister(spec);
+  size_t effort = spec->stats.numTerms + (spec->docTableName ? 0 : spec->docs->size);
+  if (spec->termDict) effort += spec->termDict->numEntries;
+  for (int i = 0; i < spec->numFields; i++) {
+    if (spec->fields[i].dict) effort += spec->fields[i].dict->numEntries;
+  }
+  LazyFree(IndexSpec_FreeInternals, spec, effort);
+}
+
 /* Load the spec from the saved version */
-IndexSpec *IndexSpec_Load(RedisModuleCtx *ctx, const char *name, int openWrite) {
+static IndexSpec *IndexSpec_LoadKey(RedisModuleCtx *ctx, const char *name, int openWrite) {
 
   RedisModuleKey *k =
       RedisModule_OpenKey(ctx, RedisModule_CreateStringPrintf(ctx, INDEX_SPEC_KEY_FMT, name),
@@ -273,9 +462,55 @@ IndexSpec *IndexSpec_Load(RedisModuleCtx *ctx, const char *name, int openWrite)
   }
 
   IndexSpec *ret = RedisModule_ModuleTypeGetValue(k);
+
+  // the shared document table is created again, empty, if its key was deleted
+  if (ret->docTableName) {
+    ret->docs = DocTable_OpenShared(ctx, ret->docTableName, 1);
+    if (ret->docs == NULL) {
+      RedisModule_Log(ctx, "warning", "The document table of index %s has the wrong type",
+                      ret->name);
+      return NULL;
+    }
+  }
+
+  // move the terms of an index saved by an older version out of the keyspace on first use
+  if (ret->flags & Index_HasLegacyTermKeys) {
+    ret->flags &= ~Index_HasLegacyTermKeys;
+    Redis_MigrateTermKeys(ctx, ret);
+    IndexSpec_UpdateInvertedStats(ret);
+  }
   return ret;
 }
 
+IndexSpec *IndexSpec_Load(RedisModuleCtx *ctx, const char *name, int openWrite) {
+  IndexSpec *sp = IndexSpec_LoadKey(ctx, name, openWrite);
+  if (sp) {
+    IngestGroup_Commit(sp->ingest, sp);
+  }
+  return sp;
+}
+
+IndexSpec *IndexSpec_LoadForAdd(RedisModuleCtx *ctx, const char *name) {
+  return IndexSpec_LoadKey(ctx, name, 1);
+}
+
+uint32_t IndexSpec_Dicts(IndexSpec *sp, TermDict **dicts) {
+  dicts[0] = sp->termDict;
+  for (int i = 0; i < sp->numFields; i++) {
+    dicts[i + 1] = sp->fields[i].dict;
+  }
+  return sp->numFields + 1;
+}
+
+void IndexSpec_UpdateInvertedStats(IndexSpec *sp) {
+  size_t size = 0, cap = 0;
+  for (uint32_t i = 0; i < sp->termDict->numEntries; i++) {
+    InvertedIndex_MemStats(sp->termDict->entries[i].idx, &size, &cap);
+  }
+  sp->stats.invertedSize = size;
+  sp->stats.invertedCap = cap;
+}
+
 t_fieldMask IndexSpec_ParseFieldMask(IndexSpec *sp, RedisModuleString **argv, int argc) {
   t_fieldMask ret = 0;
 
@@ -285,7 +520,7 @@ t_fieldMask IndexSpec_ParseFieldMask(IndexSpec *sp, RedisModuleString **argv, in
 
     FieldSpec *fs = IndexSpec_GetField(sp, p, len);
     if (fs != NULL) {
-      LG_DEBUG("Found mask for %s: %u\n", p, fs->id);
+      LG_DEBUG("Found mask for %s: %llx\n", p, (unsigned long long)fs->id);
       ret |= (fs->id & RS_FIELDMASK_ALL);
     }
   }
@@ -325,36 +560,81 @@ IndexSpec *NewIndexSpec(const char *name, size_t numFields) {
   sp->numFields = 0;
   sp->flags = INDEX_DEFAULT_FLAGS;
   sp->name = rm_strdup(name);
-  sp->docs = NewDocTable(1000);
+  sp->docs = rm_malloc(sizeof(DocTable));
+  *sp->docs = NewDocTable(1000);
+  sp->docTableName = NULL;
+  sp->lastDocId = 0;
   sp->stopwords = DefaultStopWordList();
   sp->terms = NewTrie();
+  sp->termDict = NewTermDict(0);
+  sp->gc = NewIndexGC();
+  sp->ingest = NewIngestGroup();
   sp->sortables = NULL;
   memset(&sp->stats, 0, sizeof(sp->stats));
+  sp->generation = 0;
   return sp;
 }
 
+/* Field masks are wider than the integers RDB saves, so since version 12 the id of a field is saved
+ * as the number of its bit plus one, and 0 for fields without a bit */
+static uint64_t fieldIdToBitNum(t_fieldMask id) {
+  uint64_t n = 0;
+  while (id) {
+    id >>= 1;
+    n++;
+  }
+  return n;
+}
+
+static t_fieldMask bitNumToFieldId(uint64_t n) {
+  return n ? (t_fieldMask)1 << (n - 1) : 0;
+}
+
 void __fieldSpec_rdbSave(RedisModuleIO *rdb, FieldSpec *f) {
   RedisModule_SaveStringBuffer(rdb, f->name, strlen(f->name) + 1);
-  RedisModule_SaveUnsigned(rdb, f->id);
+  RedisModule_SaveUnsigned(rdb, fieldIdToBitNum(f->id));
   RedisModule_SaveUnsigned(rdb, f->type);
   RedisModule_SaveDouble(rdb, f->weight);
   RedisModule_SaveUnsigned(rdb, f->sortable);
   RedisModule_SaveSigned(rdb, f->sortIdx);
+  // an empty string means the default separators
+  const char *seps = f->separators ? f->separators : "";
+  RedisModule_SaveStringBuffer(rdb, seps, strlen(seps) + 1);
+  RedisModule_SaveUnsigned(rdb, f->ownPostings);
 }
 
 void __fieldSpec_rdbLoad(RedisModuleIO *rdb, FieldSpec *f, int encver) {
 
   f->name = RedisModule_LoadStringBuffer(rdb, NULL);
   f->id = RedisModule_LoadUnsigned(rdb);
+  if (encver >= 12) {
+    f->id = bitNumToFieldId(f->id);
+  }
   f->type = RedisModule_LoadUnsigned(rdb);
   f->weight = RedisModule_LoadDouble(rdb);
   if (encver >= 4) {
     f->sortable = RedisModule_LoadUnsigned(rdb);
     f->sortIdx = RedisModule_LoadSigned(rdb);
   }
+  f->separators = NULL;
+  f->charTable = NULL;
+  f->dict = NULL;
+  if (encver >= 6) {
+    char *seps = RedisModule_LoadStringBuffer(rdb, NULL);
+    if (*seps) {
+      f->separators = seps;
+      f->charTable = NewTokenizerCharTable(seps);
+    } else {
+      RedisModule_Free(seps);
+    }
+  }
+  f->ownPostings = 0;
+  if (encver >= 12) {
+    f->ownPostings = RedisModule_LoadUnsigned(rdb);
+  }
 }
 
-void __indexStats_rdbLoad(RedisModuleIO *rdb, IndexStats *stats) {
+void __indexStats_rdbLoad(RedisModuleIO *rdb, IndexStats *stats, int encver) {
   stats->numDocuments = RedisModule_LoadUnsigned(rdb);
   stats->numTerms = RedisModule_LoadUnsigned(rdb);
   stats->numRecords = RedisModule_LoadUnsigned(rdb);
@@ -365,6 +645,10 @@ void __indexStats_rdbLoad(RedisModuleIO *rdb, IndexStats *stats) {
   stats->offsetVecsSize = RedisModule_LoadUnsigned(rdb);
   stats->offsetVecRecords = RedisModule_LoadUnsigned(rdb);
   stats->termsSize = RedisModule_LoadUnsigned(rdb);
+  stats->totalDocsLen = 0;
+  if (encver >= 7) {
+    stats->totalDocsLen = RedisModule_LoadUnsigned(rdb);
+  }
 }
 
 void __indexStats_rdbSave(RedisModuleIO *rdb, IndexStats *stats) {
@@ -378,6 +662,7 @@ void __indexStats_rdbSave(RedisModuleIO *rdb, IndexStats *stats) {
   RedisModule_SaveUnsigned(rdb, stats->offsetVecsSize);
   RedisModule_SaveUnsigned(rdb, stats->offsetVecRecords);
   RedisModule_SaveUnsigned(rdb, stats->termsSize);
+  RedisModule_SaveUnsigned(rdb, stats->totalDocsLen);
 }
 
 void *IndexSpec_RdbLoad(RedisModuleIO *rdb, int encver) {
@@ -386,8 +671,14 @@ void *IndexSpec_RdbLoad(RedisModuleIO *rdb, int encver) {
   }
   IndexSpec *sp = rm_malloc(sizeof(IndexSpec));
   sp->terms = NULL;
-  sp->docs = NewDocTable(1000);
+  sp->termDict = NULL;
+  sp->gc = NULL;
+  sp->ingest = NewIngestGroup();
+  sp->docs = NULL;
+  sp->docTableName = NULL;
+  sp->lastDocId = 0;
   sp->sortables = NULL;
+  sp->generation = 0;
   sp->name = RedisModule_LoadStringBuffer(rdb, NULL);
   sp->flags = (IndexFlags)RedisModule_LoadUnsigned(rdb);
 
@@ -407,9 +698,20 @@ void *IndexSpec_RdbLoad(RedisModuleIO *rdb, int encver) {
     _spec_buildSortingTable(sp, maxSortIdx + 1);
   }
 
-  __indexStats_rdbLoad(rdb, &sp->stats);
+  __indexStats_rdbLoad(rdb, &sp->stats, encver);
 
-  DocTable_RdbLoad(&sp->docs, rdb, encver);
+  /* Version 13 added shared document tables, which are saved in their own keys */
+  if (encver >= 13) {
+    char *tmp = RedisModule_LoadStringBuffer(rdb, NULL);
+    if (*tmp) sp->docTableName = rm_strdup(tmp);
+    RedisModule_Free(tmp);
+    sp->lastDocId = RedisModule_LoadUnsigned(rdb);
+  }
+  if (!sp->docTableName) {
+    sp->docs = rm_malloc(sizeof(DocTable));
+    *sp->docs = NewDocTable(1000);
+    DocTable_RdbLoad(sp->docs, rdb, encver);
+  }
   /* For version 3 or up - load the generic trie */
   if (encver >= 3) {
     sp->terms = TrieType_GenericLoad(rdb, 0);
@@ -422,12 +724,56 @@ void *IndexSpec_RdbLoad(RedisModuleIO *rdb, int encver) {
   } else {
     sp->stopwords = DefaultStopWordList();
   }
+
+  /* Up to version 7 the inverted indexes were saved in their own keys, and are moved into the term
+   * dictionary when the index is first opened */
+  if (encver >= 8) {
+    sp->termDict = TermDict_RdbLoad(rdb, encver);
+    if (sp->termDict == NULL) {
+      IndexSpec_FreeInternals(sp);
+      return NULL;
+    }
+    // the loaded blocks are sized to their data
+    IndexSpec_UpdateInvertedStats(sp);
+  } else {
+    sp->termDict = NewTermDict(sp->stats.numTerms);
+    sp->flags |= Index_HasLegacyTermKeys;
+  }
+
+  /* Version 9 added the terms of every document, so deletions can be tracked by the GC */
+  if (encver >= 9) {
+    sp->gc = IndexGC_RdbLoad(rdb, encver);
+  } else {
+    sp->gc = NewIndexGC();
+  }
+
+  /* Version 11 added the tags of the tag fields, and version 12 the text fields with their own
+   * postings */
+  for (int i = 0; i < sp->numFields; i++) {
+    FieldSpec *fs = &sp->fields[i];
+    if (fs->type != F_TAG && !fs->ownPostings) continue;
+    fs->dict = encver >= 11 ? TermDict_RdbLoad(rdb, encver) : NewTermDict(0);
+    if (fs->dict == NULL) {
+      IndexSpec_FreeInternals(sp);
+      return NULL;
+    }
+    if (fs->type == F_TAG && !fs->separators) {
+      fs->separators = rm_strdup(TAG_DEFAULT_SEPARATORS);
+      fs->charTable = NewTokenizerCharTable(fs->separators);
+    }
+  }
+
+  // the terms with deleted records are found once all the dictionaries are loaded
+  TermDict *dicts[SPEC_MAX_DICTS];
+  IndexGC_FindDirty(sp->gc, dicts, IndexSpec_Dicts(sp, dicts));
+  IndexSpec_Register(sp);
   return sp;
 }
 
 void IndexSpec_RdbSave(RedisModuleIO *rdb, void *value) {
 
   IndexSpec *sp = value;
+  IngestGroup_Commit(sp->ingest, sp);
   // we save the name plus the null terminator
   RedisModule_SaveStringBuffer(rdb, sp->name, strlen(sp->name) + 1);
   RedisModule_SaveUnsigned(rdb, (uint)sp->flags);
@@ -438,7 +784,12 @@ void IndexSpec_RdbSave(RedisModuleIO *rdb, void *value) {
   }
 
   __indexStats_rdbSave(rdb, &sp->stats);
-  DocTable_RdbSave(&sp->docs, rdb);
+  const char *dtName = sp->docTableName ? sp->docTableName : "";
+  RedisModule_SaveStringBuffer(rdb, dtName, strlen(dtName) + 1);
+  RedisModule_SaveUnsigned(rdb, sp->lastDocId);
+  if (!sp->docTableName) {
+    DocTable_RdbSave(sp->docs, rdb);
+  }
   // save trie of terms
   TrieType_GenericSave(rdb, sp->terms, 0);
 
@@ -446,6 +797,15 @@ void IndexSpec_RdbSave(RedisModuleIO *rdb, void *value) {
   if (sp->flags & Index_HasCustomStopwords) {
     StopWordList_RdbSave(rdb, sp->stopwords);
   }
+
+  TermDict_RdbSave(rdb, sp->termDict);
+  IndexGC_RdbSave(rdb, sp->gc);
+
+  for (int i = 0; i < sp->numFields; i++) {
+    if (sp->fields[i].dict) {
+      TermDict_RdbSave(rdb, sp->fields[i].dict);
+    }
+  }
 }
 
 void IndexSpec_Digest(RedisModuleDigest *digest, void *value) {
@@ -456,8 +816,11 @@ void IndexSpec_Digest(RedisModuleDigest *digest, void *value) {
 void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
 
   IndexSpec *sp = value;
+  IngestGroup_Commit(sp->ingest, sp);
   Vector *args = NewVector(RedisModuleString *, 4 + 4 * sp->numFields);
   RedisModuleCtx *ctx = RedisModule_GetContextFromIO(aof);
+  // the commands take the index name, not the key of the spec
+  RedisModuleString *name = RedisModule_CreateString(ctx, sp->name, strlen(sp->name));
 
   // printf("sp->fags:%x\n", sp->flags);
   // serialize flags
@@ -471,6 +834,23 @@ void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *valu
     __vpushStr(args, ctx, SPEC_NOSCOREIDX_STR);
   }
 
+  // custom stopwords go before the schema
+  if (sp->flags & Index_HasCustomStopwords) {
+    size_t n;
+    RedisModuleString **words = StopWordList_ToStrings(sp->stopwords, ctx, &n);
+    __vpushStr(args, ctx, SPEC_STOPWORDS_STR);
+    Vector_Push(args, RedisModule_CreateStringPrintf(ctx, "%zd", n));
+    for (size_t i = 0; i < n; i++) {
+      Vector_Push(args, words[i]);
+    }
+    rm_free(words);
+  }
+
+  if (sp->docTableName) {
+    __vpushStr(args, ctx, SPEC_DOCTABLE_STR);
+    __vpushStr(args, ctx, sp->docTableName);
+  }
+
   // write SCHEMA keyword
   __vpushStr(args, ctx, SPEC_SCHEMA_STR);
 
@@ -485,6 +865,13 @@ void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *valu
           __vpushStr(args, ctx, SPEC_WEIGHT_STR);
           Vector_Push(args, RedisModule_CreateStringPrintf(ctx, "%f", sp->fields[i].weight));
         }
+        if (sp->fields[i].separators) {
+          __vpushStr(args, ctx, SPEC_SEPARATORS_STR);
+          __vpushStr(args, ctx, sp->fields[i].separators);
+        }
+        if (sp->fields[i].ownPostings) {
+          __vpushStr(args, ctx, SPEC_OWNPOSTINGS_STR);
+        }
         break;
       case F_NUMERIC:
         __vpushStr(args, ctx, sp->fields[i].name);
@@ -493,6 +880,15 @@ void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *valu
       case F_GEO:
         __vpushStr(args, ctx, sp->fields[i].name);
         __vpushStr(args, ctx, GEO_STR);
+        break;
+      case F_TAG:
+        __vpushStr(args, ctx, sp->fields[i].name);
+        __vpushStr(args, ctx, SPEC_TAG_STR);
+        if (strcmp(sp->fields[i].separators, TAG_DEFAULT_SEPARATORS)) {
+          __vpushStr(args, ctx, SPEC_SEPARATORS_STR);
+          __vpushStr(args, ctx, sp->fields[i].separators);
+        }
+        break;
       default:
 
         break;
@@ -502,20 +898,158 @@ void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *valu
     }
   }
 
-  RedisModule_EmitAOF(aof, "FT.CREATE", "sv", key, (RedisModuleString *)args->data,
+  RedisModule_EmitAOF(aof, "FT.CREATE", "sv", name, (RedisModuleString *)args->data,
                       Vector_Size(args));
 
-  DocTable_AOFRewrite(&sp->docs, key, aof);
+  // the documents, terms and stats are restored as they are, without re-indexing anything. A
+  // shared document table is rewritten with its own key, and may not even be loaded by the index
+  t_docId maxDocId = sp->lastDocId;
+  if (!sp->docTableName) {
+    DocTable_AOFRewrite(sp->docs, name, "DOCS", aof);
+    maxDocId = sp->docs->maxDocId;
+  }
 
+  Buffer buf;
+  Buffer_Init(&buf, 0);
+  for (uint32_t i = 0; i < sp->termDict->numEntries; i++) {
+    TermDictEntry *e = &sp->termDict->entries[i];
+    buf.offset = 0;
+    InvertedIndex_Dump(e->idx, &buf);
+    RedisModule_EmitAOF(aof, "FT.RESTORE", "scbb", name, "TERM", e->term, (size_t)e->len, buf.data,
+                        buf.offset);
+  }
+  for (int f = 0; f < sp->numFields; f++) {
+    FieldSpec *fs = &sp->fields[f];
+    if (!fs->dict) continue;
+    for (uint32_t i = 0; i < fs->dict->numEntries; i++) {
+      TermDictEntry *e = &fs->dict->entries[i];
+      buf.offset = 0;
+      InvertedIndex_Dump(e->idx, &buf);
+      RedisModule_EmitAOF(aof, "FT.RESTORE", "sccbb", name, "FIELD", fs->name, e->term,
+                          (size_t)e->len, buf.data, buf.offset);
+    }
+  }
+  for (t_docId i = 1; i <= maxDocId; i += DOCTABLE_AOF_CHUNK) {
+    buf.offset = 0;
+    if (IndexGC_Dump(sp->gc, i, i + DOCTABLE_AOF_CHUNK - 1, 0, &buf)) {
+      RedisModule_EmitAOF(aof, "FT.RESTORE", "scb", name, "DOCTERMS", buf.data, buf.offset);
+    }
+    buf.offset = 0;
+    if (IndexGC_Dump(sp->gc, i, i + DOCTABLE_AOF_CHUNK - 1, 1, &buf)) {
+      RedisModule_EmitAOF(aof, "FT.RESTORE", "scb", name, "FIELDTERMS", buf.data, buf.offset);
+    }
+  }
+  Buffer_Free(&buf);
+
+  IndexStats *st = &sp->stats;
+  RedisModule_EmitAOF(aof, "FT.RESTORE", "sclllllllllll", name, "STATS",
+                      (long long)st->numDocuments, (long long)st->numTerms,
+                      (long long)st->numRecords, (long long)st->invertedSize,
+                      (long long)st->invertedCap, (long long)st->skipIndexesSize,
+                      (long long)st->scoreIndexesSize, (long long)st->offsetVecsSize,
+                      (long long)st->offsetVecRecords, (long long)st->termsSize,
+                      (long long)st->totalDocsLen);
+
+  if (sp->lastDocId) {
+    RedisModule_EmitAOF(aof, "FT.RESTORE", "scl", name, "LASTID", (long long)sp->lastDocId);
+  }
+
+  // the keys of the terms are rewritten on their own, and are moved into the index once it's loaded
+  if (sp->flags & Index_HasLegacyTermKeys) {
+    RedisModule_EmitAOF(aof, "FT.RESTORE", "sc", name, "LEGACYTERMS");
+  }
+
+  RedisModule_FreeString(ctx, name);
   Vector_Free(args);
 }
 
+int IndexSpec_RestoreTerm(IndexSpec *sp, const char *term, size_t len, const char *data,
+                          size_t dlen) {
+  InvertedIndex *idx = InvertedIndex_Restore(data, dlen, sp->flags, INDEX_STORAGE_MASK);
+  if (idx == NULL) {
+    return 0;
+  }
+  if (!TermDict_Add(sp->termDict, term, len, idx)) {
+    InvertedIndex_Free(idx);
+    return 0;
+  }
+  IndexSpec_AddTerm(sp, term, len);
+  if (idx->numDeleted) {
+    IndexGC_AddDirty(sp->gc, 0, sp->termDict->numEntries - 1);
+  }
+  return 1;
+}
+
+int IndexSpec_RestoreFieldTerm(IndexSpec *sp, const char *field, const char *term, size_t len,
+                               const char *data, size_t dlen) {
+  FieldSpec *fs = IndexSpec_GetField(sp, field, strlen(field));
+  if (fs == NULL || fs->dict == NULL) {
+    return 0;
+  }
+  // the records must be encoded the way the field writes them
+  IndexFlags flags = fs->type == F_TAG ? Index_DocIdsOnly : IndexSpec_FieldPostingsFlags(sp);
+  InvertedIndex *idx = InvertedIndex_Restore(data, dlen, flags, INDEX_STORAGE_MASK);
+  if (idx == NULL) {
+    return 0;
+  }
+  if (!TermDict_Add(fs->dict, term, len, idx)) {
+    InvertedIndex_Free(idx);
+    return 0;
+  }
+  if (fs->type == F_FULLTEXT) {
+    IndexSpec_AddTerm(sp, term, len);
+  }
+  if (idx->numDeleted) {
+    IndexGC_AddDirty(sp->gc, IndexSpec_FieldDictNum(sp, fs), fs->dict->numEntries - 1);
+  }
+  return 1;
+}
+
+size_t FieldSpec_RemapDict(FieldSpec *fs, const t_docId *idMap, t_docId maxId) {
+  size_t removed = 0;
+  for (uint32_t i = 0; i < fs->dict->numEntries; i++) {
+    removed += InvertedIndex_Remap(fs->dict->entries[i].idx, idMap, maxId);
+  }
+  return removed;
+}
+
+void FieldSpec_DictMemStats(FieldSpec *fs, size_t *size, size_t *cap) {
+  for (uint32_t i = 0; i < fs->dict->numEntries; i++) {
+    InvertedIndex_MemStats(fs->dict->entries[i].idx, size, cap);
+  }
+}
+
+int IndexSpec_RestoreStats(IndexSpec *sp, RedisModuleString **argv, int argc) {
+  size_t *fields[] = {&sp->stats.numDocuments,     &sp->stats.numTerms,
+                      &sp->stats.numRecords,       &sp->stats.invertedSize,
+                      &sp->stats.invertedCap,      &sp->stats.skipIndexesSize,
+                      &sp->stats.scoreIndexesSize, &sp->stats.offsetVecsSize,
+                      &sp->stats.offsetVecRecords, &sp->stats.termsSize,
+                      &sp->stats.totalDocsLen};
+  int n = sizeof(fields) / sizeof(fields[0]);
+  if (argc != n) {
+    return 0;
+  }
+  long long vals[n];
+  for (int i = 0; i < n; i++) {
+    if (RedisModule_StringToLongLong(argv[i], &vals[i]) == REDISMODULE_ERR || vals[i] < 0) {
+      return 0;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    *fields[i] = vals[i];
+  }
+  // the restored blocks are sized to their data, unlike the ones that were dumped
+  IndexSpec_UpdateInvertedStats(sp);
+  return 1;
+}
+
 int IndexSpec_RegisterType(RedisModuleCtx *ctx) {
   RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
                                .rdb_load = IndexSpec_RdbLoad,
                                .rdb_save = IndexSpec_RdbSave,
                                .aof_rewrite = IndexSpec_AofRewrite,
-                               .free = IndexSpec_Free};
+                               .free = IndexSpec_LazyFree};
 
   IndexSpecType = RedisModule_CreateDataType(ctx, "ft_index0", INDEX_CURRENT_VERSION, &tm);
   if (IndexSpecType == NULL) {
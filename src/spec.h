@@ -9,6 +9,7 @@
 #include "trie/trie_type.h"
 #include "sortable.h"
 #include "stopwords.h"
+#include "tokenize.h"
 
 typedef enum fieldType { F_FULLTEXT, F_NUMERIC, F_GEO, F_TAG } FieldType;
 
@@ -23,13 +24,18 @@ typedef enum fieldType { F_FULLTEXT, F_NUMERIC, F_GEO, F_TAG } FieldType;
 #define SPEC_WEIGHT_STR "WEIGHT"
 #define SPEC_TAG_STR "TAG"
 #define SPEC_SORTABLE_STR "SORTABLE"
+#define SPEC_OWNPOSTINGS_STR "OWNPOSTINGS"
+#define SPEC_SEPARATORS_STR "SEPARATORS"
 #define SPEC_STOPWORDS_STR "STOPWORDS"
+#define SPEC_DOCTABLE_STR "DOCTABLE"
 
 static const char *SpecTypeNames[] = {[F_FULLTEXT] = SPEC_TEXT_STR, [F_NUMERIC] = NUMERIC_STR,
                                       [F_GEO] = GEO_STR, [F_TAG] = SPEC_TAG_STR};
 #define INDEX_SPEC_KEY_FMT "idx:%s"
 
-#define SPEC_MAX_FIELDS 32
+/* Text and tag fields get a bit of the field mask, and the other fields don't, but we cap all the
+ * fields at the width of the mask */
+#define SPEC_MAX_FIELDS (int)(sizeof(t_fieldMask) * 8)
 
 /* The fieldSpec represents a single field in the document's field spec.
 Each field has a unique id that's a power of two, so we can filter fields
@@ -44,8 +50,18 @@ typedef struct fieldSpec {
   int sortable;
   int sortIdx;
 
-  // TODO: const char **separators;
-  // size_t numSeparators;
+  // custom tokenizer separators of a text field, NULL if it uses the default ones. The separators
+  // of the tags in a tag field
+  char *separators;
+  TokenizerCharTable *charTable;
+
+  // the text field keeps the postings of its terms in its own dictionary, instead of sharing the
+  // inverted indexes of the index
+  int ownPostings;
+
+  // the dictionary of the field's own inverted indexes - of its tags if it's a tag field, or of its
+  // terms if it's a text field with its own postings. NULL for other fields
+  struct termDict *dict;
   // TODO: More options here..
 } FieldSpec;
 
@@ -60,6 +76,8 @@ typedef struct {
   size_t offsetVecsSize;
   size_t offsetVecRecords;
   size_t termsSize;
+  // the total number of tokens in all the documents, used for the average document length
+  size_t totalDocsLen;
 } IndexStats;
 
 typedef enum {
@@ -67,10 +85,19 @@ typedef enum {
   Index_StoreFieldFlags = 0x02,
   Index_StoreScoreIndexes = 0x04,
   Index_HasCustomStopwords = 0x08,
+  // the index was loaded from an RDB that kept its terms in redis keys, and they haven't been moved
+  // into its term dictionary yet
+  Index_HasLegacyTermKeys = 0x10,
+  // the records only hold docIds, without a frequency, field mask or offsets. Only set on the
+  // inverted indexes of tag fields, never on an index spec
+  Index_DocIdsOnly = 0x20,
+  // the text fields sharing the index's inverted indexes don't all fit in 32 bits of the field mask,
+  // so the masks of their records are written as varints instead of being packed with the docId
+  Index_WideSchema = 0x40,
 } IndexFlags;
 
 #define INDEX_DEFAULT_FLAGS Index_StoreTermOffsets | Index_StoreFieldFlags | Index_StoreScoreIndexes
-#define INDEX_CURRENT_VERSION 5
+#define INDEX_CURRENT_VERSION 14
 #define INDEX_MIN_COMPAT_VERSION 2
 
 typedef struct {
@@ -83,11 +110,31 @@ typedef struct {
 
   Trie *terms;
 
+  /* The inverted indexes of the terms */
+  struct termDict *termDict;
+
+  /* Tracks the records of deleted documents left in the inverted indexes */
+  struct indexGC *gc;
+
+  /* The text records of added documents, waiting to be committed to the inverted indexes */
+  struct ingestGroup *ingest;
+
   RSSortingTable *sortables;
 
-  DocTable docs;
+  /* The index's own document table, or the shared table named docTableName. A shared table belongs
+   * to its key, and is looked up again every time the index is loaded */
+  DocTable *docs;
+  char *docTableName;
+
+  /* The last docId added to an index with a shared table, which assigns docIds to the other indexes
+   * too. Always 0 for an index with its own table */
+  t_docId lastDocId;
 
   StopWordList *stopwords;
+
+  /* Bumped by every write to the index, so cached search results can tell they are stale. Not
+   * persisted */
+  uint64_t generation;
 } IndexSpec;
 
 extern RedisModuleType *IndexSpecType;
@@ -98,10 +145,14 @@ extern RedisModuleType *IndexSpecType;
 */
 FieldSpec *IndexSpec_GetField(IndexSpec *spec, const char *name, size_t len);
 
-char *GetFieldNameByBit(IndexSpec *sp, uint32_t id);
+char *GetFieldNameByBit(IndexSpec *sp, t_fieldMask id);
 /* Get the field bitmask id of a text field by name. Return 0 if the field is not found or is not a
  * text field */
-uint32_t IndexSpec_GetFieldBit(IndexSpec *spec, const char *name, size_t len);
+t_fieldMask IndexSpec_GetFieldBit(IndexSpec *spec, const char *name, size_t len);
+
+/* The flags of the inverted indexes in the dictionary of a text field with its own postings. All
+ * the records are of the one field, so they don't store a field mask */
+#define IndexSpec_FieldPostingsFlags(sp) ((sp)->flags & ~(Index_StoreFieldFlags | Index_WideSchema))
 
 /* Get a sortable field's sort table index by its name. return -1 if the field was not found or is
  * not sortable */
@@ -119,15 +170,49 @@ IndexSpec *IndexSpec_ParseRedisArgs(RedisModuleCtx *ctx, RedisModuleString *name
 /* Same as above but with ordinary strings, to allow unit testing */
 IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char **err);
 
+/* Load an index by name. Everything that loads an index reads it, so the documents waiting in its
+ * ingestion group are committed first */
 IndexSpec *IndexSpec_Load(RedisModuleCtx *ctx, const char *name, int openWrite);
 
+/* Load an index for writing, leaving its ingestion group as it is. Only for adding documents */
+IndexSpec *IndexSpec_LoadForAdd(RedisModuleCtx *ctx, const char *name);
+
+/* Iterate the indexes sharing the document table called name, starting with *pos set to 0. Returns
+ * the next of them, or NULL once they are all returned. Their table is the one they had when they
+ * were last loaded, which may be gone */
+IndexSpec *IndexSpec_NextSharer(const char *name, size_t *pos);
+
+/* Walk the live indexes round-robin, so that repeated calls cover all of them. Returns NULL if there
+ * are none. The index is the one that was last loaded, so it should be opened by name before use */
+IndexSpec *IndexSpec_NextLive();
+
 int IndexSpec_AddTerm(IndexSpec *sp, const char *term, size_t len);
+
+/* The most dictionaries an index has - its term dictionary, and one per field */
+#define SPEC_MAX_DICTS (SPEC_MAX_FIELDS + 1)
+
+/* Fill dicts with the dictionaries of the index, numbered the way the GC numbers them: the term
+ * dictionary is 0, and the dictionary of the i-th field is i + 1, NULL if the field has none. dicts
+ * must have room for SPEC_MAX_DICTS. Returns the number of dictionaries */
+uint32_t IndexSpec_Dicts(IndexSpec *sp, struct termDict **dicts);
+
+/* The number of the dictionary of a field, as given by IndexSpec_Dicts */
+#define IndexSpec_FieldDictNum(sp, fs) ((uint32_t)((fs) - (sp)->fields) + 1)
+
+/* Recompute the data size and buffer capacity stats of the inverted indexes from their blocks.
+ * Called whenever the blocks are reallocated wholesale - on load, restore, compaction and
+ * optimization */
+void IndexSpec_UpdateInvertedStats(IndexSpec *sp);
 /*
 * Free an indexSpec. This doesn't free the spec itself as it's not allocated by the parser
 * and should be on the request's stack
 */
 void IndexSpec_Free(void *spec);
 
+/* Free an index spec that was deleted from the keyspace. This is the free callback of the index
+ * spec type - a big index is freed on the lazy free thread, so dropping it doesn't block redis */
+void IndexSpec_LazyFree(void *spec);
+
 /* Parse a new stopword list and set it. If the parsing fails we revert to the default stopword
  * list, and return 0 */
 int IndexSpec_ParseStopWords(IndexSpec *sp, RedisModuleString **strs, size_t len);
@@ -139,7 +224,32 @@ IndexSpec *NewIndexSpec(const char *name, size_t numFields);
 void *IndexSpec_RdbLoad(RedisModuleIO *rdb, int encver);
 void IndexSpec_RdbSave(RedisModuleIO *rdb, void *value);
 void IndexSpec_Digest(RedisModuleDigest *digest, void *value);
+/* Emit commands that recreate the index on AOF rewrite: FT.CREATE with the index's options and
+ * schema, followed by FT.RESTORE commands with its documents, term indexes and stats */
 void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value);
+
+/* Add a term and its inverted index, serialized by InvertedIndex_Dump, to the index. Returns 0 if
+ * the data is malformed or the index already has the term */
+int IndexSpec_RestoreTerm(IndexSpec *sp, const char *term, size_t len, const char *data,
+                          size_t dlen);
+
+/* Add a tag of a tag field, or a term of a text field with its own postings, and its inverted index
+ * serialized by InvertedIndex_Dump. Returns 0 if the field has no dictionary, the data is malformed
+ * or the field already has the term */
+int IndexSpec_RestoreFieldTerm(IndexSpec *sp, const char *field, const char *term, size_t len,
+                               const char *data, size_t dlen);
+
+/* Rewrite the inverted indexes in the dictionary of a field after a DocTable compaction. Returns
+ * the number of records removed */
+size_t FieldSpec_RemapDict(FieldSpec *fs, const t_docId *idMap, t_docId maxId);
+
+/* Add the data size and buffer capacity of the inverted indexes in the dictionary of a field to
+ * *size and *cap */
+void FieldSpec_DictMemStats(FieldSpec *fs, size_t *size, size_t *cap);
+
+/* Set the stats of the index from the arguments of an FT.RESTORE STATS command. Returns 0 if they
+ * can't be parsed */
+int IndexSpec_RestoreStats(IndexSpec *sp, RedisModuleString **argv, int argc);
 int IndexSpec_RegisterType(RedisModuleCtx *ctx);
 // void IndexSpec_Free(void *value);
 
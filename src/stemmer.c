@@ -2,7 +2,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <sys/param.h>
+#include <stdint.h>
 #include "dep/snowball/include/libstemmer.h"
+#include "util/fnv.h"
 
 const char *__supportedLanguages[] = {"arabic",     "danish",   "dutch",     "english", "finnish",
                                       "french",     "german",   "hungarian", "italian", "norwegian",
@@ -103,3 +105,127 @@ Stemmer *NewStemmer(StemmerType type, const char *language) {
   fprintf(stderr, "Invalid stemmer type");
   return NULL;
 }
+
+/* The number of slots in each language's stem cache */
+#define STEM_CACHE_SIZE (1 << 16)
+/* Longer words are not cached */
+#define STEM_CACHE_MAX_WORD 64
+/* The maximal number of languages (or language aliases) with a shared stemmer */
+#define STEM_CACHE_MAX_LANGS 32
+
+/* A cache slot. The word and its stem are stored back to back in buf. A stem length of 0 means the
+ * stemmer leaves the word as it is */
+typedef struct {
+  uint32_t hash;
+  uint16_t wordLen;
+  uint16_t stemLen;
+  char *buf;
+} stemCacheEntry;
+
+/* A two way set associative cache of stemming results. Each word maps to a set of two slots, kept
+ * in LRU order, so the cache size is bounded and eviction needs no extra bookkeeping */
+typedef struct {
+  Stemmer base;
+  Stemmer *stemmer;
+  char *language;
+  stemCacheEntry *entries;
+  StemCacheStats stats;
+} stemCache;
+
+static stemCache *__stemCaches[STEM_CACHE_MAX_LANGS];
+static int __numStemCaches = 0;
+
+static inline int __stemCacheEntry_Match(stemCacheEntry *e, uint32_t hash, const char *word,
+                                         size_t len) {
+  return e->buf && e->hash == hash && e->wordLen == len && !memcmp(e->buf, word, len);
+}
+
+static const char *__stemCache_Stem(void *ctx, const char *word, size_t len, size_t *outlen) {
+  stemCache *c = ctx;
+  if (len > STEM_CACHE_MAX_WORD) {
+    return c->stemmer->Stem(c->stemmer->ctx, word, len, outlen);
+  }
+
+  uint32_t hash = fnv_32a_buf((void *)word, len, 0);
+  stemCacheEntry *set = &c->entries[(hash % (STEM_CACHE_SIZE / 2)) * 2];
+  stemCacheEntry tmp;
+  if (__stemCacheEntry_Match(&set[1], hash, word, len)) {
+    // move the hit to the front of the set
+    tmp = set[0];
+    set[0] = set[1];
+    set[1] = tmp;
+  }
+  if (__stemCacheEntry_Match(&set[0], hash, word, len)) {
+    c->stats.hits++;
+    if (!set[0].stemLen) return NULL;
+    *outlen = set[0].stemLen;
+    return set[0].buf + len + 1;
+  }
+
+  c->stats.misses++;
+  size_t sl = 0;
+  const char *stem = c->stemmer->Stem(c->stemmer->ctx, word, len, &sl);
+  // a stem equal to the word is cached as "no change"
+  int changed = stem && (sl != len || memcmp(stem, word, len));
+
+  // evict the least recently used slot and put the new word in front
+  stemCacheEntry *e = &set[1];
+  if (!e->buf) {
+    c->stats.entries++;
+  }
+  tmp = set[1];
+  set[1] = set[0];
+  set[0] = tmp;
+  e = &set[0];
+
+  e->buf = realloc(e->buf, len + 1 + (changed ? sl + 1 : 0));
+  e->hash = hash;
+  e->wordLen = len;
+  e->stemLen = changed ? sl : 0;
+  memcpy(e->buf, word, len);
+  e->buf[len] = '\0';
+  if (!changed) return NULL;
+
+  memcpy(e->buf + len + 1, stem, sl);
+  e->buf[len + 1 + sl] = '\0';
+  *outlen = sl;
+  return e->buf + len + 1;
+}
+
+/* Shared stemmers live as long as the process does */
+static void __stemCache_Free(Stemmer *s) {
+}
+
+Stemmer *GetSharedStemmer(StemmerType type, const char *language) {
+  for (int i = 0; i < __numStemCaches; i++) {
+    if (!strcasecmp(__stemCaches[i]->language, language)) {
+      return &__stemCaches[i]->base;
+    }
+  }
+  if (__numStemCaches == STEM_CACHE_MAX_LANGS) {
+    return NULL;
+  }
+
+  Stemmer *st = NewStemmer(type, language);
+  if (!st) {
+    return NULL;
+  }
+
+  stemCache *c = calloc(1, sizeof(stemCache));
+  c->stemmer = st;
+  c->language = strdup(language);
+  c->entries = calloc(STEM_CACHE_SIZE, sizeof(stemCacheEntry));
+  c->base = (Stemmer){.ctx = c, .Stem = __stemCache_Stem, .Free = __stemCache_Free};
+  __stemCaches[__numStemCaches++] = c;
+  return &c->base;
+}
+
+StemCacheStats GetStemCacheStats() {
+  StemCacheStats ret = {0};
+  for (int i = 0; i < __numStemCaches; i++) {
+    ret.hits += __stemCaches[i]->stats.hits;
+    ret.misses += __stemCaches[i]->stats.misses;
+    ret.entries += __stemCaches[i]->stats.entries;
+  }
+  return ret;
+}
@@ -16,6 +16,24 @@ typedef struct stemmer {
 
 Stemmer *NewStemmer(StemmerType type, const char *language);
 
+/* Get the process wide stemmer of a language, wrapped with a bounded cache of its stemming results
+ * (including words that the stemmer leaves as they are). The same instance is shared by indexing
+ * and query expansion, and calling its Free function does nothing.
+ *
+ * The cached stemmer returns NULL for words that do not change. Like any stemmer, the returned stem
+ * is only valid until the next call. It is not thread safe, and must be used with the redis GIL
+ * held. Returns NULL if the language is not supported */
+Stemmer *GetSharedStemmer(StemmerType type, const char *language);
+
+/* Statistics of the shared stemmers' caches, summed over all languages */
+typedef struct {
+  size_t hits;
+  size_t misses;
+  size_t entries;
+} StemCacheStats;
+
+StemCacheStats GetStemCacheStats();
+
 /* check if a language is supported by our stemmers */
 int IsSupportedLanguage(const char *language, size_t len);
 
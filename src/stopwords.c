@@ -3,6 +3,7 @@
 #include "dep/triemap/triemap.h"
 #include "rmalloc.h"
 #include <ctype.h>
+#include <sys/param.h>
 
 #define MAX_STOPWORDLIST_SIZE 1024
 
@@ -108,3 +109,19 @@ void StopWordList_RdbSave(RedisModuleIO *rdb, StopWordList *sl) {
   }
   TrieMapIterator_Free(it);
 }
+
+RedisModuleString **StopWordList_ToStrings(StopWordList *sl, RedisModuleCtx *ctx, size_t *num) {
+  RedisModuleString **strs = rm_malloc(MAX(sl->m->cardinality, 1) * sizeof(RedisModuleString *));
+  size_t n = 0;
+  TrieMapIterator *it = TrieMap_Iterate(sl->m, "", 0);
+  char *str;
+  tm_len_t len;
+  void *ptr;
+
+  while (n < sl->m->cardinality && TrieMapIterator_Next(it, &str, &len, &ptr)) {
+    strs[n++] = RedisModule_CreateString(ctx, str, len);
+  }
+  TrieMapIterator_Free(it);
+  *num = n;
+  return strs;
+}
@@ -35,4 +35,9 @@ struct StopWordList *StopWordList_RdbLoad(RedisModuleIO *rdb, int encver);
 /* Save a stopword list to RDB */
 void StopWordList_RdbSave(RedisModuleIO *rdb, struct StopWordList *sl);
 
+/* Get the words of a stopword list as redis strings, for AOF rewrite. The caller must free the
+ * array */
+RedisModuleString **StopWordList_ToStrings(struct StopWordList *sl, RedisModuleCtx *ctx,
+                                           size_t *num);
+
 #endif
\ No newline at end of file
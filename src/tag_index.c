@@ -0,0 +1,66 @@
+#include "tag_index.h"
+#include "inverted_index.h"
+#include "index_gc.h"
+#include "index_result.h"
+#include "rmalloc.h"
+#include <ctype.h>
+#include <string.h>
+
+/* The characters collapsed into spaces in a tag - the ones the query parser does not keep in terms */
+static inline int tagBlank(char c) {
+  unsigned char u = (unsigned char)c;
+  return u < 0x80 && c != '_' && (isspace(u) || iscntrl(u) || ispunct(u));
+}
+
+size_t TagIndex_Normalize(char *tag, size_t len) {
+  size_t n = 0;
+  int blank = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (tagBlank(tag[i])) {
+      blank = 1;
+      continue;
+    }
+    // a run of blanks becomes a single space, unless it's at the start or the end
+    if (blank && n) {
+      tag[n++] = ' ';
+    }
+    blank = 0;
+    tag[n++] = (unsigned char)tag[i] < 0x80 ? tolower(tag[i]) : tag[i];
+  }
+  return n;
+}
+
+size_t TagIndex_Index(FieldSpec *fs, const char *value, t_docId docId, IndexGC *gc,
+                      uint32_t dict) {
+  char *buf = rm_strdup(value);
+  size_t written = 0;
+  RSOffsetVector noOffsets = {.data = NULL, .len = 0};
+
+  char *p = buf;
+  while (*p) {
+    char *tag = p;
+    while (*p && !(fs->charTable->cls[(unsigned char)*p] & TOKCHAR_SEPARATOR)) {
+      p++;
+    }
+    size_t len = TagIndex_Normalize(tag, p - tag);
+    if (*p) p++;
+    if (!len) continue;
+
+    TermDictEntry *te = TermDict_Open(fs->dict, tag, len, Index_DocIdsOnly);
+    // docIds only grow, so a tag already written for this document is the last one in its index
+    if (te->idx->lastId == docId) continue;
+    if (gc) IndexGC_AddDocTerm(gc, dict, te - fs->dict->entries);
+    written += InvertedIndex_WriteRecord(te->idx, docId, RS_FIELDMASK_ALL, 1, &noOffsets);
+  }
+
+  rm_free(buf);
+  return written;
+}
+
+IndexIterator *TagIndex_OpenReader(FieldSpec *fs, DocTable *dt, RSToken *tok) {
+  InvertedIndex *idx = TermDict_Get(fs->dict, tok->str, tok->len);
+  if (idx == NULL) {
+    return NULL;
+  }
+  return NewReadIterator(NewIndexReader(idx, dt, RS_FIELDMASK_ALL, idx->flags, NewTerm(tok), 0));
+}
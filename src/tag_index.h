@@ -0,0 +1,35 @@
+#ifndef __RS_TAG_INDEX_H__
+#define __RS_TAG_INDEX_H__
+
+#include "redisearch.h"
+#include "spec.h"
+#include "term_dict.h"
+#include "doc_table.h"
+#include "index_iterator.h"
+
+/* Tag fields hold short exact values, like categories or labels, and are queried by exact match.
+ *
+ * A value is split into tags at the field's separator characters. Every tag is trimmed and its ASCII
+ * is lowercased, and blanks, control characters and punctuation inside it are collapsed into single
+ * spaces - the same characters the query parser splits terms at, so "Sci-Fi" is queried as
+ * @genre:"sci fi". Tags are not stemmed, and stopwords are kept.
+ *
+ * Each tag field has its own dictionary, mapping its tags to inverted indexes of the documents that
+ * have them. The records of these indexes hold nothing but docIds (see Index_DocIdsOnly), so a tag
+ * costs about one byte per document, and reading it decodes a single varint per record */
+
+#define TAG_DEFAULT_SEPARATORS ","
+
+/* Normalize a single tag in place. Returns its new length, which is 0 if nothing is left of it */
+size_t TagIndex_Normalize(char *tag, size_t len);
+
+/* Index the value of a tag field of a document. Tags repeated in the value are indexed once. If gc
+ * is set, the tags are recorded in it as terms of the field's dictionary number dict, so deleting
+ * the document marks their records. Returns the number of bytes written to the tag indexes */
+size_t TagIndex_Index(FieldSpec *fs, const char *value, t_docId docId, struct indexGC *gc,
+                      uint32_t dict);
+
+/* Open an iterator of the documents with a normalized tag, or NULL if no document has it */
+IndexIterator *TagIndex_OpenReader(FieldSpec *fs, DocTable *dt, RSToken *tok);
+
+#endif
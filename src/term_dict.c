@@ -0,0 +1,179 @@
+#include "term_dict.h"
+#include "redis_index.h"
+#include "util/fnv.h"
+#include "rmalloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TERMDICT_MIN_CAP 16
+
+TermDict *NewTermDict(uint32_t cap) {
+  if (cap < TERMDICT_MIN_CAP) cap = TERMDICT_MIN_CAP;
+  TermDict *d = rm_malloc(sizeof(TermDict));
+  d->entriesCap = cap;
+  d->entries = rm_malloc(d->entriesCap * sizeof(TermDictEntry));
+  d->numEntries = 0;
+
+  // the table is kept at most half full, and its size is a power of two
+  d->numBuckets = TERMDICT_MIN_CAP;
+  while (d->numBuckets < cap * 2) {
+    d->numBuckets *= 2;
+  }
+  d->buckets = rm_calloc(d->numBuckets, sizeof(uint32_t));
+  d->termsSize = 0;
+  return d;
+}
+
+void TermDict_Free(TermDict *d) {
+  for (uint32_t i = 0; i < d->numEntries; i++) {
+    rm_free(d->entries[i].term);
+    InvertedIndex_Free(d->entries[i].idx);
+  }
+  rm_free(d->entries);
+  rm_free(d->buckets);
+  rm_free(d);
+}
+
+/* Double the hash table and re-insert all the entries */
+static void TermDict_Rehash(TermDict *d) {
+  d->numBuckets *= 2;
+  d->buckets = rm_realloc(d->buckets, d->numBuckets * sizeof(uint32_t));
+  memset(d->buckets, 0, d->numBuckets * sizeof(uint32_t));
+
+  uint32_t mask = d->numBuckets - 1;
+  for (uint32_t i = 0; i < d->numEntries; i++) {
+    uint32_t b = d->entries[i].hash & mask;
+    while (d->buckets[b]) {
+      b = (b + 1) & mask;
+    }
+    d->buckets[b] = i + 1;
+  }
+}
+
+/* Find the bucket of a term - either the one holding it, or the empty one it would be added at */
+static uint32_t TermDict_FindBucket(TermDict *d, const char *term, size_t len, uint32_t hval) {
+  uint32_t mask = d->numBuckets - 1;
+  uint32_t b = hval & mask;
+  while (d->buckets[b]) {
+    TermDictEntry *e = &d->entries[d->buckets[b] - 1];
+    if (e->hash == hval && e->len == len && !memcmp(e->term, term, len)) {
+      break;
+    }
+    b = (b + 1) & mask;
+  }
+  return b;
+}
+
+InvertedIndex *TermDict_Get(TermDict *d, const char *term, size_t len) {
+  uint32_t b = TermDict_FindBucket(d, term, len, fnv_32a_buf((void *)term, len, 0));
+  return d->buckets[b] ? d->entries[d->buckets[b] - 1].idx : NULL;
+}
+
+/* Add a new term at its empty bucket */
+static TermDictEntry *TermDict_AddAt(TermDict *d, uint32_t b, const char *term, size_t len,
+                                     uint32_t hval, InvertedIndex *idx) {
+  if (d->numEntries == d->entriesCap) {
+    d->entriesCap *= 2;
+    d->entries = rm_realloc(d->entries, d->entriesCap * sizeof(TermDictEntry));
+  }
+  TermDictEntry *e = &d->entries[d->numEntries++];
+  d->buckets[b] = d->numEntries;
+
+  e->term = rm_strndup(term, len);
+  e->len = len;
+  e->hash = hval;
+  e->idx = idx;
+  d->termsSize += len;
+
+  if (d->numEntries * 2 > d->numBuckets) {
+    TermDict_Rehash(d);
+  }
+  return e;
+}
+
+int TermDict_Add(TermDict *d, const char *term, size_t len, InvertedIndex *idx) {
+  uint32_t hval = fnv_32a_buf((void *)term, len, 0);
+  uint32_t b = TermDict_FindBucket(d, term, len, hval);
+  if (d->buckets[b]) {
+    return 0;
+  }
+  TermDict_AddAt(d, b, term, len, hval, idx);
+  return 1;
+}
+
+TermDictEntry *TermDict_Open(TermDict *d, const char *term, size_t len, IndexFlags flags) {
+  uint32_t hval = fnv_32a_buf((void *)term, len, 0);
+  uint32_t b = TermDict_FindBucket(d, term, len, hval);
+  if (d->buckets[b]) {
+    return &d->entries[d->buckets[b] - 1];
+  }
+  return TermDict_AddAt(d, b, term, len, hval, NewInvertedIndex(flags, 1));
+}
+
+TermDictEntry *TermDict_Random(TermDict *d) {
+  if (d->numEntries == 0) {
+    return NULL;
+  }
+  return &d->entries[rand() % d->numEntries];
+}
+
+size_t TermDict_MemUsage(TermDict *d) {
+  return sizeof(TermDict) + d->entriesCap * sizeof(TermDictEntry) +
+         d->numBuckets * sizeof(uint32_t) + d->termsSize + d->numEntries;
+}
+
+void TermDict_RdbSave(RedisModuleIO *rdb, TermDict *d) {
+  RedisModule_SaveUnsigned(rdb, d->numEntries);
+  for (uint32_t i = 0; i < d->numEntries; i++) {
+    TermDictEntry *e = &d->entries[i];
+    RedisModule_SaveStringBuffer(rdb, e->term, e->len);
+    InvertedIndex_RdbSave(rdb, e->idx);
+
+    // the deleted record counters of the index and its dirty blocks
+    InvertedIndex *idx = e->idx;
+    RedisModule_SaveUnsigned(rdb, idx->numDeleted);
+    uint32_t ndirty = 0;
+    for (uint32_t b = 0; b < idx->size && idx->numDeleted; b++) {
+      ndirty += idx->blocks[b].numDeleted > 0;
+    }
+    RedisModule_SaveUnsigned(rdb, ndirty);
+    for (uint32_t b = 0; b < idx->size && ndirty; b++) {
+      if (idx->blocks[b].numDeleted) {
+        RedisModule_SaveUnsigned(rdb, b);
+        RedisModule_SaveUnsigned(rdb, idx->blocks[b].numDeleted);
+      }
+    }
+  }
+}
+
+TermDict *TermDict_RdbLoad(RedisModuleIO *rdb, int encver) {
+  uint32_t n = RedisModule_LoadUnsigned(rdb);
+  TermDict *d = NewTermDict(n);
+  for (uint32_t i = 0; i < n; i++) {
+    size_t len;
+    char *term = RedisModule_LoadStringBuffer(rdb, &len);
+    // version 10 saves the blocks of each inverted index as one stream
+    InvertedIndex *idx = InvertedIndex_RdbLoad(rdb, encver >= 10 ? INVERTED_INDEX_ENCVER : 0);
+    if (idx == NULL) {
+      rm_free(term);
+      TermDict_Free(d);
+      return NULL;
+    }
+
+    // version 9 added the deleted record counters
+    if (encver >= 9) {
+      idx->numDeleted = RedisModule_LoadUnsigned(rdb);
+      uint32_t ndirty = RedisModule_LoadUnsigned(rdb);
+      for (uint32_t j = 0; j < ndirty; j++) {
+        uint32_t b = RedisModule_LoadUnsigned(rdb);
+        uint16_t nd = RedisModule_LoadUnsigned(rdb);
+        if (b < idx->size) idx->blocks[b].numDeleted = nd;
+      }
+    }
+    if (!TermDict_Add(d, term, len, idx)) {
+      InvertedIndex_Free(idx);
+    }
+    rm_free(term);
+  }
+  return d;
+}
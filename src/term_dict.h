@@ -0,0 +1,64 @@
+#ifndef __RS_TERM_DICT_H__
+#define __RS_TERM_DICT_H__
+
+#include <stdint.h>
+#include "inverted_index.h"
+#include "redismodule.h"
+
+/* A term's entry in the dictionary */
+typedef struct {
+  char *term;
+  uint32_t len;
+  uint32_t hash;
+  InvertedIndex *idx;
+} TermDictEntry;
+
+/* The term dictionary maps the terms of an index to their inverted indexes. It is owned by the
+ * index spec and persisted with it, so opening a term's index is a single hash probe instead of
+ * formatting a redis key and looking it up in the keyspace, and the terms don't pay for a redis key
+ * each.
+ *
+ * Entries are kept in a flat array in insertion order, with an open addressing hash table of entry
+ * index + 1 keyed by the term. Terms are never removed from the dictionary */
+typedef struct termDict {
+  TermDictEntry *entries;
+  uint32_t numEntries;
+  uint32_t entriesCap;
+
+  // 0 marks an empty bucket
+  uint32_t *buckets;
+  uint32_t numBuckets;
+
+  // the total length of all the terms
+  size_t termsSize;
+} TermDict;
+
+TermDict *NewTermDict(uint32_t cap);
+
+/* Free the dictionary, along with all its inverted indexes */
+void TermDict_Free(TermDict *d);
+
+/* Get the inverted index of a term, or NULL if the term is not in the dictionary */
+InvertedIndex *TermDict_Get(TermDict *d, const char *term, size_t len);
+
+/* Add a term with its inverted index. The dictionary takes ownership of the index. Returns 0 and
+ * does not take the index if the term is already in the dictionary */
+int TermDict_Add(TermDict *d, const char *term, size_t len, InvertedIndex *idx);
+
+/* Get the entry of a term, adding the term with a new inverted index if it's not in the dictionary
+ * yet. The entry is valid until the next term is added. Its index in the entries array is the term's
+ * id, which never changes */
+TermDictEntry *TermDict_Open(TermDict *d, const char *term, size_t len, IndexFlags flags);
+
+/* Select a random entry of the dictionary, or NULL if it's empty */
+TermDictEntry *TermDict_Random(TermDict *d);
+
+/* The memory used by the dictionary itself, not including the inverted indexes */
+size_t TermDict_MemUsage(TermDict *d);
+
+void TermDict_RdbSave(RedisModuleIO *rdb, TermDict *d);
+/* Load a dictionary saved with index spec encoding version encver. Returns NULL if one of its
+ * inverted indexes could not be loaded */
+TermDict *TermDict_RdbLoad(RedisModuleIO *rdb, int encver);
+
+#endif
@@ -5,6 +5,9 @@
 #include "../query.h"
 #include "../stopwords.h"
 #include "../ext/default.h"
+#include "../index_result.h"
+#include "time_sample.h"
+#include <math.h>
 
 struct privdata {
   int freed;
@@ -142,9 +145,246 @@ int testQueryExpander() {
   RETURN_TEST_SUCCESS;
 }
 
+static double scoreTerm(ExtScoringFunctionCtx *sx, RSScoringFunctionCtx *ctx, RSQueryTerm *term,
+                        uint32_t freq, uint32_t docLen) {
+  RSIndexResult *r = NewTokenRecord(term);
+  r->docId = 1;
+  r->freq = freq;
+  RSDocumentMetadata dmd = {.key = "doc", .score = 1, .maxFreq = freq, .len = docLen};
+  double score = sx->sf(ctx, r, &dmd, 0);
+  IndexResult_Free(r);
+  return score;
+}
+
+int testBM25Scorer() {
+  Extensions_Init();
+  ASSERT(REDISEARCH_OK == Extension_Load("DEFAULT", DefaultExtensionInit));
+
+  RSScoringFunctionCtx ctx = {.indexStats = {.numDocs = 1000, .numTerms = 100, .avgDocLen = 100}};
+  ExtScoringFunctionCtx *bm25 = Extensions_GetScoringFunction(&ctx, BM25_SCORER_NAME);
+  ASSERT(bm25 != NULL);
+  RSScoringFunctionCtx tctx = ctx;
+  ExtScoringFunctionCtx *tfidf = Extensions_GetScoringFunction(&tctx, DEFAULT_SCORER_NAME);
+  ASSERT(tfidf != NULL);
+
+  RSToken tok = {.str = "hello", .len = 5};
+  RSQueryTerm *common = NewTerm(&tok), *rare = NewTerm(&tok);
+  common->bm25_idf = log(1 + (1000 - 500 + 0.5) / (500 + 0.5));
+  rare->bm25_idf = log(1 + (1000 - 5 + 0.5) / (5 + 0.5));
+
+  // TF-IDF can't tell a short document from a long one with the same frequencies, BM25 prefers it
+  ASSERT_EQUAL(scoreTerm(tfidf, &tctx, common, 2, 10), scoreTerm(tfidf, &tctx, common, 2, 1000));
+  ASSERT(scoreTerm(bm25, &ctx, common, 2, 10) > scoreTerm(bm25, &ctx, common, 2, 1000));
+
+  // rare terms weigh more, and repeated terms saturate
+  ASSERT(scoreTerm(bm25, &ctx, rare, 1, 100) > scoreTerm(bm25, &ctx, common, 1, 100));
+  double one = scoreTerm(bm25, &ctx, common, 1, 100);
+  double many = scoreTerm(bm25, &ctx, common, 100, 100);
+  ASSERT(many > one);
+  ASSERT(many < one * 2.2);
+
+  // documents without a recorded length are treated as average ones
+  ASSERT_EQUAL(scoreTerm(bm25, &ctx, common, 3, 0), scoreTerm(bm25, &ctx, common, 3, 100));
+
+  Term_Free(common);
+  Term_Free(rare);
+  RETURN_TEST_SUCCESS;
+}
+
+static void myBatchScorer(RSScoringFunctionCtx *ctx, RSScoringBatch *b, double minScore) {
+}
+
+static int registerBatchTwice(RSExtensionCtx *ctx) {
+  return ctx->RegisterBatchScoringFunction(DEFAULT_SCORER_NAME, myBatchScorer);
+}
+
+static int registerBatchWithoutScorer(RSExtensionCtx *ctx) {
+  return ctx->RegisterBatchScoringFunction("noSuchScorer", myBatchScorer);
+}
+
+int testBatchScorers() {
+  Extensions_Init();
+  ASSERT(REDISEARCH_OK == Extension_Load("DEFAULT", DefaultExtensionInit));
+  // batch functions can only be added once, to existing scorers
+  ASSERT(REDISEARCH_ERR == Extension_Load("twice", registerBatchTwice));
+  ASSERT(REDISEARCH_ERR == Extension_Load("noscorer", registerBatchWithoutScorer));
+
+  RSToken tok = {.str = "hello", .len = 5};
+  RSQueryTerm *t1 = NewTerm(&tok), *t2 = NewTerm(&tok), *t3 = NewTerm(&tok);
+  t1->idf = t1->bm25_idf = 1.5;
+  t2->idf = t2->bm25_idf = 0.5;
+  t3->idf = t3->bm25_idf = 0.25;
+
+  // score the same results one by one and in a batch: (t1 | t2) t3
+  int n = 10;
+  RSIndexResult *results[n];
+  RSDocumentMetadata dmds[n], *dmdPtrs[n];
+  t_docId docIds[n];
+  float docScores[n];
+  uint32_t maxFreqs[n], docLens[n], termFreqs[3 * n];
+  RSQueryTerm *terms[3 * n];
+  size_t termsOffset[n + 1];
+  double scores[n];
+  termsOffset[0] = 0;
+  for (int i = 0; i < n; i++) {
+    RSIndexResult *u = NewUnionResult(2), *a = NewTokenRecord(t1), *b = NewTokenRecord(t2);
+    RSIndexResult *c = NewTokenRecord(t3);
+    a->freq = 1 + i;
+    b->freq = 2;
+    c->freq = 1 + i % 3;
+    AggregateResult_AddChild(u, a);
+    AggregateResult_AddChild(u, b);
+    results[i] = NewIntersectResult(2);
+    AggregateResult_AddChild(results[i], u);
+    AggregateResult_AddChild(results[i], c);
+
+    dmds[i] = (RSDocumentMetadata){.score = i ? 1.0 / i : 0, .maxFreq = 3 + i, .len = 10 * i};
+    dmdPtrs[i] = &dmds[i];
+    docIds[i] = results[i]->docId = i + 1;
+    docScores[i] = dmds[i].score;
+    maxFreqs[i] = dmds[i].maxFreq;
+    docLens[i] = dmds[i].len;
+    RSIndexResult *leaves[] = {a, b, c};
+    for (int t = 0; t < 3; t++) {
+      termFreqs[3 * i + t] = leaves[t]->freq;
+      terms[3 * i + t] = leaves[t]->term.term;
+    }
+    termsOffset[i + 1] = 3 * (i + 1);
+  }
+  RSScoringBatch batch = {.numResults = n,
+                          .docIds = docIds,
+                          .dmds = dmdPtrs,
+                          .docScores = docScores,
+                          .maxFreqs = maxFreqs,
+                          .docLens = docLens,
+                          .results = results,
+                          .termsOffset = termsOffset,
+                          .termFreqs = termFreqs,
+                          .terms = terms,
+                          .scores = scores};
+
+  const char *names[] = {DEFAULT_SCORER_NAME, BM25_SCORER_NAME, DISMAX_SCORER_NAME};
+  for (int s = 0; s < 3; s++) {
+    RSScoringFunctionCtx ctx = {.indexStats = {.numDocs = 100, .avgDocLen = 30}};
+    ExtScoringFunctionCtx *sx = Extensions_GetScoringFunction(&ctx, names[s]);
+    ASSERT(sx != NULL);
+    ASSERT(sx->bsf != NULL);
+    for (double minScore = 0; minScore < 2; minScore += 1) {
+      sx->bsf(&ctx, &batch, minScore);
+      for (int i = 0; i < n; i++) {
+        double expected = sx->sf(&ctx, results[i], &dmds[i], minScore);
+        ASSERT(fabs(expected - scores[i]) < 0.000001);
+      }
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    RSIndexResult *u = results[i]->agg.children[0];
+    IndexResult_Free(u->agg.children[0]);
+    IndexResult_Free(u->agg.children[1]);
+    IndexResult_Free(u);
+    IndexResult_Free(results[i]->agg.children[1]);
+    IndexResult_Free(results[i]);
+  }
+  Term_Free(t1);
+  Term_Free(t2);
+  Term_Free(t3);
+  RETURN_TEST_SUCCESS;
+}
+
+/* Score an intersection of two terms over and over with TF-IDF and BM25, one by one and in
+ * batches, and report how many results each scorer goes through per second. This measures the
+ * scoring functions alone, on prebuilt results - benchmarkQueryExecute in test_query measures the
+ * whole query execution */
+void benchmarkScorers() {
+  Extensions_Init();
+  Extension_Load("DEFAULT", DefaultExtensionInit);
+
+  RSToken tok = {.str = "hello", .len = 5};
+  RSQueryTerm *t1 = NewTerm(&tok), *t2 = NewTerm(&tok);
+  t1->idf = t1->bm25_idf = 1.5;
+  t2->idf = t2->bm25_idf = 0.5;
+  RSIndexResult *res = NewIntersectResult(2);
+  RSIndexResult *r1 = NewTokenRecord(t1), *r2 = NewTokenRecord(t2);
+  AggregateResult_AddChild(res, r1);
+  AggregateResult_AddChild(res, r2);
+
+  // a batch of the same shape
+  int B = RS_SCORING_BATCH_SIZE;
+  t_docId docIds[B];
+  RSDocumentMetadata *dmds[B];
+  float docScores[B];
+  uint32_t maxFreqs[B], docLens[B], termFreqs[2 * B];
+  RSIndexResult *results[B];
+  RSQueryTerm *terms[2 * B];
+  size_t termsOffset[B + 1];
+  double scores[B];
+  RSScoringBatch batch = {.numResults = B,
+                          .docIds = docIds,
+                          .dmds = dmds,
+                          .docScores = docScores,
+                          .maxFreqs = maxFreqs,
+                          .docLens = docLens,
+                          .results = results,
+                          .termsOffset = termsOffset,
+                          .termFreqs = termFreqs,
+                          .terms = terms,
+                          .scores = scores};
+
+  const char *names[] = {DEFAULT_SCORER_NAME, BM25_SCORER_NAME};
+  int N = 5000000;
+  for (int s = 0; s < 2; s++) {
+    RSScoringFunctionCtx ctx = {.indexStats = {.numDocs = N, .avgDocLen = 50}};
+    ExtScoringFunctionCtx *sx = Extensions_GetScoringFunction(&ctx, names[s]);
+    double total = 0;
+    TimeSample ts;
+    TimeSampler_Start(&ts);
+    for (int i = 0; i < N; i++) {
+      r1->freq = 1 + i % 7;
+      r2->freq = 1 + i % 3;
+      RSDocumentMetadata dmd = {.score = 1, .maxFreq = 7, .len = 1 + i % 100};
+      // the high minimal score skips the slop calculation, so we only measure the scoring itself
+      total += sx->sf(&ctx, res, &dmd, 1000);
+    }
+    TimeSampler_End(&ts);
+    printf("Scored %d results with %s: %.02fM results/sec\n", N, names[s],
+           (double)N / 1000000 / TimeSampler_DurationSec(&ts));
+
+    TimeSampler_Start(&ts);
+    for (int i = 0; i < N; i += B) {
+      termsOffset[0] = 0;
+      for (int j = 0; j < B; j++) {
+        docScores[j] = 1;
+        maxFreqs[j] = 7;
+        docLens[j] = 1 + (i + j) % 100;
+        termFreqs[2 * j] = 1 + (i + j) % 7;
+        termFreqs[2 * j + 1] = 1 + (i + j) % 3;
+        terms[2 * j] = t1;
+        terms[2 * j + 1] = t2;
+        termsOffset[j + 1] = 2 * (j + 1);
+      }
+      sx->bsf(&ctx, &batch, 1000);
+      total += scores[0];
+    }
+    TimeSampler_End(&ts);
+    printf("Scored %d results with %s in batches: %.02fM results/sec\n", N, names[s],
+           (double)N / 1000000 / TimeSampler_DurationSec(&ts));
+  }
+
+  IndexResult_Free(r1);
+  IndexResult_Free(r2);
+  IndexResult_Free(res);
+  Term_Free(t1);
+  Term_Free(t2);
+}
+
 TEST_MAIN({
   RMUTil_InitAlloc();
   TESTFUNC(testExtenionRegistration);
   TESTFUNC(testQueryExpander);
   TESTFUNC(testDynamicLoading);
+  TESTFUNC(testBM25Scorer);
+  TESTFUNC(testBatchScorers);
+
+  benchmarkScorers();
 });
\ No newline at end of file
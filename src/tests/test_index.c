@@ -1,4 +1,5 @@
 #include "../buffer.h"
+#include "../forward_index.h"
 #include "../index.h"
 #include "../inverted_index.h"
 #include "../query_parser/tokenizer.h"
@@ -6,6 +7,12 @@
 #include "../spec.h"
 #include "../tokenize.h"
 #include "../varint.h"
+#include "../query_profile.h"
+#include "../term_dict.h"
+#include "../lazy_free.h"
+#include "../index_gc.h"
+#include "../ingest.h"
+#include "../tag_index.h"
 #include "test_util.h"
 #include "time_sample.h"
 #include "../rmutil/alloc.h"
@@ -38,6 +45,20 @@ int testVarint() {
   }
   it.Free(it.ctx);
   VVW_Free(vw);
+
+  // bulk decoding, mixing runs of single byte deltas with multi byte ones
+  vw = NewVarintVectorWriter(8);
+  uint32_t values[100];
+  for (int i = 0; i < 100; i++) {
+    values[i] = (i ? values[i - 1] : 0) + (i % 20 == 19 ? 100000 : 3);
+    VVW_Write(vw, values[i]);
+  }
+  uint32_t decoded[vw->bw.buf->offset];
+  ASSERT_EQUAL(100, VV_Decode(vw->bw.buf->data, vw->bw.buf->offset, decoded));
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQUAL(values[i], decoded[i]);
+  }
+  VVW_Free(vw);
   return 0;
 }
 
@@ -118,6 +139,61 @@ int testDistance() {
   return 0;
 }
 
+/* Slop checks over offset lists long enough to skip far ahead in */
+int testDistanceLongOffsets() {
+  VarintVectorWriter *vw = NewVarintVectorWriter(8);
+  VarintVectorWriter *vw2 = NewVarintVectorWriter(8);
+  // the first term is at every even position, the second one only near the end
+  for (uint32_t i = 0; i < 4000; i += 2) {
+    VVW_Write(vw, i);
+  }
+  VVW_Write(vw2, 3);
+  VVW_Write(vw2, 3999);
+  VVW_Truncate(vw);
+  VVW_Truncate(vw2);
+
+  RSIndexResult *tr1 = NewTokenRecord(NULL);
+  tr1->docId = 1;
+  tr1->term.offsets = (RSOffsetVector){.data = vw->bw.buf->data, .len = vw->bw.buf->offset};
+  RSIndexResult *tr2 = NewTokenRecord(NULL);
+  tr2->docId = 1;
+  tr2->term.offsets = (RSOffsetVector){.data = vw2->bw.buf->data, .len = vw2->bw.buf->offset};
+
+  RSIndexResult *res = NewIntersectResult(2);
+  AggregateResult_AddChild(res, tr1);
+  AggregateResult_AddChild(res, tr2);
+  ASSERT_EQUAL(1, IndexResult_IsWithinRange(res, 0, 1));
+  ASSERT_EQUAL(1, IndexResult_IsWithinRange(res, 0, 0));
+  IndexResult_Free(res);
+
+  // reversed, 3 is followed right away by 4
+  res = NewIntersectResult(2);
+  AggregateResult_AddChild(res, tr2);
+  AggregateResult_AddChild(res, tr1);
+  ASSERT_EQUAL(1, IndexResult_IsWithinRange(res, 0, 1));
+  IndexResult_Free(res);
+
+  // a second term far past the end of the first one is never within range
+  VarintVectorWriter *vw3 = NewVarintVectorWriter(8);
+  VVW_Write(vw3, 10000);
+  VVW_Truncate(vw3);
+  tr2->term.offsets = (RSOffsetVector){.data = vw3->bw.buf->data, .len = vw3->bw.buf->offset};
+  res = NewIntersectResult(2);
+  AggregateResult_AddChild(res, tr1);
+  AggregateResult_AddChild(res, tr2);
+  ASSERT_EQUAL(0, IndexResult_IsWithinRange(res, 100, 1));
+  ASSERT_EQUAL(0, IndexResult_IsWithinRange(res, 100, 0));
+  ASSERT_EQUAL(1, IndexResult_IsWithinRange(res, 6002, 1));
+  IndexResult_Free(res);
+
+  IndexResult_Free(tr1);
+  IndexResult_Free(tr2);
+  VVW_Free(vw);
+  VVW_Free(vw2);
+  VVW_Free(vw3);
+  return 0;
+}
+
 int testIndexReadWrite() {
 
   InvertedIndex *idx = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
@@ -207,7 +283,6 @@ InvertedIndex *createIndex(int size, int idStep) {
     h.fieldMask = 1;
     h.freq = 1;
     h.docScore = 1;
-    h.stringFreeable = 0;
     h.term = "hello";
     h.len = 5;
 
@@ -232,6 +307,70 @@ int printIntersect(void *ctx, RSIndexResult *hits, int argc) {
   return 0;
 }
 
+int testBlockStream() {
+  const int N = 50000;
+  InvertedIndex *idx = createIndex(N, 3);
+  Buffer stream;
+  Buffer_Init(&stream, 0);
+  size_t len = InvertedIndex_EncodeBlocks(idx, &stream);
+  ASSERT_EQUAL(len, stream.offset);
+
+  InvertedIndex *loaded = NewInvertedIndex(idx->flags, 0);
+  loaded->lastId = idx->lastId;
+  ASSERT(InvertedIndex_DecodeBlocks(loaded, idx->size, stream.data, len));
+  ASSERT_EQUAL(idx->size, loaded->size);
+  size_t dataLen = 0;
+  for (uint32_t i = 0; i < idx->size; i++) {
+    IndexBlock *a = &idx->blocks[i], *b = &loaded->blocks[i];
+    ASSERT_EQUAL(a->firstId, b->firstId);
+    ASSERT_EQUAL(a->lastId, b->lastId);
+    ASSERT_EQUAL(a->numDocs, b->numDocs);
+    ASSERT_EQUAL(a->data->offset, b->data->offset);
+    ASSERT(!memcmp(a->data->data, b->data->data, a->data->offset));
+    dataLen += a->data->offset;
+  }
+  // the stream holds the block data and a header of 4 varints per block
+  ASSERT(len > dataLen && len - dataLen <= 20 * idx->size);
+  // printf("Block stream: %d blocks with %zd bytes of data in %zd bytes\n", (int)idx->size, dataLen,
+  //        len);
+
+  loaded->numDocs = idx->numDocs;
+  IndexReader *ir = NewIndexReader(loaded, NULL, RS_FIELDMASK_ALL, INDEX_DEFAULT_FLAGS, NULL, 1);
+  RSIndexResult *h = NULL;
+  t_docId expected = 3;
+  while (IR_Read(ir, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(expected, h->docId);
+    expected += 3;
+  }
+  ASSERT_EQUAL(3 * (N + 1), expected);
+  IR_Free(ir);
+
+  // the loaded blocks can still be written to
+  ForwardIndexEntry e = {.docId = expected, .fieldMask = 1, .freq = 1, .docScore = 1};
+  e.vw = NewVarintVectorWriter(8);
+  InvertedIndex_WriteEntry(loaded, &e);
+  VVW_Free(e.vw);
+  ASSERT_EQUAL(expected, loaded->lastId);
+
+  // truncated streams, streams with the wrong number of blocks, or blocks past the last docId of
+  // the index are rejected
+  InvertedIndex *bad = NewInvertedIndex(idx->flags, 0);
+  bad->lastId = idx->lastId;
+  ASSERT_EQUAL(0, InvertedIndex_DecodeBlocks(bad, idx->size, stream.data, len - 1));
+  ASSERT_EQUAL(0, InvertedIndex_DecodeBlocks(bad, idx->size + 1, stream.data, len));
+  ASSERT_EQUAL(0, InvertedIndex_DecodeBlocks(bad, idx->size - 1, stream.data, len));
+  bad->lastId = idx->lastId - 1;
+  ASSERT_EQUAL(0, InvertedIndex_DecodeBlocks(bad, idx->size, stream.data, len));
+  ASSERT_EQUAL(0, bad->size);
+  ASSERT(bad->blocks == NULL);
+
+  InvertedIndex_Free(bad);
+  InvertedIndex_Free(loaded);
+  InvertedIndex_Free(idx);
+  Buffer_Free(&stream);
+  return 0;
+}
+
 int testReadIterator() {
   InvertedIndex *idx = createIndex(10, 1);
 
@@ -395,6 +534,59 @@ int testIntersection() {
   return 0;
 }
 
+int testProfileIterator() {
+  InvertedIndex *w = createIndex(10000, 2);
+  InvertedIndex *w2 = createIndex(10000, 3);
+  QueryProfile *p = NewQueryProfile();
+
+  // build the tree like the query evaluation does, entering each node before its children
+  QueryProfileNode *root = QueryProfile_EnterNode(p, "INTERSECT");
+  IndexIterator **irs = calloc(2, sizeof(IndexIterator *));
+  InvertedIndex *idxs[] = {w, w2};
+  for (int i = 0; i < 2; i++) {
+    QueryProfileNode *n = QueryProfile_EnterNode(p, i ? "TERM b" : "TERM a");
+    IndexReader *r = NewIndexReader(idxs[i], NULL, RS_FIELDMASK_ALL, idxs[i]->flags, NULL, 0);
+    irs[i] = QueryProfile_LeaveNode(p, n, NewReadIterator(r));
+  }
+  IndexIterator *ii = QueryProfile_LeaveNode(
+      p, root, NewIntersecIterator(irs, 2, NULL, RS_FIELDMASK_ALL, -1, 0));
+  ASSERT(p->root == root);
+  ASSERT(p->current == NULL);
+  ASSERT_EQUAL(2, root->numChildren);
+  ASSERT_STRING_EQ("TERM b", root->children[1]->label);
+
+  RSIndexResult *h = NULL;
+  int count = 0;
+  while (ii->Read(ii->ctx, &h) != INDEXREAD_EOF) {
+    ASSERT(h->docId % 6 == 0);
+    count++;
+  }
+  ii->Free(ii);
+
+  // every 6th id is in both indexes
+  ASSERT_EQUAL(20000 / 6, count);
+  ASSERT_EQUAL(count, root->numHits);
+  ASSERT(root->numReads > count);
+  ASSERT(!root->isReader);
+  // the intersection stops when the shorter index ends
+  ASSERT_EQUAL(w->size, root->children[0]->numBlocks);
+  for (int i = 0; i < 2; i++) {
+    QueryProfileNode *n = root->children[i];
+    ASSERT(n->isReader);
+    ASSERT(n->isReader);
+    ASSERT(n->numReads + n->numSkips > 0);
+    ASSERT(n->numDecoded >= n->numHits);
+    ASSERT(n->numDecoded <= 10000);
+    ASSERT(n->numBlocks > 1 && n->numBlocks <= idxs[i]->size);
+    ASSERT(n->time <= root->time);
+  }
+
+  QueryProfile_Free(p);
+  InvertedIndex_Free(w);
+  InvertedIndex_Free(w2);
+  RETURN_TEST_SUCCESS;
+}
+
 int testBuffer() {
   // TEST_START();
 
@@ -409,12 +601,12 @@ int testBuffer() {
 
   ASSERT(l == strlen(x) + 1);
   ASSERT(Buffer_Offset(w.buf) == l);
-  ASSERT_EQUAL(Buffer_Capacity(w.buf), 14);
+  ASSERT_EQUAL(Buffer_Capacity(w.buf), 16);
 
   l = WriteVarint(1337654, &w);
   ASSERT(l == 3);
   ASSERT_EQUAL(Buffer_Offset(w.buf), 15);
-  ASSERT_EQUAL(Buffer_Capacity(w.buf), 17);
+  ASSERT_EQUAL(Buffer_Capacity(w.buf), 16);
 
   Buffer_Truncate(w.buf, 0);
 
@@ -438,6 +630,67 @@ int testBuffer() {
   Buffer_Free(w.buf);
   free(w.buf);
 
+  ASSERT_EQUAL(8, Buffer_SizeClass(1));
+  ASSERT_EQUAL(16, Buffer_SizeClass(9));
+  ASSERT_EQUAL(48, Buffer_SizeClass(33));
+  ASSERT_EQUAL(80, Buffer_SizeClass(65));
+  ASSERT_EQUAL(128, Buffer_SizeClass(128));
+  ASSERT_EQUAL(160, Buffer_SizeClass(129));
+  ASSERT_EQUAL(1280, Buffer_SizeClass(1025));
+
+  // writing byte by byte grows through size classes, by at least a quarter every time
+  Buffer b;
+  Buffer_Init(&b, 8);
+  w = NewBufferWriter(&b);
+  int grows = 0;
+  size_t cap = b.cap;
+  for (int i = 0; i < 100000; i++) {
+    char c = i;
+    Buffer_Write(&w, &c, 1);
+    if (b.cap != cap) {
+      ASSERT_EQUAL(b.cap, Buffer_SizeClass(b.cap));
+      ASSERT(b.cap >= cap + cap / 4);
+      cap = b.cap;
+      grows++;
+    }
+  }
+  ASSERT(grows < 50);
+  Buffer_Free(&b);
+
+  return 0;
+}
+
+int testBlockSeal() {
+  InvertedIndex *idx = createIndex(1050, 1);
+  ASSERT_EQUAL(11, idx->size);
+
+  // full blocks are sealed when they fill up, only the last one has slack
+  size_t size = 0, cap = 0;
+  for (uint32_t i = 0; i < idx->size - 1; i++) {
+    ASSERT_EQUAL(idx->blocks[i].data->offset, idx->blocks[i].data->cap);
+  }
+  InvertedIndex_MemStats(idx, &size, &cap);
+  Buffer *last = idx->blocks[idx->size - 1].data;
+  ASSERT_EQUAL(cap - size, last->cap - last->offset);
+
+  size_t freed = InvertedIndex_Seal(idx);
+  ASSERT_EQUAL(cap - size, freed);
+  ASSERT_EQUAL(last->offset, last->cap);
+
+  // the sealed index still reads and writes
+  ForwardIndexEntry e = {.docId = 1051, .fieldMask = 1, .freq = 1, .docScore = 1};
+  e.vw = NewVarintVectorWriter(8);
+  InvertedIndex_WriteEntry(idx, &e);
+  VVW_Free(e.vw);
+  IndexReader *ir = NewIndexReader(idx, NULL, RS_FIELDMASK_ALL, INDEX_DEFAULT_FLAGS, NULL, 1);
+  RSIndexResult *h = NULL;
+  t_docId expected = 1;
+  while (IR_Read(ir, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(expected++, h->docId);
+  }
+  ASSERT_EQUAL(1052, expected);
+  IR_Free(ir);
+  InvertedIndex_Free(idx);
   return 0;
 }
 
@@ -464,7 +717,7 @@ int testTokenize() {
   const char *expected[] = {"hello", "world", "wazz", "up", "שלום"};
   ctx.expected = (char **)expected;
 
-  tokenize(txt, 1, 1, &ctx, tokenFunc, NULL, 0, DefaultStopWordList());
+  tokenize(txt, 1, 1, &ctx, tokenFunc, NULL, 0, DefaultStopWordList(), NULL);
   ASSERT(ctx.num == 5);
 
   free(txt);
@@ -472,17 +725,176 @@ int testTokenize() {
   return 0;
 }
 
-// int testForwardIndex() {
+int testTokenizeSeparators() {
+  // only spaces and commas split, dashes and dots are kept in the tokens
+  TokenizerCharTable *tbl = NewTokenizerCharTable(" ,");
+  char *txt = strdup("Foo-Bar,  x.Y\tZ ,, שלום-World");
+  tokenContext ctx = {0};
+  const char *expected[] = {"foo-bar", "x.yz", "שלום-world"};
+  ctx.expected = (char **)expected;
+
+  tokenize(txt, 1, 1, &ctx, tokenFunc, NULL, 0, DefaultStopWordList(), tbl);
+  ASSERT_EQUAL(3, ctx.num);
+
+  free(txt);
+  free(tbl);
+  return 0;
+}
+
+static int countTokenFunc(void *ctx, Token t) {
+  ++*(size_t *)ctx;
+  return 0;
+}
+
+/* Tokenize the titles corpus over and over and report the tokenizer's throughput */
+void benchmarkTokenize() {
+  FILE *fp = fopen("./titles.csv", "r");
+  assert(fp != NULL);
+
+  Buffer *corpus = NewBuffer(1024 * 1024);
+  BufferWriter bw = NewBufferWriter(corpus);
+  char *line = NULL;
+  size_t len = 0;
+  ssize_t read;
+  while ((read = getline(&line, &len, fp)) != -1) {
+    Buffer_Write(&bw, line, read);
+  }
+  fclose(fp);
+  free(line);
+
+  int N = 200;
+  size_t total = corpus->offset;
+  char *txt = malloc(total + 1);
+  size_t numTokens = 0;
+
+  TimeSample ts;
+  TimeSampler_Start(&ts);
+  for (int i = 0; i < N; i++) {
+    // the tokenizer works in place, so each round works on a fresh copy
+    memcpy(txt, corpus->data, total);
+    txt[total] = '\0';
+    tokenize(txt, 1, 1, &numTokens, countTokenFunc, NULL, 0, DefaultStopWordList(), NULL);
+  }
+  TimeSampler_End(&ts);
+
+  printf("Tokenized %zd tokens in %.02fMB of titles: %.02fMB/sec\n", numTokens,
+         (double)(total * N) / 0x100000,
+         (double)(total * N) / 0x100000 / TimeSampler_DurationSec(&ts));
+
+  free(txt);
+  Buffer_Free(corpus);
+  free(corpus);
+}
+
+/* Check slop and phrase conditions on a long document, where the terms appear many times but
+ * only form a phrase at the very end, and time the checks */
+void benchmarkPhraseMatch() {
+  int numTerms = 3, numOffsets = 2000;
+  VarintVectorWriter *vws[numTerms];
+  RSIndexResult *res = NewIntersectResult(numTerms);
+  for (int i = 0; i < numTerms; i++) {
+    vws[i] = NewVarintVectorWriter(numOffsets);
+    // the terms are scattered across the document, but never close enough to each other to match
+    srand(i);
+    int n = 0;
+    for (int o = 0; o < numOffsets; o++) {
+      n += 1 + rand() % 3;
+      VVW_Write(vws[i], n * 10 + (numTerms - i) * 3);
+    }
+    VVW_Write(vws[i], numOffsets * 40 + i);
+    RSIndexResult *tr = NewTokenRecord(NULL);
+    tr->docId = 1;
+    tr->term.offsets = (RSOffsetVector){.data = vws[i]->bw.buf->data, .len = vws[i]->bw.buf->offset};
+    AggregateResult_AddChild(res, tr);
+  }
+
+  struct {
+    const char *name;
+    int maxSlop, inOrder;
+  } checks[] = {{"exact phrase", 0, 1}, {"in order slop 1", 1, 1}, {"unordered slop 1", 1, 0}};
+  int N = 2000;
+  for (int c = 0; c < sizeof(checks) / sizeof(checks[0]); c++) {
+    TimeSample ts;
+    TimeSampler_Start(&ts);
+    for (int i = 0; i < N; i++) {
+      assert(IndexResult_IsWithinRange(res, checks[c].maxSlop, checks[c].inOrder));
+    }
+    TimeSampler_End(&ts);
+    // printf("Phrase match (%s) on %d offsets per term: %.0f checks/sec\n", checks[c].name,
+    //        numOffsets, (double)N / TimeSampler_DurationSec(&ts));
+  }
+
+  for (int i = 0; i < numTerms; i++) {
+    IndexResult_Free(res->agg.children[i]);
+    VVW_Free(vws[i]);
+  }
+  IndexResult_Free(res);
+}
+
+static ForwardIndexEntry *findEntry(ForwardIndex *idx, const char *term) {
+  ForwardIndexIterator it = ForwardIndex_Iterate(idx);
+  ForwardIndexEntry *e;
+  while ((e = ForwardIndexIterator_Next(&it))) {
+    if (e->len == strlen(term) && !strncmp(e->term, term, e->len)) return e;
+  }
+  return NULL;
+}
 
-//   Document doc = NewDocument(NULL, 1, 1, "english");
-//   doc.docId = 1;
-//   doc.fields[0] = N
-//   ForwardIndex *idx = NewForwardIndex(doc);
-//   char *txt = strdup("Hello? world...  hello hello ? __WAZZ@UP? שלום");
-//   tokenize(txt, 1, 1, idx, forwardIndexTokenFunc);
+int testForwardIndex() {
+  Document doc = NewDocument(NULL, 1, 0, "english", NULL, 0);
+  doc.docId = 1;
+  ForwardIndex *idx = NewForwardIndex(doc);
+
+  // reuse the same index for a few documents, some with enough terms to grow everything. The ones
+  // after them must not see the terms they left behind
+  int roundTerms[] = {0, 0, 1000, 0, 5000, 0};
+  for (int round = 0; round < 6; round++) {
+    doc.docId = round + 1;
+    idx = ForwardIndex_Reuse(idx, doc);
+    // only the index of the largest document is too big to keep
+    ASSERT(idx->entriesCap <= FWIDX_MAX_KEPT_ENTRIES);
+    char *txt = strdup("Hello? world...  hello hello ? WAZZ@UP? שלום");
+    tokenize(txt, 1, 1, idx, forwardIndexTokenFunc, idx->stemmer, 0, DefaultStopWordList(), NULL);
+    free(txt);
+
+    int numTerms = roundTerms[round];
+    char buf[32];
+    for (int i = 0; i < numTerms; i++) {
+      sprintf(buf, "term%d", i);
+      Token t = {.s = buf, .len = strlen(buf), .pos = 100 + i, .score = 1, .fieldId = 1};
+      forwardIndexTokenFunc(idx, t);
+    }
 
-//   return 0;
-// }
+    ASSERT_EQUAL(5 + numTerms, idx->numEntries);
+    ForwardIndexEntry *e = findEntry(idx, "hello");
+    ASSERT(e != NULL);
+    ASSERT_EQUAL(3, e->freq);
+    ASSERT_EQUAL(round + 1, e->docId);
+    ASSERT_EQUAL(3, e->vw->nmemb);
+
+    // the offsets are delta encoded positions 2, 4, 5
+    BufferReader br = NewBufferReader(e->vw->bw.buf);
+    ASSERT_EQUAL(2, ReadVarint(&br));
+    ASSERT_EQUAL(2, ReadVarint(&br));
+    ASSERT_EQUAL(1, ReadVarint(&br));
+    ASSERT(BufferReader_AtEnd(&br));
+
+    for (int i = 0; i < numTerms; i += 97) {
+      sprintf(buf, "term%d", i);
+      e = findEntry(idx, buf);
+      ASSERT(e != NULL);
+      ASSERT_EQUAL(1, e->freq);
+      ASSERT_EQUAL(1, e->vw->nmemb);
+      BufferReader br = NewBufferReader(e->vw->bw.buf);
+      ASSERT_EQUAL(100 + i, ReadVarint(&br));
+    }
+    ASSERT(NULL == findEntry(idx, "term"));
+  }
+
+  ForwardIndexFree(idx);
+  free(doc.fields);
+  return 0;
+}
 
 int testIndexSpec() {
 
@@ -626,6 +1038,98 @@ int testIndexFlags() {
   return 0;
 }
 
+/* Parse a schema of n text fields named f0, f1... The fields from ownFrom on have their own
+ * postings */
+static IndexSpec *parseTextFields(int n, int ownFrom, char **err) {
+  const char **args = calloc(1 + 3 * n, sizeof(char *));
+  char **names = calloc(n, sizeof(char *));
+  int argc = 0;
+  args[argc++] = "SCHEMA";
+  for (int i = 0; i < n; i++) {
+    names[i] = malloc(8);
+    sprintf(names[i], "f%d", i);
+    args[argc++] = names[i];
+    args[argc++] = "TEXT";
+    if (i >= ownFrom) args[argc++] = "OWNPOSTINGS";
+  }
+  IndexSpec *sp = IndexSpec_Parse("idx", args, argc, err);
+  for (int i = 0; i < n; i++) free(names[i]);
+  free(names);
+  free(args);
+  return sp;
+}
+
+int testWideFieldMask() {
+  // a mask of all ones survives the varint encoding
+  Buffer *b = NewBuffer(32);
+  BufferWriter bw = NewBufferWriter(b);
+  WriteVarintFieldMask(RS_FIELDMASK_ALL, &bw);
+  WriteVarintFieldMask((t_fieldMask)1 << (SPEC_MAX_FIELDS - 1), &bw);
+  BufferReader br = NewBufferReader(b);
+  ASSERT(ReadVarintFieldMask(&br) == RS_FIELDMASK_ALL);
+  ASSERT(ReadVarintFieldMask(&br) == (t_fieldMask)1 << (SPEC_MAX_FIELDS - 1));
+  Buffer_Free(b);
+  free(b);
+
+  // the masks of the shared postings are wide once their text fields don't fit in 32 bits
+  char *err = NULL;
+  IndexSpec *sp = parseTextFields(32, 32, &err);
+  ASSERT(sp != NULL);
+  ASSERT(!(sp->flags & Index_WideSchema));
+  IndexSpec_Free(sp);
+
+  sp = parseTextFields(SPEC_MAX_FIELDS, SPEC_MAX_FIELDS, &err);
+  ASSERT(sp != NULL);
+  ASSERT(sp->flags & Index_WideSchema);
+  ASSERT(IndexSpec_GetFieldBit(sp, "f63", 3) == (t_fieldMask)1 << 63);
+  ASSERT(sp->fields[SPEC_MAX_FIELDS - 1].id == (t_fieldMask)1 << (SPEC_MAX_FIELDS - 1));
+  IndexSpec_Free(sp);
+
+  // the fields with their own postings don't store masks, so they don't count
+  sp = parseTextFields(40, 32, &err);
+  ASSERT(sp != NULL);
+  ASSERT(!(sp->flags & Index_WideSchema));
+  ASSERT_EQUAL(1, sp->fields[39].ownPostings);
+  ASSERT(sp->fields[39].dict != NULL);
+  IndexSpec_Free(sp);
+
+  ASSERT(parseTextFields(SPEC_MAX_FIELDS + 1, SPEC_MAX_FIELDS, &err) == NULL);
+  ASSERT_STRING_EQ("Too many fields", err);
+
+  // a record with a narrow mask takes as much space in the wide encoding, and the high bits of a
+  // wide mask are filtered on like the low ones
+  ForwardIndexEntry h = {.docId = 1234, .fieldMask = 0x01, .freq = 1, .docScore = 100};
+  h.vw = NewVarintVectorWriter(8);
+  for (int n = 0; n < 10; n++) {
+    VVW_Write(h.vw, n);
+  }
+  VVW_Truncate(h.vw);
+  InvertedIndex *w = NewInvertedIndex(INDEX_DEFAULT_FLAGS | Index_WideSchema, 1);
+  ASSERT_EQUAL(16, InvertedIndex_WriteEntry(w, &h));
+  const int N = 1000;
+  for (int i = 1; i <= N; i++) {
+    h.docId = 1234 + i;
+    h.fieldMask = (t_fieldMask)1 << (i % SPEC_MAX_FIELDS);
+    InvertedIndex_WriteEntry(w, &h);
+  }
+  t_fieldMask high = (t_fieldMask)1 << (SPEC_MAX_FIELDS - 1);
+  IndexReader *ir = NewIndexReader(w, NULL, high, w->flags, NULL, 0);
+  RSIndexResult *res;
+  int n = 0;
+  while (IR_Read(ir, &res) != INDEXREAD_EOF) {
+    ASSERT(res->fieldMask == high);
+    ASSERT_EQUAL(1, res->freq);
+    ASSERT_EQUAL(10, res->offsetsSz);
+    ASSERT_EQUAL(SPEC_MAX_FIELDS - 1, ((res->docId - 1234) % SPEC_MAX_FIELDS));
+    n++;
+  }
+  ASSERT_EQUAL(N / SPEC_MAX_FIELDS, n);
+  IR_Free(ir);
+  InvertedIndex_Free(w);
+  VVW_Free(h.vw);
+  return 0;
+}
+
 int testDocTable() {
 
   char buf[16];
@@ -679,6 +1183,698 @@ int testDocTable() {
   return 0;
 }
 
+int testCompact() {
+  char buf[16];
+  DocTable dt = NewDocTable(10);
+  int N = 3000;
+  for (int i = 0; i < N; i++) {
+    int n = sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, buf, (double)i, Document_DefaultFlags, buf, n);
+  }
+  // nothing deleted - nothing to compact
+  ASSERT(NULL == DocTable_Compact(&dt));
+
+  // delete every odd document
+  for (int i = 1; i < N; i += 2) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT_EQUAL(1, DocTable_Delete(&dt, buf));
+  }
+
+  InvertedIndex *idx = createIndex(N, 1);
+  t_docId *idMap = DocTable_Compact(&dt);
+  ASSERT(idMap != NULL);
+  ASSERT_EQUAL(N / 2, dt.maxDocId);
+  ASSERT_EQUAL(N / 2 + 1, dt.size);
+
+  for (int i = 0; i < N; i += 2) {
+    t_docId id = i / 2 + 1;
+    ASSERT_EQUAL(id, idMap[i + 1]);
+    ASSERT_EQUAL(0, idMap[i + 2]);
+
+    sprintf(buf, "doc_%d", i);
+    ASSERT_STRING_EQ(buf, DocTable_GetKey(&dt, id));
+    ASSERT_EQUAL(id, DocIdMap_Get(&dt.dim, buf));
+    RSDocumentMetadata *dmd = DocTable_Get(&dt, id);
+    ASSERT_EQUAL(i, (int)dmd->score);
+    ASSERT(!strncmp(dmd->payload->data, buf, dmd->payload->len));
+  }
+
+  size_t removed = InvertedIndex_Remap(idx, idMap, N);
+  ASSERT_EQUAL(N / 2, removed);
+  ASSERT_EQUAL(N / 2, idx->numDocs);
+  ASSERT_EQUAL(N / 2, idx->lastId);
+
+  IndexReader *ir = NewIndexReader(idx, NULL, RS_FIELDMASK_ALL, INDEX_DEFAULT_FLAGS, NULL, 1);
+  RSIndexResult *h = NULL;
+  t_docId expected = 1;
+  while (IR_Read(ir, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(expected, h->docId);
+    expected++;
+  }
+  ASSERT_EQUAL(N / 2 + 1, expected);
+
+  IR_Free(ir);
+  InvertedIndex_Free(idx);
+  free(idMap);
+  DocTable_Free(&dt);
+  return 0;
+}
+
+static void fillDocTable(DocTable *dt, int num) {
+  char buf[32];
+  for (int i = 0; i < num; i++) {
+    int n = sprintf(buf, "doc:%d", i);
+    DocTable_Put(dt, buf, 1.0, Document_DefaultFlags, buf, n);
+  }
+}
+
+/* Fill a DocTable with N documents and report the memory the table holds */
+void benchmarkDocTable() {
+  const int N = 10000000;
+  DocTable dt = NewDocTable(1000);
+  TIME_SAMPLE_RUN(fillDocTable(&dt, N));
+  size_t metaSize = dt.numPages * DOCTABLE_PAGE_SIZE * sizeof(RSDocumentMetadata);
+  size_t arenaSize = arena_memusage(dt.arena);
+  size_t keymapSize = TrieMap_MemUsage(dt.dim.tm);
+  printf("Memory for %d docs: metadata %zdMB, keys+payloads %zdMB, key map %zdMB (%.1f bytes/doc)\n",
+         N, metaSize / 0x100000, arenaSize / 0x100000, keymapSize / 0x100000,
+         (double)(metaSize + arenaSize + keymapSize) / N);
+  DocTable_Free(&dt);
+}
+
+int testTermDict() {
+  const int N = 100000;
+  TermDict *d = NewTermDict(0);
+  ASSERT(TermDict_Random(d) == NULL);
+  char buf[32];
+  for (int i = 0; i < N; i++) {
+    int n = sprintf(buf, "term%d", i);
+    ASSERT(TermDict_Get(d, buf, n) == NULL);
+    InvertedIndex *idx = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
+    ASSERT_EQUAL(1, TermDict_Add(d, buf, n, idx));
+    ASSERT(TermDict_Get(d, buf, n) == idx);
+  }
+  ASSERT_EQUAL(N, d->numEntries);
+
+  // adding an existing term leaves the dictionary as it is
+  InvertedIndex *idx = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
+  ASSERT_EQUAL(0, TermDict_Add(d, "term42", 6, idx));
+  ASSERT(TermDict_Get(d, "term42", 6) != idx);
+  InvertedIndex_Free(idx);
+  ASSERT_EQUAL(N, d->numEntries);
+
+  // prefixes of existing terms are different terms
+  ASSERT(TermDict_Get(d, "term", 4) == NULL);
+  ASSERT(TermDict_Get(d, "term4", 5) != TermDict_Get(d, "term42", 6));
+  for (int i = 0; i < N; i++) {
+    int n = sprintf(buf, "term%d", i);
+    ASSERT(TermDict_Get(d, buf, n) == d->entries[i].idx);
+    ASSERT_EQUAL(n, d->entries[i].len);
+    ASSERT_STRING_EQ(buf, d->entries[i].term);
+  }
+
+  for (int i = 0; i < 100; i++) {
+    TermDictEntry *e = TermDict_Random(d);
+    ASSERT(e != NULL);
+    ASSERT(TermDict_Get(d, e->term, e->len) == e->idx);
+  }
+
+  // size_t memsize = TermDict_MemUsage(d);
+  // printf("Term dictionary: %d terms in %zdKB (%.1f bytes/term)\n", N, memsize / 1024,
+  //        (double)memsize / N);
+  TermDict_Free(d);
+  return 0;
+}
+
+/* Index a term of a document through the term dictionary, recording it in the GC */
+static void gcIndexTerm(TermDict *td, IndexGC *gc, const char *term, t_docId docId) {
+  TermDictEntry *e = TermDict_Open(td, term, strlen(term), INDEX_DEFAULT_FLAGS);
+  ForwardIndexEntry h = {.docId = docId, .fieldMask = 1, .freq = 1, .docScore = 1};
+  h.vw = NewVarintVectorWriter(8);
+  VVW_Write(h.vw, 1);
+  InvertedIndex_WriteEntry(e->idx, &h);
+  VVW_Free(h.vw);
+  IndexGC_AddDocTerm(gc, 0, e - td->entries);
+}
+
+int testIndexGC() {
+  const int N = 1000;
+  char buf[16];
+  DocTable dt = NewDocTable(10);
+  TermDict *td = NewTermDict(0);
+  IndexGC *gc = NewIndexGC();
+
+  // "all" is in every document, "even" in every other one
+  for (int i = 0; i < N; i++) {
+    sprintf(buf, "doc_%d", i);
+    t_docId id = DocTable_Put(&dt, buf, 1.0, Document_DefaultFlags, NULL, 0);
+    gcIndexTerm(td, gc, "all", id);
+    if (id % 2 == 0) gcIndexTerm(td, gc, "even", id);
+    IndexGC_EndDoc(gc, id);
+  }
+  InvertedIndex *all = TermDict_Get(td, "all", 3);
+  InvertedIndex *even = TermDict_Get(td, "even", 4);
+  ASSERT_EQUAL(N, all->numDocs);
+  ASSERT_EQUAL(N / 2, even->numDocs);
+
+  // delete the documents of the first block of "all", and one of the last block
+  for (t_docId id = 1; id <= 100; id++) {
+    ASSERT_EQUAL(1, DocTable_Delete(&dt, DocTable_GetKey(&dt, id)));
+    size_t expected = (id & 1) ? 1 : 2;
+    ASSERT_EQUAL(expected, IndexGC_MarkDeleted(gc, &td, 1, id));
+  }
+  ASSERT_EQUAL(1, DocTable_Delete(&dt, DocTable_GetKey(&dt, N - 1)));
+  ASSERT_EQUAL(1, IndexGC_MarkDeleted(gc, &td, 1, N - 1));
+  // a document's records are only marked once
+  ASSERT_EQUAL(0, IndexGC_MarkDeleted(gc, &td, 1, 1));
+
+  ASSERT_EQUAL(101, all->numDeleted);
+  ASSERT_EQUAL(100, all->blocks[0].numDeleted);
+  ASSERT_EQUAL(1, all->blocks[all->size - 1].numDeleted);
+  ASSERT_EQUAL(50, even->numDeleted);
+  IndexGCStats st = IndexGC_Stats(gc, &td, 1);
+  ASSERT_EQUAL(2, st.dirtyTerms);
+  ASSERT_EQUAL(151, st.deletedRecords);
+
+  // the dirtiest block of the dirtiest term is repaired first
+  IndexGCRepair rep;
+  size_t size = 0, cap = 0;
+  InvertedIndex_MemStats(all, &size, &cap);
+  TermDictEntry *e = IndexGC_RepairNext(gc, &td, 1, &dt, 1, &rep);
+  ASSERT(e != NULL && e->idx == all);
+  ASSERT_EQUAL(0, rep.dict);
+  ASSERT_EQUAL(100, rep.removed);
+  ASSERT_EQUAL(size, rep.size);
+  ASSERT_EQUAL(cap, rep.cap);
+  ASSERT_EQUAL(N - 100, all->numDocs);
+  ASSERT_EQUAL(1, all->numDeleted);
+
+  e = IndexGC_RepairNext(gc, &td, 1, &dt, 10, &rep);
+  ASSERT(e != NULL && e->idx == even);
+  ASSERT_EQUAL(50, rep.removed);
+  ASSERT_EQUAL(N / 2 - 50, even->numDocs);
+
+  e = IndexGC_RepairNext(gc, &td, 1, &dt, 10, &rep);
+  ASSERT(e != NULL && e->idx == all);
+  ASSERT_EQUAL(1, rep.removed);
+  ASSERT_EQUAL(N - 101, all->numDocs);
+
+  // nothing is left to repair
+  ASSERT(NULL == IndexGC_RepairNext(gc, &td, 1, &dt, 10, &rep));
+  ASSERT_EQUAL(0, rep.removed);
+  st = IndexGC_Stats(gc, &td, 1);
+  ASSERT_EQUAL(0, st.dirtyTerms);
+  ASSERT_EQUAL(0, st.deletedRecords);
+
+  IndexReader *ir = NewIndexReader(all, NULL, RS_FIELDMASK_ALL, INDEX_DEFAULT_FLAGS, NULL, 1);
+  RSIndexResult *h = NULL;
+  t_docId expected = 101;
+  while (IR_Read(ir, &h) != INDEXREAD_EOF) {
+    if (expected == N - 1) expected++;
+    ASSERT_EQUAL(expected, h->docId);
+    expected++;
+  }
+  ASSERT_EQUAL(N + 1, expected);
+  IR_Free(ir);
+
+  IndexGC_Free(gc);
+  TermDict_Free(td);
+  DocTable_Free(&dt);
+  return 0;
+}
+
+/* The term lists of deleted documents are reclaimed, instead of piling up in the arena */
+int testIndexGCReclaim() {
+  const int N = 100000;
+  TermDict *td = NewTermDict(0);
+  IndexGC *gc = NewIndexGC();
+  TermDictEntry *e = TermDict_Open(td, "all", 3, INDEX_DEFAULT_FLAGS);
+  for (t_docId id = 1; id <= N; id++) {
+    InvertedIndex_WriteRecord(e->idx, id, 1, 1, &(RSOffsetVector){.data = "\x01", .len = 1});
+    IndexGC_AddDocTerm(gc, 0, 0);
+    IndexGC_EndDoc(gc, id);
+  }
+  size_t full = IndexGC_MemUsage(gc);
+
+  // delete all but the last 1000 documents
+  for (t_docId id = 1; id <= N - 1000; id++) {
+    ASSERT_EQUAL(1, IndexGC_MarkDeleted(gc, &td, 1, id));
+  }
+  size_t left = IndexGC_MemUsage(gc);
+  ASSERT(left - N * sizeof(char *) < (full - N * sizeof(char *)) / 2);
+
+  // the lists that are left were moved intact
+  for (t_docId id = N - 999; id <= N; id++) {
+    ASSERT_EQUAL(1, IndexGC_MarkDeleted(gc, &td, 1, id));
+  }
+  ASSERT_EQUAL(N, e->idx->numDeleted);
+
+  IndexGC_Free(gc);
+  TermDict_Free(td);
+  return 0;
+}
+
+/* Deleting a document marks its records in the dictionaries of tag fields and of text fields with
+ * their own postings too */
+int testIndexGCFieldDicts() {
+  char *err = NULL;
+  const char *args[] = {"SCHEMA", "title", "text", "body", "text", "OWNPOSTINGS", "tags", "tag"};
+  IndexSpec *sp = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(const char *), &err);
+  ASSERT(sp != NULL);
+  FieldSpec *body = IndexSpec_GetField(sp, "body", 4);
+  FieldSpec *tags = IndexSpec_GetField(sp, "tags", 4);
+  ASSERT(body->dict != NULL && tags->dict != NULL);
+  TermDict *dicts[SPEC_MAX_DICTS];
+  ASSERT_EQUAL(4, IndexSpec_Dicts(sp, dicts));
+  ASSERT(dicts[0] == sp->termDict && dicts[1] == NULL);
+  ASSERT(dicts[IndexSpec_FieldDictNum(sp, body)] == body->dict);
+  ASSERT(dicts[IndexSpec_FieldDictNum(sp, tags)] == tags->dict);
+
+  const int N = 100;
+  char key[16];
+  for (int i = 0; i < N; i++) {
+    sprintf(key, "doc_%d", i);
+    t_docId id = DocTable_Put(sp->docs, key, 1.0, Document_DefaultFlags, NULL, 0);
+    TermDictEntry *e = TermDict_Open(body->dict, "hello", 5, IndexSpec_FieldPostingsFlags(sp));
+    InvertedIndex_WriteRecord(e->idx, id, 1, 1, &(RSOffsetVector){.data = "\x01", .len = 1});
+    IndexGC_AddDocTerm(sp->gc, IndexSpec_FieldDictNum(sp, body), e - body->dict->entries);
+    TagIndex_Index(tags, id % 2 ? "red" : "red,blue", id, sp->gc, IndexSpec_FieldDictNum(sp, tags));
+    IndexGC_EndDoc(sp->gc, id);
+  }
+
+  // delete the even documents
+  for (t_docId id = 2; id <= N; id += 2) {
+    ASSERT_EQUAL(1, DocTable_Delete(sp->docs, DocTable_GetKey(sp->docs, id)));
+    ASSERT_EQUAL(3, IndexGC_MarkDeleted(sp->gc, dicts, 4, id));
+  }
+  InvertedIndex *hello = TermDict_Get(body->dict, "hello", 5);
+  InvertedIndex *red = TermDict_Get(tags->dict, "red", 3);
+  InvertedIndex *blue = TermDict_Get(tags->dict, "blue", 4);
+  ASSERT_EQUAL(N / 2, hello->numDeleted);
+  ASSERT_EQUAL(N / 2, red->numDeleted);
+  ASSERT_EQUAL(N / 2, blue->numDeleted);
+  IndexGCStats st = IndexGC_Stats(sp->gc, dicts, 4);
+  ASSERT_EQUAL(3, st.dirtyTerms);
+  ASSERT_EQUAL(3 * N / 2, st.deletedRecords);
+
+  // the dirty terms are found in their dictionaries
+  uint32_t dict = 0;
+  TermDictEntry *e = IndexGC_NextDirty(sp->gc, dicts, 4, &dict);
+  ASSERT(e != NULL && dicts[dict]->entries <= e &&
+         e < dicts[dict]->entries + dicts[dict]->numEntries);
+  // and repaired from there
+  size_t removed = 0;
+  IndexGCRepair rep;
+  while ((e = IndexGC_RepairNext(sp->gc, dicts, 4, sp->docs, 10, &rep))) {
+    ASSERT(dicts[rep.dict]->entries <= e &&
+           e < dicts[rep.dict]->entries + dicts[rep.dict]->numEntries);
+    removed += rep.removed;
+  }
+  ASSERT_EQUAL(3 * N / 2, removed);
+  ASSERT_EQUAL(N / 2, hello->numDocs);
+  ASSERT_EQUAL(N / 2, red->numDocs);
+  ASSERT_EQUAL(0, blue->numDocs);
+  ASSERT_EQUAL(0, IndexGC_Stats(sp->gc, dicts, 4).deletedRecords);
+
+  // and after a restore, from their deleted record counters
+  hello->numDeleted = 1;
+  IndexGC_FindDirty(sp->gc, dicts, 4);
+  ASSERT(IndexGC_NextDirty(sp->gc, dicts, 4, &dict)->idx == hello);
+  ASSERT_EQUAL(IndexSpec_FieldDictNum(sp, body), dict);
+
+  IndexSpec_Free(sp);
+  return 0;
+}
+
+/* The live indexes are walked round-robin, and freed indexes leave the walk */
+int testLiveIndexes() {
+  char *err = NULL;
+  const char *args[] = {"SCHEMA", "title", "text"};
+  IndexSpec *a = IndexSpec_Parse("a", args, 3, &err);
+  IndexSpec *b = IndexSpec_Parse("b", args, 3, &err);
+  ASSERT(a != NULL && b != NULL);
+
+  // both are returned within a walk over all the indexes, which ends where it started
+  IndexSpec *first = IndexSpec_NextLive(), *sp = first;
+  int seenA = 0, seenB = 0;
+  do {
+    seenA += sp == a;
+    seenB += sp == b;
+  } while ((sp = IndexSpec_NextLive()) != first);
+  ASSERT_EQUAL(1, seenA);
+  ASSERT_EQUAL(1, seenB);
+
+  IndexSpec_Free(a);
+  first = IndexSpec_NextLive();
+  sp = first;
+  seenB = 0;
+  do {
+    ASSERT(sp != a);
+    seenB += sp == b;
+  } while ((sp = IndexSpec_NextLive()) != first);
+  ASSERT_EQUAL(1, seenB);
+
+  IndexSpec_Free(b);
+  return 0;
+}
+
+#define INGEST_VOCAB 20000
+#define INGEST_TERMS_PER_DOC 40
+
+/* Index documents of INGEST_TERMS_PER_DOC unique terms each, drawn from a skewed vocabulary, with
+ * ingestion groups of groupSize documents */
+static IndexSpec *ingestDocs(const int *docTerms, int numDocs, int groupSize, char **vocab,
+                             VarintVectorWriter **vws, TimeSample *ts) {
+  IndexSpec *sp = NewIndexSpec("idx", 0);
+  IngestGroup_SetLimits(groupSize, 1000000);
+
+  TimeSampler_Start(ts);
+  for (int d = 0; d < numDocs; d++) {
+    for (int k = 0; k < INGEST_TERMS_PER_DOC; k++) {
+      const char *term = vocab[docTerms[d * INGEST_TERMS_PER_DOC + k]];
+      TermDictEntry *te = TermDict_Open(sp->termDict, term, strlen(term), sp->flags);
+      ForwardIndexEntry ent = {
+          .docId = d + 1, .fieldMask = 1 << (k % 4), .freq = 1 + k % 3, .vw = vws[k % 4]};
+      IngestGroup_AddRecord(sp->ingest, te - sp->termDict->entries, &ent);
+    }
+    if (IngestGroup_EndDoc(sp->ingest, d + 1)) {
+      IngestGroup_Commit(sp->ingest, sp);
+      TimeSampler_Tick(ts);
+    }
+  }
+  if (IngestGroup_Commit(sp->ingest, sp)) {
+    TimeSampler_Tick(ts);
+  }
+  TimeSampler_End(ts);
+  return sp;
+}
+
+int testIngestGroup() {
+  const int N = 20000;
+  char **vocab = malloc(INGEST_VOCAB * sizeof(char *));
+  for (int i = 0; i < INGEST_VOCAB; i++) {
+    vocab[i] = malloc(16);
+    sprintf(vocab[i], "term%d", i);
+  }
+  VarintVectorWriter *vws[4];
+  for (int i = 0; i < 4; i++) {
+    vws[i] = NewVarintVectorWriter(8);
+    for (int j = 0; j <= i; j++) VVW_Write(vws[i], 1 + j * 3);
+  }
+
+  // the k-th term of a document is one of the terms that are k modulo the terms per document, with
+  // the low ones much more likely
+  int *docTerms = malloc(N * INGEST_TERMS_PER_DOC * sizeof(int));
+  srand(1337);
+  const int perSlot = INGEST_VOCAB / INGEST_TERMS_PER_DOC;
+  for (int i = 0; i < N * INGEST_TERMS_PER_DOC; i++) {
+    int r = rand() % perSlot;
+    docTerms[i] = (r * r / perSlot) * INGEST_TERMS_PER_DOC + i % INGEST_TERMS_PER_DOC;
+  }
+
+  TimeSample ts;
+  IndexSpec *single = ingestDocs(docTerms, N, 1, vocab, vws, &ts);
+  ASSERT_EQUAL(N, ts.num);
+  // printf("Ingested %d docs one at a time: %.0f docs/sec\n", N,
+  //        N / ((double)TimeSampler_DurationNS(&ts) / 1000000000));
+
+  int groupSizes[] = {8, 64, 256, 1024};
+  for (int g = 0; g < sizeof(groupSizes) / sizeof(groupSizes[0]); g++) {
+    IndexSpec *sp = ingestDocs(docTerms, N, groupSizes[g], vocab, vws, &ts);
+    ASSERT_EQUAL((N + groupSizes[g] - 1) / groupSizes[g], ts.num);
+    // printf("Ingested %d docs in groups of %d: %.0f docs/sec, %.3fms per commit\n", N,
+    //        groupSizes[g], N / ((double)TimeSampler_DurationNS(&ts) / 1000000000),
+    //        (double)TimeSampler_DurationNS(&ts) / ts.num / 1000000);
+
+    // grouping changes nothing in the written indexes or the stats
+    ASSERT_EQUAL(single->termDict->numEntries, sp->termDict->numEntries);
+    ASSERT_EQUAL(single->stats.numRecords, sp->stats.numRecords);
+    ASSERT_EQUAL(single->stats.invertedSize, sp->stats.invertedSize);
+    ASSERT_EQUAL(single->stats.invertedCap, sp->stats.invertedCap);
+    ASSERT_EQUAL(single->stats.offsetVecsSize, sp->stats.offsetVecsSize);
+    ASSERT_EQUAL(single->stats.offsetVecRecords, sp->stats.offsetVecRecords);
+    for (uint32_t i = 0; i < sp->termDict->numEntries; i++) {
+      TermDictEntry *e = &sp->termDict->entries[i];
+      InvertedIndex *a = TermDict_Get(single->termDict, e->term, e->len), *b = e->idx;
+      ASSERT(a != NULL);
+      ASSERT_EQUAL(a->numDocs, b->numDocs);
+      ASSERT_EQUAL(a->lastId, b->lastId);
+      ASSERT_EQUAL(a->size, b->size);
+      for (uint32_t j = 0; j < a->size; j++) {
+        ASSERT_EQUAL(a->blocks[j].firstId, b->blocks[j].firstId);
+        ASSERT_EQUAL(a->blocks[j].data->offset, b->blocks[j].data->offset);
+        ASSERT(!memcmp(a->blocks[j].data->data, b->blocks[j].data->data, a->blocks[j].data->offset));
+      }
+    }
+    IndexSpec_Free(sp);
+  }
+  IndexSpec_Free(single);
+  IngestGroup_SetLimits(INGEST_DEFAULT_GROUP_SIZE, INGEST_DEFAULT_GROUP_LATENCY_MS);
+
+  for (int i = 0; i < INGEST_VOCAB; i++) free(vocab[i]);
+  free(vocab);
+  for (int i = 0; i < 4; i++) VVW_Free(vws[i]);
+  free(docTerms);
+  return 0;
+}
+
+int testTagIndex() {
+  char *err = NULL;
+  const char *args[] = {"SCHEMA", "title", "text", "tags",       "tag",
+                        "genre",  "tag",   "SEPARATORS", ";"};
+  IndexSpec *sp = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(const char *), &err);
+  ASSERT(sp != NULL);
+  FieldSpec *tags = IndexSpec_GetField(sp, "tags", 4);
+  FieldSpec *genre = IndexSpec_GetField(sp, "genre", 5);
+  ASSERT_EQUAL(F_TAG, tags->type);
+  ASSERT_EQUAL(0x02, tags->id);
+  ASSERT_EQUAL(0x04, genre->id);
+  ASSERT_STRING_EQ(",", tags->separators);
+  ASSERT_STRING_EQ(";", genre->separators);
+
+  char buf[] = "  Sci-Fi,  New   York! ";
+  size_t n = TagIndex_Normalize(buf, strlen(buf));
+  buf[n] = 0;
+  ASSERT_STRING_EQ("sci fi new york", buf);
+
+  const int N = 10000;
+  for (t_docId id = 1; id <= N; id++) {
+    // repeated tags are indexed once per document
+    TagIndex_Index(tags, id % 2 ? "Red" : "red, blue ,RED", id, NULL, 0);
+    TagIndex_Index(genre, "Sci-Fi; drama,comedy", id, NULL, 0);
+  }
+  ASSERT_EQUAL(2, tags->dict->numEntries);
+  ASSERT_EQUAL(2, genre->dict->numEntries);
+  InvertedIndex *red = TermDict_Get(tags->dict, "red", 3);
+  ASSERT_EQUAL(N, red->numDocs);
+  ASSERT_EQUAL(N / 2, TermDict_Get(tags->dict, "blue", 4)->numDocs);
+  ASSERT(TermDict_Get(genre->dict, "sci fi", 6) != NULL);
+  ASSERT(TermDict_Get(genre->dict, "drama comedy", 12) != NULL);
+
+  // a record is a docId delta, a single byte for consecutive documents
+  size_t size = 0, cap = 0;
+  InvertedIndex_MemStats(red, &size, &cap);
+  // printf("Tag index: %d records in %zd bytes (%.2f bytes/record)\n", N, size, (double)size / N);
+  ASSERT(size <= N + red->size);
+
+  RSToken tok = {.str = "blue", .len = 4};
+  IndexIterator *it = TagIndex_OpenReader(tags, sp->docs, &tok);
+  ASSERT(it != NULL);
+  RSIndexResult *h;
+  t_docId expected = 2;
+  while (it->Read(it->ctx, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(expected, h->docId);
+    ASSERT_EQUAL(1, h->freq);
+    ASSERT_EQUAL(RS_FIELDMASK_ALL, h->fieldMask);
+    expected += 2;
+  }
+  ASSERT_EQUAL(N + 2, expected);
+  it->Free(it);
+  tok = (RSToken){.str = "green", .len = 5};
+  ASSERT(TagIndex_OpenReader(tags, sp->docs, &tok) == NULL);
+
+  // tags are restored into tag fields only
+  Buffer dump;
+  Buffer_Init(&dump, 0);
+  InvertedIndex_Dump(red, &dump);
+  ASSERT_EQUAL(0, IndexSpec_RestoreFieldTerm(sp, "title", "red", 3, dump.data, dump.offset));
+  ASSERT_EQUAL(0, IndexSpec_RestoreFieldTerm(sp, "tags", "red", 3, dump.data, dump.offset));
+  ASSERT_EQUAL(1, IndexSpec_RestoreFieldTerm(sp, "genre", "red", 3, dump.data, dump.offset));
+  ASSERT_EQUAL(N, TermDict_Get(genre->dict, "red", 3)->numDocs);
+  Buffer_Free(&dump);
+
+  // compaction drops the odd documents and moves the even ones down
+  t_docId *idMap = calloc(N + 1, sizeof(t_docId));
+  for (t_docId id = 2; id <= N; id += 2) {
+    idMap[id] = id / 2;
+  }
+  ASSERT_EQUAL(N / 2, FieldSpec_RemapDict(tags, idMap, N));
+  ASSERT_EQUAL(N / 2, red->numDocs);
+  ASSERT_EQUAL(N / 2, red->lastId);
+  free(idMap);
+
+  IndexSpec_Free(sp);
+  return 0;
+}
+
+int testAofDump() {
+  // inverted indexes, with their deleted record counters
+  InvertedIndex *idx = createIndex(1000, 2);
+  idx->blocks[3].numDeleted = 7;
+  idx->numDeleted = 7;
+  Buffer buf;
+  Buffer_Init(&buf, 0);
+  size_t len = InvertedIndex_Dump(idx, &buf);
+  ASSERT_EQUAL(len, buf.offset);
+
+  InvertedIndex *restored = InvertedIndex_Restore(buf.data, len, idx->flags, INDEX_STORAGE_MASK);
+  ASSERT(restored != NULL);
+  ASSERT_EQUAL(idx->flags, restored->flags);
+  ASSERT_EQUAL(idx->lastId, restored->lastId);
+  ASSERT_EQUAL(idx->numDocs, restored->numDocs);
+  ASSERT_EQUAL(idx->size, restored->size);
+  ASSERT_EQUAL(7, restored->numDeleted);
+  ASSERT_EQUAL(7, restored->blocks[3].numDeleted);
+  ASSERT_EQUAL(0, restored->blocks[2].numDeleted);
+  for (uint32_t i = 0; i < idx->size; i++) {
+    ASSERT_EQUAL(idx->blocks[i].data->offset, restored->blocks[i].data->offset);
+    ASSERT(!memcmp(idx->blocks[i].data->data, restored->blocks[i].data->data,
+                   idx->blocks[i].data->offset));
+  }
+  InvertedIndex_Free(restored);
+
+  // malformed data is rejected: a truncated stream, records of another encoding, blocks past the
+  // last docId of the index, a truncated varint and a block count the data can't hold
+  ASSERT(NULL == InvertedIndex_Restore(buf.data, len - 1, idx->flags, INDEX_STORAGE_MASK));
+  ASSERT(NULL == InvertedIndex_Restore(buf.data, len, Index_DocIdsOnly, INDEX_STORAGE_MASK));
+  buf.offset = 0;
+  idx->lastId--;
+  len = InvertedIndex_Dump(idx, &buf);
+  ASSERT(NULL == InvertedIndex_Restore(buf.data, len, idx->flags, INDEX_STORAGE_MASK));
+  ASSERT(NULL == InvertedIndex_Restore("\x07\x80", 2, idx->flags, INDEX_STORAGE_MASK));
+  buf.offset = 0;
+  BufferWriter bw = NewBufferWriter(&buf);
+  WriteVarint(idx->flags, &bw);
+  WriteVarint(0, &bw);
+  WriteVarint(0, &bw);
+  WriteVarint(0x7fffffff, &bw);
+  WriteVarint(1, &bw);
+  ASSERT(NULL == InvertedIndex_Restore(buf.data, buf.offset, idx->flags, INDEX_STORAGE_MASK));
+  InvertedIndex_Free(idx);
+
+  // the doc table, in two chunks
+  char key[16];
+  DocTable dt = NewDocTable(10);
+  for (int i = 0; i < 30; i++) {
+    int n = sprintf(key, "doc%d", i);
+    t_docId id = DocTable_Put(&dt, key, i, Document_DefaultFlags, i % 2 ? key : NULL, n);
+    DocTable_Get(&dt, id)->len = i;
+  }
+  RSSortingVector *v = NewSortingVector(2);
+  RSSortingVector_Put(v, 0, "hello", RS_SORTABLE_STR);
+  double num = 3.5;
+  RSSortingVector_Put(v, 1, &num, RS_SORTABLE_NUM);
+  DocTable_SetSortingVector(&dt, 5, v);
+  DocTable_Delete(&dt, "doc3");
+
+  DocTable dt2 = NewDocTable(10);
+  buf.offset = 0;
+  DocTable_Dump(&dt, 1, 20, &buf);
+  ASSERT_EQUAL(20, DocTable_Restore(&dt2, buf.data, buf.offset));
+  // chunks must be restored in order
+  ASSERT_EQUAL(-1, DocTable_Restore(&dt2, buf.data, buf.offset));
+  buf.offset = 0;
+  DocTable_Dump(&dt, 21, 40, &buf);
+  ASSERT_EQUAL(10, DocTable_Restore(&dt2, buf.data, buf.offset));
+
+  ASSERT_EQUAL(dt.size, dt2.size);
+  ASSERT_EQUAL(dt.maxDocId, dt2.maxDocId);
+  ASSERT_EQUAL(dt.memsize, dt2.memsize);
+  for (t_docId id = 1; id <= dt.maxDocId; id++) {
+    RSDocumentMetadata *a = DocTable_Get(&dt, id), *b = DocTable_Get(&dt2, id);
+    ASSERT_STRING_EQ(a->key, b->key);
+    ASSERT_EQUAL(a->score, b->score);
+    ASSERT_EQUAL(a->len, b->len);
+    ASSERT((a->flags & Document_Deleted) == (b->flags & Document_Deleted));
+    ASSERT_EQUAL(DocTable_GetId(&dt, a->key), DocTable_GetId(&dt2, b->key));
+    ASSERT((a->payload == NULL) == (b->payload == NULL));
+    if (a->payload) {
+      ASSERT_EQUAL(a->payload->len, b->payload->len);
+      ASSERT(!memcmp(a->payload->data, b->payload->data, a->payload->len));
+    }
+  }
+  ASSERT_EQUAL(0, DocTable_GetId(&dt2, "doc3"));
+  RSSortingVector *v2 = DocTable_Get(&dt2, 5)->sortVector;
+  ASSERT(v2 != NULL);
+  ASSERT_STRING_EQ("hello", v2->values[0].str);
+  ASSERT_EQUAL(3.5, v2->values[1].num);
+
+  // the document terms of the GC, in the term dictionary and in a field dictionary
+  IndexGC *gc = NewIndexGC(), *gc2 = NewIndexGC();
+  for (t_docId id = 1; id <= 10; id += 3) {
+    IndexGC_AddDocTerm(gc, 0, id);
+    IndexGC_AddDocTerm(gc, 0, id * 100);
+    if (id > 1) IndexGC_AddDocTerm(gc, 2, id);
+    IndexGC_EndDoc(gc, id);
+  }
+  for (int fields = 0; fields <= 1; fields++) {
+    buf.offset = 0;
+    IndexGC_Dump(gc, 1, 10, fields, &buf);
+    ASSERT(IndexGC_Restore(gc2, buf.data, buf.offset, fields));
+    ASSERT(!IndexGC_Restore(gc2, buf.data, buf.offset - 1, fields));
+  }
+  for (t_docId id = 1; id <= 10; id++) {
+    ASSERT((gc->docTerms[id] == NULL) == (gc2->docTerms[id] == NULL));
+    if (gc->docTerms[id]) {
+      uint32_t l[2];
+      memcpy(l, gc->docTerms[id], sizeof(l));
+      ASSERT_EQUAL(id > 1, l[1] > 0);
+      ASSERT(!memcmp(gc->docTerms[id], gc2->docTerms[id], sizeof(l) + l[0] + l[1]));
+    }
+  }
+
+  IndexGC_Free(gc);
+  IndexGC_Free(gc2);
+  DocTable_Free(&dt);
+  DocTable_Free(&dt2);
+  Buffer_Free(&buf);
+  return 0;
+}
+
+static int numLazyFreed = 0;
+
+static void countingFree(void *p) {
+  __sync_fetch_and_add(&numLazyFreed, 1);
+  free(p);
+}
+
+int testLazyFree() {
+  // cheap values are freed right away
+  LazyFree(countingFree, malloc(8), 1);
+  ASSERT_EQUAL(1, numLazyFreed);
+  ASSERT_EQUAL(0, LazyFree_Pending());
+
+  for (int i = 0; i < 10; i++) {
+    LazyFree(countingFree, malloc(8), LAZYFREE_THRESHOLD + 1);
+  }
+  LazyFree_Wait();
+  ASSERT_EQUAL(11, numLazyFreed);
+  ASSERT_EQUAL(0, LazyFree_Pending());
+
+  // a big index is freed in the background
+  IndexSpec *sp = NewIndexSpec("idx", 0);
+  char buf[32];
+  for (int i = 0; i < 1000; i++) {
+    int n = sprintf(buf, "term%d", i);
+    TermDict_Add(sp->termDict, buf, n, NewInvertedIndex(sp->flags, 1));
+    sp->stats.numTerms++;
+  }
+  IndexSpec_LazyFree(sp);
+  LazyFree_Wait();
+  ASSERT_EQUAL(0, LazyFree_Pending());
+  return 0;
+}
+
 int testSortable() {
   RSSortingTable *tbl = NewSortingTable(3);
   ASSERT_EQUAL(3, tbl->len);
@@ -748,17 +1944,38 @@ TEST_MAIN({
 
   TESTFUNC(testVarint);
   TESTFUNC(testDistance);
+  TESTFUNC(testDistanceLongOffsets);
   TESTFUNC(testIndexReadWrite);
 
   TESTFUNC(testReadIterator);
+  TESTFUNC(testBlockStream);
   TESTFUNC(testIntersection);
   TESTFUNC(testNot);
   TESTFUNC(testUnion);
+  TESTFUNC(testProfileIterator);
 
   TESTFUNC(testBuffer);
+  TESTFUNC(testBlockSeal);
   TESTFUNC(testTokenize);
+  TESTFUNC(testTokenizeSeparators);
+  TESTFUNC(testForwardIndex);
   TESTFUNC(testIndexSpec);
   TESTFUNC(testIndexFlags);
+  TESTFUNC(testWideFieldMask);
   TESTFUNC(testDocTable);
+  TESTFUNC(testCompact);
+  TESTFUNC(testTermDict);
+  TESTFUNC(testIndexGC);
+  TESTFUNC(testIndexGCReclaim);
+  TESTFUNC(testIndexGCFieldDicts);
+  TESTFUNC(testLiveIndexes);
+  TESTFUNC(testIngestGroup);
+  TESTFUNC(testTagIndex);
+  TESTFUNC(testAofDump);
+  TESTFUNC(testLazyFree);
   TESTFUNC(testSortable);
+
+  // benchmarkDocTable();
+  // benchmarkTokenize();
+  benchmarkPhraseMatch();
 });
\ No newline at end of file
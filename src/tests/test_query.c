@@ -6,6 +6,12 @@
 #include "../extension.h"
 #include "../ext/default.h"
 #include "../rmutil/alloc.h"
+#include "../cursor.h"
+#include "../query_cache.h"
+#include "../result_cache.h"
+#include "../term_dict.h"
+#include "../inverted_index.h"
+#include "../tag_index.h"
 #include <stdio.h>
 
 void QueryNode_Print(Query *q, QueryNode *qs, int depth);
@@ -234,6 +240,324 @@ int testFieldSpec() {
 
   return 0;
 }
+/* Parse and expand a query on an index with tag fields */
+static Query *parseTagQuery(RedisSearchCtx *ctx, const char *qt) {
+  char *err = NULL;
+  Query *q = NewQuery(ctx, qt, strlen(qt), 0, 1, RS_FIELDMASK_ALL, 0, "en", DefaultStopWordList(),
+                      NULL, -1, 0, NULL, (RSPayload){}, NULL);
+  QueryNode *n = Query_Parse(q, &err);
+  if (err || !n) {
+    Query_Free(q);
+    return NULL;
+  }
+  Query_Expand(q);
+  printf("%s ====> ", qt);
+  QueryNode_Print(q, q->root, 0);
+  return q;
+}
+
+int testTagQuery() {
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text", "tags", "tag", "body", "text"};
+  RedisSearchCtx ctx = {.spec = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(char *), &err)};
+  ASSERT(ctx.spec != NULL);
+  ASSERT_EQUAL(0x02, IndexSpec_GetFieldBit(ctx.spec, "tags", 4));
+
+  // tags are looked up as they are, without stemming
+  Query *q = parseTagQuery(&ctx, "@tags:Running");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_TAG, q->root->type);
+  ASSERT_EQUAL(0x02, q->root->fieldMask);
+  ASSERT_STRING_EQ("running", q->root->tag.str);
+  Query_Free(q);
+
+  // a tag set is a union of tags
+  q = parseTagQuery(&ctx, "hello @tags:(red|blue)");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_PHRASE, q->root->type);
+  QueryNode *un = q->root->pn.children[1];
+  ASSERT_EQUAL(QN_UNION, un->type);
+  ASSERT_EQUAL(2, un->un.numChildren);
+  ASSERT_EQUAL(QN_TAG, un->un.children[0]->type);
+  ASSERT_STRING_EQ("red", un->un.children[0]->tag.str);
+  ASSERT_EQUAL(QN_TAG, un->un.children[1]->type);
+  ASSERT_STRING_EQ("blue", un->un.children[1]->tag.str);
+  // terms without a modifier still search the text fields
+  ASSERT(q->root->pn.children[0]->type != QN_TAG);
+  Query_Free(q);
+
+  // an exact phrase is a single multi-word tag, and so is a tag with punctuation
+  q = parseTagQuery(&ctx, "@tags:\"New York\"");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_TAG, q->root->type);
+  ASSERT_STRING_EQ("new york", q->root->tag.str);
+  Query_Free(q);
+
+  // a text field and a tag field are searched for the term and the tag
+  q = parseTagQuery(&ctx, "@title|tags:red");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_UNION, q->root->type);
+  ASSERT_EQUAL(2, q->root->un.numChildren);
+  ASSERT_EQUAL(0x01, q->root->un.children[0]->fieldMask);
+  ASSERT(q->root->un.children[0]->type != QN_TAG);
+  ASSERT_EQUAL(QN_TAG, q->root->un.children[1]->type);
+  ASSERT_EQUAL(0x02, q->root->un.children[1]->fieldMask);
+  Query_Free(q);
+
+  q = parseTagQuery(&ctx, "hello -@tags:red");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_NOT, q->root->pn.children[1]->type);
+  ASSERT_EQUAL(QN_TAG, q->root->pn.children[1]->not.child->type);
+  Query_Free(q);
+
+  // tags keep their stopwords, while the text fields still drop them
+  q = parseTagQuery(&ctx, "@tags:\"in stock\"");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_TAG, q->root->type);
+  ASSERT_STRING_EQ("in stock", q->root->tag.str);
+  Query_Free(q);
+
+  q = parseTagQuery(&ctx, "@tags:a");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_TAG, q->root->type);
+  ASSERT_STRING_EQ("a", q->root->tag.str);
+  Query_Free(q);
+
+  q = parseTagQuery(&ctx, "@tags:(the|who)");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_UNION, q->root->type);
+  ASSERT_EQUAL(2, q->root->un.numChildren);
+  ASSERT_STRING_EQ("the", q->root->un.children[0]->tag.str);
+  ASSERT_STRING_EQ("who", q->root->un.children[1]->tag.str);
+  Query_Free(q);
+
+  q = parseTagQuery(&ctx, "@title|tags:the");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_TAG, q->root->type);
+  ASSERT_EQUAL(0x02, q->root->fieldMask);
+  Query_Free(q);
+
+  q = parseTagQuery(&ctx, "the hello @title:(an apple)");
+  ASSERT(q != NULL);
+  ASSERT_EQUAL(QN_PHRASE, q->root->type);
+  ASSERT_EQUAL(2, q->root->pn.numChildren);
+  ASSERT_EQUAL(QN_PHRASE, q->root->pn.children[1]->type);
+  ASSERT_EQUAL(1, q->root->pn.children[1]->pn.numChildren);
+  Query_Free(q);
+
+  // nothing is left of a query of stopwords
+  ASSERT(parseTagQuery(&ctx, "the -a") == NULL);
+
+  IndexSpec_Free(ctx.spec);
+  return 0;
+}
+
+/* Evaluate a query, returning its root iterator */
+static IndexIterator *evalQuery(RedisSearchCtx *ctx, const char *qt, Query **q) {
+  char *err = NULL;
+  *q = NewQuery(ctx, qt, strlen(qt), 0, 10, RS_FIELDMASK_ALL, 1, "en", DefaultStopWordList(), NULL,
+                -1, 0, NULL, (RSPayload){}, NULL);
+  (*q)->docTable = ctx->spec->docs;
+  if (!Query_Parse(*q, &err)) {
+    return NULL;
+  }
+  return Query_EvalNode(*q, (*q)->root);
+}
+
+static int countResults(IndexIterator *it) {
+  RSIndexResult *h;
+  int n = 0;
+  while (it->Read(it->ctx, &h) != INDEXREAD_EOF) n++;
+  return n;
+}
+
+int testOwnPostings() {
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text", "OWNPOSTINGS", "body", "text"};
+  RedisSearchCtx ctx = {.spec = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(char *), &err)};
+  ASSERT(ctx.spec != NULL);
+  FieldSpec *title = IndexSpec_GetField(ctx.spec, "title", 5);
+  ASSERT_EQUAL(1, title->ownPostings);
+
+  // every document has the term in the body, and every tenth one in the title too
+  const int N = 10000;
+  RSOffsetVector offsets = {.data = "\x01", .len = 1};
+  InvertedIndex *shared = TermDict_Open(ctx.spec->termDict, "hello", 5, ctx.spec->flags)->idx;
+  InvertedIndex *own =
+      TermDict_Open(title->dict, "hello", 5, IndexSpec_FieldPostingsFlags(ctx.spec))->idx;
+  for (t_docId id = 1; id <= N; id++) {
+    DocTable_Put(ctx.spec->docs, "doc", 1, 0, NULL, 0);
+    InvertedIndex_WriteRecord(shared, id, 0x02, 1, &offsets);
+    if (id % 10 == 0) InvertedIndex_WriteRecord(own, id, 0x01, 1, &offsets);
+  }
+
+  // a query on the field only decodes its own records
+  Query *q;
+  IndexIterator *it = evalQuery(&ctx, "@title:hello", &q);
+  ASSERT(it != NULL);
+  ASSERT_EQUAL(N / 10, countResults(it));
+  ASSERT_EQUAL(N / 10, ((IndexReader *)it->ctx)->numDecoded);
+  it->Free(it);
+  Query_Free(q);
+
+  // and a query on the other fields doesn't read them at all
+  it = evalQuery(&ctx, "@body:hello", &q);
+  ASSERT(it != NULL);
+  ASSERT_EQUAL(N, countResults(it));
+  ASSERT(((IndexReader *)it->ctx)->idx == shared);
+  it->Free(it);
+  Query_Free(q);
+
+  // a query on all the fields reads both
+  it = evalQuery(&ctx, "hello", &q);
+  ASSERT(it != NULL);
+  ASSERT_EQUAL(N, countResults(it));
+  it->Free(it);
+  Query_Free(q);
+
+  it = evalQuery(&ctx, "@title:world", &q);
+  ASSERT(it == NULL);
+  Query_Free(q);
+
+  IndexSpec_Free(ctx.spec);
+  return 0;
+}
+
+int testSharedDocTable() {
+  char *err = NULL;
+  static const char *textArgs[] = {"DOCTABLE", "products", "SCHEMA", "title", "text"};
+  static const char *tagArgs[] = {"DOCTABLE", "products", "SCHEMA", "color", "tag"};
+  RedisSearchCtx textCtx = {.spec = IndexSpec_Parse("idx_en", textArgs, 5, &err)};
+  RedisSearchCtx tagCtx = {.spec = IndexSpec_Parse("idx_attrs", tagArgs, 5, &err)};
+  ASSERT(textCtx.spec != NULL);
+  ASSERT(tagCtx.spec != NULL);
+  ASSERT_STRING_EQ("products", textCtx.spec->docTableName);
+  // the table is looked up when the index is loaded, there's none before
+  ASSERT(textCtx.spec->docs == NULL);
+
+  // the sort vectors are laid out by a single index
+  static const char *sortArgs[] = {"DOCTABLE", "products", "SCHEMA",
+                                   "price",    "numeric",  "sortable"};
+  ASSERT(IndexSpec_Parse("idx_sort", sortArgs, 6, &err) == NULL);
+  static const char *badArgs[] = {"DOCTABLE", "SCHEMA", "title", "text"};
+  ASSERT(IndexSpec_Parse("idx_bad", badArgs, 4, &err) == NULL);
+
+  DocTable dt = NewDocTable(100);
+  textCtx.spec->docs = tagCtx.spec->docs = &dt;
+
+  // every document has the term, and every third one is red
+  const int N = 3000;
+  RSOffsetVector offsets = {.data = "\x01", .len = 1};
+  InvertedIndex *idx = TermDict_Open(textCtx.spec->termDict, "hello", 5, textCtx.spec->flags)->idx;
+  FieldSpec *color = IndexSpec_GetField(tagCtx.spec, "color", 5);
+  for (t_docId id = 1; id <= N; id++) {
+    char key[16];
+    sprintf(key, "doc%d", (int)id);
+    ASSERT_EQUAL(id, DocTable_Put(&dt, key, 1, 0, NULL, 0));
+    InvertedIndex_WriteRecord(idx, id, 0x01, 1, &offsets);
+    if (id % 3 == 0) TagIndex_Index(color, "red", id, NULL, 0);
+  }
+
+  Query *q = NewQuery(&textCtx, "hello", 5, 0, 10, RS_FIELDMASK_ALL, 1, "en",
+                      DefaultStopWordList(), NULL, -1, 0, NULL, (RSPayload){}, NULL);
+  Query *other = NewQuery(&tagCtx, "@color:red", 10, 0, 10, RS_FIELDMASK_ALL, 1, "en",
+                          DefaultStopWordList(), NULL, -1, 0, NULL, (RSPayload){}, NULL);
+  q->docTable = other->docTable = &dt;
+  ASSERT(Query_Parse(q, &err) != NULL);
+  ASSERT(Query_Parse(other, &err) != NULL);
+  Query_SetIndexFilter(q, other);
+
+  const char *explain = Query_DumpExplain(q);
+  ASSERT(strstr(explain, "INDEX idx_attrs {") != NULL);
+  ASSERT(strstr(explain, "TAG{red}") != NULL);
+  free((char *)explain);
+
+  // the documents of the term in one index are intersected with the ones of the tag in the other
+  IndexIterator *it = Query_EvalNode(q, q->root);
+  ASSERT(it != NULL);
+  RSIndexResult *h;
+  int n = 0;
+  while (it->Read(it->ctx, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(0, (h->docId % 3));
+    n++;
+  }
+  ASSERT_EQUAL(N / 3, n);
+  it->Free(it);
+  Query_Free(q);
+  Query_Free(other);
+
+  // the indexes sharing the table are found by its name, so a deletion reaches all of them
+  size_t pos = 0;
+  ASSERT(IndexSpec_NextSharer("products", &pos) != NULL);
+  ASSERT(IndexSpec_NextSharer("products", &pos) != NULL);
+  ASSERT(IndexSpec_NextSharer("products", &pos) == NULL);
+  pos = 0;
+  ASSERT(IndexSpec_NextSharer("prices", &pos) == NULL);
+
+  // freeing the indexes leaves the shared table alone
+  IndexSpec_Free(textCtx.spec);
+  pos = 0;
+  ASSERT(IndexSpec_NextSharer("products", &pos) == tagCtx.spec);
+  ASSERT(IndexSpec_NextSharer("products", &pos) == NULL);
+  IndexSpec_Free(tagCtx.spec);
+  pos = 0;
+  ASSERT(IndexSpec_NextSharer("products", &pos) == NULL);
+  ASSERT_STRING_EQ("doc1", DocTable_GetKey(&dt, 1));
+  DocTable_Free(&dt);
+  return 0;
+}
+
+/* Execute a query of two terms over an index where every document has both, with TF-IDF and BM25,
+ * scoring the results one by one and in batches, and report how many results each way goes through
+ * per second. Unlike benchmarkScorers in test_extensions, this covers the whole path of a result -
+ * reading it, copying it into the batch, scoring it and offering it to the heap */
+void benchmarkQueryExecute() {
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text"};
+  RedisSearchCtx ctx = {.spec = IndexSpec_Parse("idx", args, 3, &err)};
+  DocTable *dt = ctx.spec->docs;
+
+  const int N = 200000;
+  RSOffsetVector offsets = {.data = "\x01", .len = 1};
+  InvertedIndex *hello = TermDict_Open(ctx.spec->termDict, "hello", 5, ctx.spec->flags)->idx;
+  InvertedIndex *world = TermDict_Open(ctx.spec->termDict, "world", 5, ctx.spec->flags)->idx;
+  for (t_docId id = 1; id <= N; id++) {
+    char key[16];
+    sprintf(key, "doc%d", (int)id);
+    DocTable_Put(dt, key, 1, 0, NULL, 0);
+    RSDocumentMetadata *dmd = DocTable_Get(dt, id);
+    dmd->maxFreq = 7;
+    dmd->len = 1 + id % 100;
+    InvertedIndex_WriteRecord(hello, id, 0x01, 1 + id % 7, &offsets);
+    InvertedIndex_WriteRecord(world, id, 0x01, 1 + id % 3, &offsets);
+  }
+  ctx.spec->stats.numDocuments = N;
+  ctx.spec->stats.totalDocsLen = 50 * N;
+
+  const char *scorers[] = {DEFAULT_SCORER_NAME, BM25_SCORER_NAME};
+  const int R = 10;
+  for (int s = 0; s < 2; s++) {
+    for (int batched = 0; batched < 2; batched++) {
+      Query *q = NewQuery(&ctx, "hello world", 11, 0, 10, RS_FIELDMASK_ALL, 1, "en",
+                          DefaultStopWordList(), NULL, -1, 0, scorers[s], (RSPayload){}, NULL);
+      q->docTable = dt;
+      Query_Parse(q, &err);
+      if (!batched) q->batchScorer = NULL;
+
+      TimeSample ts;
+      TimeSampler_Start(&ts);
+      for (int i = 0; i < R; i++) {
+        QueryResult_Free(Query_Execute(q));
+      }
+      TimeSampler_End(&ts);
+      printf("Executed a query over %d results with %s%s: %.02fM results/sec\n", N, scorers[s],
+             batched ? " in batches" : "", (double)N * R / 1000000 / TimeSampler_DurationSec(&ts));
+      Query_Free(q);
+    }
+  }
+  IndexSpec_Free(ctx.spec);
+}
+
 void benchmarkQueryParser() {
   char *qt = "(hello|world) \"another world\"";
   char *err = NULL;
@@ -243,12 +567,288 @@ void benchmarkQueryParser() {
   TIME_SAMPLE_RUN_LOOP(50000, { Query_Parse(q, &err); });
 }
 
+/* Parse a query through the cache, returning its explain string */
+static char *parseCached(RedisSearchCtx *ctx, const char *qt, const char *expander) {
+  char *err = NULL;
+  Query *q = NewQuery(ctx, qt, strlen(qt), 0, 10, RS_FIELDMASK_ALL, 0, "en", DefaultStopWordList(),
+                      expander, -1, 0, NULL, (RSPayload){}, NULL);
+  char *ret = NULL;
+  if (Query_ParseCached(q, &err)) {
+    ret = (char *)Query_DumpExplain(q);
+  }
+  free(err);
+  Query_Free(q);
+  return ret;
+}
+
+int testQueryCache() {
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text", "body", "text", "bar", "numeric"};
+  RedisSearchCtx ctx = {.spec = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(char *), &err)};
+  Extensions_Init();
+  ASSERT(Extension_Load("DEFAULT", DefaultExtensionInit) == REDISEARCH_OK);
+  QueryCache_Clear();
+  QueryCacheStats st0 = GetQueryCacheStats();
+
+  const char *qt = "@title:(hello|worlds) -foo @bar:[1 (5] \"running dogs\"";
+  char *miss = parseCached(&ctx, qt, NULL);
+  ASSERT(miss != NULL);
+  QueryCacheStats st = GetQueryCacheStats();
+  ASSERT_EQUAL(st0.misses + 1, st.misses);
+  ASSERT_EQUAL(1, st.entries);
+
+  // the same query with different spacing is a hit, and yields the same tree
+  char *hit = parseCached(&ctx, "  @title:(hello|worlds)   -foo\t@bar:[1 (5] \"running  dogs\" ", NULL);
+  st = GetQueryCacheStats();
+  ASSERT_EQUAL(st0.hits + 1, st.hits);
+  ASSERT_EQUAL(1, st.entries);
+  ASSERT_STRING_EQ(miss, hit);
+  free(hit);
+
+  // the cached tree is copied, so modifying a query's tree doesn't affect the next ones
+  Query *q = NewQuery(&ctx, qt, strlen(qt), 0, 10, RS_FIELDMASK_ALL, 0, "en", DefaultStopWordList(),
+                      NULL, -1, 0, NULL, (RSPayload){}, NULL);
+  ASSERT(Query_ParseCached(q, &err) != NULL);
+  Query_SetNumericFilter(q, NewNumericFilter(0, 10, 1, 1));
+  Query_Free(q);
+  hit = parseCached(&ctx, qt, NULL);
+  ASSERT_STRING_EQ(miss, hit);
+  free(hit);
+  free(miss);
+
+  // an unknown expander means no expansion, just like VERBATIM, and both differ from stemming
+  st0 = GetQueryCacheStats();
+  char *verbatim = parseCached(&ctx, qt, "nosuchexpander");
+  ASSERT(verbatim != NULL);
+  free(verbatim);
+  ASSERT_EQUAL(st0.misses + 1, GetQueryCacheStats().misses);
+  Query *vq = NewQuery(&ctx, qt, strlen(qt), 0, 10, RS_FIELDMASK_ALL, 1, "en",
+                       DefaultStopWordList(), NULL, -1, 0, NULL, (RSPayload){}, NULL);
+  ASSERT(Query_ParseCached(vq, &err) != NULL);
+  Query_Free(vq);
+  ASSERT_EQUAL(st0.hits + 1, GetQueryCacheStats().hits);
+  ASSERT_EQUAL(2, GetQueryCacheStats().entries);
+
+  // the cache is bounded
+  for (int i = 0; i < QUERY_CACHE_SIZE + 10; i++) {
+    char buf[32];
+    sprintf(buf, "foo%d bar", i);
+    free(parseCached(&ctx, buf, NULL));
+  }
+  ASSERT_EQUAL(QUERY_CACHE_SIZE, GetQueryCacheStats().entries);
+
+  // freeing the index drops its queries
+  IndexSpec_Free(ctx.spec);
+  ASSERT_EQUAL(0, GetQueryCacheStats().entries);
+  RETURN_TEST_SUCCESS;
+}
+
+/* Record a small search reply, as QueryResult_Serialize would */
+static void recordReply(ReplyRecorder *rr, long long total, const char *id) {
+  ReplyRecorder_Init(rr);
+  ReplyRecorder_Array(rr, NULL, REDISMODULE_POSTPONED_ARRAY_LEN);
+  ReplyRecorder_LongLong(rr, NULL, total);
+  ReplyRecorder_StringBuffer(rr, NULL, id, strlen(id));
+  ReplyRecorder_Double(rr, NULL, 0.5);
+  ReplyRecorder_Null(rr, NULL);
+  ReplyRecorder_SetArrayLength(rr, NULL, 4);
+}
+
+int testResultCache() {
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text"};
+  IndexSpec *sp = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(char *), &err);
+  ResultCache_Clear();
+  ResultCacheStats st0 = GetResultCacheStats();
+
+  RSSearchRequest req = {.rawQuery = "hello world", .qlen = 11, .num = 10, .slop = -1};
+  sds key = ResultCache_RequestKey(&req, sp);
+  ASSERT(key != NULL);
+
+  // requests that differ only in query spacing share a key, any other field sets them apart
+  RSSearchRequest spaced = req;
+  spaced.rawQuery = " hello   world";
+  spaced.qlen = strlen(spaced.rawQuery);
+  sds key2 = ResultCache_RequestKey(&spaced, sp);
+  ASSERT(sdslen(key) == sdslen(key2) && !memcmp(key, key2, sdslen(key)));
+  sdsfree(key2);
+  spaced.offset = 10;
+  key2 = ResultCache_RequestKey(&spaced, sp);
+  ASSERT(sdslen(key) != sdslen(key2) || memcmp(key, key2, sdslen(key)));
+  sdsfree(key2);
+
+  // cursors and profiles are not cached
+  spaced.flags |= Search_WithCursor;
+  ASSERT(ResultCache_RequestKey(&spaced, sp) == NULL);
+
+  ASSERT(ResultCache_Get(sp, key) == NULL);
+  ReplyRecorder rr;
+  recordReply(&rr, 1, "doc1");
+  size_t replyLen = Buffer_Offset(&rr.buf);
+  ResultCache_Put(sp, sp->generation, sdsdup(key), &rr);
+  ASSERT(rr.buf.data == NULL);
+  ASSERT_EQUAL(1, GetResultCacheStats().entries);
+
+  Buffer *reply = ResultCache_Get(sp, key);
+  ASSERT(reply != NULL);
+  ASSERT_EQUAL(replyLen, Buffer_Offset(reply));
+  ResultCacheStats st = GetResultCacheStats();
+  ASSERT_EQUAL(st0.hits + 1, st.hits);
+  ASSERT_EQUAL(st0.misses + 1, st.misses);
+
+  // a write to the index makes the entry stale, and it is dropped when looked up
+  sp->generation++;
+  ASSERT(ResultCache_Get(sp, key) == NULL);
+  ASSERT_EQUAL(0, GetResultCacheStats().entries);
+  ASSERT_EQUAL(0, GetResultCacheStats().memsize);
+
+  // a reply computed while the index was written to is not cached
+  recordReply(&rr, 1, "doc1");
+  ResultCache_Put(sp, sp->generation - 1, sdsdup(key), &rr);
+  ASSERT_EQUAL(0, GetResultCacheStats().entries);
+
+  // the cache is bounded by memory, evicting the least recently used replies
+  ResultCache_SetMaxMemory(64 * 1024);
+  for (int i = 0; i < 1000; i++) {
+    char buf[32];
+    sprintf(buf, "hello%d", i);
+    RSSearchRequest r = {.rawQuery = buf, .qlen = strlen(buf), .num = 10};
+    recordReply(&rr, i, buf);
+    ResultCache_Put(sp, sp->generation, ResultCache_RequestKey(&r, sp), &rr);
+  }
+  st = GetResultCacheStats();
+  ASSERT(st.memsize <= 64 * 1024);
+  ASSERT(st.entries > 0 && st.entries < 1000);
+
+  // a zero limit disables the cache
+  ResultCache_SetMaxMemory(0);
+  ASSERT_EQUAL(0, GetResultCacheStats().entries);
+  ASSERT(ResultCache_RequestKey(&req, sp) == NULL);
+  ResultCache_SetMaxMemory(RESULT_CACHE_DEFAULT_MAXMEM);
+
+  // freeing the index drops its replies
+  recordReply(&rr, 1, "doc1");
+  ResultCache_Put(sp, sp->generation, key, &rr);
+  ASSERT_EQUAL(1, GetResultCacheStats().entries);
+  IndexSpec_Free(sp);
+  ASSERT_EQUAL(0, GetResultCacheStats().entries);
+  RETURN_TEST_SUCCESS;
+}
+
+/* Create a cursor over n fake results */
+static Cursor *newTestCursor(RedisSearchCtx *sctx, size_t n, long long maxIdle) {
+  RSSearchRequest *req = calloc(1, sizeof(*req));
+  req->sctx = sctx;
+  req->num = 10;
+
+  QueryResult r = {.totalResults = n, .numResults = n, .results = calloc(n, sizeof(ResultEntry))};
+  for (size_t i = 0; i < n; i++) {
+    r.results[i] = (ResultEntry){.docId = i + 1, .score = n - i};
+  }
+  Cursor *c = Cursors_Create(req, &r, 0, maxIdle);
+  free(r.results);
+  return c;
+}
+
+int testCursors() {
+  RedisSearchCtx sctx = {.spec = NULL};
+  size_t budget = Cursors_Budget();
+  ASSERT_EQUAL(RS_CURSOR_MAX_RESULTS, budget);
+
+  Cursor *c = newTestCursor(&sctx, 100, RS_CURSOR_DEFAULT_MAXIDLE);
+  ASSERT(c->id > 0);
+  ASSERT(sctx.spec == c->spec);
+  ASSERT(c->req->sctx == NULL);
+  ASSERT_EQUAL(100, c->numResults);
+  ASSERT_EQUAL(0, c->pos);
+  for (size_t i = 0; i < 100; i++) {
+    ASSERT_EQUAL(i + 1, c->docIds[i]);
+    ASSERT_EQUAL(100 - i, c->scores[i]);
+  }
+  ASSERT_EQUAL(1, Cursors_Count());
+  ASSERT_EQUAL(100, Cursors_NumResults());
+  ASSERT_EQUAL(budget - 100, Cursors_Budget());
+
+  Cursor *c2 = newTestCursor(&sctx, 10, RS_CURSOR_DEFAULT_MAXIDLE);
+  ASSERT(c2->id != c->id);
+  ASSERT(c == Cursors_Find(c->id));
+  ASSERT(c2 == Cursors_Find(c2->id));
+  ASSERT(NULL == Cursors_Find(c->id + c2->id));
+
+  // a cursor with no idle time expires on the next access to the table
+  Cursor *expired = newTestCursor(&sctx, 5, 0);
+  uint64_t expiredId = expired->id;
+  ASSERT_EQUAL(3, Cursors_Count());
+  ASSERT(NULL == Cursors_Find(expiredId));
+  ASSERT_EQUAL(2, Cursors_Count());
+  ASSERT_EQUAL(110, Cursors_NumResults());
+
+  ASSERT_EQUAL(1, Cursors_Delete(c->id));
+  ASSERT_EQUAL(0, Cursors_Delete(c->id));
+  ASSERT_EQUAL(1, Cursors_Count());
+  ASSERT(c2 == Cursors_Find(c2->id));
+  ASSERT_EQUAL(1, Cursors_Delete(c2->id));
+  ASSERT_EQUAL(0, Cursors_Count());
+  ASSERT_EQUAL(0, Cursors_NumResults());
+  ASSERT_EQUAL(0, Cursors_GC());
+
+  // freeing an index releases its cursors, and only them
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text"};
+  RedisSearchCtx specCtx = {.spec = IndexSpec_Parse("idx", args, 3, &err)};
+  newTestCursor(&specCtx, 10, RS_CURSOR_DEFAULT_MAXIDLE);
+  newTestCursor(&specCtx, 10, RS_CURSOR_DEFAULT_MAXIDLE);
+  c = newTestCursor(&sctx, 10, RS_CURSOR_DEFAULT_MAXIDLE);
+  ASSERT_EQUAL(3, Cursors_Count());
+  IndexSpec_Free(specCtx.spec);
+  ASSERT_EQUAL(1, Cursors_Count());
+  ASSERT(c == Cursors_Find(c->id));
+  ASSERT_EQUAL(1, Cursors_PurgeIndex(NULL));
+  ASSERT_EQUAL(0, Cursors_NumResults());
+  RETURN_TEST_SUCCESS;
+}
+
+void benchmarkQueryCache() {
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text", "body", "text", "price", "numeric"};
+  RedisSearchCtx ctx = {.spec = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(char *), &err)};
+  const char *qt = "@title:(running|jumping) dogs -cats @price:[10 100] \"quick brown foxes\"";
+
+  int N = 100000;
+  for (int cached = 0; cached < 2; cached++) {
+    TimeSample ts;
+    TimeSampler_Start(&ts);
+    for (int i = 0; i < N; i++) {
+      Query *q = NewQuery(&ctx, qt, strlen(qt), 0, 10, RS_FIELDMASK_ALL, 0, "en",
+                          DefaultStopWordList(), NULL, -1, 0, NULL, (RSPayload){}, NULL);
+      if (cached) {
+        Query_ParseCached(q, &err);
+      } else if (Query_Parse(q, &err)) {
+        Query_Expand(q);
+      }
+      Query_Free(q);
+    }
+    TimeSampler_End(&ts);
+    printf("Parsed and expanded queries%s: %.0f queries/sec\n", cached ? " with the query cache" : "",
+           N / TimeSampler_DurationSec(&ts));
+  }
+  IndexSpec_Free(ctx.spec);
+}
+
 void RMUTil_InitAlloc();
 TEST_MAIN({
   RMUTil_InitAlloc();
   // LOGGING_INIT(L_INFO);
   TESTFUNC(testQueryParser);
   TESTFUNC(testFieldSpec);
+  TESTFUNC(testCursors);
+  TESTFUNC(testQueryCache);
+  TESTFUNC(testResultCache);
+  TESTFUNC(testTagQuery);
+  TESTFUNC(testOwnPostings);
+  TESTFUNC(testSharedDocTable);
   benchmarkQueryParser();
+  benchmarkQueryCache();
+  benchmarkQueryExecute();
 
 });
@@ -130,6 +130,126 @@ int testRangeIterator() {
   return 0;
 }
 
+int testRangeUpdate() {
+  NumericRangeTree *t = NewNumericRangeTree();
+  int N = 10000;
+  double *lookup = calloc(N + 1, sizeof(double));
+  for (t_docId docId = 1; docId <= N; docId++) {
+    lookup[docId] = (double)(1 + prng() % 1000);
+    NumericRangeTree_Add(t, docId, lookup[docId]);
+  }
+
+  // move every third document to a new value, and drop every seventh one
+  for (t_docId docId = 1; docId <= N; docId++) {
+    if (docId % 7 == 0) {
+      ASSERT_EQUAL(1, NumericRangeTree_Delete(t, docId));
+      lookup[docId] = -1;
+    } else if (docId % 3 == 0) {
+      lookup[docId] = (double)(1 + prng() % 1000);
+      NumericRangeTree_Update(t, docId, lookup[docId]);
+    }
+  }
+  ASSERT_EQUAL(N - N / 7, t->numEntries);
+  ASSERT_EQUAL(0, NumericRangeTree_Delete(t, 7));
+
+  NumericFilter *flt = NewNumericFilter(100, 500, 1, 1);
+  int count = 0;
+  for (t_docId docId = 1; docId <= N; docId++) {
+    if (NumericFilter_Match(flt, lookup[docId])) count++;
+  }
+
+  // the iterator must return every matching document once, in docId order
+  IndexIterator *it = NewNumericFilterIterator(t, flt);
+  RSIndexResult *res = NULL;
+  t_docId lastId = 0;
+  int xcount = 0;
+  while (it->Read(it->ctx, &res) != INDEXREAD_EOF) {
+    ASSERT(res->docId > lastId);
+    ASSERT(NumericFilter_Match(flt, lookup[res->docId]));
+    lastId = res->docId;
+    xcount++;
+  }
+  ASSERT_EQUAL(count, xcount);
+
+  it->Free(it);
+  free(lookup);
+  NumericRangeTree_Free(t);
+  return 0;
+}
+
+int testRangeLeaves() {
+  NumericRangeTree *t = NewNumericRangeTree();
+  int N = 50000;
+  for (t_docId docId = 1; docId <= N; docId++) {
+    NumericRangeTree_Add(t, docId, (double)(1 + prng() % 5000));
+  }
+
+  // the leaves hold every entry once, and are ordered by value without overlapping
+  Vector *v = NumericRangeTree_Leaves(t);
+  ASSERT(Vector_Size(v) > 1);
+  size_t total = 0;
+  double lastMax = -1;
+  for (int i = 0; i < Vector_Size(v); i++) {
+    NumericRange *l;
+    Vector_Get(v, i, &l);
+    double min = l->maxVal, max = l->minVal;
+    for (uint32_t j = 0; j < l->size; j++) {
+      ASSERT(l->entries[j].value >= l->minVal && l->entries[j].value <= l->maxVal);
+      min = _min(min, l->entries[j].value);
+      max = _max(max, l->entries[j].value);
+    }
+    ASSERT(min > lastMax);
+    lastMax = max;
+    total += l->size;
+  }
+  ASSERT_EQUAL(N, total);
+  Vector_Free(v);
+  NumericRangeTree_Free(t);
+  return 0;
+}
+
+int testRangeRestore() {
+  NumericRangeTree *t = NewNumericRangeTree();
+  int N = 20000;
+  for (t_docId docId = 1; docId <= N; docId++) {
+    NumericRangeTree_Add(t, docId, (double)(prng() % 1000) / 7.0);
+  }
+
+  size_t num;
+  NumericRangeEntry *entries = NumericRangeTree_Entries(t, &num);
+  ASSERT_EQUAL(N, num);
+  for (size_t i = 0; i < num; i++) {
+    ASSERT_EQUAL(i + 1, entries[i].docId);
+  }
+
+  // restore the entries in two chunks
+  NumericRangeTree *t2 = NewNumericRangeTree();
+  Buffer buf;
+  Buffer_Init(&buf, 0);
+  NumericRangeTree_DumpEntries(entries, N / 2, &buf);
+  ASSERT_EQUAL(N / 2, NumericRangeTree_Restore(t2, buf.data, buf.offset));
+  buf.offset = 0;
+  NumericRangeTree_DumpEntries(entries + N / 2, N - N / 2, &buf);
+  ASSERT_EQUAL(N - N / 2, NumericRangeTree_Restore(t2, buf.data, buf.offset));
+  ASSERT_EQUAL(-1, NumericRangeTree_Restore(t2, buf.data, buf.offset - 1));
+  ASSERT_EQUAL(N, t2->numEntries);
+
+  size_t num2;
+  NumericRangeEntry *entries2 = NumericRangeTree_Entries(t2, &num2);
+  ASSERT_EQUAL(N, num2);
+  for (size_t i = 0; i < num; i++) {
+    ASSERT_EQUAL(entries[i].docId, entries2[i].docId);
+    ASSERT_EQUAL(entries[i].value, entries2[i].value);
+  }
+
+  free(entries);
+  free(entries2);
+  Buffer_Free(&buf);
+  NumericRangeTree_Free(t);
+  NumericRangeTree_Free(t2);
+  return 0;
+}
+
 int benchmarkNumericRangeTree() {
   NumericRangeTree *t = NewNumericRangeTree();
   int count = 1;
@@ -167,5 +287,8 @@ TEST_MAIN({
 
   TESTFUNC(testNumericRangeTree);
   TESTFUNC(testRangeIterator);
+  TESTFUNC(testRangeUpdate);
+  TESTFUNC(testRangeLeaves);
+  TESTFUNC(testRangeRestore);
   benchmarkNumericRangeTree();
 });
@@ -2,7 +2,9 @@
 #include "../tokenize.h"
 #include "test_util.h"
 #include "../rmutil/alloc.h"
+#include "time_sample.h"
 #include <string.h>
+#include <stdio.h>
 
 int testStemmer() {
 
@@ -55,7 +57,7 @@ int testTokenize() {
   Stemmer *s = NewStemmer(SnowballStemmer, "en");
   ASSERT(s != NULL)
 
-  tokenize(txt, 1, 1, &ctx, tokenFunc, s, 0, DefaultStopWordList());
+  tokenize(txt, 1, 1, &ctx, tokenFunc, s, 0, DefaultStopWordList(), NULL);
   ASSERT(ctx.num == 9);
 
   free(txt);
@@ -63,8 +65,87 @@ int testTokenize() {
   return 0;
 }
 
+int testSharedStemmer() {
+  Stemmer *s = NewStemmer(SnowballStemmer, "english");
+  Stemmer *cs = GetSharedStemmer(SnowballStemmer, "english");
+  ASSERT(cs != NULL);
+  ASSERT(cs == GetSharedStemmer(SnowballStemmer, "ENGLISH"));
+  ASSERT(NULL == GetSharedStemmer(SnowballStemmer, "klingon"));
+
+  const char *words[] = {"arbitrary", "going", "world", "worlds", "hello", "going", "arbitrary"};
+  for (int n = 0; n < 2; n++) {
+    for (int i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+      size_t len = strlen(words[i]), sl, csl;
+      const char *stem = s->Stem(s->ctx, words[i], len, &sl);
+      const char *cstem = cs->Stem(cs->ctx, words[i], len, &csl);
+      if (sl == len && !strncmp(stem, words[i], len)) {
+        // unchanged words are not returned by the cache
+        ASSERT(cstem == NULL);
+      } else {
+        ASSERT(cstem != NULL);
+        ASSERT_EQUAL(sl, csl);
+        ASSERT(!strncmp(stem, cstem, sl));
+      }
+    }
+  }
+
+  StemCacheStats st = GetStemCacheStats();
+  ASSERT_EQUAL(5, st.entries);
+  ASSERT_EQUAL(5, st.misses);
+  ASSERT_EQUAL(9, st.hits);
+
+  s->Free(s);
+  return 0;
+}
+
+static int countTokenFunc(void *ctx, Token t) {
+  ++*(size_t *)ctx;
+  return 0;
+}
+
+static void benchmarkStemmerRun(const char *corpus, size_t len, Stemmer *s, const char *name) {
+  char *txt = malloc(len + 1);
+  size_t numTokens = 0;
+  int N = 50;
+
+  TimeSample ts;
+  TimeSampler_Start(&ts);
+  for (int i = 0; i < N; i++) {
+    memcpy(txt, corpus, len);
+    txt[len] = '\0';
+    tokenize(txt, 1, 1, &numTokens, countTokenFunc, s, 0, DefaultStopWordList(), NULL);
+  }
+  TimeSampler_End(&ts);
+  printf("Tokenized and stemmed titles with %s stemmer: %.02fMB/sec\n", name,
+         (double)(len * N) / 0x100000 / TimeSampler_DurationSec(&ts));
+  free(txt);
+}
+
+/* Compare indexing time tokenization of the titles corpus with and without the stem cache */
+void benchmarkStemmer() {
+  FILE *fp = fopen("./titles.csv", "r");
+  assert(fp != NULL);
+  char *corpus = malloc(1024 * 1024);
+  size_t len = fread(corpus, 1, 1024 * 1024 - 1, fp);
+  fclose(fp);
+
+  Stemmer *s = NewStemmer(SnowballStemmer, "english");
+  benchmarkStemmerRun(corpus, len, s, "snowball");
+  s->Free(s);
+
+  StemCacheStats before = GetStemCacheStats();
+  benchmarkStemmerRun(corpus, len, GetSharedStemmer(SnowballStemmer, "english"), "cached");
+  StemCacheStats after = GetStemCacheStats();
+  printf("Stem cache: %zd entries, %.02f%% hit rate\n", after.entries,
+         100.0 * (after.hits - before.hits) /
+             (double)(after.hits - before.hits + after.misses - before.misses));
+  free(corpus);
+}
+
 TEST_MAIN({
   RMUTil_InitAlloc();
   TESTFUNC(testStemmer);
   TESTFUNC(testTokenize);
+  TESTFUNC(testSharedStemmer);
+  benchmarkStemmer();
 });
\ No newline at end of file
@@ -6,16 +6,48 @@
 #include <stdlib.h>
 #include <strings.h>
 
+static TokenizerCharTable defaultCharTable;
+static int defaultCharTableInit = 0;
+
+static void TokenizerCharTable_Init(TokenizerCharTable *t, const char *separators) {
+  for (int c = 0; c < 256; c++) {
+    if (c >= 'A' && c <= 'Z') {
+      t->cls[c] = TOKCHAR_UPPER;
+    } else if (c < 0x80 && (isblank(c) || iscntrl(c))) {
+      t->cls[c] = TOKCHAR_STRIP;
+    } else {
+      t->cls[c] = 0;
+    }
+  }
+  for (const char *p = separators; *p; p++) {
+    t->cls[(uint8_t)*p] |= TOKCHAR_SEPARATOR;
+  }
+  // the NULL terminator ends the last token
+  t->cls[0] |= TOKCHAR_SEPARATOR;
+}
+
+TokenizerCharTable *NewTokenizerCharTable(const char *separators) {
+  TokenizerCharTable *t = rm_malloc(sizeof(TokenizerCharTable));
+  TokenizerCharTable_Init(t, separators);
+  return t;
+}
+
+const TokenizerCharTable *DefaultTokenizerCharTable() {
+  if (!defaultCharTableInit) {
+    TokenizerCharTable_Init(&defaultCharTable, DEFAULT_SEPARATORS);
+    defaultCharTableInit = 1;
+  }
+  return &defaultCharTable;
+}
+
 int tokenize(const char *text, float score, t_fieldMask fieldId, void *ctx, TokenFunc f, Stemmer *s,
-             u_int offset, StopWordList *stopwords) {
+             u_int offset, StopWordList *stopwords, const TokenizerCharTable *charTable) {
   TokenizerCtx tctx;
-  tctx.text = text;
-  tctx.pos = (char **)&text;
-  tctx.separators = DEFAULT_SEPARATORS;
+  tctx.pos = (char *)text;
+  tctx.charTable = charTable ? charTable : DefaultTokenizerCharTable();
   tctx.fieldScore = score;
   tctx.tokenFunc = f;
   tctx.tokenFuncCtx = ctx;
-  tctx.normalize = DefaultNormalize;
   tctx.fieldId = fieldId;
   tctx.stemmer = s;
   tctx.lastOffset = offset;
@@ -27,19 +59,26 @@ int tokenize(const char *text, float score, t_fieldMask fieldId, void *ctx, Toke
 // tokenize the text in the context
 int _tokenize(TokenizerCtx *ctx) {
   u_int pos = ctx->lastOffset + 1;
+  const uint8_t *cls = ctx->charTable->cls;
 
-  while (*ctx->pos != NULL) {
-    // get the next token
-    char *tok = strsep(ctx->pos, ctx->separators);
-    // this means we're at the end
-    if (tok == NULL) break;
-
-    // normalize the token
-    size_t tlen;
-    tok = ctx->normalize(tok, &tlen);
+  while (*ctx->pos != '\0') {
+    // split the next token off the text, lowercasing and stripping it in place as we go
+    char *tok = ctx->pos, *dst = tok, *src = tok;
+    uint8_t c;
+    while (!((c = cls[(uint8_t)*src]) & TOKCHAR_SEPARATOR)) {
+      if (c == 0) {
+        *dst++ = *src;
+      } else if (c & TOKCHAR_UPPER) {
+        *dst++ = *src + ('a' - 'A');
+      }
+      src++;
+    }
+    ctx->pos = *src ? src + 1 : src;
+    *dst = '\0';
+    size_t tlen = dst - tok;
 
     // ignore tokens that turn into nothing
-    if (tok == NULL || tlen == 0) {
+    if (tlen == 0) {
       continue;
     }
 
@@ -48,7 +87,12 @@ int _tokenize(TokenizerCtx *ctx) {
       continue;
     }
     // create the token struct
-    Token t = {tok, tlen, ++pos, ctx->fieldScore, ctx->fieldId, DT_WORD, 0};
+    Token t = {.s = tok,
+               .len = tlen,
+               .pos = ++pos,
+               .score = ctx->fieldScore,
+               .fieldId = ctx->fieldId,
+               .type = DT_WORD};
 
     // let it be handled - and break on non zero response
     if (ctx->tokenFunc(ctx->tokenFuncCtx, t) != 0) {
@@ -60,11 +104,10 @@ int _tokenize(TokenizerCtx *ctx) {
       size_t sl;
       const char *stem = ctx->stemmer->Stem(ctx->stemmer->ctx, tok, tlen, &sl);
       if (stem && strncmp(stem, tok, tlen)) {
-        t.s = rm_strndup(stem, sl);
+        t.s = stem;
         t.type = DT_STEM;
         t.len = sl;
         t.fieldId = ctx->fieldId;
-        t.stringFreeable = 1;
         if (ctx->tokenFunc(ctx->tokenFuncCtx, t) != 0) {
           break;
         }
@@ -76,19 +119,17 @@ int _tokenize(TokenizerCtx *ctx) {
 }
 
 char *DefaultNormalize(char *s, size_t *len) {
+  const uint8_t *cls = DefaultTokenizerCharTable()->cls;
   char *dst = s, *src = s;
-  *len = 0;
-  while (*src != '\0') {
-    if (isupper(*src)) {
-      *dst++ = tolower(*src++);
-    } else if (isblank(*src) || iscntrl(*src)) {
-      src++;
-      continue;
-    } else {
-      *dst++ = *src++;
+  for (; *src != '\0'; src++) {
+    uint8_t c = cls[(uint8_t)*src];
+    if (c & TOKCHAR_UPPER) {
+      *dst++ = *src + ('a' - 'A');
+    } else if (!(c & TOKCHAR_STRIP)) {
+      *dst++ = *src;
     }
-    ++(*len);
   }
   *dst = 0;
+  *len = dst - s;
   return s;
 }
@@ -31,31 +31,46 @@ typedef struct {
   // Field id - used later for filtering.
   t_fieldMask fieldId;
 
-  int stringFreeable;
-
   DocTokenType type;
 } Token;
 
-// A TokenFunc handles tokens in a tokenizer, for example aggregates them, or builds the query tree
+// A TokenFunc handles tokens in a tokenizer, for example aggregates them, or builds the query tree.
+// The token's string is only valid during the call
 typedef int (*TokenFunc)(void *ctx, Token t);
 
 // A NormalizeFunc converts a raw token to the normalized form in which it will be stored
 typedef char *(*NormalizeFunc)(char *, size_t *);
 
 //! " # $ % & ' ( ) * + , - . / : ; < = > ? @ [ \ ] ^ _ ` { | } ~
-#define DEFAULT_SEPARATORS " \t,./(){}[]:;/\\~!@#$%^&*-=+|'`\"<>?";
+#define DEFAULT_SEPARATORS " \t,./(){}[]:;/\\~!@#$%^&*-=+|'`\"<>?"
 
 #define STEM_TOKEN_FACTOR 0.2
 
+/* Character classes of the tokenizer's lookup table */
+#define TOKCHAR_SEPARATOR 0x01
+#define TOKCHAR_UPPER 0x02
+#define TOKCHAR_STRIP 0x04
+
+/* A 256 entry character class table, indexed by byte value. It lets the tokenizer split the text,
+ * lowercase ASCII and strip blanks and control characters from tokens in a single pass. Bytes of
+ * multibyte UTF-8 sequences are never separators and are copied as they are */
+typedef struct {
+  uint8_t cls[256];
+} TokenizerCharTable;
+
+/* Create a character table in which the given characters are the separators */
+TokenizerCharTable *NewTokenizerCharTable(const char *separators);
+
+/* The shared table for DEFAULT_SEPARATORS. It must not be freed */
+const TokenizerCharTable *DefaultTokenizerCharTable();
+
 typedef struct {
-  const char *text;
-  char **pos;
-  const char *separators;
+  char *pos;
+  const TokenizerCharTable *charTable;
   double fieldScore;
   int fieldId;
   TokenFunc tokenFunc;
   void *tokenFuncCtx;
-  NormalizeFunc normalize;
   Stemmer *stemmer;
   StopWordList *stopwords;
   u_int lastOffset;
@@ -66,10 +81,12 @@ int _tokenize(TokenizerCtx *ctx);
 
 /** The extenral API. Tokenize text, and create tokens with the given score and fieldId.
 TokenFunc is a callback that will be called for each token found
-if doStem is 1, we will add stemming extraction for the text
+if doStem is 1, we will add stemming extraction for the text.
+The text is split and normalized in place, using the separators of charTable, or the default ones
+if it is NULL
 */
 int tokenize(const char *text, float fieldScore, t_fieldMask fieldId, void *ctx, TokenFunc f,
-             Stemmer *s, u_int offset, StopWordList *stopwords);
+             Stemmer *s, u_int offset, StopWordList *stopwords, const TokenizerCharTable *charTable);
 
 /** A simple text normalizer that convertes all tokens to lowercase and removes accents.
 Does NOT normalize unicode */
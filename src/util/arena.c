@@ -0,0 +1,118 @@
+#define _RS_ARENA_C_
+#include "arena.h"
+#include <string.h>
+#include <sys/param.h>
+#include "../rmalloc.h"
+
+typedef struct arenaBlock {
+  struct arenaBlock *next;
+  size_t cap;
+  size_t used;
+  char data[];
+} arenaBlock;
+
+typedef struct arena_t {
+  arenaBlock *head;
+  // regular sized blocks released by arena_reset, waiting to be reused
+  arenaBlock *spare;
+  size_t blockSize;
+  size_t memsize;
+} arena_t;
+
+#define ARENA_ALIGN sizeof(void *)
+
+static arenaBlock *arena_newBlock(arena_t *a, size_t cap) {
+  if (cap == a->blockSize && a->spare) {
+    arenaBlock *b = a->spare;
+    a->spare = b->next;
+    b->used = 0;
+    b->next = NULL;
+    return b;
+  }
+  arenaBlock *b = rm_malloc(sizeof(arenaBlock) + cap);
+  b->cap = cap;
+  b->used = 0;
+  b->next = NULL;
+  a->memsize += sizeof(arenaBlock) + cap;
+  return b;
+}
+
+arena_t *arena_new(size_t blockSize) {
+  arena_t *a = rm_malloc(sizeof(arena_t));
+  a->head = NULL;
+  a->spare = NULL;
+  a->memsize = 0;
+  a->blockSize = blockSize ? blockSize : ARENA_DEFAULT_BLOCK_SIZE;
+  return a;
+}
+
+static void *arena_allocAligned(arena_t *a, size_t size, size_t align) {
+  // big allocations get their own block, linked behind the current head so we keep filling it
+  if (size > a->blockSize / 4) {
+    arenaBlock *b = arena_newBlock(a, size);
+    b->used = size;
+    if (a->head) {
+      b->next = a->head->next;
+      a->head->next = b;
+    } else {
+      a->head = b;
+    }
+    return b->data;
+  }
+
+  arenaBlock *b = a->head;
+  size_t off = b ? (b->used + align - 1) & ~(align - 1) : 0;
+  if (!b || off + size > b->cap) {
+    b = arena_newBlock(a, a->blockSize);
+    b->next = a->head;
+    a->head = b;
+    off = 0;
+  }
+  b->used = off + size;
+  return b->data + off;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+  return arena_allocAligned(a, size, ARENA_ALIGN);
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t len) {
+  char *ret = arena_allocAligned(a, len + 1, 1);
+  memcpy(ret, s, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+size_t arena_memusage(arena_t *a) {
+  return a->memsize;
+}
+
+void arena_reset(arena_t *a) {
+  arenaBlock *b = a->head;
+  while (b) {
+    arenaBlock *next = b->next;
+    if (b->cap == a->blockSize) {
+      b->next = a->spare;
+      a->spare = b;
+    } else {
+      a->memsize -= sizeof(arenaBlock) + b->cap;
+      rm_free(b);
+    }
+    b = next;
+  }
+  a->head = NULL;
+}
+
+static void arena_freeBlocks(arenaBlock *b) {
+  while (b) {
+    arenaBlock *next = b->next;
+    rm_free(b);
+    b = next;
+  }
+}
+
+void arena_destroy(arena_t *a) {
+  arena_freeBlocks(a->head);
+  arena_freeBlocks(a->spare);
+  rm_free(a);
+}
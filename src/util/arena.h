@@ -0,0 +1,39 @@
+#ifndef __RS_ARENA_H__
+#define __RS_ARENA_H__
+
+/* Arena - a simple, thread-unsafe bump allocator for many small allocations that share a lifetime.
+ * Memory is carved out of large blocks and is only released when the whole arena is reset or destroyed, so
+ * individual allocations cannot be freed */
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The default size of each arena block */
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+#ifndef _RS_ARENA_C_
+typedef struct arena_t arena_t;
+#else
+struct arena_t;
+#endif
+
+/* Create a new arena allocating blocks of blockSize bytes. Allocations bigger than a quarter of the
+ * block size get a dedicated block of their own */
+struct arena_t *arena_new(size_t blockSize);
+
+/* Allocate size bytes from the arena, aligned to pointer size */
+void *arena_alloc(struct arena_t *a, size_t size);
+
+/* Copy len bytes of s into the arena and NULL terminate them. The copy is not aligned */
+char *arena_strndup(struct arena_t *a, const char *s, size_t len);
+
+/* The total number of bytes held by the arena's blocks */
+size_t arena_memusage(struct arena_t *a);
+
+/* Discard all the allocations of the arena at once. Regular sized blocks are kept and reused by
+ * later allocations, so an arena that is reset and refilled in a loop stops allocating memory */
+void arena_reset(struct arena_t *a);
+
+/* Release all the blocks of the arena and the arena itself */
+void arena_destroy(struct arena_t *a);
+
+#endif
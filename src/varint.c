@@ -23,6 +23,61 @@ inline int ReadVarint(BufferReader *b) {
   return val;
 }
 
+int ReadVarintChecked(BufferReader *b, uint32_t *value) {
+  const unsigned char *p = (const unsigned char *)b->buf->data;
+  size_t end = b->buf->offset;
+  if (b->pos >= end) return 0;
+
+  unsigned char c = p[b->pos++];
+  uint64_t val = c & 127;
+  while (c >> 7) {
+    // a 32 bit value takes 5 bytes at most
+    if (b->pos >= end || val > (UINT32_MAX >> 7)) return 0;
+    ++val;
+    c = p[b->pos++];
+    val = (val << 7) | (c & 127);
+  }
+  if (val > UINT32_MAX) return 0;
+  *value = (uint32_t)val;
+  return 1;
+}
+
+/* Most offset deltas fit in a single byte, so we decode 8 bytes at a time as long as none of them
+ * has its continuation bit set, and fall back to byte by byte decoding otherwise */
+size_t VV_Decode(const char *data, size_t len, uint32_t *out) {
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char *end = p + len;
+  uint32_t last = 0;
+  size_t n = 0;
+
+  while (p < end) {
+    if (end - p >= 8) {
+      uint64_t word;
+      memcpy(&word, p, sizeof(word));
+      if (!(word & 0x8080808080808080ULL)) {
+        for (int i = 0; i < 8; i++) {
+          last += p[i];
+          out[n + i] = last;
+        }
+        n += 8;
+        p += 8;
+        continue;
+      }
+    }
+
+    unsigned char c = *p++;
+    uint32_t val = c & 127;
+    while (c >> 7) {
+      ++val;
+      c = *p++;
+      val = (val << 7) | (c & 127);
+    }
+    last += val;
+    out[n++] = last;
+  }
+  return n;
+}
+
 int WriteVarint(int value, BufferWriter *w) {
   unsigned char varint[16];
   unsigned pos = sizeof(varint) - 1;
@@ -32,6 +87,29 @@ int WriteVarint(int value, BufferWriter *w) {
   return Buffer_Write(w, varint + pos, 16 - pos);
 }
 
+inline t_fieldMask ReadVarintFieldMask(BufferReader *b) {
+
+  unsigned char c = BUFFER_READ_BYTE(b);
+
+  t_fieldMask val = c & 127;
+  while (c >> 7) {
+    ++val;
+    c = BUFFER_READ_BYTE(b);
+    val = (val << 7) | (c & 127);
+  }
+
+  return val;
+}
+
+size_t WriteVarintFieldMask(t_fieldMask value, BufferWriter *w) {
+  // a 128 bit mask takes at most 19 bytes
+  unsigned char varint[24];
+  unsigned pos = sizeof(varint) - 1;
+  varint[pos] = value & 127;
+  while (value >>= 7) varint[--pos] = 128 | (--value & 127);
+  return Buffer_Write(w, varint + pos, sizeof(varint) - pos);
+}
+
 size_t varintSize(int value) {
   assert(value > 0);
   size_t outputSize = 0;
@@ -3,13 +3,28 @@
 
 #include <stdlib.h>
 #include <sys/types.h>
+#include <stdint.h>
 #include "buffer.h"
+#include "redisearch.h"
 
 size_t varintSize(int value);
 
 int ReadVarint(BufferReader *b);
 int WriteVarint(int value, BufferWriter *w);
 
+/* Read a varint of untrusted data, which ends at the offset of the reader's buffer. Returns 0 if the
+ * varint is truncated or doesn't fit in 32 bits */
+int ReadVarintChecked(BufferReader *b, uint32_t *value);
+
+/* Field masks wider than 32 bits are written as varints of the whole mask, in the same format as
+ * the other varints */
+t_fieldMask ReadVarintFieldMask(BufferReader *b);
+size_t WriteVarintFieldMask(t_fieldMask value, BufferWriter *w);
+
+/* Decode a whole delta encoded varint vector of len bytes into out, which must have room for at
+ * least len values. Returns the number of values decoded */
+size_t VV_Decode(const char *data, size_t len, uint32_t *out);
+
 typedef struct {
   BufferWriter bw;
   // how many members we've put in